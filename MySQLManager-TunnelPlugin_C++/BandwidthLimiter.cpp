@@ -0,0 +1,169 @@
+/**
+	A token bucket that limits how fast tunnels can forward data. There are three levels, and the data a connection forwards has to get
+	through each one that is configured:
+
+	- The whole plugin, bandwidthLimitBytesPerSecond in [app_settings]
+	- Every tunnel to an SSH host, bandwidthLimitBytesPerSecond in the [ssh_host:X] section
+	- A single tunnel, bandwidthLimitBytesPerSecond in the CreateTunnel request
+
+	The bucket holds up to 100ms worth of data (at least 16KB) so a short burst, e.g. the result of an interactive query, isn't held up.
+	When a connection can't get any more it stops reading from its channel (or writing to it), so the SSH window isn't adjusted and the SSH
+	server stops sending, rather than the data piling up in memory
+*/
+
+#include "BandwidthLimiter.h"
+
+using namespace std;
+
+std::mutex BandwidthLimiter::hostLimitersMutex;
+std::map<std::string, BandwidthLimiter*> BandwidthLimiter::hostLimiters;
+std::atomic<unsigned long long> BandwidthLimiter::totalThrottled{ 0 };
+
+/**
+	Create the bucket without a limit, setRate sets the limit
+*/
+BandwidthLimiter::BandwidthLimiter()
+{
+}
+
+/**
+	@param bytesPerSecond The rate the bucket fills at, 0 for no limit
+*/
+void BandwidthLimiter::setRate(unsigned long long bytesPerSecond)
+{
+	lock_guard<mutex> lock(this->bucketMutex);
+	this->bytesPerSecond = (double)bytesPerSecond;
+	this->burstBytes = this->bytesPerSecond / 10 > 16384 ? this->bytesPerSecond / 10 : 16384;
+	//Don't hand out tiny amounts as the bucket refills, each one would be a channel read or write of its own
+	this->minimumGrant = this->burstBytes < 4096 ? this->burstBytes : 4096;
+	this->tokens = this->burstBytes;
+	this->lastRefill = chrono::steady_clock::now();
+}
+
+bool BandwidthLimiter::isLimited()
+{
+	return this->bytesPerSecond > 0;
+}
+
+/**
+	Take as much of what is wanted as the bucket has
+	@param wanted The number of bytes that are about to be forwarded
+	@return size_t The number of bytes that can be forwarded, 0 if the bucket is empty (see getWaitMicroseconds)
+*/
+size_t BandwidthLimiter::take(size_t wanted)
+{
+	if (!this->isLimited())
+	{
+		return wanted;
+	}
+	lock_guard<mutex> lock(this->bucketMutex);
+	this->refill();
+	size_t granted = this->tokens >= (double)wanted ? wanted : (size_t)this->tokens;
+	if (granted < wanted)
+	{
+		BandwidthLimiter::totalThrottled++;
+		if ((double)granted < this->minimumGrant)
+		{
+			return 0;
+		}
+	}
+	this->tokens -= (double)granted;
+	return granted;
+}
+
+/**
+	Put back what was taken but not forwarded, e.g. the channel had less data than was asked for
+	@param bytes The number of bytes to put back
+*/
+void BandwidthLimiter::giveBack(size_t bytes)
+{
+	if (!this->isLimited() || bytes == 0)
+	{
+		return;
+	}
+	lock_guard<mutex> lock(this->bucketMutex);
+	this->tokens = this->tokens + (double)bytes < this->burstBytes ? this->tokens + (double)bytes : this->burstBytes;
+}
+
+/**
+	@return long How long until take will hand out data again, 0 if it will now
+*/
+long BandwidthLimiter::getWaitMicroseconds()
+{
+	if (!this->isLimited())
+	{
+		return 0;
+	}
+	lock_guard<mutex> lock(this->bucketMutex);
+	this->refill();
+	double needed = this->minimumGrant - this->tokens;
+	return needed > 0 ? (long)(needed * 1000000 / this->bytesPerSecond) + 1 : 0;
+}
+
+void BandwidthLimiter::refill()
+{
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	double elapsedSeconds = chrono::duration_cast<chrono::duration<double>>(now - this->lastRefill).count();
+	this->lastRefill = now;
+	this->tokens += elapsedSeconds * this->bytesPerSecond;
+	if (this->tokens > this->burstBytes)
+	{
+		this->tokens = this->burstBytes;
+	}
+}
+
+/**
+	@return BandwidthLimiter The bucket shared by every tunnel, NULL if bandwidthLimitBytesPerSecond isn't set
+*/
+BandwidthLimiter *BandwidthLimiter::getGlobalLimiter()
+{
+	static BandwidthLimiter *globalLimiter = []() -> BandwidthLimiter* {
+		if (StaticSettings::AppSettings::bandwidthLimitBytesPerSecond <= 0)
+		{
+			return NULL;
+		}
+		BandwidthLimiter *limiter = new BandwidthLimiter();
+		limiter->setRate(StaticSettings::AppSettings::bandwidthLimitBytesPerSecond);
+		return limiter;
+	}();
+	return globalLimiter;
+}
+
+/**
+	@param sshHost The SSH host of the tunnel
+	@return BandwidthLimiter The bucket shared by every tunnel to the SSH host, NULL if the host doesn't have bandwidthLimitBytesPerSecond
+*/
+BandwidthLimiter *BandwidthLimiter::getHostLimiter(string sshHost)
+{
+	int bytesPerSecond = HostSettings::getSetting(sshHost, "bandwidthLimitBytesPerSecond", 0);
+	if (bytesPerSecond <= 0)
+	{
+		return NULL;
+	}
+	lock_guard<mutex> lock(BandwidthLimiter::hostLimitersMutex);
+	map<string, BandwidthLimiter*>::iterator it = BandwidthLimiter::hostLimiters.find(sshHost);
+	if (it != BandwidthLimiter::hostLimiters.end())
+	{
+		return it->second;
+	}
+	BandwidthLimiter *hostLimiter = new BandwidthLimiter();
+	hostLimiter->setRate(bytesPerSecond);
+	BandwidthLimiter::hostLimiters[sshHost] = hostLimiter;
+	return hostLimiter;
+}
+
+/**
+	Add the bandwidth limit counters to the statistics that are returned to the PHP API
+	@param stats The map that the statistics are added to
+*/
+void BandwidthLimiter::appendStatistics(map<string, string> *stats)
+{
+	size_t limitedHosts = 0;
+	{
+		lock_guard<mutex> lock(BandwidthLimiter::hostLimitersMutex);
+		limitedHosts = BandwidthLimiter::hostLimiters.size();
+	}
+	(*stats)["bandwidthLimitBytesPerSecond"] = std::to_string(StaticSettings::AppSettings::bandwidthLimitBytesPerSecond);
+	(*stats)["bandwidthLimitedHosts"] = std::to_string(limitedHosts);
+	(*stats)["bandwidthThrottled"] = std::to_string(BandwidthLimiter::totalThrottled.load());
+}
@@ -0,0 +1,37 @@
+#pragma once
+#ifndef BANDWIDTHLIMITER_H
+#define BANDWIDTHLIMITER_H
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include "StaticSettings.h"
+#include "HostSettings.h"
+
+class BandwidthLimiter
+{
+public:
+	BandwidthLimiter();
+	void setRate(unsigned long long bytesPerSecond);
+	bool isLimited();
+	size_t take(size_t wanted);
+	void giveBack(size_t bytes);
+	long getWaitMicroseconds();
+	static BandwidthLimiter *getGlobalLimiter();
+	static BandwidthLimiter *getHostLimiter(std::string sshHost);
+	static void appendStatistics(std::map<std::string, std::string> *stats);
+private:
+	std::mutex bucketMutex;
+	double bytesPerSecond = 0;
+	double burstBytes = 0;
+	double minimumGrant = 0;
+	double tokens = 0;
+	std::chrono::steady_clock::time_point lastRefill;
+	void refill();
+	static std::mutex hostLimitersMutex;
+	static std::map<std::string, BandwidthLimiter*> hostLimiters;
+	static std::atomic<unsigned long long> totalThrottled;
+};
+
+#endif //!BANDWIDTHLIMITER_H
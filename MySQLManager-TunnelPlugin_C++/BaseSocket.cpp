@@ -19,16 +19,15 @@ BaseSocket::BaseSocket(Logger *logger)
 	This sets up the buffer length and socket port number being used, the WindowsSocket.cpp and LinuxSocket.cpp
 	will do other stuff to create the port but this is the default port that each platform has to do. 
 	@param port The socket port number that is going to be created. This is confiruable within tunnel.conf. This is used when creating the socket that is used by the PHP API. 
-	@param bufferLength This is the length of the buffer for the socket, i.e. this is how many bytes will be retrieved from the socket at a time.
+	@param bufferLength This is how many bytes will be retrieved from the socket at a time. Each connection receives into its own ReceiveBuffer
 */
 bool BaseSocket::createsocket(int port, int bufferLength)
 {
 	this->bufferLength = bufferLength;
-	this->buffer = new char[bufferLength];
 	this->socketPort = port;
 
 	stringstream logstream;
-	logstream << "Creating buffer of length " << bufferLength;
+	logstream << "Receiving in chunks of " << bufferLength << " bytes";
 	this->logger->writeToLog(logstream.str(), "BaseSocket", "createSocket");
 	return true; //The base method can't fail but has to return soemthing
 }
\ No newline at end of file
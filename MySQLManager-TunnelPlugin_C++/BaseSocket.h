@@ -22,7 +22,6 @@ public:
 protected:
 	Logger *logger = NULL;
 	int bufferLength;
-	char *buffer = NULL;
 	int socketPort;
 };
 
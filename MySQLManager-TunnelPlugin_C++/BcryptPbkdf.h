@@ -0,0 +1,27 @@
+#pragma once
+#ifndef BCRYPTPBKDF_H
+#define BCRYPTPBKDF_H
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+class BcryptPbkdf
+{
+public:
+	static bool deriveKey(const std::string& passphrase, const unsigned char *salt, size_t saltLength, unsigned int rounds, unsigned char *key, size_t keyLength);
+private:
+	struct BlowfishState
+	{
+		uint32_t P[18];
+		uint32_t S[4][256];
+	};
+	static const uint32_t initialP[18];
+	static const uint32_t initialS[4][256];
+	static void initialiseState(BlowfishState *state);
+	static uint32_t streamToWord(const unsigned char *data, size_t dataLength, size_t *position);
+	static void encipher(BlowfishState *state, uint32_t *left, uint32_t *right);
+	static void expandState(BlowfishState *state, const unsigned char *salt, size_t saltLength, const unsigned char *key, size_t keyLength);
+	static void bcryptHash(const unsigned char *sha2Passphrase, const unsigned char *sha2Salt, unsigned char *out);
+};
+
+#endif //!BCRYPTPBKDF_H
@@ -0,0 +1,161 @@
+/**
+	The buffers that forwarded connections pass data through. A connection only holds a buffer for a direction while that direction has 
+	data waiting to be passed on, so an idle connection doesn't hold any buffer memory at all.
+	Buffers are forwardBufferSize bytes and are carved out of 1MB slabs, a slab is freed once none of its buffers are in use (one empty slab 
+	is kept back so a busy tunnel doesn't allocate and free a slab over and over). No more than forwardBufferPoolMaxBytes is allocated in 
+	total, once that is reached a connection waits for a buffer and the data waits in the socket or the SSH channel until one is free
+*/
+
+#include "BufferPool.h"
+#include <stdlib.h>
+
+using namespace std;
+
+std::mutex BufferPool::poolMutex;
+std::map<char*, BufferPool::Slab*> BufferPool::slabs;
+size_t BufferPool::blockSize = 0;
+size_t BufferPool::blocksPerSlab = 0;
+size_t BufferPool::buffersInUse = 0;
+size_t BufferPool::buffersFree = 0;
+size_t BufferPool::bytesAllocated = 0;
+unsigned long long BufferPool::exhaustedCount = 0;
+
+/**
+	Take a buffer from the pool
+	@param capacity Set to the size of the buffer
+	@return char The buffer, or NULL if forwardBufferPoolMaxBytes has been reached and there isn't a free buffer
+*/
+char *BufferPool::acquireBuffer(size_t *capacity)
+{
+	lock_guard<mutex> lock(BufferPool::poolMutex);
+	if (BufferPool::blockSize == 0)
+	{
+		//The buffer size comes from tunnel.conf which has been read by the time the first tunnel forwards anything
+		BufferPool::blockSize = StaticSettings::AppSettings::forwardBufferSize > 0 ? (size_t)StaticSettings::AppSettings::forwardBufferSize : 65536;
+		BufferPool::blocksPerSlab = 1048576 / BufferPool::blockSize;
+		size_t maxBlocks = (size_t)StaticSettings::AppSettings::forwardBufferPoolMaxBytes / BufferPool::blockSize;
+		BufferPool::blocksPerSlab = maxBlocks < BufferPool::blocksPerSlab ? maxBlocks : BufferPool::blocksPerSlab;
+		BufferPool::blocksPerSlab = BufferPool::blocksPerSlab == 0 ? 1 : BufferPool::blocksPerSlab;
+	}
+
+	//Use the fullest slab that has a free buffer so the emptier slabs can drain and be freed
+	Slab *chosenSlab = NULL;
+	for (map<char*, Slab*>::iterator it = BufferPool::slabs.begin(); it != BufferPool::slabs.end(); ++it)
+	{
+		if (!it->second->freeBlocks.empty() && (chosenSlab == NULL || it->second->freeBlocks.size() < chosenSlab->freeBlocks.size()))
+		{
+			chosenSlab = it->second;
+		}
+	}
+	if (chosenSlab == NULL)
+	{
+		chosenSlab = BufferPool::createSlab();
+		if (chosenSlab == NULL)
+		{
+			BufferPool::exhaustedCount++;
+			return NULL;
+		}
+	}
+	char *buffer = chosenSlab->freeBlocks.back();
+	chosenSlab->freeBlocks.pop_back();
+	BufferPool::buffersInUse++;
+	BufferPool::buffersFree--;
+	*capacity = BufferPool::blockSize;
+	return buffer;
+}
+
+/**
+	Give a buffer back to the pool
+	@param buffer The buffer returned by acquireBuffer
+*/
+void BufferPool::releaseBuffer(char *buffer)
+{
+	lock_guard<mutex> lock(BufferPool::poolMutex);
+	map<char*, Slab*>::iterator it = BufferPool::slabs.upper_bound(buffer);
+	if (it == BufferPool::slabs.begin())
+	{
+		return;
+	}
+	--it;
+	Slab *slab = it->second;
+	slab->freeBlocks.push_back(buffer);
+	BufferPool::buffersInUse--;
+	BufferPool::buffersFree++;
+
+	if (slab->freeBlocks.size() == slab->blockCount && BufferPool::buffersFree > slab->blockCount)
+	{
+		//There's free space in another slab as well, so this one isn't needed
+		BufferPool::freeSlab(slab);
+	}
+}
+
+/**
+	Check whether acquireBuffer would succeed, so a connection that is waiting for a buffer isn't polled for data it can't read yet
+	@return bool True if there's a free buffer or another slab can be allocated
+*/
+bool BufferPool::canAcquire()
+{
+	lock_guard<mutex> lock(BufferPool::poolMutex);
+	return BufferPool::buffersFree > 0 || BufferPool::blockSize == 0 ||
+		BufferPool::bytesAllocated + BufferPool::blockSize * BufferPool::blocksPerSlab <= (size_t)StaticSettings::AppSettings::forwardBufferPoolMaxBytes;
+}
+
+/**
+	Allocate a new slab, poolMutex must be held
+	@return Slab The new slab, or NULL if it would go over forwardBufferPoolMaxBytes or the memory couldn't be allocated
+*/
+BufferPool::Slab *BufferPool::createSlab()
+{
+	size_t slabBytes = BufferPool::blockSize * BufferPool::blocksPerSlab;
+	if (BufferPool::bytesAllocated + slabBytes > (size_t)StaticSettings::AppSettings::forwardBufferPoolMaxBytes)
+	{
+		return NULL;
+	}
+	char *memory = static_cast<char*>(malloc(slabBytes));
+	if (memory == NULL)
+	{
+		return NULL;
+	}
+	Slab *slab = new Slab();
+	slab->memory = memory;
+	slab->blockCount = BufferPool::blocksPerSlab;
+	slab->freeBlocks.reserve(slab->blockCount);
+	for (size_t i = slab->blockCount; i > 0; i--)
+	{
+		slab->freeBlocks.push_back(memory + (i - 1) * BufferPool::blockSize);
+	}
+	BufferPool::slabs[memory] = slab;
+	BufferPool::bytesAllocated += slabBytes;
+	BufferPool::buffersFree += slab->blockCount;
+	return slab;
+}
+
+/**
+	Free a slab that has none of its buffers in use, poolMutex must be held
+	@param slab The slab to free
+*/
+void BufferPool::freeSlab(Slab *slab)
+{
+	BufferPool::slabs.erase(slab->memory);
+	BufferPool::bytesAllocated -= slab->blockCount * BufferPool::blockSize;
+	BufferPool::buffersFree -= slab->blockCount;
+	free(slab->memory);
+	delete slab;
+}
+
+/**
+	Add the forwarding buffer pool statistics to the statistics returned by the GetStats request
+	@param stats The statistics to add to
+*/
+void BufferPool::appendStatistics(map<string, string> *stats)
+{
+	lock_guard<mutex> lock(BufferPool::poolMutex);
+	size_t totalBuffers = BufferPool::buffersInUse + BufferPool::buffersFree;
+	(*stats)["forwardBufferPoolSlabs"] = std::to_string(BufferPool::slabs.size());
+	(*stats)["forwardBufferPoolBuffersInUse"] = std::to_string(BufferPool::buffersInUse);
+	(*stats)["forwardBufferPoolBuffersFree"] = std::to_string(BufferPool::buffersFree);
+	(*stats)["forwardBufferPoolBytesAllocated"] = std::to_string(BufferPool::bytesAllocated);
+	(*stats)["forwardBufferPoolBytesLimit"] = std::to_string(StaticSettings::AppSettings::forwardBufferPoolMaxBytes);
+	(*stats)["forwardBufferPoolOccupancyPercent"] = std::to_string(totalBuffers == 0 ? 0 : BufferPool::buffersInUse * 100 / totalBuffers);
+	(*stats)["forwardBufferPoolExhausted"] = std::to_string(BufferPool::exhaustedCount);
+}
@@ -0,0 +1,36 @@
+#pragma once
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+#include "StaticSettings.h"
+
+class BufferPool
+{
+public:
+	static char *acquireBuffer(size_t *capacity);
+	static void releaseBuffer(char *buffer);
+	static bool canAcquire();
+	static void appendStatistics(std::map<std::string, std::string> *stats);
+private:
+	struct Slab
+	{
+		char *memory = NULL;
+		size_t blockCount = 0;
+		std::vector<char*> freeBlocks;
+	};
+	static Slab *createSlab();
+	static void freeSlab(Slab *slab);
+	static std::mutex poolMutex;
+	static std::map<char*, Slab*> slabs;
+	static size_t blockSize;
+	static size_t blocksPerSlab;
+	static size_t buffersInUse;
+	static size_t buffersFree;
+	static size_t bytesAllocated;
+	static unsigned long long exhaustedCount;
+};
+
+#endif //!BUFFERPOOL_H
@@ -0,0 +1,511 @@
+/**
+	Does the client side of a tunnel's I/O (accepting on the local listen port, receiving from and sending to the MySQL clients) through
+	io_uring instead of a recv()/send() per packet after select(). Everything the tunnel needs for the next pass of its loop is queued, then
+	submitted in one go while waiting for the completions, so a pass is a single io_uring_enter() however many clients are busy.
+	The listen port has a multishot accept, receives go straight into the connection's client to server buffer and both parts of a wrapped
+	server to client buffer go out with a single sendmsg(). The SSH socket is still read and written by libssh2, the ring only polls it.
+
+	Only built with HAVE_LIBURING (liburing 2.2 or later). Whether the kernel supports it is checked once, if it doesn't, or useIOUring is
+	turned off, the tunnels use the select() loop in SSHTunnelForwarder instead
+*/
+
+#include "ClientIOUring.h"
+#ifdef HAVE_LIBURING
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sstream>
+#endif
+
+using namespace std;
+
+/**
+	@return bool True if the tunnels should use io_uring for their client sockets
+*/
+bool ClientIOUring::isSupported()
+{
+#ifdef HAVE_LIBURING
+	static bool supported = StaticSettings::AppSettings::useIOUring && ClientIOUring::probe();
+	return supported;
+#else
+	return false;
+#endif
+}
+
+#ifdef HAVE_LIBURING
+
+/**
+	Check that a ring can be created (it can be blocked by seccomp or kernel.io_uring_disabled) and the kernel has every operation we use
+	@return bool True if io_uring can be used
+*/
+bool ClientIOUring::probe()
+{
+	struct io_uring probeRing;
+	if (io_uring_queue_init(4, &probeRing, 0) < 0)
+	{
+		return false;
+	}
+	bool supported = false;
+	struct io_uring_probe *opcodes = io_uring_get_probe_ring(&probeRing);
+	if (opcodes != NULL)
+	{
+		supported = io_uring_opcode_supported(opcodes, IORING_OP_ACCEPT) && io_uring_opcode_supported(opcodes, IORING_OP_RECV) &&
+			io_uring_opcode_supported(opcodes, IORING_OP_SENDMSG) && io_uring_opcode_supported(opcodes, IORING_OP_POLL_ADD) &&
+			io_uring_opcode_supported(opcodes, IORING_OP_ASYNC_CANCEL);
+		io_uring_free_probe(opcodes);
+	}
+	io_uring_queue_exit(&probeRing);
+	return supported;
+}
+
+ClientIOUring::ClientIOUring(Logger *logger)
+{
+	this->logger = logger;
+}
+
+/**
+	Wait for everything that is still queued to finish before the ring is freed, the kernel could otherwise still be writing into a
+	connection's buffer. Connections that were closed while they had something queued are deleted here
+*/
+ClientIOUring::~ClientIOUring()
+{
+	if (!this->ringInitialised)
+	{
+		return;
+	}
+	if (this->acceptQueued)
+	{
+		this->cancelOperation(NULL, Operation::OPERATION_ACCEPT);
+	}
+	if (this->pollQueued)
+	{
+		this->cancelOperation(NULL, Operation::OPERATION_POLL);
+	}
+	for (map<ForwardedConnection*, ClientIO>::iterator it = this->clients.begin(); it != this->clients.end();)
+	{
+		//cancelClientIO can remove the connection from clients
+		ForwardedConnection *connection = it->first;
+		bool closing = it->second.closing;
+		++it;
+		if (!closing)
+		{
+			this->cancelClientIO(connection);
+		}
+	}
+	for (int i = 0; this->operationsInFlight > 0 && i < 50; i++)
+	{
+		if (!this->waitForCompletions(100000))
+		{
+			break;
+		}
+	}
+	io_uring_queue_exit(&this->ring);
+	for (map<ForwardedConnection*, ClientIO>::iterator it = this->clients.begin(); it != this->clients.end(); ++it)
+	{
+		if (it->second.closing)
+		{
+			delete it->first;
+		}
+	}
+	for (vector<int>::iterator it = this->acceptedSockets.begin(); it != this->acceptedSockets.end(); ++it)
+	{
+		close(*it);
+	}
+}
+
+/**
+	Create the ring for a tunnel
+	@param listenSocket The tunnel's local listen socket
+	@param maxClients maxClientsPerTunnel, each client can have a receive and a send queued at the same time
+	@return bool False if the ring couldn't be created, the tunnel should use select() instead
+*/
+bool ClientIOUring::initialise(int listenSocket, unsigned int maxClients)
+{
+	int result = io_uring_queue_init(maxClients * 2 + 8, &this->ring, 0);
+	if (result < 0)
+	{
+		stringstream logstream;
+		logstream << "io_uring_queue_init failed. Error: " << strerror(-result);
+		this->logger->writeToLog(logstream.str(), "ClientIOUring", "initialise");
+		return false;
+	}
+	this->ringInitialised = true;
+	this->listenSocket = listenSocket;
+	return true;
+}
+
+/**
+	Start or stop accepting clients on the listen port. While the tunnel is at maxClientsPerTunnel the accept is cancelled, so new clients
+	wait in the listen backlog the same as they do with select()
+	@param accepting True if the tunnel can take another client
+*/
+void ClientIOUring::setAccepting(bool accepting)
+{
+	if (accepting && !this->acceptQueued)
+	{
+		struct io_uring_sqe *sqe = this->getSubmissionEntry();
+		if (sqe == NULL)
+		{
+			return;
+		}
+		if (this->multishotAccept)
+		{
+			io_uring_prep_multishot_accept(sqe, this->listenSocket, NULL, NULL, 0);
+		}
+		else
+		{
+			io_uring_prep_accept(sqe, this->listenSocket, NULL, NULL, 0);
+		}
+		this->queueOperation(sqe, NULL, Operation::OPERATION_ACCEPT);
+		this->acceptQueued = true;
+	}
+	else if (!accepting && this->accepting && this->acceptQueued)
+	{
+		this->cancelOperation(NULL, Operation::OPERATION_ACCEPT);
+	}
+	this->accepting = accepting;
+}
+
+/**
+	Poll a socket that is read and written by something else (the SSH socket, which belongs to libssh2). The poll is one shot, it is queued
+	again on the next pass. If the events change while a poll is queued, the poll is cancelled and queued again with the new events
+	@param sock The socket to poll
+	@param events POLLIN and/or POLLOUT, 0 to stop polling
+*/
+void ClientIOUring::pollSocket(int sock, short events)
+{
+	if (this->pollQueued)
+	{
+		if ((events != this->pollEvents || sock != this->pollSocketDescriptor) && !this->pollCancelQueued)
+		{
+			this->cancelOperation(NULL, Operation::OPERATION_POLL);
+			this->pollCancelQueued = true;
+		}
+		return;
+	}
+	if (events == 0)
+	{
+		return;
+	}
+	struct io_uring_sqe *sqe = this->getSubmissionEntry();
+	if (sqe == NULL)
+	{
+		return;
+	}
+	io_uring_prep_poll_add(sqe, sock, events);
+	this->queueOperation(sqe, NULL, Operation::OPERATION_POLL);
+	this->pollQueued = true;
+	this->pollSocketDescriptor = sock;
+	this->pollEvents = events;
+}
+
+/**
+	Queue a receive from the client, unless one is already queued. The write position of the client to server buffer is held until it
+	completes, so nothing else can be written to the buffer in the meantime
+	@param connection The client connection
+	@param buffer Where to receive into, from the connection's clientToServer getWritePointer
+	@param length The most that can be received
+*/
+void ClientIOUring::queueReceive(ForwardedConnection *connection, char *buffer, size_t length)
+{
+	ClientIO &clientIO = this->clients[connection];
+	if (clientIO.receiveQueued || clientIO.closing || length == 0)
+	{
+		return;
+	}
+	struct io_uring_sqe *sqe = this->getSubmissionEntry();
+	if (sqe == NULL)
+	{
+		return;
+	}
+	io_uring_prep_recv(sqe, connection->clientSocket, buffer, length, 0);
+	this->queueOperation(sqe, connection, Operation::OPERATION_RECEIVE);
+	clientIO.receiveQueued = true;
+	connection->clientToServer.holdWritePosition(true);
+}
+
+/**
+	Queue a send of everything in the server to client buffer, unless a send is already queued. If the buffer has wrapped around both
+	parts go in the same sendmsg(). Whatever the client doesn't take is sent on a later pass
+	@param connection The client connection
+*/
+void ClientIOUring::queueSend(ForwardedConnection *connection)
+{
+	ClientIO &clientIO = this->clients[connection];
+	if (clientIO.sendQueued || clientIO.closing || connection->serverToClient.empty())
+	{
+		return;
+	}
+	struct io_uring_sqe *sqe = this->getSubmissionEntry();
+	if (sqe == NULL)
+	{
+		return;
+	}
+	size_t length = 0;
+	size_t wrappedLength = 0;
+	clientIO.sendVectors[0].iov_base = const_cast<char*>(connection->serverToClient.getReadPointer(&length));
+	clientIO.sendVectors[0].iov_len = length;
+	clientIO.sendVectors[1].iov_base = const_cast<char*>(connection->serverToClient.getWrappedReadPointer(&wrappedLength));
+	clientIO.sendVectors[1].iov_len = wrappedLength;
+	memset(&clientIO.sendMessage, 0, sizeof(clientIO.sendMessage));
+	clientIO.sendMessage.msg_iov = clientIO.sendVectors;
+	clientIO.sendMessage.msg_iovlen = wrappedLength > 0 ? 2 : 1;
+	io_uring_prep_sendmsg(sqe, connection->clientSocket, &clientIO.sendMessage, MSG_NOSIGNAL);
+	this->queueOperation(sqe, connection, Operation::OPERATION_SEND);
+	clientIO.sendQueued = true;
+}
+
+/**
+	@param connection The client connection
+	@return bool True if a receive from or send to the client has failed, and the connection should be closed
+*/
+bool ClientIOUring::hasClientFailed(ForwardedConnection *connection)
+{
+	map<ForwardedConnection*, ClientIO>::iterator it = this->clients.find(connection);
+	return it != this->clients.end() && it->second.failed;
+}
+
+/**
+	Cancel anything queued for a connection that is being closed. The socket is shut down so anything already waiting on it completes
+	straight away
+	@param connection The client connection
+	@return bool True if the ring is still using the connection's buffers, the connection is deleted once everything has completed and
+	mustn't be deleted by the caller
+*/
+bool ClientIOUring::cancelClientIO(ForwardedConnection *connection)
+{
+	map<ForwardedConnection*, ClientIO>::iterator it = this->clients.find(connection);
+	if (it == this->clients.end())
+	{
+		return false;
+	}
+	if (!it->second.receiveQueued && !it->second.sendQueued)
+	{
+		this->clients.erase(it);
+		return false;
+	}
+	it->second.closing = true;
+	shutdown(connection->clientSocket, SHUT_RDWR);
+	if (it->second.receiveQueued)
+	{
+		this->cancelOperation(connection, Operation::OPERATION_RECEIVE);
+	}
+	if (it->second.sendQueued)
+	{
+		this->cancelOperation(connection, Operation::OPERATION_SEND);
+	}
+	return true;
+}
+
+/**
+	Submit everything that has been queued and wait for at least one completion, then handle everything that has completed
+	@param timeoutMicroseconds How long to wait if nothing completes
+	@return bool False if the ring has failed
+*/
+bool ClientIOUring::waitForCompletions(long timeoutMicroseconds)
+{
+	int result = io_uring_submit(&this->ring);
+	if (result < 0 && result != -EINTR && result != -EBUSY)
+	{
+		stringstream logstream;
+		logstream << "io_uring_submit failed. Error: " << strerror(-result);
+		this->logger->writeToLog(logstream.str(), "ClientIOUring", "waitForCompletions");
+		return false;
+	}
+	struct __kernel_timespec timeout;
+	timeout.tv_sec = timeoutMicroseconds / 1000000;
+	timeout.tv_nsec = (timeoutMicroseconds % 1000000) * 1000;
+	struct io_uring_cqe *cqe = NULL;
+	result = io_uring_wait_cqe_timeout(&this->ring, &cqe, &timeout);
+	if (result < 0 && result != -ETIME && result != -EINTR)
+	{
+		stringstream logstream;
+		logstream << "io_uring_wait_cqe_timeout failed. Error: " << strerror(-result);
+		this->logger->writeToLog(logstream.str(), "ClientIOUring", "waitForCompletions");
+		return false;
+	}
+	while (io_uring_peek_cqe(&this->ring, &cqe) == 0)
+	{
+		this->processCompletion(cqe);
+		io_uring_cqe_seen(&this->ring, cqe);
+	}
+	return true;
+}
+
+/**
+	Take the next client accepted on the listen port
+	@param clientSocket Set to the client's socket
+	@return bool False if no more clients have been accepted
+*/
+bool ClientIOUring::takeAcceptedSocket(int *clientSocket)
+{
+	if (this->acceptedSockets.empty())
+	{
+		return false;
+	}
+	*clientSocket = this->acceptedSockets.front();
+	this->acceptedSockets.erase(this->acceptedSockets.begin());
+	return true;
+}
+
+/**
+	@return bool True if the polled socket has become ready since this was last called
+*/
+bool ClientIOUring::takeSocketReady()
+{
+	bool ready = this->socketReady;
+	this->socketReady = false;
+	return ready;
+}
+
+/**
+	Get a submission queue entry, submitting what's already been queued if the submission queue is full
+	@return io_uring_sqe The entry, NULL if the queue is still full, in which case the operation is queued on a later pass
+*/
+struct io_uring_sqe *ClientIOUring::getSubmissionEntry()
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&this->ring);
+	if (sqe == NULL)
+	{
+		io_uring_submit(&this->ring);
+		sqe = io_uring_get_sqe(&this->ring);
+	}
+	return sqe;
+}
+
+/**
+	Tag an entry with what it is for, the connection pointer with the operation in its low bits (a ForwardedConnection is always at least
+	8 byte aligned)
+*/
+void ClientIOUring::queueOperation(struct io_uring_sqe *sqe, ForwardedConnection *connection, Operation operation)
+{
+	io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(connection) | operation));
+	this->operationsInFlight++;
+}
+
+void ClientIOUring::cancelOperation(ForwardedConnection *connection, Operation operation)
+{
+	struct io_uring_sqe *sqe = this->getSubmissionEntry();
+	if (sqe == NULL)
+	{
+		return;
+	}
+	io_uring_prep_cancel(sqe, reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(connection) | operation), 0);
+	this->queueOperation(sqe, NULL, Operation::OPERATION_CANCEL);
+}
+
+void ClientIOUring::processCompletion(struct io_uring_cqe *cqe)
+{
+	uintptr_t userData = reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe));
+	Operation operation = static_cast<Operation>(userData & 7);
+	ForwardedConnection *connection = reinterpret_cast<ForwardedConnection*>(userData & ~static_cast<uintptr_t>(7));
+	bool more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+	if (!more)
+	{
+		this->operationsInFlight--;
+	}
+	switch (operation)
+	{
+	case Operation::OPERATION_ACCEPT:
+		if (cqe->res >= 0)
+		{
+			this->acceptedSockets.push_back(cqe->res);
+		}
+		else if (cqe->res == -EINVAL && this->multishotAccept)
+		{
+			//The kernel is older than 5.19, accept one client at a time instead
+			this->multishotAccept = false;
+		}
+		else if (cqe->res != -ECANCELED && cqe->res != -EINTR && cqe->res != -EAGAIN)
+		{
+			stringstream logstream;
+			logstream << "Failed to accept a client. Error: " << strerror(-cqe->res);
+			this->logger->writeToLog(logstream.str(), "ClientIOUring", "processCompletion");
+		}
+		if (!more)
+		{
+			this->acceptQueued = false;
+		}
+		break;
+	case Operation::OPERATION_POLL:
+		this->pollQueued = false;
+		this->pollCancelQueued = false;
+		if (cqe->res > 0)
+		{
+			this->socketReady = true;
+		}
+		break;
+	case Operation::OPERATION_RECEIVE:
+	case Operation::OPERATION_SEND:
+		this->completeClientIO(connection, operation, cqe->res);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+	Handle a receive from or a send to a client completing
+	@param connection The client connection
+	@param operation OPERATION_RECEIVE or OPERATION_SEND
+	@param result The number of bytes, or minus the error
+*/
+void ClientIOUring::completeClientIO(ForwardedConnection *connection, Operation operation, int result)
+{
+	map<ForwardedConnection*, ClientIO>::iterator it = this->clients.find(connection);
+	if (it == this->clients.end())
+	{
+		return;
+	}
+	ClientIO &clientIO = it->second;
+	bool retry = result == -EAGAIN || result == -EINTR || result == -ECANCELED;
+	if (operation == Operation::OPERATION_RECEIVE)
+	{
+		clientIO.receiveQueued = false;
+		if (!clientIO.closing)
+		{
+			if (result > 0)
+			{
+				connection->clientToServer.commitWrite(result);
+			}
+			else if (result == 0)
+			{
+				connection->clientDisconnected = true;
+			}
+			else if (!retry)
+			{
+				stringstream logstream;
+				logstream << "Failed to receive data on socket. Error: " << strerror(-result);
+				this->logger->writeToLog(logstream.str(), "ClientIOUring", "completeClientIO");
+				clientIO.failed = true;
+			}
+		}
+		connection->clientToServer.holdWritePosition(false);
+	}
+	else
+	{
+		clientIO.sendQueued = false;
+		if (!clientIO.closing)
+		{
+			if (result > 0)
+			{
+				connection->serverToClient.consume(result);
+			}
+			else if (result < 0 && !retry)
+			{
+				stringstream logstream;
+				logstream << "Failed to send to forward socket. Error: " << strerror(-result);
+				this->logger->writeToLog(logstream.str(), "ClientIOUring", "completeClientIO");
+				clientIO.failed = true;
+			}
+		}
+	}
+	if (clientIO.closing && !clientIO.receiveQueued && !clientIO.sendQueued)
+	{
+		this->clients.erase(it);
+		delete connection;
+	}
+}
+
+#endif
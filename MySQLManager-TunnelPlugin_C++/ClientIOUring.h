@@ -0,0 +1,68 @@
+#pragma once
+#ifndef CLIENTIOURING_H
+#define CLIENTIOURING_H
+#include <map>
+#include <vector>
+#include "Logger.h"
+#include "StaticSettings.h"
+#include "ForwardedConnection.h"
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+class ClientIOUring
+{
+public:
+	static bool isSupported();
+#ifdef HAVE_LIBURING
+	ClientIOUring(Logger *logger);
+	~ClientIOUring();
+	bool initialise(int listenSocket, unsigned int maxClients);
+	void setAccepting(bool accepting);
+	void pollSocket(int sock, short events);
+	void queueReceive(ForwardedConnection *connection, char *buffer, size_t length);
+	void queueSend(ForwardedConnection *connection);
+	bool hasClientFailed(ForwardedConnection *connection);
+	bool cancelClientIO(ForwardedConnection *connection);
+	bool waitForCompletions(long timeoutMicroseconds);
+	bool takeAcceptedSocket(int *clientSocket);
+	bool takeSocketReady();
+private:
+	enum Operation { OPERATION_ACCEPT = 1, OPERATION_POLL, OPERATION_RECEIVE, OPERATION_SEND, OPERATION_CANCEL };
+	struct ClientIO
+	{
+		bool receiveQueued = false;
+		bool sendQueued = false;
+		bool failed = false;
+		bool closing = false;
+		struct iovec sendVectors[2];
+		struct msghdr sendMessage;
+	};
+	Logger *logger = NULL;
+	struct io_uring ring;
+	bool ringInitialised = false;
+	int listenSocket = -1;
+	bool accepting = false;
+	bool acceptQueued = false;
+	bool multishotAccept = true;
+	int pollSocketDescriptor = -1;
+	short pollEvents = 0;
+	bool pollQueued = false;
+	bool pollCancelQueued = false;
+	bool socketReady = false;
+	unsigned int operationsInFlight = 0;
+	std::vector<int> acceptedSockets;
+	std::map<ForwardedConnection*, ClientIO> clients;
+	static bool probe();
+	struct io_uring_sqe *getSubmissionEntry();
+	void queueOperation(struct io_uring_sqe *sqe, ForwardedConnection *connection, Operation operation);
+	void processCompletion(struct io_uring_cqe *cqe);
+	void completeClientIO(ForwardedConnection *connection, Operation operation, int result);
+	void cancelOperation(ForwardedConnection *connection, Operation operation);
+#endif
+};
+
+#endif //!CLIENTIOURING_H
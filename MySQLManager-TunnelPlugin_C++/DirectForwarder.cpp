@@ -0,0 +1,509 @@
+/**
+	Forwards a tunnel's clients straight to the MySQL server without going through SSH, for MySQL servers that the SSH server is on the same 
+	machine as, or a trusted network segment. The operator lists the destinations that can be forwarded directly for an SSH host, as 
+	mysqlHost:port the same as they are sent in the CreateTunnel request, e.g.
+
+	[ssh_host:db.example.com]
+	directForwardDestinations = 127.0.0.1:3306,10.0.0.5:3306
+
+	The tunnel still gets a local port, expires and is closed the same as any other tunnel, but there's no SSH session, and the data is moved 
+	between the client and the MySQL server with splice() through a pipe for each direction, so it is never copied into this process.
+	splice() is Linux only, on other platforms directForwardDestinations is ignored and the tunnel goes through SSH
+*/
+
+#include "DirectForwarder.h"
+#include "SSHTunnelForwarder.h"
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#endif
+
+using namespace std;
+
+DirectForwarder::DirectForwarder(Logger *logger, string mysqlHost, int mysqlPort, struct sockaddr_in serverAddress, int localListenPort)
+{
+	this->logger = logger;
+	this->mysqlHost = mysqlHost;
+	this->mysqlPort = mysqlPort;
+	this->serverAddress = serverAddress;
+	this->localListenPort = localListenPort;
+}
+
+DirectForwarder::~DirectForwarder()
+{
+	while (!this->connections.empty())
+	{
+		this->closeConnection(this->connections.front());
+	}
+}
+
+/**
+	@return bool True if direct forwarding can be used on this platform
+*/
+bool DirectForwarder::isSupported()
+{
+#ifdef __linux__
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+	Check whether the operator has allowed the MySQL server to be forwarded to directly for the SSH host, from directForwardDestinations in 
+	the SSH host's section
+	@param sshHost The SSH host from the tunnel request
+	@param mysqlHost The MySQL host from the tunnel request
+	@param mysqlPort The MySQL port from the tunnel request
+	@return bool True if the tunnel should be forwarded directly
+*/
+bool DirectForwarder::isDirectDestination(string sshHost, string mysqlHost, int mysqlPort)
+{
+	string destinations = HostSettings::getSetting(sshHost, "directForwardDestinations", string());
+	if (destinations.empty() || !DirectForwarder::isSupported())
+	{
+		return false;
+	}
+	HelperMethods helperMethods;
+	string requested = mysqlHost + ":" + std::to_string(mysqlPort);
+	vector<string> allowedDestinations = helperMethods.splitString(destinations, ',');
+	for (vector<string>::iterator it = allowedDestinations.begin(); it != allowedDestinations.end(); ++it)
+	{
+		helperMethods.trimString(*it);
+		if (*it == requested)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+unsigned long long DirectForwarder::getBytesToServer()
+{
+	return this->totalBytesToServer;
+}
+
+unsigned long long DirectForwarder::getBytesFromServer()
+{
+	return this->totalBytesFromServer;
+}
+
+#ifdef __linux__
+
+/**
+	Resolve the MySQL server's address. This is done once when the tunnel is created, rather than for each client, so a client isn't 
+	held up by a DNS lookup, and neither are the tunnel's other clients while it waits
+	@param logger The logger to write a failed lookup to
+	@param mysqlHost The MySQL host from the tunnel request
+	@param mysqlPort The MySQL port from the tunnel request
+	@param serverAddress Set to the address to connect each client to
+	@return bool False if the MySQL host couldn't be resolved
+*/
+bool DirectForwarder::resolveServer(Logger *logger, string mysqlHost, int mysqlPort, struct sockaddr_in *serverAddress)
+{
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo *record = NULL;
+	int resolveResult = getaddrinfo(mysqlHost.c_str(), NULL, &hints, &record);
+	if (resolveResult != 0 || record == NULL)
+	{
+		stringstream logstream;
+		logstream << "Unable to resolve " << mysqlHost << " Error: " << gai_strerror(resolveResult);
+		logger->writeToLog(logstream.str(), "DirectForwarder", "resolveServer");
+		return false;
+	}
+	*serverAddress = *(sockaddr_in *)record->ai_addr;
+	freeaddrinfo(record);
+	serverAddress->sin_port = htons(mysqlPort);
+	return true;
+}
+
+/**
+	Accept clients on the tunnel's local port and forward them to the MySQL server until the tunnel is closed
+	@param listensock The tunnel's listening socket, which must be non-blocking
+	@param closeRequested Set by another thread when the tunnel should close
+	@param sessionClosed Set when the tunnel has been closed on this thread
+*/
+void DirectForwarder::acceptAndForward(int listensock, atomic<bool> *closeRequested, bool *sessionClosed)
+{
+	stringstream logstream;
+	logstream << "Forwarding port " << this->localListenPort << " directly to " << this->mysqlHost << ":" << this->mysqlPort;
+	this->logger->writeToLog(logstream.str(), "DirectForwarder", "acceptAndForward");
+
+	//poll() rather than select(), the client and server sockets of a busy tunnel can be numbered past FD_SETSIZE. Each connection has a 
+	//client and a server socket, in that order, after the listen socket
+	vector<struct pollfd> pollSockets;
+	while (!*closeRequested && !*sessionClosed)
+	{
+		pollSockets.clear();
+		struct pollfd pollSocket;
+		pollSocket.fd = listensock;
+		pollSocket.events = this->connections.size() < (size_t)StaticSettings::AppSettings::maxClientsPerTunnel ? POLLIN : 0;
+		pollSocket.revents = 0;
+		pollSockets.push_back(pollSocket);
+		for (vector<SplicedConnection*>::iterator it = this->connections.begin(); it != this->connections.end(); ++it)
+		{
+			SplicedConnection *connection = *it;
+			short clientEvents = 0;
+			short serverEvents = 0;
+			if (connection->connecting)
+			{
+				serverEvents = POLLOUT;
+			}
+			else
+			{
+				//Only read from a side while its pipe has room, and only wait to write to a side while there's data in the pipe for it
+				if (!connection->clientToServer.sourceClosed && connection->clientToServer.bytes < connection->clientToServer.capacity)
+				{
+					clientEvents |= POLLIN;
+				}
+				if (!connection->serverToClient.sourceClosed && connection->serverToClient.bytes < connection->serverToClient.capacity)
+				{
+					serverEvents |= POLLIN;
+				}
+				if (connection->clientToServer.bytes > 0)
+				{
+					serverEvents |= POLLOUT;
+				}
+				if (connection->serverToClient.bytes > 0)
+				{
+					clientEvents |= POLLOUT;
+				}
+			}
+			//A socket with no events is left out by giving poll() a negative descriptor, so a hang up it can't act on doesn't wake the loop
+			pollSocket.fd = clientEvents != 0 ? connection->clientSocket : -1;
+			pollSocket.events = clientEvents;
+			pollSockets.push_back(pollSocket);
+			pollSocket.fd = serverEvents != 0 ? connection->serverSocket : -1;
+			pollSocket.events = serverEvents;
+			pollSockets.push_back(pollSocket);
+		}
+
+		int rc = poll(pollSockets.data(), pollSockets.size(), 100);
+		if (rc == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			logstream.clear();
+			logstream.str(string());
+			logstream << "Socket poll failed. Error: " << strerror(errno);
+			this->logger->writeToLog(logstream.str(), "DirectForwarder", "acceptAndForward");
+			break;
+		}
+		for (size_t index = 0; index < this->connections.size(); index++)
+		{
+			this->connections[index]->clientEvents = pollSockets[1 + index * 2].revents;
+			this->connections[index]->serverEvents = pollSockets[2 + index * 2].revents;
+		}
+		if (rc > 0 && (pollSockets[0].revents & POLLIN))
+		{
+			this->acceptClient(listensock);
+		}
+
+		//Take a copy as connections are removed from the list as they close
+		vector<SplicedConnection*> currentConnections = this->connections;
+		for (vector<SplicedConnection*>::iterator it = currentConnections.begin(); it != currentConnections.end(); ++it)
+		{
+			if (!this->forwardConnectionData(*it))
+			{
+				this->closeConnection(*it);
+			}
+		}
+	}
+	while (!this->connections.empty())
+	{
+		this->closeConnection(this->connections.front());
+	}
+}
+
+/**
+	Accept a client on the local port and start connecting it to the MySQL server. The connect carries on in the poll() loop so a slow
+	connect doesn't hold up the tunnel's other clients
+	@param listensock The tunnel's listening socket
+*/
+void DirectForwarder::acceptClient(int listensock)
+{
+	sockaddr_in clientAddr;
+	socklen_t clientAddrLen = sizeof(clientAddr);
+	int clientSocket = accept(listensock, (struct sockaddr *)&clientAddr, &clientAddrLen);
+	if (clientSocket == -1)
+	{
+		return;
+	}
+	fcntl(clientSocket, F_SETFL, fcntl(clientSocket, F_GETFL, 0) | O_NONBLOCK);
+	SSHTunnelForwarder::setTCPKeepalive(clientSocket);
+
+	SplicedConnection *connection = new SplicedConnection();
+	connection->clientSocket = clientSocket;
+	connection->clientHost = inet_ntoa(clientAddr.sin_addr);
+	connection->clientPort = ntohs(clientAddr.sin_port);
+	this->connections.push_back(connection);
+	if (!this->createPipe(&connection->clientToServer) || !this->createPipe(&connection->serverToClient) || !this->connectToServer(connection))
+	{
+		this->closeConnection(connection);
+		return;
+	}
+
+	stringstream logstream;
+	logstream << "Forwarding connection from " << connection->clientHost << ":" << connection->clientPort << " directly to ";
+	logstream << this->mysqlHost << ":" << this->mysqlPort << " (" << this->connections.size() << " client(s) on port " << this->localListenPort << ")";
+	this->logger->writeToLog(logstream.str(), "DirectForwarder", "acceptClient");
+}
+
+/**
+	Start a non-blocking connect to the MySQL server's address resolved by resolveServer for a client
+	@param connection The client connection
+	@return bool False if the connect failed straight away
+*/
+bool DirectForwarder::connectToServer(SplicedConnection *connection)
+{
+	stringstream logstream;
+	connection->serverSocket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (connection->serverSocket == -1)
+	{
+		logstream << "Failed to open socket. Error: " << strerror(errno);
+		this->logger->writeToLog(logstream.str(), "DirectForwarder", "connectToServer");
+		return false;
+	}
+	fcntl(connection->serverSocket, F_SETFL, fcntl(connection->serverSocket, F_GETFL, 0) | O_NONBLOCK);
+	SSHTunnelForwarder::setTCPKeepalive(connection->serverSocket);
+	connection->connectStarted = std::chrono::steady_clock::now();
+	if (connect(connection->serverSocket, (struct sockaddr *)&this->serverAddress, sizeof(this->serverAddress)) == 0)
+	{
+		connection->connecting = false;
+	}
+	else if (errno != EINPROGRESS)
+	{
+		logstream << "Failed to connect to " << this->mysqlHost << ":" << this->mysqlPort << ". Error: " << strerror(errno);
+		this->logger->writeToLog(logstream.str(), "DirectForwarder", "connectToServer");
+		return false;
+	}
+	return true;
+}
+
+/**
+	Create the pipe that one direction of a connection is spliced through, sized to forwardBufferSize if the kernel allows it
+	@param splicePipe The direction's pipe
+	@return bool False if the pipe couldn't be created
+*/
+bool DirectForwarder::createPipe(SplicePipe *splicePipe)
+{
+	int pipeEnds[2];
+	if (pipe2(pipeEnds, O_NONBLOCK | O_CLOEXEC) == -1)
+	{
+		stringstream logstream;
+		logstream << "Failed to create pipe. Error: " << strerror(errno);
+		this->logger->writeToLog(logstream.str(), "DirectForwarder", "createPipe");
+		return false;
+	}
+	splicePipe->readEnd = pipeEnds[0];
+	splicePipe->writeEnd = pipeEnds[1];
+	fcntl(splicePipe->writeEnd, F_SETPIPE_SZ, StaticSettings::AppSettings::forwardBufferSize);
+	int capacity = fcntl(splicePipe->writeEnd, F_GETPIPE_SZ);
+	splicePipe->capacity = capacity > 0 ? (size_t)capacity : 65536;
+	return true;
+}
+
+/**
+	Move whatever is waiting between the client and the MySQL server
+	@param connection The client connection, with the events poll() reported for its client and server sockets
+	@return bool False if either side has disconnected, or forwarding failed, and the connection should be closed
+*/
+bool DirectForwarder::forwardConnectionData(SplicedConnection *connection)
+{
+	stringstream logstream;
+	//A socket that has hung up or failed is treated as ready, the same as select() did, so the read or SO_ERROR finds out what happened
+	short failedEvents = POLLHUP | POLLERR;
+	if (connection->connecting)
+	{
+		if (connection->serverEvents & (POLLOUT | failedEvents))
+		{
+			int socketError = 0;
+			socklen_t errorLength = sizeof(socketError);
+			getsockopt(connection->serverSocket, SOL_SOCKET, SO_ERROR, &socketError, &errorLength);
+			if (socketError != 0)
+			{
+				logstream << "Failed to connect to " << this->mysqlHost << ":" << this->mysqlPort << ". Error: " << strerror(socketError);
+				this->logger->writeToLog(logstream.str(), "DirectForwarder", "forwardConnectionData");
+				return false;
+			}
+			connection->connecting = false;
+		}
+		else if (std::chrono::steady_clock::now() - connection->connectStarted > std::chrono::seconds(StaticSettings::AppSettings::sshConnectTimeoutSeconds))
+		{
+			logstream << "Connecting to " << this->mysqlHost << ":" << this->mysqlPort << " timed out";
+			this->logger->writeToLog(logstream.str(), "DirectForwarder", "forwardConnectionData");
+			return false;
+		}
+		return true;
+	}
+
+	if ((connection->clientEvents & (POLLIN | failedEvents)) && !this->spliceIn(connection, connection->clientSocket, &connection->clientToServer))
+	{
+		return false;
+	}
+	if ((connection->serverEvents & (POLLIN | failedEvents)) && !this->spliceIn(connection, connection->serverSocket, &connection->serverToClient))
+	{
+		return false;
+	}
+	//Whatever was just read is sent straight away rather than waiting for the next poll()
+	if (!this->spliceOut(connection, &connection->clientToServer, connection->serverSocket, &this->totalBytesToServer) ||
+		!this->spliceOut(connection, &connection->serverToClient, connection->clientSocket, &this->totalBytesFromServer))
+	{
+		return false;
+	}
+
+	//Pass a disconnect on to the other side once everything that was sent before it has been passed on, the connection is closed once both 
+	//sides have disconnected
+	if (connection->clientToServer.sourceClosed && connection->clientToServer.bytes == 0 && !connection->clientToServer.destinationShutdown)
+	{
+		shutdown(connection->serverSocket, SHUT_WR);
+		connection->clientToServer.destinationShutdown = true;
+	}
+	if (connection->serverToClient.sourceClosed && connection->serverToClient.bytes == 0 && !connection->serverToClient.destinationShutdown)
+	{
+		shutdown(connection->clientSocket, SHUT_WR);
+		connection->serverToClient.destinationShutdown = true;
+	}
+	if (connection->clientToServer.destinationShutdown && connection->serverToClient.destinationShutdown)
+	{
+		logstream << "The client " << connection->clientHost << ":" << connection->clientPort << " and the server at " << this->mysqlHost << ":";
+		logstream << this->mysqlPort << " have disconnected";
+		this->logger->writeToLog(logstream.str(), "DirectForwarder", "forwardConnectionData");
+		return false;
+	}
+	return true;
+}
+
+/**
+	Splice data from a socket into the direction's pipe, as much as the pipe has room for
+	@param connection The client connection
+	@param source The socket to read from
+	@param splicePipe The direction's pipe
+	@return bool False if reading from the socket failed
+*/
+bool DirectForwarder::spliceIn(SplicedConnection *connection, int source, SplicePipe *splicePipe)
+{
+	if (splicePipe->sourceClosed || splicePipe->bytes >= splicePipe->capacity)
+	{
+		return true;
+	}
+	ssize_t moved = splice(source, NULL, splicePipe->writeEnd, NULL, splicePipe->capacity - splicePipe->bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (moved == 0)
+	{
+		splicePipe->sourceClosed = true;
+	}
+	else if (moved < 0)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		{
+			return true;
+		}
+		stringstream logstream;
+		logstream << "Failed to receive data for client " << connection->clientHost << ":" << connection->clientPort << ". Error: " << strerror(errno);
+		this->logger->writeToLog(logstream.str(), "DirectForwarder", "spliceIn");
+		return false;
+	}
+	else
+	{
+		splicePipe->bytes += moved;
+	}
+	return true;
+}
+
+/**
+	Splice the data waiting in the direction's pipe out to a socket, as much as the socket will take without blocking
+	@param connection The client connection
+	@param splicePipe The direction's pipe
+	@param destination The socket to send to
+	@param totalBytes The tunnel's byte count for the direction
+	@return bool False if the other side has gone away or sending to the socket failed
+*/
+bool DirectForwarder::spliceOut(SplicedConnection *connection, SplicePipe *splicePipe, int destination, unsigned long long *totalBytes)
+{
+	while (splicePipe->bytes > 0)
+	{
+		ssize_t moved = splice(splicePipe->readEnd, NULL, destination, NULL, splicePipe->bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (moved < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				break;
+			}
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			stringstream logstream;
+			//The client or the MySQL server dropping the connection while data is still being sent is a normal disconnect
+			if (errno == EPIPE || errno == ECONNRESET)
+			{
+				logstream << "The " << (destination == connection->clientSocket ? "client " : "server for client ") << connection->clientHost << ":";
+				logstream << connection->clientPort << " disconnected before all the data was sent";
+				this->logger->writeToLog(logstream.str(), "DirectForwarder", "spliceOut");
+				return false;
+			}
+			logstream << "Failed to send data for client " << connection->clientHost << ":" << connection->clientPort << ". Error: " << strerror(errno);
+			this->logger->writeToLog(logstream.str(), "DirectForwarder", "spliceOut");
+			return false;
+		}
+		splicePipe->bytes -= moved;
+		*totalBytes += moved;
+	}
+	return true;
+}
+
+/**
+	Close a client connection, its connection to the MySQL server and its pipes, and remove it from the tunnel
+	@param connection The client connection to close
+*/
+void DirectForwarder::closeConnection(SplicedConnection *connection)
+{
+	for (vector<SplicedConnection*>::iterator it = this->connections.begin(); it != this->connections.end(); ++it)
+	{
+		if (*it == connection)
+		{
+			this->connections.erase(it);
+			break;
+		}
+	}
+	int descriptors[] = { connection->clientSocket, connection->serverSocket, connection->clientToServer.readEnd, connection->clientToServer.writeEnd,
+		connection->serverToClient.readEnd, connection->serverToClient.writeEnd };
+	for (size_t i = 0; i < sizeof(descriptors) / sizeof(descriptors[0]); i++)
+	{
+		if (descriptors[i] != -1)
+		{
+			close(descriptors[i]);
+		}
+	}
+	delete connection;
+}
+
+#else
+
+bool DirectForwarder::resolveServer(Logger *logger, string mysqlHost, int mysqlPort, struct sockaddr_in *serverAddress)
+{
+	return false;
+}
+
+void DirectForwarder::acceptAndForward(int listensock, atomic<bool> *closeRequested, bool *sessionClosed)
+{
+	this->logger->writeToLog("Direct forwarding is only supported on Linux", "DirectForwarder", "acceptAndForward");
+}
+
+void DirectForwarder::closeConnection(SplicedConnection *connection)
+{
+	delete connection;
+}
+
+#endif //!__linux__
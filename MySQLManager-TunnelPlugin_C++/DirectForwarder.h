@@ -0,0 +1,70 @@
+#pragma once
+#ifndef DIRECTFORWARDER_H
+#define DIRECTFORWARDER_H
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <poll.h>
+#include <netinet/in.h>
+#endif
+#include "Logger.h"
+#include "StaticSettings.h"
+#include "HostSettings.h"
+#include "HelperMethods.h"
+
+class DirectForwarder
+{
+public:
+	DirectForwarder(Logger *logger, std::string mysqlHost, int mysqlPort, struct sockaddr_in serverAddress, int localListenPort);
+	~DirectForwarder();
+	static bool isSupported();
+	static bool isDirectDestination(std::string sshHost, std::string mysqlHost, int mysqlPort);
+	static bool resolveServer(Logger *logger, std::string mysqlHost, int mysqlPort, struct sockaddr_in *serverAddress);
+	void acceptAndForward(int listensock, std::atomic<bool> *closeRequested, bool *sessionClosed);
+	unsigned long long getBytesToServer();
+	unsigned long long getBytesFromServer();
+private:
+	struct SplicePipe
+	{
+		int readEnd = -1;
+		int writeEnd = -1;
+		size_t bytes = 0;
+		size_t capacity = 0;
+		bool sourceClosed = false;
+		bool destinationShutdown = false;
+	};
+	struct SplicedConnection
+	{
+		int clientSocket = -1;
+		int serverSocket = -1;
+		std::string clientHost;
+		int clientPort = 0;
+		bool connecting = true;
+		short clientEvents = 0;
+		short serverEvents = 0;
+		std::chrono::steady_clock::time_point connectStarted;
+		SplicePipe clientToServer;
+		SplicePipe serverToClient;
+	};
+	Logger *logger = NULL;
+	std::string mysqlHost;
+	int mysqlPort;
+	struct sockaddr_in serverAddress;
+	int localListenPort;
+	std::vector<SplicedConnection*> connections;
+	unsigned long long totalBytesToServer = 0;
+	unsigned long long totalBytesFromServer = 0;
+	void acceptClient(int listensock);
+	bool connectToServer(SplicedConnection *connection);
+	bool createPipe(SplicePipe *splicePipe);
+	bool forwardConnectionData(SplicedConnection *connection);
+	bool spliceIn(SplicedConnection *connection, int source, SplicePipe *splicePipe);
+	bool spliceOut(SplicedConnection *connection, SplicePipe *splicePipe, int destination, unsigned long long *totalBytes);
+	void closeConnection(SplicedConnection *connection);
+};
+
+#endif //!DIRECTFORWARDER_H
@@ -0,0 +1,104 @@
+/**
+	A single MySQL client connection that has been accepted on a tunnel's local listen port, along with the direct-tcpip channel that
+	its data is forwarded through. A tunnel can have several of these open at the same time, all sharing the tunnel's SSH session
+*/
+
+#include "ForwardedConnection.h"
+
+using namespace std;
+
+/**
+	Create the connection for a client that has just been accepted. The channel is opened afterwards by the SSHTunnelForwarder
+	@param clientSocket The socket descriptor returned by accept()
+	@param clientHost The IP address of the client
+	@param clientPort The port of the client
+*/
+#ifdef _WIN32
+ForwardedConnection::ForwardedConnection(SOCKET clientSocket, string clientHost, int clientPort)
+#else
+ForwardedConnection::ForwardedConnection(int clientSocket, string clientHost, int clientPort)
+#endif
+{
+	this->clientSocket = clientSocket;
+	this->clientHost = clientHost;
+	this->clientPort = clientPort;
+}
+
+/**
+	Close the channel and the client socket. The SSH session itself is left open so that other clients can carry on using it.
+	The session is put into blocking mode so that the channel is definitely freed, the caller needs to put it back into non-blocking mode if required
+*/
+void ForwardedConnection::closeConnection()
+{
+	if (this->channel != NULL)
+	{
+		libssh2_channel_set_blocking(this->channel, 1);
+		libssh2_channel_send_eof(this->channel);
+		libssh2_channel_close(this->channel);
+		libssh2_channel_free(this->channel);
+		this->channel = NULL;
+	}
+#ifdef _WIN32
+	if (this->clientSocket != INVALID_SOCKET)
+	{
+		closesocket(this->clientSocket);
+		this->clientSocket = INVALID_SOCKET;
+	}
+#else
+	if (this->clientSocket != -1)
+	{
+		close(this->clientSocket);
+		this->clientSocket = -1;
+	}
+#endif
+}
+
+/**
+	Make sure a direction's buffer has memory to receive into, taking a buffer from the BufferPool if it doesn't
+	@param ringBuffer clientToServer or serverToClient
+	@return bool False if the pool has no free buffers, the data has to be left where it is until a buffer is free
+*/
+bool ForwardedConnection::attachBuffer(RingBuffer *ringBuffer)
+{
+	if (ringBuffer->hasMemory())
+	{
+		return true;
+	}
+	size_t capacity = 0;
+	char *memory = BufferPool::acquireBuffer(&capacity);
+	if (memory == NULL)
+	{
+		return false;
+	}
+	ringBuffer->attach(memory, capacity);
+	return true;
+}
+
+/**
+	Give the buffer of any direction that has nothing waiting in it back to the BufferPool, so an idle connection doesn't hold any buffer memory.
+	A buffer that is still being received into is kept
+*/
+void ForwardedConnection::releaseIdleBuffers()
+{
+	if (this->clientToServer.hasMemory() && this->clientToServer.empty() && !this->clientToServer.isWritePositionHeld())
+	{
+		BufferPool::releaseBuffer(this->clientToServer.detach());
+	}
+	if (this->serverToClient.hasMemory() && this->serverToClient.empty())
+	{
+		BufferPool::releaseBuffer(this->serverToClient.detach());
+	}
+}
+
+ForwardedConnection::~ForwardedConnection()
+{
+	this->closeConnection();
+	if (this->clientToServer.hasMemory())
+	{
+		BufferPool::releaseBuffer(this->clientToServer.detach());
+	}
+	if (this->serverToClient.hasMemory())
+	{
+		BufferPool::releaseBuffer(this->serverToClient.detach());
+	}
+}
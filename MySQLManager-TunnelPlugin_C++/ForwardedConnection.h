@@ -0,0 +1,56 @@
+#pragma once
+#ifndef FORWARDEDCONNECTION_H
+#define FORWARDEDCONNECTION_H
+#include <libssh2.h>
+#include <string>
+#include <chrono>
+#include "RingBuffer.h"
+#include "BufferPool.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <unistd.h>
+#endif
+
+class ForwardedConnection
+{
+public:
+	enum ConnectionState { OPENING_CHANNEL, FORWARDING };
+#ifdef _WIN32
+	ForwardedConnection(SOCKET clientSocket, std::string clientHost, int clientPort);
+	SOCKET clientSocket = INVALID_SOCKET;
+#else
+	ForwardedConnection(int clientSocket, std::string clientHost, int clientPort);
+	int clientSocket = -1;
+#endif
+	~ForwardedConnection();
+	void closeConnection();
+	bool attachBuffer(RingBuffer *ringBuffer);
+	void releaseIdleBuffers();
+	std::string clientHost;
+	int clientPort;
+	int localPort = 0;
+	std::string destinationHost;
+	int destinationPort = 0;
+	ConnectionState state = OPENING_CHANNEL;
+	LIBSSH2_CHANNEL *channel = NULL;
+	RingBuffer clientToServer;
+	RingBuffer serverToClient;
+	bool clientReadPaused = false;
+	bool clientReadable = false;
+	bool channelReadPaused = false;
+	bool clientDisconnected = false;
+	bool serverDisconnected = false;
+	bool channelWriteHeld = false;
+	size_t scheduleQuantumLeft = 0;
+	bool scheduleLimited = false;
+	bool bandwidthLimited = false;
+	std::chrono::steady_clock::time_point lastChannelWrite;
+	unsigned int channelWindowSize = 0;
+	unsigned long long burstBytes = 0;
+	std::chrono::steady_clock::time_point burstStarted;
+	std::chrono::steady_clock::time_point lastServerData;
+};
+
+#endif //!FORWARDEDCONNECTION_H
@@ -114,6 +114,27 @@ string HelperMethods::base64Decode(string const& encoded_string)
 	return ret;
 }
 
+/**
+	Create a SHA256 hash of a string, e.g. so that credentials can be used as a lookup key without keeping the credentials themselves
+	@param content The string content that should be hashed
+	@return string The hex encoded SHA256 hash
+*/
+string HelperMethods::sha256Hash(string const& content)
+{
+	unsigned char hash[SHA256_DIGEST_LENGTH];
+	SHA256((const unsigned char*)content.data(), content.size(), hash);
+
+	static const char hexChars[] = "0123456789abcdef";
+	string ret;
+	ret.reserve(SHA256_DIGEST_LENGTH * 2);
+	for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
+	{
+		ret += hexChars[hash[i] >> 4];
+		ret += hexChars[hash[i] & 0x0F];
+	}
+	return ret;
+}
+
 /**
 	Split a string by a particular character into a vector of string
 	@param content The string content that should be split
@@ -21,6 +21,7 @@ class HelperMethods
 public:
 	string base64Encode(const char* buffer, int in_len);
 	string base64Decode(string const& encoded_string);
+	string sha256Hash(string const& content);
 	vector<string> splitString(string content, char delimiter);
 	void trimString(string& s);
 	bool findFileNameAndExtensionFromFileName(const string fileName, string *fileNameWithoutExt, string *extension);
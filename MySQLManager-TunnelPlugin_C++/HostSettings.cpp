@@ -0,0 +1,82 @@
+/**
+	Settings that can be overridden for a specific SSH server. Each SSH server has its own [ssh_host:<hostname or IP>] section in the 
+	configuration file containing any of the [app_settings] keys that support it, e.g.
+	
+	[ssh_host:db.example.com]
+	channelWindowSize = 8388608
+	
+	The hostname has to match the SSH host exactly as it is sent in the CreateTunnel request. Any key that isn't in the host's section
+	uses the value from [app_settings]
+*/
+
+#include "HostSettings.h"
+
+using namespace std;
+
+std::map<std::string, std::map<std::string, std::string>> HostSettings::hostSettings;
+
+/**
+	Read every [ssh_host:...] section from the configuration file. This is only called when the configuration is read on start up
+	@param iniParser The parser for the configuration file
+*/
+void HostSettings::loadHostSettings(INIParser *iniParser)
+{
+	const string sectionPrefix = "ssh_host:";
+	vector<string> sectionNames = iniParser->getSectionNames();
+	for (vector<string>::iterator it = sectionNames.begin(); it != sectionNames.end(); ++it)
+	{
+		if (it->compare(0, sectionPrefix.length(), sectionPrefix) == 0 && it->length() > sectionPrefix.length())
+		{
+			string sshHost = it->substr(sectionPrefix.length());
+			HostSettings::hostSettings[sshHost] = iniParser->getSection(*it);
+			cout << "Loaded " << HostSettings::hostSettings[sshHost].size() << " setting(s) for SSH host " << sshHost << endl;
+		}
+	}
+}
+
+/**
+	Get a setting for an SSH server
+	@param sshHost The SSH hostname or IP address from the tunnel request
+	@param key The name of the setting
+	@param defaultValue The value to use if the SSH server doesn't override the setting, normally the [app_settings] value
+	@return string The value of the setting
+*/
+string HostSettings::getSetting(string sshHost, string key, string defaultValue)
+{
+	map<string, map<string, string>>::iterator host = HostSettings::hostSettings.find(sshHost);
+	if (host == HostSettings::hostSettings.end())
+	{
+		return defaultValue;
+	}
+	map<string, string>::iterator setting = host->second.find(key);
+	if (setting == host->second.end())
+	{
+		return defaultValue;
+	}
+	return setting->second;
+}
+
+/**
+	Get a numeric setting for an SSH server
+	@param sshHost The SSH hostname or IP address from the tunnel request
+	@param key The name of the setting
+	@param defaultValue The value to use if the SSH server doesn't override the setting, or its value isn't a number
+	@return int The value of the setting
+*/
+int HostSettings::getSetting(string sshHost, string key, int defaultValue)
+{
+	string value = HostSettings::getSetting(sshHost, key, string());
+	if (value.empty())
+	{
+		return defaultValue;
+	}
+	try
+	{
+		return stoi(value);
+	}
+	catch (std::exception&)
+	{
+		cout << "Invalid value for " << key << " in [ssh_host:" << sshHost << "]. Using " << defaultValue << endl;
+		return defaultValue;
+	}
+}
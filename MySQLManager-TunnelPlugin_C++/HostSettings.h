@@ -0,0 +1,18 @@
+#pragma once
+#ifndef HOSTSETTINGS_H
+#define HOSTSETTINGS_H
+#include <string>
+#include <map>
+#include "INIParser.h"
+
+class HostSettings
+{
+public:
+	static void loadHostSettings(INIParser *iniParser);
+	static std::string getSetting(std::string sshHost, std::string key, std::string defaultValue);
+	static int getSetting(std::string sshHost, std::string key, int defaultValue);
+private:
+	static std::map<std::string, std::map<std::string, std::string>> hostSettings;
+};
+
+#endif //!HOSTSETTINGS_H
@@ -203,6 +203,30 @@ map<string, string> INIParser::getSection(string section)
 	return keyValuePair;
 }
 
+/**
+	Get the names of every section within the configuration file, without the brackets
+	@return vector<string> The section names in the order they are in the file
+*/
+vector<string> INIParser::getSectionNames()
+{
+	vector<string> sectionNames;
+	if (fileHandle.is_open())
+	{
+		string line;
+		while (getline(fileHandle, line))
+		{
+			if (line.length() > 2 && line[0] == '[' && line[line.length() - 1] == ']')
+			{
+				sectionNames.push_back(line.substr(1, line.length() - 2));
+			}
+		}
+	}
+	//Restore the stream back to the start
+	fileHandle.clear();
+	fileHandle.seekg(0, ios::beg);
+	return sectionNames;
+}
+
 /**
 	Check if the key exists within the map<string, string> which was returned in method INIParser::getSection(string section)
 	@param lookup The map that contains the key/value pair which was returned in method INIParser::getSection(string section)
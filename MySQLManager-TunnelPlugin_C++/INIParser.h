@@ -16,6 +16,7 @@ class INIParser
 public:
 	INIParser(string configFile);
 	map<string, string> getSection(string sectionName);
+	vector<string> getSectionNames();
 	bool getKeyValueFromSection(string section, string key, string *value);
 	bool getKeyValueFromSection(string section, string key, int *value);
 	bool getKeyValueFromSection(string section, string key, long *value);
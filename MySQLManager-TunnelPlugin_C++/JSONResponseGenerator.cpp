@@ -11,11 +11,54 @@
 using namespace std;
 using namespace rapidjson;
 
-JSONResponseGenerator::JSONResponseGenerator()
+JSONResponseGenerator::JSONResponseGenerator() :
+	writer(buffer)
 {
 
 }
 
+/**
+	The responses that never carry any data, e.g. {"result":4,"message":"SSHConnectFailed"}. These are serialised once
+	the first time they are needed and then handed out as is, so the failure paths don't build the same JSON over and over again
+	@return The fixed responses keyed by the result and message
+*/
+const JSONResponseGenerator::FixedResponseMap& JSONResponseGenerator::getFixedResponses()
+{
+	static const FixedResponseMap fixedResponses = []()
+	{
+		const pair<APIResponse, const char*> templates[] = {
+			{ APIResponse::API_SUCCESS, "" },
+			{ APIResponse::API_GENERAL_ERROR, "SocketCreationFailed" },
+			{ APIResponse::API_GENERAL_ERROR, "SocketBindFailed" },
+			{ APIResponse::API_GENERAL_ERROR, "SocketListenFailed" },
+			{ APIResponse::API_GENERAL_ERROR, "LocalListenDetailsFailed" },
+			{ APIResponse::API_GENERAL_ERROR, "InvalidTunnelBatch" },
+			{ APIResponse::API_GENERAL_ERROR, "TicketCreationFailed" },
+			{ APIResponse::API_AUTH_FAILURE, "PasswordAuthNotSupported" },
+			{ APIResponse::API_AUTH_FAILURE, "NoValidAuthMethod" },
+			{ APIResponse::API_TUNNEL_ERROR, "SSHConnectFailed" },
+			{ APIResponse::API_TUNNEL_ERROR, "DNSResolutionFailed" },
+			{ APIResponse::API_TUNNEL_ERROR, "SSHSetupTimeout" },
+			{ APIResponse::API_TUNNEL_ERROR, "SSHHandshakeQueueTimeout" },
+			{ APIResponse::API_TUNNEL_ERROR, "SSH_SystemFaultOccurred" },
+			{ APIResponse::API_TUNNEL_ERROR, "PasswordAuthFailed" },
+			{ APIResponse::API_TUNNEL_ERROR, "KeyPassphraseError" },
+			{ APIResponse::API_TUNNEL_ERROR, "UsernameNotMatchedToPrivateKey" },
+			{ APIResponse::API_TUNNEL_ERROR, "InvalidPublicKey" },
+			{ APIResponse::API_TUNNEL_ERROR, "StartTunnelFailed" }
+		};
+		FixedResponseMap responses;
+		for (const pair<APIResponse, const char*>& fixed : templates)
+		{
+			JSONResponseGenerator jsonResponse;
+			jsonResponse.writeResponse(fixed.first, fixed.second, NULL);
+			responses[make_pair(static_cast<int>(fixed.first), string(fixed.second))] = jsonResponse.getJSONString();
+		}
+		return responses;
+	}();
+	return fixedResponses;
+}
+
 /**
 	Return a standard response with just the result and a message. 
 	@param result This is the result of the request, if adding a new APIResponse to the enum, ensure that the enum value (API_SUCCESS = 0) matches with the defines in the PHP API
@@ -23,8 +66,16 @@ JSONResponseGenerator::JSONResponseGenerator()
 */
 void JSONResponseGenerator::generateJSONResponse(JSONResponseGenerator::APIResponse result, string message)
 {
-	map<string, string> data;
-	this->generateJSONResponse(result, message, &data);
+	const FixedResponseMap& fixedResponses = getFixedResponses();
+	FixedResponseMap::const_iterator fixed = fixedResponses.find(make_pair(static_cast<int>(result), message));
+	if (fixed == fixedResponses.end())
+	{
+		this->writeResponse(result, message, NULL);
+		return;
+	}
+	this->buffer.Clear();
+	this->objectOpen = false;
+	this->fixedResponse = &(*fixed);
 }
 
 /**
@@ -35,22 +86,70 @@ void JSONResponseGenerator::generateJSONResponse(JSONResponseGenerator::APIRespo
 */
 void JSONResponseGenerator::generateJSONResponse(JSONResponseGenerator::APIResponse result, string message, map<string, string> *data)
 {
-	this->jsondoc.SetObject();
-	rapidjson::Document::AllocatorType& allocator = this->jsondoc.GetAllocator();
-	this->jsondoc.AddMember("result", result, allocator);
-	Value v(message.c_str(), allocator);
-	this->jsondoc.AddMember("message", v, allocator);
-	
-	if (data->size() > 0)
+	this->writeResponse(result, message, data);
+}
+
+/**
+	Serialise the result, message and any data straight into the output buffer. The object is left open so that
+	addJSONArray can still add to it, it is closed when the response is read back
+	@param result The result of the request
+	@param message The message that is returned
+	@param data The extra key/values to add to the response, can be NULL
+*/
+void JSONResponseGenerator::writeResponse(JSONResponseGenerator::APIResponse result, const string& message, map<string, string> *data)
+{
+	this->buffer.Clear();
+	this->writer.Reset(this->buffer);
+	this->fixedResponse = NULL;
+	this->writer.StartObject();
+	this->writer.Key("result");
+	this->writer.Int(result);
+	this->writer.Key("message");
+	this->writer.String(message.c_str(), static_cast<rapidjson::SizeType>(message.length()));
+	if (data != NULL)
 	{
 		typedef map<string, string>::iterator it_type;
 		for (it_type iterator = data->begin(); iterator != data->end(); iterator++)
 		{
-			Value k(iterator->first.c_str(), allocator);
-			Value v(iterator->second.c_str(), allocator);
-			this->jsondoc.AddMember(k, v, allocator);
+			this->writer.Key(iterator->first.c_str(), static_cast<rapidjson::SizeType>(iterator->first.length()));
+			this->writer.String(iterator->second.c_str(), static_cast<rapidjson::SizeType>(iterator->second.length()));
 		}
 	}
+	this->objectOpen = true;
+}
+
+/**
+	Add an array of JSON objects to the response, e.g. the response for each tunnel in a batch request. Call after generateJSONResponse
+	The objects are already serialised so they are written into the response as is rather than being parsed again
+	@param name The name of the array in the response
+	@param jsonObjects The JSON objects, each one is normally a response created by another JSONResponseGenerator
+*/
+void JSONResponseGenerator::addJSONArray(string name, vector<string> *jsonObjects)
+{
+	if (this->fixedResponse != NULL)
+	{
+		//The fixed responses are already closed, so write the result and message again leaving the object open for the array
+		this->writeResponse(static_cast<APIResponse>(this->fixedResponse->first.first), this->fixedResponse->first.second, NULL);
+	}
+	this->writer.Key(name.c_str(), static_cast<rapidjson::SizeType>(name.length()));
+	this->writer.StartArray();
+	for (vector<string>::iterator it = jsonObjects->begin(); it != jsonObjects->end(); ++it)
+	{
+		this->writer.RawValue(it->c_str(), it->length(), kObjectType);
+	}
+	this->writer.EndArray();
+}
+
+/**
+	Close the response object if it is still open
+*/
+void JSONResponseGenerator::endResponse()
+{
+	if (this->objectOpen)
+	{
+		this->writer.EndObject();
+		this->objectOpen = false;
+	}
 }
 
 /**
@@ -59,9 +158,27 @@ void JSONResponseGenerator::generateJSONResponse(JSONResponseGenerator::APIRespo
 */
 string JSONResponseGenerator::getJSONString()
 {
-	rapidjson::StringBuffer buffer;
-	buffer.Clear();
-	rapidjson::Writer<rapidjson::StringBuffer>writer(buffer);
-	this->jsondoc.Accept(writer);
-	return string(buffer.GetString());
+	if (this->fixedResponse != NULL)
+	{
+		return this->fixedResponse->second;
+	}
+	this->endResponse();
+	return string(this->buffer.GetString(), this->buffer.GetSize());
+}
+
+/**
+	Return the created JSON response without copying it, used when the response is sent straight to the socket
+	@param length Set to the length of the response
+	@returns A pointer to the response, valid until this class is used to generate another response or is destroyed
+*/
+const char *JSONResponseGenerator::getJSONData(size_t *length)
+{
+	if (this->fixedResponse != NULL)
+	{
+		*length = this->fixedResponse->second.length();
+		return this->fixedResponse->second.c_str();
+	}
+	this->endResponse();
+	*length = this->buffer.GetSize();
+	return this->buffer.GetString();
 }
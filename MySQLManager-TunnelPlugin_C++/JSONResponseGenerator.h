@@ -6,6 +6,9 @@
 #include <rapidjson/writer.h>
 #include <rapidjson/stringbuffer.h>
 #include <map>
+#include <vector>
+#include <string>
+#include <utility>
 
 
 class JSONResponseGenerator
@@ -15,10 +18,18 @@ public:
 	enum APIResponse { API_SUCCESS, API_GENERAL_ERROR, API_AUTH_FAILURE, API_NOT_IMPLEMENTED, API_TUNNEL_ERROR };
 	void generateJSONResponse(JSONResponseGenerator::APIResponse result, std::string message);
 	void generateJSONResponse(JSONResponseGenerator::APIResponse result, std::string message, std::map<std::string, std::string> *jsondata);
+	void addJSONArray(std::string name, std::vector<std::string> *jsonObjects);
 	std::string getJSONString();
+	const char *getJSONData(size_t *length);
 private:
-	rapidjson::Document jsondoc;
-	rapidjson::Value jsonvalue;
+	typedef std::map<std::pair<int, std::string>, std::string> FixedResponseMap;
+	static const FixedResponseMap& getFixedResponses();
+	void writeResponse(JSONResponseGenerator::APIResponse result, const std::string& message, std::map<std::string, std::string> *jsondata);
+	void endResponse();
+	rapidjson::StringBuffer buffer;
+	rapidjson::Writer<rapidjson::StringBuffer> writer;
+	bool objectOpen = false;
+	const FixedResponseMap::value_type *fixedResponse = NULL;
 };
 
-#endif
\ No newline at end of file
+#endif
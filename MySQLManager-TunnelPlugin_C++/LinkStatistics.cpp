@@ -0,0 +1,179 @@
+/**
+	Keeps track of how each SSH server's link performs, the round trip time and how fast data comes through it, so that settings that 
+	depend on the link (such as the channel window size) can be sized for it. The measurements are smoothed and kept for as long as the 
+	application is running, so each new tunnel to the same SSH server starts from what the previous tunnels found
+*/
+
+#include "LinkStatistics.h"
+
+using namespace std;
+
+std::mutex LinkStatistics::statisticsMutex;
+std::map<std::string, LinkStatistics::DestinationStatistics> LinkStatistics::destinations;
+unsigned long long LinkStatistics::windowIncreases = 0;
+unsigned long long LinkStatistics::compressedSessions = 0;
+
+/**
+	Measurements are only shared between tunnels to the same SSH host and port
+	@param sshHost The SSH hostname or IP address
+	@param sshPort The SSH port
+*/
+LinkStatistics::LinkStatistics(string sshHost, int sshPort)
+{
+	this->destination = sshHost + ":" + std::to_string(sshPort);
+}
+
+/**
+	Record how long a request to the SSH server took to be answered, e.g. a channel being opened
+	@param milliseconds The round trip time
+*/
+void LinkStatistics::recordRoundTrip(long long milliseconds)
+{
+	lock_guard<mutex> lock(LinkStatistics::statisticsMutex);
+	DestinationStatistics& statistics = LinkStatistics::destinations[this->destination];
+	if (statistics.roundTripMs == 0)
+	{
+		statistics.roundTripMs = (double)milliseconds;
+	}
+	else
+	{
+		statistics.roundTripMs = statistics.roundTripMs * 0.75 + milliseconds * 0.25;
+	}
+}
+
+/**
+	Record a burst of data received from the SSH server on a channel
+	@param bytes The number of bytes received in the burst
+	@param milliseconds How long the burst took
+	@param windowSize The window size of the channel the data was received on
+*/
+void LinkStatistics::recordTransfer(unsigned long long bytes, long long milliseconds, unsigned int windowSize)
+{
+	if (milliseconds <= 0)
+	{
+		return;
+	}
+	lock_guard<mutex> lock(LinkStatistics::statisticsMutex);
+	DestinationStatistics& statistics = LinkStatistics::destinations[this->destination];
+	double bytesPerSecond = (double)bytes * 1000 / milliseconds;
+	if (statistics.bytesPerSecond == 0)
+	{
+		statistics.bytesPerSecond = bytesPerSecond;
+	}
+	else
+	{
+		statistics.bytesPerSecond = statistics.bytesPerSecond * 0.75 + bytesPerSecond * 0.25;
+	}
+	//When a window's worth of data is in flight for every round trip, the window rather than the link was the limit
+	double bytesInFlight = bytesPerSecond * statistics.roundTripMs / 1000;
+	statistics.windowLimited = bytesInFlight >= windowSize * 0.75;
+	statistics.lastWindowSize = windowSize;
+}
+
+/**
+	Work out the window size for a new channel from the bandwidth delay product of the link. If the last channel's window was the limit, 
+	the measured throughput doesn't show what the link can do, so the window is doubled instead
+	@param minimumWindowSize The smallest window to use, also used when nothing has been measured yet
+	@param maximumWindowSize The largest window to use
+	@return unsigned int The window size to open the channel with
+*/
+unsigned int LinkStatistics::suggestChannelWindowSize(unsigned int minimumWindowSize, unsigned int maximumWindowSize)
+{
+	lock_guard<mutex> lock(LinkStatistics::statisticsMutex);
+	map<string, DestinationStatistics>::iterator it = LinkStatistics::destinations.find(this->destination);
+	if (it == LinkStatistics::destinations.end() || it->second.roundTripMs == 0 || it->second.bytesPerSecond == 0)
+	{
+		return minimumWindowSize;
+	}
+	double windowSize = it->second.bytesPerSecond * it->second.roundTripMs / 1000 * 2;
+	if (it->second.windowLimited && (double)it->second.lastWindowSize * 2 > windowSize)
+	{
+		windowSize = (double)it->second.lastWindowSize * 2;
+	}
+	if (windowSize < minimumWindowSize)
+	{
+		windowSize = minimumWindowSize;
+	}
+	if (windowSize > maximumWindowSize)
+	{
+		windowSize = maximumWindowSize;
+	}
+	if ((unsigned int)windowSize > it->second.lastWindowSize && it->second.lastWindowSize != 0)
+	{
+		LinkStatistics::windowIncreases++;
+	}
+	return (unsigned int)windowSize;
+}
+
+/**
+	Record how well the data on a compressed session compressed
+	@param payloadBytes The number of bytes received on the session's channels, after decompression
+	@param wireBytes The number of bytes received on the SSH socket
+*/
+void LinkStatistics::recordCompression(unsigned long long payloadBytes, unsigned long long wireBytes)
+{
+	if (wireBytes == 0)
+	{
+		return;
+	}
+	lock_guard<mutex> lock(LinkStatistics::statisticsMutex);
+	DestinationStatistics& statistics = LinkStatistics::destinations[this->destination];
+	double compressionRatio = (double)payloadBytes / wireBytes;
+	if (statistics.compressionRatio == 0)
+	{
+		statistics.compressionRatio = compressionRatio;
+	}
+	else
+	{
+		statistics.compressionRatio = statistics.compressionRatio * 0.75 + compressionRatio * 0.25;
+	}
+}
+
+/**
+	Decide whether a new session should use compression. Compression only pays off when the link is slower than zlib and the data actually
+	compresses, so it is used until the link has been measured as fast, or the data has been measured as not compressing well. As the ratio 
+	is only measured on compressed sessions, every 20th session to a destination whose data didn't compress well is compressed again to 
+	check that it still doesn't
+	@param maximumBytesPerSecond Links measured faster than this don't use compression
+	@param minimumCompressionRatio Destinations whose data compresses less than this don't use compression
+	@return bool True if compression should be enabled for the session
+*/
+bool LinkStatistics::shouldCompress(double maximumBytesPerSecond, double minimumCompressionRatio)
+{
+	lock_guard<mutex> lock(LinkStatistics::statisticsMutex);
+	DestinationStatistics& statistics = LinkStatistics::destinations[this->destination];
+	bool compress = true;
+	if (statistics.bytesPerSecond > maximumBytesPerSecond)
+	{
+		compress = false;
+	}
+	else if (statistics.compressionRatio != 0 && statistics.compressionRatio < minimumCompressionRatio)
+	{
+		statistics.sessionsSinceCompressionProbe++;
+		if (statistics.sessionsSinceCompressionProbe < 20)
+		{
+			compress = false;
+		}
+		else
+		{
+			statistics.sessionsSinceCompressionProbe = 0;
+		}
+	}
+	if (compress)
+	{
+		LinkStatistics::compressedSessions++;
+	}
+	return compress;
+}
+
+/**
+	Add the link statistics to the statistics returned by the GetStats request
+	@param stats The statistics to add to
+*/
+void LinkStatistics::appendStatistics(map<string, string> *stats)
+{
+	lock_guard<mutex> lock(LinkStatistics::statisticsMutex);
+	(*stats)["linkDestinationsMeasured"] = std::to_string(LinkStatistics::destinations.size());
+	(*stats)["channelWindowIncreases"] = std::to_string(LinkStatistics::windowIncreases);
+	(*stats)["adaptiveCompressedSessions"] = std::to_string(LinkStatistics::compressedSessions);
+}
@@ -0,0 +1,35 @@
+#pragma once
+#ifndef LINKSTATISTICS_H
+#define LINKSTATISTICS_H
+#include <string>
+#include <map>
+#include <mutex>
+
+class LinkStatistics
+{
+public:
+	LinkStatistics(std::string sshHost, int sshPort);
+	void recordRoundTrip(long long milliseconds);
+	void recordTransfer(unsigned long long bytes, long long milliseconds, unsigned int windowSize);
+	unsigned int suggestChannelWindowSize(unsigned int minimumWindowSize, unsigned int maximumWindowSize);
+	void recordCompression(unsigned long long payloadBytes, unsigned long long wireBytes);
+	bool shouldCompress(double maximumBytesPerSecond, double minimumCompressionRatio);
+	static void appendStatistics(std::map<std::string, std::string> *stats);
+private:
+	struct DestinationStatistics
+	{
+		double roundTripMs = 0;
+		double bytesPerSecond = 0;
+		unsigned int lastWindowSize = 0;
+		bool windowLimited = false;
+		double compressionRatio = 0;
+		int sessionsSinceCompressionProbe = 0;
+	};
+	std::string destination;
+	static std::mutex statisticsMutex;
+	static std::map<std::string, DestinationStatistics> destinations;
+	static unsigned long long windowIncreases;
+	static unsigned long long compressedSessions;
+};
+
+#endif //!LINKSTATISTICS_H
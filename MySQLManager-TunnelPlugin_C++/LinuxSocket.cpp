@@ -166,51 +166,102 @@ int *LinuxSocket::acceptClientAndReturnSocket(sockaddr_in *clientAddr)
 */
 int LinuxSocket::sendToSocket(int *socket, std::string dataToSend)
 {
-    dataToSend.append("\r\n");
-    int sentBytes = write(*socket, dataToSend.c_str(), dataToSend.length());
-    if (sentBytes < 0)
+    return this->sendToSocket(socket, dataToSend.c_str(), dataToSend.length());
+}
+
+/**
+	Send data on the specified socket followed by the \r\n terminator. The data and the terminator are
+	handed to the kernel in one writev call so the data doesn't need copying to append the terminator
+	@param socket The socket descriptor where the data should be sent
+	@param data The data that is to be sent on the socket
+	@param length The length of the data
+	@return int The number of bytes that have been sent on the socket
+	@throws SocketException If the sending of the socket fails
+*/
+int LinuxSocket::sendToSocket(int *socket, const char *data, size_t length)
+{
+    static const char terminator[] = "\r\n";
+    struct iovec iov[2];
+    iov[0].iov_base = const_cast<char *>(data);
+    iov[0].iov_len = length;
+    iov[1].iov_base = const_cast<char *>(terminator);
+    iov[1].iov_len = sizeof(terminator) - 1;
+    struct iovec *current = iov;
+    int remainingBuffers = 2;
+    size_t sentBytes = 0;
+    while (remainingBuffers > 0)
     {
-        stringstream logstream;
-        logstream << "Failed to write to socket. Error: " << strerror(sentBytes);
-        this->logger->writeToLog(logstream.str(), "LinuxSocket", "sendToSocket");
-        throw SocketException(strerror(sentBytes));
+        ssize_t written = writev(*socket, current, remainingBuffers);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            int error = errno;
+            stringstream logstream;
+            logstream << "Failed to write to socket. Error: " << strerror(error);
+            this->logger->writeToLog(logstream.str(), "LinuxSocket", "sendToSocket");
+            throw SocketException(strerror(error));
+        }
+        sentBytes += written;
+        //Skip past whatever was written, a partial write can leave us part way through a buffer
+        while (remainingBuffers > 0 && static_cast<size_t>(written) >= current->iov_len)
+        {
+            written -= current->iov_len;
+            current++;
+            remainingBuffers--;
+        }
+        if (remainingBuffers > 0)
+        {
+            current->iov_base = static_cast<char *>(current->iov_base) + written;
+            current->iov_len -= written;
+        }
     }
-    return sentBytes;
+    return static_cast<int>(sentBytes);
 }
 
 /**
-	Wait and receive data on the specified socket
+	Wait and receive a request on the specified socket. The data is received straight into the buffer, the request is complete
+	when a recv returns less than was asked for
 	@param socket The socket that should be receiving data
-	@return string The string content of the data that was received on the socket
-	@throws SocketException If an error occurred while receiving the socket an exception is thrown
+	@param receiveBuffer The buffer the request is received into, any previous contents are cleared
+	@throws SocketException If an error occurred while receiving the socket, or the request is larger than maxControlRequestBytes, an exception is thrown
 */
-string LinuxSocket::receiveDataOnSocket(int *socket)
+void LinuxSocket::receiveDataOnSocket(int *socket, ReceiveBuffer *receiveBuffer)
 {
-    string receiveData = "";
-    char * temp = NULL;
-    int bytesReceived = 0;
-    do
+    receiveBuffer->clear();
+    size_t available = 0;
+    for (;;)
     {
-        bytesReceived = recv(*socket, this->buffer, this->bufferLength, 0);
+        if (receiveBuffer->getLength() >= static_cast<size_t>(StaticSettings::AppSettings::maxControlRequestBytes))
+        {
+            this->logger->writeToLog("Request is larger than maxControlRequestBytes", "LinuxSocket", "receiveDataOnSocket");
+            this->closeSocket(socket);
+            throw SocketException("Request too large");
+        }
+        char *space = receiveBuffer->prepare(this->bufferLength, &available);
+        ssize_t bytesReceived = recv(*socket, space, available, 0);
         if (bytesReceived < 0)
         {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            int error = errno;
             stringstream logstream;
-            logstream << "Failed to read data on socket. Error: " << strerror(bytesReceived);
+            logstream << "Failed to read data on socket. Error: " << strerror(error);
             this->logger->writeToLog(logstream.str(), "LinuxSocket", "receiveDataOnSocket");
             this->closeSocket(socket);
-            throw SocketException(strerror(bytesReceived));
+            throw SocketException(strerror(error));
         }
-        //If we got here then we should be able to get some data
-        temp = new char[bytesReceived + 1];
-        strncpy(temp, this->buffer, bytesReceived);
-        temp[bytesReceived] = '\0';
-        receiveData.append(temp);
-        delete[] temp;
-        temp = NULL;
-        memset(this->buffer, 0, this->bufferLength);
-    } while (bytesReceived == this->bufferLength);
-    
-    return receiveData;
+        receiveBuffer->commit(bytesReceived);
+        //A short read means the request has all arrived, a full buffer means there may be more waiting
+        if (static_cast<size_t>(bytesReceived) < available)
+        {
+            break;
+        }
+    }
 }
 
 /**
@@ -232,10 +283,6 @@ void LinuxSocket::closeSocket()
     {
         delete this->serv_addr;
     }
-    if (this->buffer != NULL)
-    {
-        delete[] this->buffer;
-    }
     this->serverSocket = -1;
 }
 
@@ -3,6 +3,8 @@
 
 #ifndef _WIN32
 #include "BaseSocket.h"
+#include "ReceiveBuffer.h"
+#include "StaticSettings.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,6 +14,8 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <net/if.h>
+#include <sys/uio.h>
+#include <errno.h>
 class LinuxSocket : public BaseSocket
 {
     public:
@@ -22,7 +26,8 @@ class LinuxSocket : public BaseSocket
         int returnSocket();
         int *acceptClientAndReturnSocket(sockaddr_in *clientAddr);
         int sendToSocket(int *socket, std::string dataToSend);
-        std::string receiveDataOnSocket(int * socket);
+        int sendToSocket(int *socket, const char *data, size_t length);
+        void receiveDataOnSocket(int *socket, ReceiveBuffer *receiveBuffer);
         void closeSocket();
         void closeSocket(int *socket);
     private:
@@ -0,0 +1,258 @@
+/**
+	Caches SSH private keys once they have been decoded, so a user reconnecting with the same key and passphrase doesn't pay for the key 
+	being parsed and, for encrypted OpenSSH keys, the deliberately slow bcrypt key derivation every time.
+	The decoded keys are held as unencrypted PKCS#8 in memory that is locked so it is never swapped to disk, and is wiped when the key is 
+	evicted. Keys are evicted when they haven't been used for privateKeyCacheTtlSeconds, and the least recently used key is evicted when 
+	there are more than privateKeyCacheMaxEntries keys. Setting privateKeyCacheMaxEntries to 0 disables the cache.
+	Keys are looked up by a SHA-256 hash of the key and passphrase, so the passphrase has to match as well as the key
+*/
+
+#include "PrivateKeyCache.h"
+#include "SSHTunnelForwarder.h"
+#include <string.h>
+#include <openssl/crypto.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+std::mutex PrivateKeyCache::cacheMutex;
+std::map<std::string, PrivateKeyCache::CachedKey> PrivateKeyCache::cachedKeys;
+unsigned long long PrivateKeyCache::hits = 0;
+unsigned long long PrivateKeyCache::misses = 0;
+unsigned long long PrivateKeyCache::evictions = 0;
+bool PrivateKeyCache::memoryLockFailureLogged = false;
+
+PrivateKeyCache::PrivateKeyCache(Logger *logger)
+{
+	this->logger = logger;
+}
+
+/**
+	Get the cached key, decoding and caching the key if it isn't already cached
+	@param privateKey The private key from the tunnel request
+	@param passphrase The private key's passphrase, empty if there isn't one
+	@param cacheKey Set to the key to pass to signWithCachedKey
+	@param publicKeyBlob Set to the public key to send to the SSH server
+	@return LookupResult KEY_AVAILABLE if the key is cached, KEY_WRONG_PASSPHRASE if the key couldn't be decrypted with the passphrase, 
+	otherwise KEY_NOT_CACHEABLE and the key should be given to libssh2 as it is (e.g. an unsupported key type, or the cache is disabled)
+*/
+PrivateKeyCache::LookupResult PrivateKeyCache::getKey(const string& privateKey, const string& passphrase, string *cacheKey, string *publicKeyBlob)
+{
+	if (StaticSettings::AppSettings::privateKeyCacheMaxEntries <= 0)
+	{
+		return LookupResult::KEY_NOT_CACHEABLE;
+	}
+	HelperMethods helperMethods;
+	*cacheKey = helperMethods.sha256Hash(privateKey + '\0' + passphrase);
+	{
+		lock_guard<mutex> lock(PrivateKeyCache::cacheMutex);
+		PrivateKeyCache::evictKeys(StaticSettings::AppSettings::privateKeyCacheMaxEntries);
+		map<string, CachedKey>::iterator it = PrivateKeyCache::cachedKeys.find(*cacheKey);
+		if (it != PrivateKeyCache::cachedKeys.end())
+		{
+			PrivateKeyCache::hits++;
+			it->second.lastUsedTime = std::time(nullptr);
+			*publicKeyBlob = it->second.publicKeyBlob;
+			return LookupResult::KEY_AVAILABLE;
+		}
+		PrivateKeyCache::misses++;
+	}
+
+	//Decoding can take a while for encrypted keys, so other tunnels aren't held up waiting for the lock
+	SSHPrivateKey decodedKey;
+	SSHPrivateKey::DecodeResult result = decodedKey.decode(privateKey, passphrase);
+	if (result == SSHPrivateKey::DecodeResult::WRONG_PASSPHRASE)
+	{
+		return LookupResult::KEY_WRONG_PASSPHRASE;
+	}
+	if (result != SSHPrivateKey::DecodeResult::DECODED)
+	{
+		return LookupResult::KEY_NOT_CACHEABLE;
+	}
+	CachedKey cachedKey;
+	if (!this->storeKey(&decodedKey, &cachedKey))
+	{
+		return LookupResult::KEY_NOT_CACHEABLE;
+	}
+
+	lock_guard<mutex> lock(PrivateKeyCache::cacheMutex);
+	map<string, CachedKey>::iterator it = PrivateKeyCache::cachedKeys.find(*cacheKey);
+	if (it != PrivateKeyCache::cachedKeys.end())
+	{
+		//Another tunnel cached the same key while this one was decoding it
+		PrivateKeyCache::wipeKey(&cachedKey);
+		it->second.lastUsedTime = std::time(nullptr);
+		*publicKeyBlob = it->second.publicKeyBlob;
+		return LookupResult::KEY_AVAILABLE;
+	}
+	*publicKeyBlob = cachedKey.publicKeyBlob;
+	PrivateKeyCache::cachedKeys[*cacheKey] = cachedKey;
+	PrivateKeyCache::evictKeys(StaticSettings::AppSettings::privateKeyCacheMaxEntries);
+	return LookupResult::KEY_AVAILABLE;
+}
+
+/**
+	Copy the decoded key into locked memory
+	@param key The decoded key
+	@param cachedKey The cache entry to store it in
+	@return bool False if the key couldn't be encoded or the memory couldn't be allocated
+*/
+bool PrivateKeyCache::storeKey(SSHPrivateKey *key, CachedKey *cachedKey)
+{
+	cachedKey->publicKeyBlob = key->getPublicKeyBlob();
+	cachedKey->pkcs8Length = key->getPKCS8Length();
+	if (cachedKey->publicKeyBlob.empty() || cachedKey->pkcs8Length == 0)
+	{
+		return false;
+	}
+	bool memoryLocked;
+#ifdef _WIN32
+	cachedKey->allocatedLength = cachedKey->pkcs8Length;
+	cachedKey->pkcs8 = (unsigned char*)VirtualAlloc(NULL, cachedKey->allocatedLength, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (cachedKey->pkcs8 == NULL)
+	{
+		return false;
+	}
+	memoryLocked = VirtualLock(cachedKey->pkcs8, cachedKey->allocatedLength) != 0;
+#else
+	//Each key has its own pages, so unlocking one key's memory never unlocks another's
+	size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	cachedKey->allocatedLength = (cachedKey->pkcs8Length + pageSize - 1) / pageSize * pageSize;
+	void *memory = mmap(NULL, cachedKey->allocatedLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+	{
+		return false;
+	}
+	cachedKey->pkcs8 = (unsigned char*)memory;
+	memoryLocked = mlock(memory, cachedKey->allocatedLength) == 0;
+#ifdef MADV_DONTDUMP
+	madvise(memory, cachedKey->allocatedLength, MADV_DONTDUMP);
+#endif
+#endif
+	if (!memoryLocked && !PrivateKeyCache::memoryLockFailureLogged)
+	{
+		PrivateKeyCache::memoryLockFailureLogged = true;
+		this->logger->writeToLog("Unable to lock the memory for cached private keys, they could be swapped to disk. Check the locked memory limit (ulimit -l)", 
+			"PrivateKeyCache", "storeKey");
+	}
+	if (!key->writePKCS8(cachedKey->pkcs8))
+	{
+		PrivateKeyCache::wipeKey(cachedKey);
+		return false;
+	}
+	return true;
+}
+
+/**
+	Wipe and free the key's memory
+	@param cachedKey The cache entry
+*/
+void PrivateKeyCache::wipeKey(CachedKey *cachedKey)
+{
+	if (cachedKey->pkcs8 == NULL)
+	{
+		return;
+	}
+	OPENSSL_cleanse(cachedKey->pkcs8, cachedKey->allocatedLength);
+#ifdef _WIN32
+	VirtualUnlock(cachedKey->pkcs8, cachedKey->allocatedLength);
+	VirtualFree(cachedKey->pkcs8, 0, MEM_RELEASE);
+#else
+	munlock(cachedKey->pkcs8, cachedKey->allocatedLength);
+	munmap(cachedKey->pkcs8, cachedKey->allocatedLength);
+#endif
+	cachedKey->pkcs8 = NULL;
+	cachedKey->pkcs8Length = 0;
+	cachedKey->allocatedLength = 0;
+}
+
+/**
+	Evict the keys that haven't been used within privateKeyCacheTtlSeconds, then the least recently used keys until there are no more 
+	than maxEntries. The cache mutex must be locked
+	@param maxEntries The maximum number of keys to keep
+*/
+void PrivateKeyCache::evictKeys(size_t maxEntries)
+{
+	time_t currentTime = std::time(nullptr);
+	for (map<string, CachedKey>::iterator it = PrivateKeyCache::cachedKeys.begin(); it != PrivateKeyCache::cachedKeys.end();)
+	{
+		if (StaticSettings::AppSettings::privateKeyCacheTtlSeconds > 0 && currentTime - it->second.lastUsedTime >= StaticSettings::AppSettings::privateKeyCacheTtlSeconds)
+		{
+			PrivateKeyCache::wipeKey(&it->second);
+			it = PrivateKeyCache::cachedKeys.erase(it);
+			PrivateKeyCache::evictions++;
+		}
+		else
+		{
+			++it;
+		}
+	}
+	while (PrivateKeyCache::cachedKeys.size() > maxEntries)
+	{
+		map<string, CachedKey>::iterator leastRecentlyUsed = PrivateKeyCache::cachedKeys.begin();
+		for (map<string, CachedKey>::iterator it = PrivateKeyCache::cachedKeys.begin(); it != PrivateKeyCache::cachedKeys.end(); ++it)
+		{
+			if (it->second.lastUsedTime < leastRecentlyUsed->second.lastUsedTime)
+			{
+				leastRecentlyUsed = it;
+			}
+		}
+		PrivateKeyCache::wipeKey(&leastRecentlyUsed->second);
+		PrivateKeyCache::cachedKeys.erase(leastRecentlyUsed);
+		PrivateKeyCache::evictions++;
+	}
+}
+
+/**
+	The libssh2 public key authentication sign callback. Signs the authentication request with the cached key
+	@param abstract Points to the cache key (std::string*) returned from getKey
+	@return int 0 on success, -1 if the key is no longer cached or signing failed
+*/
+int PrivateKeyCache::signWithCachedKey(LIBSSH2_SESSION *session, unsigned char **sig, size_t *sig_len, const unsigned char *data, size_t data_len, void **abstract)
+{
+	string *cacheKey = (string*)*abstract;
+	SSHPrivateKey signingKey;
+	{
+		lock_guard<mutex> lock(PrivateKeyCache::cacheMutex);
+		map<string, CachedKey>::iterator it = PrivateKeyCache::cachedKeys.find(*cacheKey);
+		if (it == PrivateKeyCache::cachedKeys.end() || !signingKey.loadPKCS8(it->second.pkcs8, it->second.pkcs8Length))
+		{
+			return -1;
+		}
+	}
+	string algorithm;
+	vector<unsigned char> signature;
+	if (!SSHPrivateKey::getSignatureAlgorithm(data, data_len, &algorithm) || !signingKey.sign(data, data_len, algorithm, &signature))
+	{
+		return -1;
+	}
+	//libssh2 frees the signature with the session's allocator
+	*sig = (unsigned char*)SSHTunnelForwarder::allocateForSession(signature.size(), libssh2_session_abstract(session));
+	if (*sig == NULL)
+	{
+		return -1;
+	}
+	memcpy(*sig, signature.data(), signature.size());
+	*sig_len = signature.size();
+	return 0;
+}
+
+/**
+	Add the private key cache statistics to the statistics returned by the GetStats request
+	@param stats The statistics to add to
+*/
+void PrivateKeyCache::appendStatistics(map<string, string> *stats)
+{
+	lock_guard<mutex> lock(PrivateKeyCache::cacheMutex);
+	unsigned long long lookups = PrivateKeyCache::hits + PrivateKeyCache::misses;
+	(*stats)["privateKeyCacheEntries"] = std::to_string(PrivateKeyCache::cachedKeys.size());
+	(*stats)["privateKeyCacheHits"] = std::to_string(PrivateKeyCache::hits);
+	(*stats)["privateKeyCacheMisses"] = std::to_string(PrivateKeyCache::misses);
+	(*stats)["privateKeyCacheEvictions"] = std::to_string(PrivateKeyCache::evictions);
+	(*stats)["privateKeyCacheHitRatePercent"] = std::to_string(lookups == 0 ? 0 : PrivateKeyCache::hits * 100 / lookups);
+}
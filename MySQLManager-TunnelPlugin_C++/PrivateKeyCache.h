@@ -0,0 +1,43 @@
+#pragma once
+#ifndef PRIVATEKEYCACHE_H
+#define PRIVATEKEYCACHE_H
+#include <libssh2.h>
+#include <string>
+#include <map>
+#include <mutex>
+#include <ctime>
+#include "SSHPrivateKey.h"
+#include "StaticSettings.h"
+#include "HelperMethods.h"
+#include "Logger.h"
+
+class PrivateKeyCache
+{
+public:
+	enum LookupResult { KEY_AVAILABLE, KEY_NOT_CACHEABLE, KEY_WRONG_PASSPHRASE };
+	PrivateKeyCache(Logger *logger);
+	LookupResult getKey(const std::string& privateKey, const std::string& passphrase, std::string *cacheKey, std::string *publicKeyBlob);
+	static LIBSSH2_USERAUTH_PUBLICKEY_SIGN_FUNC(signWithCachedKey);
+	static void appendStatistics(std::map<std::string, std::string> *stats);
+private:
+	struct CachedKey
+	{
+		unsigned char *pkcs8 = NULL;
+		size_t pkcs8Length = 0;
+		size_t allocatedLength = 0;
+		std::string publicKeyBlob;
+		time_t lastUsedTime = 0;
+	};
+	Logger *logger = NULL;
+	bool storeKey(SSHPrivateKey *key, CachedKey *cachedKey);
+	static void wipeKey(CachedKey *cachedKey);
+	static void evictKeys(size_t maxEntries);
+	static std::mutex cacheMutex;
+	static std::map<std::string, CachedKey> cachedKeys;
+	static unsigned long long hits;
+	static unsigned long long misses;
+	static unsigned long long evictions;
+	static bool memoryLockFailureLogged;
+};
+
+#endif //!PRIVATEKEYCACHE_H
@@ -0,0 +1,163 @@
+/**
+	A growable buffer that a control connection's request is received into. recv() writes straight into the buffer's spare 
+	capacity, so receiving a request doesn't allocate or copy anything once the buffer is big enough. The buffer is always 
+	null terminated so the parser can read the request in place.
+	Buffers are handed out from a pool and returned when the connection has been processed, buffers that grew past 
+	maxRetainedCapacity for a large request are shrunk back when they are returned so the pool doesn't hold on to the memory
+*/
+
+#include "ReceiveBuffer.h"
+#include <stdlib.h>
+#include <new>
+
+using namespace std;
+
+std::mutex ReceiveBuffer::poolMutex;
+std::vector<ReceiveBuffer*> ReceiveBuffer::pooledBuffers;
+unsigned long long ReceiveBuffer::buffersInUse = 0;
+unsigned long long ReceiveBuffer::buffersCreated = 0;
+unsigned long long ReceiveBuffer::buffersReused = 0;
+
+ReceiveBuffer::ReceiveBuffer()
+{
+	this->grow(ReceiveBuffer::initialCapacity);
+}
+
+ReceiveBuffer::~ReceiveBuffer()
+{
+	free(this->data);
+}
+
+/**
+	Take a buffer from the pool, creating one if the pool is empty. The buffer must be given back with release
+	@return ReceiveBuffer An empty buffer
+*/
+ReceiveBuffer *ReceiveBuffer::acquire()
+{
+	{
+		lock_guard<mutex> lock(ReceiveBuffer::poolMutex);
+		ReceiveBuffer::buffersInUse++;
+		if (!ReceiveBuffer::pooledBuffers.empty())
+		{
+			ReceiveBuffer *receiveBuffer = ReceiveBuffer::pooledBuffers.back();
+			ReceiveBuffer::pooledBuffers.pop_back();
+			ReceiveBuffer::buffersReused++;
+			return receiveBuffer;
+		}
+		ReceiveBuffer::buffersCreated++;
+	}
+	return new ReceiveBuffer();
+}
+
+/**
+	Give a buffer back to the pool
+	@param receiveBuffer The buffer returned by acquire
+*/
+void ReceiveBuffer::release(ReceiveBuffer *receiveBuffer)
+{
+	receiveBuffer->clear();
+	if (receiveBuffer->capacity > ReceiveBuffer::maxRetainedCapacity)
+	{
+		char *shrunk = static_cast<char*>(realloc(receiveBuffer->data, ReceiveBuffer::initialCapacity + 1));
+		if (shrunk != NULL)
+		{
+			receiveBuffer->data = shrunk;
+			receiveBuffer->capacity = ReceiveBuffer::initialCapacity;
+		}
+	}
+	{
+		lock_guard<mutex> lock(ReceiveBuffer::poolMutex);
+		ReceiveBuffer::buffersInUse--;
+		if (ReceiveBuffer::pooledBuffers.size() < ReceiveBuffer::maxPooledBuffers)
+		{
+			ReceiveBuffer::pooledBuffers.push_back(receiveBuffer);
+			return;
+		}
+	}
+	delete receiveBuffer;
+}
+
+/**
+	Get the spare space at the end of the buffer to receive into, growing the buffer if there isn't at least minimumSpace free.
+	Call commit with the number of bytes that were written into the space
+	@param minimumSpace The least amount of space that is needed
+	@param available Set to the amount of space that can be written to, which may be more than minimumSpace
+	@return char A pointer to the spare space
+*/
+char *ReceiveBuffer::prepare(size_t minimumSpace, size_t *available)
+{
+	if (this->capacity - this->length < minimumSpace)
+	{
+		this->grow(this->length + minimumSpace);
+	}
+	*available = this->capacity - this->length;
+	return this->data + this->length;
+}
+
+/**
+	Add the bytes written to the space returned by prepare to the buffer's contents
+	@param length The number of bytes that were written
+*/
+void ReceiveBuffer::commit(size_t length)
+{
+	this->length += length;
+	this->data[this->length] = '\0';
+}
+
+/**
+	@return char The buffer's contents, which are null terminated
+*/
+const char *ReceiveBuffer::getData() const
+{
+	return this->data;
+}
+
+size_t ReceiveBuffer::getLength() const
+{
+	return this->length;
+}
+
+/**
+	Empty the buffer, the memory is kept for the next request
+*/
+void ReceiveBuffer::clear()
+{
+	this->length = 0;
+	this->data[0] = '\0';
+}
+
+/**
+	Grow the buffer so it can hold at least minimumCapacity bytes, the capacity is doubled each time to keep the number of reallocations down.
+	One extra byte is always allocated for the null terminator
+	@param minimumCapacity The capacity that is needed
+	@throws bad_alloc If the memory couldn't be allocated
+*/
+void ReceiveBuffer::grow(size_t minimumCapacity)
+{
+	size_t newCapacity = this->capacity == 0 ? ReceiveBuffer::initialCapacity : this->capacity;
+	while (newCapacity < minimumCapacity)
+	{
+		newCapacity *= 2;
+	}
+	char *newData = static_cast<char*>(realloc(this->data, newCapacity + 1));
+	if (newData == NULL)
+	{
+		throw std::bad_alloc();
+	}
+	this->data = newData;
+	this->capacity = newCapacity;
+	this->data[this->length] = '\0';
+}
+
+/**
+	Add the receive buffer pool statistics to the statistics returned by the GetStats request
+	@param stats The statistics to add to
+*/
+void ReceiveBuffer::appendStatistics(map<string, string> *stats)
+{
+	lock_guard<mutex> lock(ReceiveBuffer::poolMutex);
+	(*stats)["receiveBuffersInUse"] = std::to_string(ReceiveBuffer::buffersInUse);
+	(*stats)["receiveBuffersPooled"] = std::to_string(ReceiveBuffer::pooledBuffers.size());
+	(*stats)["receiveBuffersCreated"] = std::to_string(ReceiveBuffer::buffersCreated);
+	(*stats)["receiveBuffersReused"] = std::to_string(ReceiveBuffer::buffersReused);
+}
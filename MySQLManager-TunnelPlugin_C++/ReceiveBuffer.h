@@ -0,0 +1,37 @@
+#pragma once
+#ifndef RECEIVEBUFFER_H
+#define RECEIVEBUFFER_H
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+
+class ReceiveBuffer
+{
+public:
+	static ReceiveBuffer *acquire();
+	static void release(ReceiveBuffer *receiveBuffer);
+	static void appendStatistics(std::map<std::string, std::string> *stats);
+	char *prepare(size_t minimumSpace, size_t *available);
+	void commit(size_t length);
+	const char *getData() const;
+	size_t getLength() const;
+	void clear();
+private:
+	ReceiveBuffer();
+	~ReceiveBuffer();
+	void grow(size_t minimumCapacity);
+	char *data = NULL;
+	size_t length = 0;
+	size_t capacity = 0;
+	static const size_t initialCapacity = 4096;
+	static const size_t maxRetainedCapacity = 65536;
+	static const size_t maxPooledBuffers = 32;
+	static std::mutex poolMutex;
+	static std::vector<ReceiveBuffer*> pooledBuffers;
+	static unsigned long long buffersInUse;
+	static unsigned long long buffersCreated;
+	static unsigned long long buffersReused;
+};
+
+#endif //!RECEIVEBUFFER_H
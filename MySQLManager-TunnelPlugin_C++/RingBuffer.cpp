@@ -0,0 +1,176 @@
+/**
+	A fixed size circular byte buffer used to hold data being forwarded in one direction of a tunnelled connection. 
+	Data is written straight into, and read straight out of, the buffer's memory so no copies are made on the way through. As the
+	buffer can wrap around, the read and write pointers only ever cover the contiguous part, so anything reading or writing the whole buffer 
+	needs to loop until the length it gets back is 0.
+	The buffer doesn't own its memory, it is attached while there is data to hold and detached again once the buffer is empty (see BufferPool)
+*/
+
+#include "RingBuffer.h"
+
+using namespace std;
+
+/**
+	Create the buffer without any memory, attach has to be called before anything is written
+*/
+RingBuffer::RingBuffer()
+{
+}
+
+/**
+	Give the buffer memory to hold data in
+	@param memory The memory to use, it stays owned by the caller
+	@param capacity The size of the memory, i.e. the maximum number of bytes the buffer can hold
+*/
+void RingBuffer::attach(char *memory, size_t capacity)
+{
+	this->memory = memory;
+	this->bufferCapacity = capacity;
+	this->clear();
+}
+
+/**
+	Take the memory back from the buffer, any data still in the buffer is lost so this should only be done once the buffer is empty
+	@return char* The memory passed to attach, NULL if the buffer didn't have any memory
+*/
+char *RingBuffer::detach()
+{
+	char *memory = this->memory;
+	this->memory = NULL;
+	this->bufferCapacity = 0;
+	this->clear();
+	return memory;
+}
+
+bool RingBuffer::hasMemory()
+{
+	return this->memory != NULL;
+}
+
+/**
+	@return size_t The number of bytes waiting to be read from the buffer
+*/
+size_t RingBuffer::size()
+{
+	return this->used;
+}
+
+size_t RingBuffer::capacity()
+{
+	return this->bufferCapacity;
+}
+
+/**
+	@return size_t The number of bytes that can be written before the buffer is full
+*/
+size_t RingBuffer::freeSpace()
+{
+	return this->bufferCapacity - this->used;
+}
+
+bool RingBuffer::empty()
+{
+	return this->used == 0;
+}
+
+/**
+	Get where the next data should be written to, e.g. so recv() can write directly into the buffer. Call commitWrite with the number of 
+	bytes that were actually written
+	@param length Set to the number of contiguous bytes that can be written from the returned pointer, 0 if the buffer is full or has no memory
+	@return char* Where the next byte should be written
+*/
+char *RingBuffer::getWritePointer(size_t *length)
+{
+	if (this->memory == NULL)
+	{
+		*length = 0;
+		return NULL;
+	}
+	size_t writePosition = (this->readPosition + this->used) % this->bufferCapacity;
+	if (this->used == this->bufferCapacity)
+	{
+		*length = 0;
+	}
+	else if (writePosition >= this->readPosition)
+	{
+		*length = this->bufferCapacity - writePosition;
+	}
+	else
+	{
+		*length = this->readPosition - writePosition;
+	}
+	return this->memory + writePosition;
+}
+
+/**
+	Mark bytes written to the pointer returned by getWritePointer as being in the buffer
+	@param length The number of bytes that were written
+*/
+void RingBuffer::commitWrite(size_t length)
+{
+	this->used += length;
+}
+
+/**
+	Get the oldest data in the buffer, e.g. so send() can send directly from the buffer. Call consume with the number of bytes that were used
+	@param length Set to the number of contiguous bytes that can be read from the returned pointer, 0 if the buffer is empty
+	@return const char* The oldest byte in the buffer
+*/
+const char *RingBuffer::getReadPointer(size_t *length)
+{
+	size_t endPosition = this->readPosition + this->used;
+	*length = endPosition > this->bufferCapacity ? this->bufferCapacity - this->readPosition : this->used;
+	return this->memory + this->readPosition;
+}
+
+/**
+	Get the data that follows the part returned by getReadPointer, i.e. the part that has wrapped around to the start of the buffer. Together
+	they cover everything in the buffer, so both parts can be sent with a single writev()/sendmsg()
+	@param length Set to the number of bytes at the start of the buffer, 0 if the data doesn't wrap around
+	@return const char* The start of the buffer
+*/
+const char *RingBuffer::getWrappedReadPointer(size_t *length)
+{
+	size_t endPosition = this->readPosition + this->used;
+	*length = endPosition > this->bufferCapacity ? endPosition - this->bufferCapacity : 0;
+	return this->memory;
+}
+
+/**
+	Remove bytes that have been read from the pointer returned by getReadPointer
+	@param length The number of bytes that were read
+*/
+void RingBuffer::consume(size_t length)
+{
+	this->used -= length;
+	if (this->used == 0 && !this->writePositionHeld)
+	{
+		//Start from the beginning again so the next read and write are as large as possible
+		this->readPosition = 0;
+	}
+	else
+	{
+		this->readPosition = (this->readPosition + length) % this->bufferCapacity;
+	}
+}
+
+void RingBuffer::clear()
+{
+	this->readPosition = 0;
+	this->used = 0;
+}
+
+/**
+	Keep the write position where it is while something outside of this thread (e.g. an io_uring receive) is writing to the pointer 
+	returned by getWritePointer. Otherwise emptying the buffer would move the write position back to the start of the buffer
+	@param hold True while the write is in progress, false once it has been committed
+*/
+void RingBuffer::holdWritePosition(bool hold)
+{
+	this->writePositionHeld = hold;
+}
+
+bool RingBuffer::isWritePositionHeld()
+{
+	return this->writePositionHeld;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+#include <stddef.h>
+
+class RingBuffer
+{
+public:
+	RingBuffer();
+	void attach(char *memory, size_t capacity);
+	char *detach();
+	bool hasMemory();
+	size_t size();
+	size_t capacity();
+	size_t freeSpace();
+	bool empty();
+	char *getWritePointer(size_t *length);
+	void commitWrite(size_t length);
+	const char *getReadPointer(size_t *length);
+	const char *getWrappedReadPointer(size_t *length);
+	void consume(size_t length);
+	void clear();
+	void holdWritePosition(bool hold);
+	bool isWritePositionHeld();
+private:
+	char *memory = NULL;
+	size_t bufferCapacity = 0;
+	size_t readPosition = 0;
+	size_t used = 0;
+	bool writePositionHeld = false;
+};
+
+#endif //!RINGBUFFER_H
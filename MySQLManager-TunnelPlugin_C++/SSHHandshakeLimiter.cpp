@@ -0,0 +1,154 @@
+/**
+	Limits how many SSH handshakes can be in progress at the same time against a single SSH server. 
+	OpenSSH servers randomly drop unauthenticated connections once too many are in flight (MaxStartups, 10 by default), so rather
+	than firing every tunnel request at the SSH server at once, any requests over the limit wait in a first come first served queue
+	until one of the in progress handshakes has finished authenticating.
+*/
+
+#include "SSHHandshakeLimiter.h"
+
+using namespace std;
+
+std::mutex SSHHandshakeLimiter::limiterMutex;
+std::condition_variable SSHHandshakeLimiter::slotReleased;
+std::map<std::string, SSHHandshakeLimiter::DestinationState> SSHHandshakeLimiter::destinations;
+unsigned long long SSHHandshakeLimiter::nextTicket = 0;
+unsigned long long SSHHandshakeLimiter::totalQueued = 0;
+unsigned long long SSHHandshakeLimiter::totalQueueTimeouts = 0;
+unsigned long long SSHHandshakeLimiter::totalQueueWaitMs = 0;
+unsigned long long SSHHandshakeLimiter::maxQueueWaitMs = 0;
+
+/**
+	Create a limiter for a single tunnel request. The slot is shared with every other tunnel request going to the same SSH host and port
+	@param logger Allow any debug or events to be logged
+	@param sshHost The hostname or IP address of the SSH server that is about to be connected to
+	@param sshPort The port of the SSH server that is about to be connected to
+*/
+SSHHandshakeLimiter::SSHHandshakeLimiter(Logger *logger, string sshHost, int sshPort)
+{
+	this->logger = logger;
+	stringstream destinationStream;
+	destinationStream << sshHost << ":" << sshPort;
+	this->destination = destinationStream.str();
+}
+
+/**
+	Wait for a free handshake slot for the SSH server. If the maximum number of handshakes are already in progress, this request is 
+	added to the back of the queue and blocks until it reaches the front and a slot is free, or until handshakeQueueTimeoutInSeconds has passed
+	@return bool True if a slot was acquired, false if the request timed out waiting in the queue
+*/
+bool SSHHandshakeLimiter::acquireSlot()
+{
+	if (this->slotAcquired)
+	{
+		return true;
+	}
+	int limit = StaticSettings::AppSettings::maxConcurrentHandshakesPerHost;
+	unique_lock<mutex> lock(SSHHandshakeLimiter::limiterMutex);
+	DestinationState& state = SSHHandshakeLimiter::destinations[this->destination];
+
+	//No limit configured, or a slot is free with nobody ahead of us
+	if (limit <= 0 || (state.inProgress < limit && state.waitQueue.empty()))
+	{
+		state.inProgress++;
+		this->slotAcquired = true;
+		return true;
+	}
+
+	unsigned long long ticket = SSHHandshakeLimiter::nextTicket++;
+	state.waitQueue.push_back(ticket);
+	SSHHandshakeLimiter::totalQueued++;
+	size_t queuePosition = state.waitQueue.size();
+	chrono::steady_clock::time_point queuedTime = chrono::steady_clock::now();
+	chrono::steady_clock::time_point deadline = queuedTime + chrono::seconds(StaticSettings::AppSettings::handshakeQueueTimeoutInSeconds);
+
+	bool acquired = SSHHandshakeLimiter::slotReleased.wait_until(lock, deadline, [&state, ticket, limit]() {
+		return state.inProgress < limit && state.waitQueue.front() == ticket;
+	});
+
+	unsigned long long waitMs = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - queuedTime).count();
+	SSHHandshakeLimiter::totalQueueWaitMs += waitMs;
+	if (waitMs > SSHHandshakeLimiter::maxQueueWaitMs)
+	{
+		SSHHandshakeLimiter::maxQueueWaitMs = waitMs;
+	}
+
+	for (deque<unsigned long long>::iterator it = state.waitQueue.begin(); it != state.waitQueue.end(); ++it)
+	{
+		if (*it == ticket)
+		{
+			state.waitQueue.erase(it);
+			break;
+		}
+	}
+
+	stringstream logstream;
+	if (acquired)
+	{
+		state.inProgress++;
+		this->slotAcquired = true;
+		logstream << "Waited " << waitMs << "ms in position " << queuePosition << " for a handshake slot on SSH Host " << this->destination;
+	}
+	else
+	{
+		SSHHandshakeLimiter::totalQueueTimeouts++;
+		logstream << "Timed out after " << waitMs << "ms waiting for a handshake slot on SSH Host " << this->destination;
+		logstream << ". " << state.inProgress << " handshakes in progress and " << state.waitQueue.size() << " still queued";
+	}
+	//Whoever is now at the front of the queue may be able to go, whether we took the slot or gave up our place
+	SSHHandshakeLimiter::slotReleased.notify_all();
+	lock.unlock();
+	this->logger->writeToLog(logstream.str(), "SSHHandshakeLimiter", "acquireSlot");
+	return acquired;
+}
+
+/**
+	Give the handshake slot back so that the next queued request for the same SSH server can start its handshake. This should be called
+	as soon as the SSH session has authenticated (or failed), not when the tunnel is closed
+*/
+void SSHHandshakeLimiter::releaseSlot()
+{
+	if (!this->slotAcquired)
+	{
+		return;
+	}
+	lock_guard<mutex> lock(SSHHandshakeLimiter::limiterMutex);
+	map<string, DestinationState>::iterator it = SSHHandshakeLimiter::destinations.find(this->destination);
+	if (it != SSHHandshakeLimiter::destinations.end())
+	{
+		it->second.inProgress--;
+		if (it->second.inProgress <= 0 && it->second.waitQueue.empty())
+		{
+			SSHHandshakeLimiter::destinations.erase(it);
+		}
+	}
+	this->slotAcquired = false;
+	SSHHandshakeLimiter::slotReleased.notify_all();
+}
+
+/**
+	Add the handshake queue counters to the statistics that are returned to the PHP API
+	@param stats The map that the statistics are added to
+*/
+void SSHHandshakeLimiter::appendStatistics(map<string, string> *stats)
+{
+	lock_guard<mutex> lock(SSHHandshakeLimiter::limiterMutex);
+	unsigned long long inProgress = 0;
+	unsigned long long queued = 0;
+	for (map<string, DestinationState>::iterator it = SSHHandshakeLimiter::destinations.begin(); it != SSHHandshakeLimiter::destinations.end(); ++it)
+	{
+		inProgress += it->second.inProgress;
+		queued += it->second.waitQueue.size();
+	}
+	(*stats)["handshakesInProgress"] = std::to_string(inProgress);
+	(*stats)["handshakesQueued"] = std::to_string(queued);
+	(*stats)["handshakeQueueWaits"] = std::to_string(SSHHandshakeLimiter::totalQueued);
+	(*stats)["handshakeQueueTimeouts"] = std::to_string(SSHHandshakeLimiter::totalQueueTimeouts);
+	(*stats)["handshakeQueueWaitTotalMs"] = std::to_string(SSHHandshakeLimiter::totalQueueWaitMs);
+	(*stats)["handshakeQueueWaitMaxMs"] = std::to_string(SSHHandshakeLimiter::maxQueueWaitMs);
+}
+
+SSHHandshakeLimiter::~SSHHandshakeLimiter()
+{
+	this->releaseSlot();
+}
@@ -0,0 +1,40 @@
+#pragma once
+#ifndef SSHHANDSHAKELIMITER_H
+#define SSHHANDSHAKELIMITER_H
+#include <string>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "StaticSettings.h"
+#include "Logger.h"
+
+class SSHHandshakeLimiter
+{
+public:
+	SSHHandshakeLimiter(Logger *logger, std::string sshHost, int sshPort);
+	~SSHHandshakeLimiter();
+	bool acquireSlot();
+	void releaseSlot();
+	static void appendStatistics(std::map<std::string, std::string> *stats);
+private:
+	struct DestinationState
+	{
+		int inProgress = 0;
+		std::deque<unsigned long long> waitQueue;
+	};
+	Logger *logger = NULL;
+	std::string destination;
+	bool slotAcquired = false;
+	static std::mutex limiterMutex;
+	static std::condition_variable slotReleased;
+	static std::map<std::string, DestinationState> destinations;
+	static unsigned long long nextTicket;
+	static unsigned long long totalQueued;
+	static unsigned long long totalQueueTimeouts;
+	static unsigned long long totalQueueWaitMs;
+	static unsigned long long maxQueueWaitMs;
+};
+
+#endif //!SSHHANDSHAKELIMITER_H
@@ -0,0 +1,218 @@
+/**
+	Remembers SSH servers that recently couldn't be resolved or connected to, and credentials that recently failed password authentication,
+	so that further tunnel requests fail straight away instead of waiting for the same DNS or connect timeout, or re-running an authentication
+	that is going to fail again. 
+	After a failure the breaker stays open for a backoff period (doubling on each consecutive failure up to circuitBreakerMaxBackoffInSeconds). Once the 
+	backoff has passed a single request is let through as a probe, if the probe succeeds the breaker is closed, otherwise it opens again for longer.
+	Each backoff is jittered so that probes for a host that many users are trying to reach don't all arrive at the same time.
+*/
+
+#include "SSHHostCircuitBreaker.h"
+
+using namespace std;
+
+std::mutex SSHHostCircuitBreaker::breakerMutex;
+std::map<std::string, SSHHostCircuitBreaker::BreakerState> SSHHostCircuitBreaker::breakers;
+std::mt19937 SSHHostCircuitBreaker::jitterGenerator(std::random_device{}());
+unsigned long long SSHHostCircuitBreaker::totalFastFailures = 0;
+unsigned long long SSHHostCircuitBreaker::totalProbes = 0;
+
+/**
+	Create a circuit breaker for a single tunnel request
+	@param logger Allow any debug or events to be logged
+	@param sshHost The hostname or IP address of the SSH server
+	@param sshPort The port of the SSH server
+	@param credentialHash A hash of the credentials being used, authentication failures are only remembered for this exact set of credentials
+*/
+SSHHostCircuitBreaker::SSHHostCircuitBreaker(Logger *logger, string sshHost, int sshPort, string credentialHash)
+{
+	this->logger = logger;
+	stringstream keyStream;
+	keyStream << sshHost << ":" << sshPort;
+	this->destinationKey = keyStream.str();
+	keyStream << "|" << credentialHash;
+	this->credentialKey = keyStream.str();
+}
+
+/**
+	Check whether the tunnel request should go ahead. If the SSH server or the credentials recently failed and the backoff hasn't passed, the request
+	should fail straight away with the cached failure
+	@param cachedFailure If the request is not allowed, this is set to the failure that was remembered
+	@param retryAfterSeconds If the request is not allowed, this is set to roughly how long until another attempt will be let through
+	@return bool True if the request can go ahead, false if it should fail fast
+*/
+bool SSHHostCircuitBreaker::allowRequest(FailureType *cachedFailure, int *retryAfterSeconds)
+{
+	if (StaticSettings::AppSettings::circuitBreakerBaseBackoffInSeconds <= 0)
+	{
+		return true;
+	}
+	lock_guard<mutex> lock(SSHHostCircuitBreaker::breakerMutex);
+	if (!this->checkState(this->destinationKey, &this->holdingDestinationProbe, cachedFailure, retryAfterSeconds))
+	{
+		return false;
+	}
+	if (!this->checkState(this->credentialKey, &this->holdingCredentialProbe, cachedFailure, retryAfterSeconds))
+	{
+		this->releaseProbe(this->destinationKey, &this->holdingDestinationProbe);
+		return false;
+	}
+	return true;
+}
+
+/**
+	Check a single breaker. The breaker mutex must be held by the caller
+	@return bool True if the request can go ahead
+*/
+bool SSHHostCircuitBreaker::checkState(string key, bool *holdingProbe, FailureType *cachedFailure, int *retryAfterSeconds)
+{
+	map<string, BreakerState>::iterator it = SSHHostCircuitBreaker::breakers.find(key);
+	if (it == SSHHostCircuitBreaker::breakers.end())
+	{
+		return true;
+	}
+	BreakerState& state = it->second;
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+
+	//If a probe has been running for longer than the handshake could possibly take, assume it is lost and allow another
+	if (state.probeInFlight && now - state.probeStarted > chrono::seconds(StaticSettings::AppSettings::circuitBreakerMaxBackoffInSeconds))
+	{
+		state.probeInFlight = false;
+	}
+
+	if (now >= state.openUntil && !state.probeInFlight)
+	{
+		//Half open, let this request through to find out if the problem has cleared
+		state.probeInFlight = true;
+		state.probeStarted = now;
+		*holdingProbe = true;
+		SSHHostCircuitBreaker::totalProbes++;
+		return true;
+	}
+
+	*cachedFailure = state.lastFailure;
+	*retryAfterSeconds = (int)chrono::duration_cast<chrono::seconds>(state.openUntil - now).count();
+	if (*retryAfterSeconds < 1)
+	{
+		*retryAfterSeconds = 1;
+	}
+	SSHHostCircuitBreaker::totalFastFailures++;
+	return false;
+}
+
+/**
+	Record that the SSH server couldn't be resolved or connected to
+	@param failureType The reason the connection failed, only DNS_RESOLUTION_FAILED and SSH_CONNECT_FAILED are remembered
+*/
+void SSHHostCircuitBreaker::recordConnectFailure(FailureType failureType)
+{
+	lock_guard<mutex> lock(SSHHostCircuitBreaker::breakerMutex);
+	this->recordFailure(this->destinationKey, failureType, &this->holdingDestinationProbe);
+	this->releaseProbe(this->credentialKey, &this->holdingCredentialProbe);
+}
+
+/**
+	Record that the SSH server rejected the password for the credentials used by this request
+*/
+void SSHHostCircuitBreaker::recordAuthFailure()
+{
+	lock_guard<mutex> lock(SSHHostCircuitBreaker::breakerMutex);
+	this->recordSuccess(this->destinationKey, &this->holdingDestinationProbe);
+	this->recordFailure(this->credentialKey, FailureType::PASSWORD_AUTH_FAILED, &this->holdingCredentialProbe);
+}
+
+/**
+	Record that the SSH server was reachable, any remembered connection failure for the SSH server is cleared
+*/
+void SSHHostCircuitBreaker::recordConnectSuccess()
+{
+	lock_guard<mutex> lock(SSHHostCircuitBreaker::breakerMutex);
+	this->recordSuccess(this->destinationKey, &this->holdingDestinationProbe);
+}
+
+/**
+	Record that the credentials authenticated, any remembered authentication failure for the credentials is cleared
+*/
+void SSHHostCircuitBreaker::recordAuthSuccess()
+{
+	lock_guard<mutex> lock(SSHHostCircuitBreaker::breakerMutex);
+	this->recordSuccess(this->destinationKey, &this->holdingDestinationProbe);
+	this->recordSuccess(this->credentialKey, &this->holdingCredentialProbe);
+}
+
+/**
+	Open (or re-open) the breaker for the key. The breaker mutex must be held by the caller
+*/
+void SSHHostCircuitBreaker::recordFailure(string key, FailureType failureType, bool *holdingProbe)
+{
+	BreakerState& state = SSHHostCircuitBreaker::breakers[key];
+	state.lastFailure = failureType;
+	state.consecutiveFailures++;
+	state.probeInFlight = false;
+	*holdingProbe = false;
+
+	long long backoff = StaticSettings::AppSettings::circuitBreakerBaseBackoffInSeconds;
+	for (int i = 1; i < state.consecutiveFailures && backoff < StaticSettings::AppSettings::circuitBreakerMaxBackoffInSeconds; i++)
+	{
+		backoff *= 2;
+	}
+	if (backoff > StaticSettings::AppSettings::circuitBreakerMaxBackoffInSeconds)
+	{
+		backoff = StaticSettings::AppSettings::circuitBreakerMaxBackoffInSeconds;
+	}
+
+	//Jitter the backoff by +/- 20% so that probes from many waiting users are spread out
+	uniform_int_distribution<long long> jitter(backoff * 800, backoff * 1200);
+	state.openUntil = chrono::steady_clock::now() + chrono::milliseconds(jitter(SSHHostCircuitBreaker::jitterGenerator));
+
+	stringstream logstream;
+	logstream << "Circuit breaker opened for " << (key == this->destinationKey ? this->destinationKey : this->destinationKey + " (credentials)");
+	logstream << " for roughly " << backoff << " seconds after " << state.consecutiveFailures << " consecutive failure(s)";
+	this->logger->writeToLog(logstream.str(), "SSHHostCircuitBreaker", "recordFailure");
+}
+
+/**
+	Close the breaker for the key. The breaker mutex must be held by the caller
+*/
+void SSHHostCircuitBreaker::recordSuccess(string key, bool *holdingProbe)
+{
+	SSHHostCircuitBreaker::breakers.erase(key);
+	*holdingProbe = false;
+}
+
+/**
+	If this request was let through as a probe but never reported an outcome for the key, let another request probe instead. 
+	The breaker mutex must be held by the caller
+*/
+void SSHHostCircuitBreaker::releaseProbe(string key, bool *holdingProbe)
+{
+	if (!*holdingProbe)
+	{
+		return;
+	}
+	map<string, BreakerState>::iterator it = SSHHostCircuitBreaker::breakers.find(key);
+	if (it != SSHHostCircuitBreaker::breakers.end())
+	{
+		it->second.probeInFlight = false;
+	}
+	*holdingProbe = false;
+}
+
+/**
+	Add the circuit breaker counters to the statistics that are returned to the PHP API
+	@param stats The map that the statistics are added to
+*/
+void SSHHostCircuitBreaker::appendStatistics(map<string, string> *stats)
+{
+	lock_guard<mutex> lock(SSHHostCircuitBreaker::breakerMutex);
+	(*stats)["circuitBreakersOpen"] = std::to_string(SSHHostCircuitBreaker::breakers.size());
+	(*stats)["circuitBreakerFastFailures"] = std::to_string(SSHHostCircuitBreaker::totalFastFailures);
+	(*stats)["circuitBreakerProbes"] = std::to_string(SSHHostCircuitBreaker::totalProbes);
+}
+
+SSHHostCircuitBreaker::~SSHHostCircuitBreaker()
+{
+	lock_guard<mutex> lock(SSHHostCircuitBreaker::breakerMutex);
+	this->releaseProbe(this->destinationKey, &this->holdingDestinationProbe);
+	this->releaseProbe(this->credentialKey, &this->holdingCredentialProbe);
+}
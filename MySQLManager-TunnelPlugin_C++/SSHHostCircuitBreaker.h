@@ -0,0 +1,49 @@
+#pragma once
+#ifndef SSHHOSTCIRCUITBREAKER_H
+#define SSHHOSTCIRCUITBREAKER_H
+#include <string>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <random>
+#include "StaticSettings.h"
+#include "Logger.h"
+
+class SSHHostCircuitBreaker
+{
+public:
+	enum FailureType { NO_FAILURE, DNS_RESOLUTION_FAILED, SSH_CONNECT_FAILED, PASSWORD_AUTH_FAILED };
+	SSHHostCircuitBreaker(Logger *logger, std::string sshHost, int sshPort, std::string credentialHash);
+	~SSHHostCircuitBreaker();
+	bool allowRequest(FailureType *cachedFailure, int *retryAfterSeconds);
+	void recordConnectFailure(FailureType failureType);
+	void recordAuthFailure();
+	void recordConnectSuccess();
+	void recordAuthSuccess();
+	static void appendStatistics(std::map<std::string, std::string> *stats);
+private:
+	struct BreakerState
+	{
+		FailureType lastFailure = NO_FAILURE;
+		int consecutiveFailures = 0;
+		std::chrono::steady_clock::time_point openUntil;
+		bool probeInFlight = false;
+		std::chrono::steady_clock::time_point probeStarted;
+	};
+	Logger *logger = NULL;
+	std::string destinationKey;
+	std::string credentialKey;
+	bool holdingDestinationProbe = false;
+	bool holdingCredentialProbe = false;
+	bool checkState(std::string key, bool *holdingProbe, FailureType *cachedFailure, int *retryAfterSeconds);
+	void recordFailure(std::string key, FailureType failureType, bool *holdingProbe);
+	void recordSuccess(std::string key, bool *holdingProbe);
+	void releaseProbe(std::string key, bool *holdingProbe);
+	static std::mutex breakerMutex;
+	static std::map<std::string, BreakerState> breakers;
+	static std::mt19937 jitterGenerator;
+	static unsigned long long totalFastFailures;
+	static unsigned long long totalProbes;
+};
+
+#endif //!SSHHOSTCIRCUITBREAKER_H
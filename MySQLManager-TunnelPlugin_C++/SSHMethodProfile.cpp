@@ -0,0 +1,158 @@
+/**
+	Sets which key exchange, cipher and MAC algorithms are offered to the SSH server, most preferred first, before the SSH handshake. 
+	Without this libssh2 offers its own order, which some SSH servers answer with CBC ciphers and HMAC-SHA1.
+	
+	There are two built in profiles:
+	compat - the libssh2 defaults, nothing is changed
+	throughput - AES-GCM and ChaCha20-Poly1305 ciphers, encrypt-then-MAC SHA-2 MACs and curve25519 key exchange, falling back to the 
+	older algorithms for SSH servers that don't support them
+	
+	More profiles can be added to the configuration file in an [ssh_method_profile:<name>] section with kex, ciphers and macs keys, each 
+	a comma separated list of algorithm names. Any key that is left out uses the libssh2 defaults.
+	Host key algorithms are never changed, as the host key fingerprint that has been confirmed depends on which host key the SSH server uses
+*/
+
+#include "SSHMethodProfile.h"
+#include <sstream>
+
+using namespace std;
+
+std::map<std::string, SSHMethodProfile::MethodPreferences> SSHMethodProfile::customProfiles;
+
+/**
+	@param logger The logger
+	@param profileName The name of a built in profile or a profile from the configuration file
+*/
+SSHMethodProfile::SSHMethodProfile(Logger *logger, string profileName)
+{
+	this->logger = logger;
+	this->profileName = profileName;
+}
+
+string SSHMethodProfile::getProfileName()
+{
+	return this->profileName;
+}
+
+/**
+	Read every [ssh_method_profile:...] section from the configuration file. This is only called when the configuration is read on start up
+	@param iniParser The parser for the configuration file
+*/
+void SSHMethodProfile::loadProfiles(INIParser *iniParser)
+{
+	const string sectionPrefix = "ssh_method_profile:";
+	vector<string> sectionNames = iniParser->getSectionNames();
+	for (vector<string>::iterator it = sectionNames.begin(); it != sectionNames.end(); ++it)
+	{
+		if (it->compare(0, sectionPrefix.length(), sectionPrefix) == 0 && it->length() > sectionPrefix.length())
+		{
+			map<string, string> section = iniParser->getSection(*it);
+			MethodPreferences preferences;
+			preferences.kex = section["kex"];
+			preferences.ciphers = section["ciphers"];
+			preferences.macs = section["macs"];
+			SSHMethodProfile::customProfiles[it->substr(sectionPrefix.length())] = preferences;
+		}
+	}
+}
+
+/**
+	Look up the algorithms for the profile. Profiles in the configuration file take priority over the built in profiles
+	@param preferences Set to the algorithms for the profile, an empty list means the libssh2 default is used
+	@return bool False if there is no profile with this name
+*/
+bool SSHMethodProfile::getPreferences(MethodPreferences *preferences)
+{
+	map<string, MethodPreferences>::iterator it = SSHMethodProfile::customProfiles.find(this->profileName);
+	if (it != SSHMethodProfile::customProfiles.end())
+	{
+		*preferences = it->second;
+		return true;
+	}
+	if (this->profileName == "compat")
+	{
+		return true;
+	}
+	if (this->profileName == "throughput")
+	{
+		preferences->kex = "curve25519-sha256,curve25519-sha256@libssh.org,ecdh-sha2-nistp256,ecdh-sha2-nistp384,ecdh-sha2-nistp521,"
+			"diffie-hellman-group14-sha256,diffie-hellman-group-exchange-sha256,diffie-hellman-group16-sha512,diffie-hellman-group14-sha1";
+		preferences->ciphers = "aes128-gcm@openssh.com,aes256-gcm@openssh.com,chacha20-poly1305@openssh.com,aes128-ctr,aes192-ctr,aes256-ctr,"
+			"aes128-cbc,aes256-cbc";
+		preferences->macs = "hmac-sha2-256-etm@openssh.com,hmac-sha2-512-etm@openssh.com,hmac-sha2-256,hmac-sha2-512,hmac-sha1";
+		return true;
+	}
+	return false;
+}
+
+/**
+	Set the session's algorithm preferences from the profile. This has to be done before libssh2_session_handshake. Anything libssh2 
+	rejects is logged and left as the libssh2 default, so a bad profile never stops the tunnel from being created
+	@param session The SSH session that hasn't done its handshake yet
+*/
+void SSHMethodProfile::applyToSession(LIBSSH2_SESSION *session)
+{
+	MethodPreferences preferences;
+	if (!this->getPreferences(&preferences))
+	{
+		stringstream logstream;
+		logstream << "Unknown SSH method profile " << this->profileName << ". Using the libssh2 defaults";
+		this->logger->writeToLog(logstream.str(), "SSHMethodProfile", "applyToSession");
+		return;
+	}
+	this->applyPreference(session, LIBSSH2_METHOD_KEX, "kex", preferences.kex);
+	this->applyPreference(session, LIBSSH2_METHOD_CRYPT_CS, "ciphers", preferences.ciphers);
+	this->applyPreference(session, LIBSSH2_METHOD_CRYPT_SC, "ciphers", preferences.ciphers);
+	this->applyPreference(session, LIBSSH2_METHOD_MAC_CS, "macs", preferences.macs);
+	this->applyPreference(session, LIBSSH2_METHOD_MAC_SC, "macs", preferences.macs);
+}
+
+/**
+	@param session The SSH session
+	@param methodType The LIBSSH2_METHOD_* type being set
+	@param methodName The name of the setting, used for logging
+	@param preference Comma separated algorithm names, most preferred first. Nothing is changed if this is empty
+*/
+void SSHMethodProfile::applyPreference(LIBSSH2_SESSION *session, int methodType, string methodName, string preference)
+{
+	if (preference.empty())
+	{
+		return;
+	}
+	//libssh2 drops any algorithms it doesn't support and only fails if none of them are supported
+	int result = libssh2_session_method_pref(session, methodType, preference.c_str());
+	if (result != 0)
+	{
+		stringstream logstream;
+		logstream << "libssh2 doesn't support any of the " << methodName << " in SSH method profile " << this->profileName << ". Error: " << result;
+		this->logger->writeToLog(logstream.str(), "SSHMethodProfile", "applyPreference");
+	}
+}
+
+/**
+	Get the algorithms that were agreed with the SSH server during the handshake
+	@param session The SSH session that has done its handshake
+	@return string The algorithms, e.g. kex=curve25519-sha256 hostkey=ssh-ed25519 cipher=aes128-gcm@openssh.com/aes128-gcm@openssh.com mac=...
+*/
+string SSHMethodProfile::describeNegotiatedMethods(LIBSSH2_SESSION *session)
+{
+	const int methodTypes[] = { LIBSSH2_METHOD_KEX, LIBSSH2_METHOD_HOSTKEY, LIBSSH2_METHOD_CRYPT_CS, LIBSSH2_METHOD_CRYPT_SC, 
+		LIBSSH2_METHOD_MAC_CS, LIBSSH2_METHOD_MAC_SC, LIBSSH2_METHOD_COMP_CS, LIBSSH2_METHOD_COMP_SC };
+	const char *methodNames[] = { "kex", "hostkey", "cipher", NULL, "mac", NULL, "compression", NULL };
+	stringstream methods;
+	for (int index = 0; index < 8; index++)
+	{
+		const char *method = libssh2_session_methods(session, methodTypes[index]);
+		if (methodNames[index] != NULL)
+		{
+			methods << (index == 0 ? "" : " ") << methodNames[index] << "=";
+		}
+		else
+		{
+			//The client to server and server to client algorithms are shown together
+			methods << "/";
+		}
+		methods << (method != NULL ? method : "none");
+	}
+	return methods.str();
+}
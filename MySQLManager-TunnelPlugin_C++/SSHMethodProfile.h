@@ -0,0 +1,32 @@
+#pragma once
+#ifndef SSHMETHODPROFILE_H
+#define SSHMETHODPROFILE_H
+#include <libssh2.h>
+#include <string>
+#include <map>
+#include "INIParser.h"
+#include "Logger.h"
+
+class SSHMethodProfile
+{
+public:
+	SSHMethodProfile(Logger *logger, std::string profileName);
+	void applyToSession(LIBSSH2_SESSION *session);
+	std::string getProfileName();
+	static std::string describeNegotiatedMethods(LIBSSH2_SESSION *session);
+	static void loadProfiles(INIParser *iniParser);
+private:
+	struct MethodPreferences
+	{
+		std::string kex;
+		std::string ciphers;
+		std::string macs;
+	};
+	Logger *logger = NULL;
+	std::string profileName;
+	bool getPreferences(MethodPreferences *preferences);
+	void applyPreference(LIBSSH2_SESSION *session, int methodType, std::string methodName, std::string preference);
+	static std::map<std::string, MethodPreferences> customProfiles;
+};
+
+#endif //!SSHMETHODPROFILE_H
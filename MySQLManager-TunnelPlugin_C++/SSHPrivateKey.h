@@ -0,0 +1,34 @@
+#pragma once
+#ifndef SSHPRIVATEKEY_H
+#define SSHPRIVATEKEY_H
+#include <string>
+#include <vector>
+#include <openssl/evp.h>
+#include <openssl/bn.h>
+
+class SSHPrivateKey
+{
+public:
+	enum DecodeResult { DECODED, NOT_SUPPORTED, WRONG_PASSPHRASE, INVALID_KEY };
+	SSHPrivateKey();
+	~SSHPrivateKey();
+	DecodeResult decode(const std::string& privateKey, const std::string& passphrase);
+	bool loadPKCS8(const unsigned char *der, size_t length);
+	size_t getPKCS8Length();
+	bool writePKCS8(unsigned char *der);
+	std::string getPublicKeyBlob();
+	bool sign(const unsigned char *data, size_t dataLength, std::string algorithm, std::vector<unsigned char> *signature);
+	static bool getSignatureAlgorithm(const unsigned char *data, size_t dataLength, std::string *algorithm);
+private:
+	EVP_PKEY *key = NULL;
+	DecodeResult decodeOpenSSHKey(const std::string& privateKey, const std::string& passphrase);
+	DecodeResult decodePEMKey(const std::string& privateKey, const std::string& passphrase);
+	DecodeResult createKeyFromOpenSSH(const unsigned char *data, size_t length);
+	static int passphraseCallback(char *buffer, int size, int rwflag, void *userdata);
+	static bool readUInt32(const unsigned char **data, size_t *remaining, uint32_t *value);
+	static bool readString(const unsigned char **data, size_t *remaining, const unsigned char **value, size_t *valueLength);
+	static void writeString(std::string *out, const void *value, size_t length);
+	static void writeMPInt(std::string *out, const BIGNUM *value);
+};
+
+#endif //!SSHPRIVATEKEY_H
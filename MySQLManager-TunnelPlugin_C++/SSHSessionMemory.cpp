@@ -0,0 +1,155 @@
+/**
+	Keeps count of the memory libssh2 has allocated for an SSH session. The session is created with allocator callbacks that come here 
+	(see SSHTunnelForwarder::allocateForSession), so the memory of each tunnel's session can be seen in the GetStats response, and a session 
+	can be limited to sshSessionMemoryLimitBytes, in which case libssh2 gets NULL back for an allocation that would go over the limit and fails 
+	whatever it was doing with LIBSSH2_ERROR_ALLOC.
+	Each allocation has a small header in front of it with its size, as libssh2 doesn't pass the size when it frees or reallocates
+*/
+
+#include "SSHSessionMemory.h"
+#include <stdlib.h>
+
+using namespace std;
+
+//The header is a whole max_align_t so the memory returned to libssh2 is as aligned as malloc's
+static const size_t headerSize = sizeof(std::max_align_t) > sizeof(size_t) ? sizeof(std::max_align_t) : sizeof(size_t);
+
+std::atomic<size_t> SSHSessionMemory::totalBytesInUse{ 0 };
+std::atomic<unsigned long long> SSHSessionMemory::totalAllocations{ 0 };
+std::atomic<unsigned long long> SSHSessionMemory::totalLimitFailures{ 0 };
+
+/**
+	@param limitBytes The most memory the session can have allocated at once, 0 for no limit
+*/
+void SSHSessionMemory::setLimit(size_t limitBytes)
+{
+	this->limitBytes = limitBytes;
+}
+
+/**
+	Allocate memory for libssh2
+	@param size The number of bytes libssh2 asked for
+	@return void The memory, NULL if the session's limit would be exceeded or malloc failed
+*/
+void *SSHSessionMemory::allocate(size_t size)
+{
+	if (!this->reserve(size))
+	{
+		return NULL;
+	}
+	char *memory = static_cast<char*>(malloc(headerSize + size));
+	if (memory == NULL)
+	{
+		this->unreserve(size);
+		return NULL;
+	}
+	*reinterpret_cast<size_t*>(memory) = size;
+	SSHSessionMemory::totalAllocations++;
+	return memory + headerSize;
+}
+
+/**
+	Resize memory previously returned by allocate
+	@param ptr The memory to resize, NULL to allocate new memory
+	@param size The new size
+	@return void The resized memory, NULL if the session's limit would be exceeded or realloc failed, in which case ptr is left as it was
+*/
+void *SSHSessionMemory::reallocate(void *ptr, size_t size)
+{
+	if (ptr == NULL)
+	{
+		return this->allocate(size);
+	}
+	char *memory = static_cast<char*>(ptr) - headerSize;
+	size_t oldSize = *reinterpret_cast<size_t*>(memory);
+	if (size > oldSize && !this->reserve(size - oldSize))
+	{
+		return NULL;
+	}
+	char *resized = static_cast<char*>(realloc(memory, headerSize + size));
+	if (resized == NULL)
+	{
+		if (size > oldSize)
+		{
+			this->unreserve(size - oldSize);
+		}
+		return NULL;
+	}
+	if (size < oldSize)
+	{
+		this->unreserve(oldSize - size);
+	}
+	*reinterpret_cast<size_t*>(resized) = size;
+	return resized + headerSize;
+}
+
+/**
+	Free memory previously returned by allocate or reallocate
+	@param ptr The memory to free, can be NULL
+*/
+void SSHSessionMemory::release(void *ptr)
+{
+	if (ptr == NULL)
+	{
+		return;
+	}
+	char *memory = static_cast<char*>(ptr) - headerSize;
+	this->unreserve(*reinterpret_cast<size_t*>(memory));
+	free(memory);
+}
+
+/**
+	Count memory that is about to be allocated against the session, checking it doesn't take the session over its limit
+	@param size The number of bytes being allocated
+	@return bool False if the session would go over its limit
+*/
+bool SSHSessionMemory::reserve(size_t size)
+{
+	size_t inUse = this->bytesInUse.fetch_add(size) + size;
+	if (this->limitBytes > 0 && inUse > this->limitBytes)
+	{
+		this->bytesInUse -= size;
+		this->limitFailures++;
+		SSHSessionMemory::totalLimitFailures++;
+		return false;
+	}
+	SSHSessionMemory::totalBytesInUse += size;
+	size_t peak = this->peakBytes.load();
+	while (inUse > peak && !this->peakBytes.compare_exchange_weak(peak, inUse));
+	return true;
+}
+
+void SSHSessionMemory::unreserve(size_t size)
+{
+	this->bytesInUse -= size;
+	SSHSessionMemory::totalBytesInUse -= size;
+}
+
+size_t SSHSessionMemory::getBytesInUse()
+{
+	return this->bytesInUse.load();
+}
+
+size_t SSHSessionMemory::getPeakBytes()
+{
+	return this->peakBytes.load();
+}
+
+/**
+	@return unsigned long long The number of allocations that were refused because the session would have gone over its limit
+*/
+unsigned long long SSHSessionMemory::getLimitFailures()
+{
+	return this->limitFailures.load();
+}
+
+/**
+	Add the memory used by all the SSH sessions to the statistics returned by the GetStats request
+	@param stats The statistics to add to
+*/
+void SSHSessionMemory::appendStatistics(map<string, string> *stats)
+{
+	(*stats)["sshSessionMemoryBytes"] = std::to_string(SSHSessionMemory::totalBytesInUse.load());
+	(*stats)["sshSessionAllocations"] = std::to_string(SSHSessionMemory::totalAllocations.load());
+	(*stats)["sshSessionMemoryLimitFailures"] = std::to_string(SSHSessionMemory::totalLimitFailures.load());
+}
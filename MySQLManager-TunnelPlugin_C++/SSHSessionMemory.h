@@ -0,0 +1,32 @@
+#pragma once
+#ifndef SSHSESSIONMEMORY_H
+#define SSHSESSIONMEMORY_H
+#include <string>
+#include <map>
+#include <atomic>
+#include <cstddef>
+
+class SSHSessionMemory
+{
+public:
+	void setLimit(size_t limitBytes);
+	void *allocate(size_t size);
+	void *reallocate(void *ptr, size_t size);
+	void release(void *ptr);
+	size_t getBytesInUse();
+	size_t getPeakBytes();
+	unsigned long long getLimitFailures();
+	static void appendStatistics(std::map<std::string, std::string> *stats);
+private:
+	bool reserve(size_t size);
+	void unreserve(size_t size);
+	size_t limitBytes = 0;
+	std::atomic<size_t> bytesInUse{ 0 };
+	std::atomic<size_t> peakBytes{ 0 };
+	std::atomic<unsigned long long> limitFailures{ 0 };
+	static std::atomic<size_t> totalBytesInUse;
+	static std::atomic<unsigned long long> totalAllocations;
+	static std::atomic<unsigned long long> totalLimitFailures;
+};
+
+#endif //!SSHSESSIONMEMORY_H
@@ -63,6 +63,24 @@ void SSHTunnelForwarder::setSSHPrivateKeyCertPassphrase(string certPassphrase)
 	this->sshPrivateKeyPassPhrase = certPassphrase;
 }
 
+/**
+	Limit how fast this tunnel can forward data, on top of any global or SSH host limit (see BandwidthLimiter)
+	@param bytesPerSecond The limit for the tunnel's clients together, 0 for no limit of its own
+*/
+void SSHTunnelForwarder::setBandwidthLimit(unsigned long long bytesPerSecond)
+{
+	this->tunnelBandwidthLimiter.setRate(bytesPerSecond);
+}
+
+/**
+	@param credentialHash The hash of the tunnel's credentials that CreateTunnel used for the SSHHostCircuitBreaker, reconnectSSHSession 
+	records its failures against the same breaker
+*/
+void SSHTunnelForwarder::setCredentialHash(string credentialHash)
+{
+	this->credentialHash = credentialHash;
+}
+
 string SSHTunnelForwarder::getUsername()
 {
 	return this->username;
@@ -111,15 +129,32 @@ int SSHTunnelForwarder::getLocalListenPort()
 }
 
 /**
-	Connects to the SSH server and returns the SSH server finger print
+	Connects to the SSH server and returns the SSH server finger print, waiting on this thread for each step of the connect and handshake. 
+	New tunnels are connected by a TunnelSetupLoop instead, this is used when the thread forwarding the tunnel reconnects its session
 	@param error Any errors are stored in this paramter
 */
 string SSHTunnelForwarder::connectToSSHAndFingerprint(ErrorStatus& error)
+{
+	string fingerprint;
+	SetupResult result = this->startConnectToSSH(error);
+	while (result == SetupResult::SETUP_WAITING)
+	{
+		this->waitForSetupStep();
+		result = this->continueConnectToSSH(&fingerprint, error);
+	}
+	return result == SetupResult::SETUP_DONE ? fingerprint : string();
+}
+
+/**
+	Start connecting to the SSH server. The SSH server's hostname is resolved and the connect is started without waiting for it to finish, 
+	continueConnectToSSH carries on once the SSH socket is writable
+	@param error Any errors are stored in this paramter
+	@return SetupResult SETUP_WAITING while the connect is in progress or SETUP_FAILED
+*/
+SSHTunnelForwarder::SetupResult SSHTunnelForwarder::startConnectToSSH(ErrorStatus& error)
 {
 	stringstream logstream;
-	int rc, i;
 	struct sockaddr_in sin;
-	const char * tempfingerprint;
 
 #ifdef WIN32
 	char sockopt;
@@ -132,101 +167,176 @@ string SSHTunnelForwarder::connectToSSHAndFingerprint(ErrorStatus& error)
 	if (err != 0) {
 		fprintf(stderr, "WSAStartup failed with error: %d\n", err);
 		error = ErrorStatus::SYSTEM_FAULT;
-		return string();
+		return SetupResult::SETUP_FAILED;
 	}
 #endif
 
 	//Convert the hostname to an ip address
-	hostent *record = gethostbyname(this->sshHostnameOrIpAddress.c_str());
-	if (record == NULL)
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo *record = NULL;
+	int resolveResult = getaddrinfo(this->sshHostnameOrIpAddress.c_str(), NULL, &hints, &record);
+	if (resolveResult != 0 || record == NULL)
 	{
-#ifdef _WIN32
-		logstream << "Unable to resolve " << this->sshHostnameOrIpAddress << " Error: " << WSAGetLastError();
-#else
-		logstream << "Unable to resolve " << this->sshHostnameOrIpAddress;
-#endif
-		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "connectToSSHAndFingerprint");
+		logstream << "Unable to resolve " << this->sshHostnameOrIpAddress << " Error: " << gai_strerror(resolveResult);
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "startConnectToSSH");
 		error = ErrorStatus::DNS_RESOLUTION_FAILED;
-		return string();
+		return SetupResult::SETUP_FAILED;
 	}
 
-	in_addr * address = (in_addr *)record->h_addr;
-	this->sshServerIP = inet_ntoa(*address);
-
-	rc = libssh2_init(0);
-
-	if (rc != 0) {
-		logstream << "libssh2 initialised failed (" << rc << ")";
-		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "connectToSSHAndFingerprint");
-		error = ErrorStatus::SYSTEM_FAULT;
-		return string();
-	}
+	in_addr address = ((sockaddr_in *)record->ai_addr)->sin_addr;
+	freeaddrinfo(record);
+	this->sshServerIP = inet_ntoa(address);
 
 	/* Connect to SSH server */
 	this->sshSocket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
 #ifdef WIN32
 	if (this->sshSocket == INVALID_SOCKET) {
 		logstream << "Failed to open socket. Error: " << WSAGetLastError();
-		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "connectToSSHAndFingerprint");
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "startConnectToSSH");
 		error = ErrorStatus::SYSTEM_FAULT;
-		return string();
+		return SetupResult::SETUP_FAILED;
 	}
 #else
 	if (this->sshSocket == -1) {
 		logstream << "Failed to open socket. Error: " << strerror(this->sshSocket);
-		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "connectToSSHAndFingerprint");
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "startConnectToSSH");
 		error = ErrorStatus::SYSTEM_FAULT;
-		return string();
+		return SetupResult::SETUP_FAILED;
 	}
 #endif
 
 	sin.sin_family = AF_INET;
 	if (INADDR_NONE == (sin.sin_addr.s_addr = inet_addr(this->sshServerIP.c_str()))) {
 		logstream << "Failed to copy server ip to structure";
-		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "connectToSSHAndFingerprint");
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "startConnectToSSH");
 		error = ErrorStatus::SYSTEM_FAULT;
-		return string();
+		return SetupResult::SETUP_FAILED;
 	}
 	sin.sin_port = htons(this->getSSHPort());
 
 	sockopt = '1';
 	setsockopt(this->sshSocket, SOL_SOCKET, SO_REUSEADDR, (char*)&sockopt, sizeof(sockopt));
 
+	//The connect doesn't block, so an SSH server that doesn't answer fails after sshConnectTimeoutSeconds instead of the OS connect timeout
+	this->beginSetupStep(SetupStep::SETUP_CONNECT);
+	SSHTunnelForwarder::setSocketBlocking(this->sshSocket, false);
 	int result = connect(this->sshSocket, (struct sockaddr*)(&sin), sizeof(struct sockaddr_in));
-	if (result != 0) {
+	if (result != 0 && !SSHTunnelForwarder::connectInProgress())
+	{
 #ifdef _WIN32
 		logstream << "Failed to connect to SSH Server. Error: " << WSAGetLastError();
 #else
-		logstream << "Failed to connect to SSH Server. Error: " << strerror(result);
+		logstream << "Failed to connect to SSH Server. Error: " << strerror(errno);
 #endif
-		this->logger->writeToLog(logstream.str(), "SSHTunnelForward", "connectToSSHAndFingerprint");
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForward", "startConnectToSSH");
 		error = ErrorStatus::SSH_CONNECT_FAILED;
-		return string();
+		return SetupResult::SETUP_FAILED;
 	}
+	//A connect that has already finished leaves the socket writable, so continueConnectToSSH is called straight away
+	error = ErrorStatus::SUCCESS;
+	return SetupResult::SETUP_WAITING;
+}
+
+/**
+	Carry on connecting to the SSH server, once the SSH socket is ready for the current step or the step's deadline has passed. When the 
+	connect has finished the SSH session is created, then the handshake is carried on for as far as it can go without waiting for the SSH server
+	@param fingerprint Set to the SSH server's fingerprint once the handshake has finished
+	@param error Any errors are stored in this paramter
+	@return SetupResult SETUP_WAITING until the handshake has finished, then SETUP_DONE, or SETUP_FAILED
+*/
+SSHTunnelForwarder::SetupResult SSHTunnelForwarder::continueConnectToSSH(string *fingerprint, ErrorStatus& error)
+{
+	stringstream logstream;
+	int rc, i;
+	const char * tempfingerprint;
+
+	if (this->setupStep == SetupStep::SETUP_CONNECT)
+	{
+		int result = this->setupStepTimedOut ? -1 : SSHTunnelForwarder::getSocketError(this->sshSocket);
+		if (result != 0) {
+			if (this->setupStepTimedOut)
+			{
+				logstream << "Failed to connect to SSH Server. Timed out after " << this->getSetupStepTimeout() << " seconds";
+			}
+			else
+			{
+#ifdef _WIN32
+				logstream << "Failed to connect to SSH Server. Error: " << result;
+#else
+				logstream << "Failed to connect to SSH Server. Error: " << strerror(result > 0 ? result : errno);
+#endif
+			}
+			this->logger->writeToLog(logstream.str(), "SSHTunnelForward", "continueConnectToSSH");
+			error = ErrorStatus::SSH_CONNECT_FAILED;
+			return SetupResult::SETUP_FAILED;
+		}
+		SSHTunnelForwarder::setTCPKeepalive(this->sshSocket);
+
+		/* Create a session instance, everything libssh2 allocates for the session is counted against this tunnel */
+		this->sessionMemory.setLimit((size_t)HostSettings::getSetting(this->getSSHHostnameOrIPAddress(), "sshSessionMemoryLimitBytes", 
+			StaticSettings::AppSettings::sshSessionMemoryLimitBytes));
+		this->session = libssh2_session_init_ex(&SSHTunnelForwarder::allocateForSession, &SSHTunnelForwarder::freeForSession, 
+			&SSHTunnelForwarder::reallocateForSession, this);
 
-	/* Create a session instance */
-	this->session = libssh2_session_init();
+		if (!this->session) {
+			logstream << "Failed to initialise the SSH Session";
+			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "continueConnectToSSH");
+			error = ErrorStatus::SYSTEM_FAULT;
+			return SetupResult::SETUP_FAILED;
+		}
+		libssh2_trace(this->session, LIBSSH2_TRACE_PUBLICKEY | LIBSSH2_TRACE_ERROR | LIBSSH2_TRACE_AUTH);
 
-	libssh2_trace(this->session, LIBSSH2_TRACE_PUBLICKEY | LIBSSH2_TRACE_ERROR | LIBSSH2_TRACE_AUTH);
+		//The whole setup is non-blocking, each step only goes as far as it can without waiting for the SSH server
+		libssh2_session_set_blocking(this->session, 0);
 
-	if (!this->session) {
-		logstream << "Failed to initialise the SSH Session";
-		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "connectToSSHAndFingerprint");
-		error = ErrorStatus::SYSTEM_FAULT;
-		return string();
+		SSHMethodProfile methodProfile(this->logger, HostSettings::getSetting(this->getSSHHostnameOrIPAddress(), "sshMethodProfile", StaticSettings::AppSettings::sshMethodProfile));
+		methodProfile.applyToSession(this->session);
+		this->methodProfileName = methodProfile.getProfileName();
+
+		this->compressionEnabled = this->isCompressionEnabled();
+		if (this->compressionEnabled)
+		{
+			libssh2_session_flag(this->session, LIBSSH2_FLAG_COMPRESS, 1);
+		}
+		//Count what arrives on the SSH socket, for the compression ratio and so isSSHServerAlive can tell the SSH server is still answering
+		libssh2_session_callback_set2(this->session, LIBSSH2_CALLBACK_RECV, (libssh2_cb_generic*)&SSHTunnelForwarder::receiveFromSSHSocket);
+
+		this->beginSetupStep(SetupStep::SETUP_HANDSHAKE);
+		this->handshakeStarted = std::chrono::steady_clock::now();
+	}
+
+	if (this->setupStepTimedOut)
+	{
+		logstream << "SSH handshake with " << this->getSSHHostnameOrIPAddress() << " timed out after " << this->getSetupStepTimeout() << " seconds";
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "continueConnectToSSH");
+		error = ErrorStatus::SSH_CONNECT_FAILED;
+		return SetupResult::SETUP_FAILED;
 	}
 
 	/* ... start it up. This will trade welcome banners, exchange keys,
 	* and setup crypto, compression, and MAC layers
 	*/
 	rc = libssh2_session_handshake(this->session, this->sshSocket);
-
+	if (rc == LIBSSH2_ERROR_EAGAIN)
+	{
+		return SetupResult::SETUP_WAITING;
+	}
 	if (rc) {
 		logstream << "Error starting up SSH session. Error: " << rc;
-		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "connectToSSHAndFingerprint");
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "continueConnectToSSH");
 		error = ErrorStatus::SYSTEM_FAULT;
-		return string();
+		return SetupResult::SETUP_FAILED;
 	}
+	this->negotiatedMethods = SSHMethodProfile::describeNegotiatedMethods(this->session);
+	logstream << "SSH handshake with " << this->getSSHHostnameOrIPAddress() << ":" << this->getSSHPort() << " took ";
+	logstream << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - this->handshakeStarted).count() << "ms";
+	logstream << " using method profile " << this->methodProfileName << ". Negotiated " << this->negotiatedMethods;
+	this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "continueConnectToSSH");
+	logstream.clear();
+	logstream.str(string());
 
 	/* At this point we havn't yet authenticated.  The first thing to do
 	* is check the hostkey's fingerprint against our known.
@@ -238,418 +348,2275 @@ string SSHTunnelForwarder::connectToSSHAndFingerprint(ErrorStatus& error)
 	{
 		fingerprintstream << std::setw(2) << (unsigned int)(tempfingerprint[i] & 0xFF) << ":";
 	}
-	string fingerprint = fingerprintstream.str();
+	*fingerprint = fingerprintstream.str();
+	*fingerprint = fingerprint->substr(0, fingerprint->size() - 1); //Remove the last colon (:) from the end of the string
+	//The tunnel is only forwarded once the first fingerprint has been confirmed, so a reconnect has to see the same host key
+	if (this->hostKeyFingerprint.empty())
+	{
+		this->hostKeyFingerprint = *fingerprint;
+	}
 	error = ErrorStatus::SUCCESS;
-	return fingerprint.substr(0, fingerprint.size() - 1); //Remove the last colon (:) from the end of the string
+	return SetupResult::SETUP_DONE;
 }
 
 /**
-	Connects to the SSH server, authenticates and then sets up the SSH tunnel
-	@param response This will be a JSON string generated by the JSONResponseGenerator class
-	@return bool Returns true on success otherwise false
+	Whether the session should use zlib compression, from sshCompression in the SSH host's section or [app_settings]. It can be on, off or 
+	adaptive, where compression is only used for SSH servers whose link has been measured as slower than compressionMaxBytesPerSecond and 
+	whose data has compressed to at least compressionMinRatioPercent on previous sessions
+	@return bool True if compression should be requested for the session
 */
-bool SSHTunnelForwarder::authenticateSSHServerAndStartPortForwarding(string *response)
+bool SSHTunnelForwarder::isCompressionEnabled()
 {
-
-	char *userauthlist;
-	userauthlist = libssh2_userauth_list(this->session, this->getUsername().c_str(), strlen(this->getUsername().c_str()));
-
-	if (strstr(userauthlist, "password"))
+	string compression = HostSettings::getSetting(this->getSSHHostnameOrIPAddress(), "sshCompression", StaticSettings::AppSettings::sshCompression);
+	if (compression == "on")
 	{
-		supportedAuthMethod |= AUTH_PASSWORD;
+		return true;
 	}
-	if (strstr(userauthlist, "publickey"))
+	if (compression == "adaptive")
 	{
-		supportedAuthMethod |= AUTH_PUBLICKEY;
+		int maxBytesPerSecond = HostSettings::getSetting(this->getSSHHostnameOrIPAddress(), "compressionMaxBytesPerSecond", StaticSettings::AppSettings::compressionMaxBytesPerSecond);
+		int minRatioPercent = HostSettings::getSetting(this->getSSHHostnameOrIPAddress(), "compressionMinRatioPercent", StaticSettings::AppSettings::compressionMinRatioPercent);
+		LinkStatistics linkStatistics(this->getSSHHostnameOrIPAddress(), this->getSSHPort());
+		return linkStatistics.shouldCompress(maxBytesPerSecond, minRatioPercent / 100.0);
 	}
+	return false;
+}
 
-	//Are we authenticating via a password
-	if (this->getAuthMethod() == SupportedAuthMethods::AUTH_PASSWORD)
+/**
+	Receives data from the SSH socket for libssh2, the same as libssh2's own receive except it counts the bytes received
+	@return ssize_t The number of bytes received, or a negative errno on failure as libssh2 expects
+*/
+ssize_t SSHTunnelForwarder::receiveFromSSHSocket(libssh2_socket_t socket, void *buffer, size_t length, int flags, void **abstract)
+{
+	SSHTunnelForwarder *sshTunnelForwarder = (SSHTunnelForwarder*)*abstract;
+	ssize_t received = recv(socket, (char*)buffer, (int)length, flags);
+	if (received < 0)
 	{
-		stringstream logstream;
-		logstream << "Using password authentication for SSH Host: " << this->getSSHHostnameOrIPAddress();
-		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "authenticateSSHServer");
-		if (chosenAuthMethod & SupportedAuthMethods::AUTH_PASSWORD)
-		{
-			if (libssh2_userauth_password(this->session, this->getUsername().c_str(), this->getPassword().c_str()) < 0)
-			{
-				logstream.clear();
-				logstream.str(string());
-				this->closeSSHSessions();
-				logstream << "SSH Host " << this->getSSHHostnameOrIPAddress() << " password authentication failed";
-				this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "authenticateSSHServer");
-				JSONResponseGenerator jsonResponse;
-				jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "PasswordAuthFailed");
-				*response =  jsonResponse.getJSONString();
-				return false;
-			}
-			else
-			{
-				logstream.clear();
-				logstream.str(string());
-				logstream << "Successfully authenticated with SSH Host: " << this->getSSHHostnameOrIPAddress();
-				this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "authenticateSSHServerAndStartPortForwarding");
-			}
-		}
-		else
-		{
-			this->closeSSHSessions();
-			logstream << "SSH Host: " << this->getSSHHostnameOrIPAddress() << " does not support password authentication";
-			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "authenticateSSHServer");
-			JSONResponseGenerator jsonResponse;
-			jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_AUTH_FAILURE, "PasswordAuthNotSupported");
-			*response = jsonResponse.getJSONString();
-			return false;
-		}
+#ifdef _WIN32
+		return WSAGetLastError() == WSAEWOULDBLOCK ? -EAGAIN : -ECONNRESET;
+#else
+		return -errno;
+#endif
 	}
-	else if (this->getAuthMethod() == SupportedAuthMethods::AUTH_PUBLICKEY)
-	{
+	sshTunnelForwarder->sshSocketBytesReceived += received;
+	return received;
+}
 
-		string test = this->getSSHPrivateKey();
+/**
+	The libssh2 allocator callbacks for the tunnel's session, the session's abstract is the SSHTunnelForwarder so the memory is counted against 
+	the tunnel's SSHSessionMemory. Anything that hands memory to libssh2 for it to free, e.g. the signature from a sign callback, has to 
+	allocate it with allocateForSession
+*/
+void *SSHTunnelForwarder::allocateForSession(size_t count, void **abstract)
+{
+	return ((SSHTunnelForwarder*)*abstract)->sessionMemory.allocate(count);
+}
 
-		//boost::replace_all(test, "\n", "");
+void *SSHTunnelForwarder::reallocateForSession(void *ptr, size_t count, void **abstract)
+{
+	return ((SSHTunnelForwarder*)*abstract)->sessionMemory.reallocate(ptr, count);
+}
 
-		unsigned char * key = (unsigned char *)test.c_str();
+void SSHTunnelForwarder::freeForSession(void *ptr, void **abstract)
+{
+	((SSHTunnelForwarder*)*abstract)->sessionMemory.release(ptr);
+}
 
-		size_t sizeofkey = strlen((char*)key);
-		cout << key << endl;
-		stringstream logstream;
-		logstream << "Using public key authentication for SSH Host: " << this->getSSHHostnameOrIPAddress();
-		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "authenticateSSHServer");
-		if (chosenAuthMethod & SupportedAuthMethods::AUTH_PUBLICKEY)
-		{
-			//int result = 0;
-			//int result = libssh2_userauth_publickey(this->session, this->getUsername().c_str(), key, sizeofkey, SSHTunnelForwarder::publicKeyAuthComplete, 0);
-			string certpassPhrase = this->getSSHPrivateKeyCertPassphrase();
-			int result;
-			if (this->getSSHPrivateKeyCertPassphrase().empty())
-			{
-				result = libssh2_userauth_publickey_frommemory(this->session, this->getUsername().c_str(), strlen(username.c_str()), nullptr, 0, test.c_str(), sizeofkey, nullptr);
-			}
-			else
-			{
-				result = libssh2_userauth_publickey_frommemory(this->session, this->getUsername().c_str(), strlen(username.c_str()), nullptr, 0, test.c_str(), sizeofkey, this->getSSHPrivateKeyCertPassphrase().c_str());
-			}
-			if (result != 0)
-			{
-				char * error = NULL;
-				int len = 0;
-				int errbuf = 0;
-				libssh2_session_last_error(this->session, &error, &len, errbuf);
-				this->logger->writeToLog(std::string(error), "SSHTunnelForwarder", "auth");
-				JSONResponseGenerator jsonResponse;
-				if (result == -16) //Invalid certificate passphrase
-				{
-					jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "KeyPassphraseError");
-				}
-				else if (result == -18) //Username and private key combination doesn't match
-				{
-					jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "UsernameNotMatchedToPrivateKey");
-				}
-				else
-				{
-					jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "InvalidPublicKey");
-				}
-				
-				*response = jsonResponse.getJSONString();
-				return false;
-				
-			}
-		}
-	}
+/**
+	@return SSHSessionMemory The memory accounting for the tunnel's SSH session
+*/
+SSHSessionMemory *SSHTunnelForwarder::getSessionMemory()
+{
+	return &this->sessionMemory;
+}
 
-	//At this point we've authenticated
-	stringstream logstream;
-	logstream << "SSH Host " << this->getSSHHostnameOrIPAddress() << " authenticated successfully";
-	this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "authencateSSHServer");
-	*response = this->setupPortForwarding();
-	return true;
+/**
+	Start the next step of setting up the tunnel. Each step has its own deadline, so a slow SSH server fails the step that it is slow in, 
+	rather than holding up the thread for as long as the OS or the SSH server lets it
+	@param step The setup step that is starting
+*/
+void SSHTunnelForwarder::beginSetupStep(SetupStep step)
+{
+	this->setupStep = step;
+	this->setupStepTimedOut = false;
+	this->setupStepDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(this->getSetupStepTimeout());
 }
 
 /**
-	At this point the SSH server has successfully connected and authenticated, so now we need to set up the port forwarding so that 
-	MySQL traffic can be tunnelled through the SSH server.
-	@return string The JSON response generated by the JSONResponseGenerator class
+	Get how long the current setup step is allowed to take, from the SSH host's section or [app_settings]
+	@return int The timeout in seconds
 */
-string SSHTunnelForwarder::setupPortForwarding()
+int SSHTunnelForwarder::getSetupStepTimeout()
 {
-	this->listensock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
-#ifdef WIN32
-	if (this->listensock == INVALID_SOCKET)
+	if (this->setupStep == SetupStep::SETUP_CONNECT)
 	{
-		stringstream logstream;
-		logstream << "Failed to open listen socket";
-		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
-		JSONResponseGenerator jsonResponse;
-		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_GENERAL_ERROR, "SocketCreationFailed");
-		return jsonResponse.getJSONString();
+		return HostSettings::getSetting(this->getSSHHostnameOrIPAddress(), "sshConnectTimeoutSeconds", StaticSettings::AppSettings::sshConnectTimeoutSeconds);
 	}
-#else
-	if (listensock == -1) {
-		stringstream logstream;
-		logstream << "Failed to open listen socket";
-		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
-		JSONResponseGenerator jsonResponse;
-		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_GENERAL_ERROR, "SocketCreationFailed");
-		return jsonResponse.getJSONString();
+	else if (this->setupStep == SetupStep::SETUP_HANDSHAKE)
+	{
+		return HostSettings::getSetting(this->getSSHHostnameOrIPAddress(), "sshHandshakeTimeoutSeconds", StaticSettings::AppSettings::sshHandshakeTimeoutSeconds);
 	}
-#endif
-	int sockopt = 1;
-	setsockopt(this->listensock, SOL_SOCKET, SO_REUSEADDR, (char*)&sockopt, sizeof(sockopt));
-	//setsockopt(this->listensock, SOL_SOCKET, SO_REUSEADDR, &this->sockopt, sizeof(this->sockopt));
+	return HostSettings::getSetting(this->getSSHHostnameOrIPAddress(), "sshAuthTimeoutSeconds", StaticSettings::AppSettings::sshAuthTimeoutSeconds);
+}
 
-	sin.sin_family = AF_INET;
-	sin.sin_port = htons(this->localListenPort);
-	if (INADDR_NONE == (sin.sin_addr.s_addr = inet_addr("127.0.0.1"))) {
-		TunnelManager tunnelManager(this->logger);
-		stringstream logstream;
-		logstream << "Failed to set up local listen details";
-		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
-		this->closeSSHSessions();
-		JSONResponseGenerator jsonResponse;
-		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_GENERAL_ERROR, "LocalListenDetailsFailed");
-		return jsonResponse.getJSONString();
+/**
+	Whether the current setup step is waiting for the SSH socket to be readable, writable or both. While connecting that is writable, 
+	after that it is whichever direction libssh2 is blocked on
+	@param waitToRead Set to true if the step is waiting for the SSH socket to be readable
+	@param waitToWrite Set to true if the step is waiting for the SSH socket to be writable
+*/
+void SSHTunnelForwarder::getSetupStepDirections(bool *waitToRead, bool *waitToWrite)
+{
+	*waitToRead = false;
+	*waitToWrite = false;
+	if (this->setupStep == SetupStep::SETUP_CONNECT)
+	{
+		*waitToWrite = true;
+		return;
 	}
-	sinlen = sizeof(sin);
-	int result = ::bind(this->listensock, (struct sockaddr *)&sin, sinlen);
-	if (result == -1) 
+	int directions = libssh2_session_block_directions(this->session);
+	*waitToRead = (directions & LIBSSH2_SESSION_BLOCK_INBOUND) != 0;
+	*waitToWrite = (directions & LIBSSH2_SESSION_BLOCK_OUTBOUND) != 0;
+	if (!*waitToRead && !*waitToWrite)
 	{
+		*waitToRead = true;
+	}
+}
 
-		//The socket bind failed, probably because the local listen socket has only just closed - can take
-		//a few seconds for the socket to clean up completely.
-		//Get a new socket instead, but if it fails more than 3 times, actually send a failure so we don't
-		//get stuck in a loop
-		if (this->socketBindRetryCount < 3)
-		{
-			this->socketBindRetryCount++;
-			stringstream logstream;
-			logstream << "Local listen port " << this->localListenPort << " bind failed. Retrying ";
-			logstream << this->socketBindRetryCount << " of 3";
+/**
+	@return time_point When the current setup step times out
+*/
+std::chrono::steady_clock::time_point SSHTunnelForwarder::getSetupStepDeadline()
+{
+	return this->setupStepDeadline;
+}
+
+/**
+	Check whether the current setup step's deadline has passed. If it has setupStepTimedOut is set, so the next call to carry on the step fails 
+	with the timeout
+	@return bool True if the step has timed out
+*/
+bool SSHTunnelForwarder::hasSetupStepExpired()
+{
+	if (!this->setupStepTimedOut && std::chrono::steady_clock::now() >= this->setupStepDeadline)
+	{
+		this->setupStepTimedOut = true;
+	}
+	return this->setupStepTimedOut;
+}
+
+/**
+	@return The socket connected to the SSH server, that the setup steps wait on
+*/
 #ifdef _WIN32
-			logstream << "Bind Error: " << WSAGetLastError();
+SOCKET SSHTunnelForwarder::getSSHSocket()
 #else
-			logstream << "Bind Error: " << strerror(result);
+int SSHTunnelForwarder::getSSHSocket()
 #endif
-			this->closeSSHSessions();
-			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
-			TunnelManager tunnelManager(this->logger);
-			this->localListenPort = tunnelManager.findNextAvailableLocalSSHPort();
-			logstream.clear();
-			logstream.str(string());
-			logstream << "Now got local listen port of " << this->localListenPort;
-			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
-			return this->setupPortForwarding();
+{
+	return this->sshSocket;
+}
+
+/**
+	Wait on this thread until the SSH socket is ready for the current setup step to carry on, or the step's deadline has passed. 
+	If poll fails there is nothing left to wait for, so the step is failed the same as if it had timed out
+*/
+void SSHTunnelForwarder::waitForSetupStep()
+{
+	bool waitToRead = false;
+	bool waitToWrite = false;
+	this->getSetupStepDirections(&waitToRead, &waitToWrite);
+
+	while (!this->hasSetupStepExpired())
+	{
+		long long remainingMs = std::chrono::duration_cast<std::chrono::milliseconds>(this->setupStepDeadline - std::chrono::steady_clock::now()).count() + 1;
+		struct pollfd pollSocket;
+		pollSocket.fd = this->sshSocket;
+		pollSocket.events = (waitToRead ? POLLIN : 0) | (waitToWrite ? POLLOUT : 0);
+		pollSocket.revents = 0;
+#ifdef _WIN32
+		int ready = WSAPoll(&pollSocket, 1, (INT)(remainingMs > 0 ? remainingMs : 0));
+#else
+		int ready = poll(&pollSocket, 1, (int)(remainingMs > 0 ? remainingMs : 0));
+#endif
+		if (ready > 0)
+		{
+			return;
 		}
-		else
+#ifdef _WIN32
+		if (ready < 0)
+#else
+		if (ready < 0 && errno != EINTR)
+#endif
 		{
-			this->closeSSHSessions();
-			stringstream logstream;
-			logstream << "Failed to bind socket";
-			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
-			JSONResponseGenerator jsonResponse;
-			jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_GENERAL_ERROR, "SocketBindFailed");
-			return jsonResponse.getJSONString();
+			this->setupStepTimedOut = true;
+			return;
 		}
 	}
-	if (-1 == listen(listensock, SOMAXCONN)) {
-		stringstream logstream;
-		logstream << "Failed to start socket listening";
-		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
-		this->closeSSHSessions();
-		JSONResponseGenerator jsonResponse;
-		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_GENERAL_ERROR, "SocketListenFailed");
-		return jsonResponse.getJSONString();
-	}
+}
 
+/**
+	Fail the setup because the current step took longer than its timeout
+	@param response Set to the JSON error response
+	@param error Set to SETUP_TIMEOUT
+	@return SetupResult Always SETUP_FAILED so it can be returned straight from continueAuthentication
+*/
+SSHTunnelForwarder::SetupResult SSHTunnelForwarder::failSetupStepTimedOut(string *response, ErrorStatus& error)
+{
 	stringstream logstream;
-	logstream << "Waiting for TCP connection on " << inet_ntoa(sin.sin_addr) << ":" << ntohs(sin.sin_port);
-	this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarder");
-
+	logstream << "SSH Host " << this->getSSHHostnameOrIPAddress() << " authentication timed out after " << this->getSetupStepTimeout() << " seconds";
+	this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "continueAuthentication");
+	this->abandonSetup();
 	JSONResponseGenerator jsonResponse;
-	map<string, string> data;
-	data["LocalTunnelPort"] = std::to_string(this->localListenPort);
-	jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_SUCCESS, "", &data);
-	return jsonResponse.getJSONString();
+	jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "SSHSetupTimeout");
+	*response = jsonResponse.getJSONString();
+	error = ErrorStatus::SETUP_TIMEOUT;
+	return SetupResult::SETUP_FAILED;
 }
 
 /**
-	The SSH tunnelling has been set up so now accept connections through the SSH tunnel
+	Check whether the last connect() on a non-blocking socket is still in progress rather than having failed
+	@return bool True if the connect is in progress
 */
-void SSHTunnelForwarder::acceptAndForwardToMySQL()
+bool SSHTunnelForwarder::connectInProgress()
 {
-	this->forwardsock = accept(listensock, (struct sockaddr *)&sin, &sinlen);
-	if (this->hasSessionBeenClosed)
-	{
 #ifdef _WIN32
-		closesocket(this->listensock);
+	return WSAGetLastError() == WSAEWOULDBLOCK;
 #else
-		close(this->listensock);
+	return errno == EINPROGRESS;
 #endif
-		return;
-	}
+}
+
+/**
+	Get the result of a non-blocking connect once the socket is writable
+	@param sock The socket that was connecting
+	@return int 0 if the socket connected, otherwise the socket error
+*/
+#ifdef _WIN32
+int SSHTunnelForwarder::getSocketError(SOCKET sock)
+#else
+int SSHTunnelForwarder::getSocketError(int sock)
+#endif
+{
+	int socketError = 0;
+	socklen_t socketErrorLength = sizeof(socketError);
+	if (getsockopt(sock, SOL_SOCKET, SO_ERROR, (char*)&socketError, &socketErrorLength) != 0)
+	{
+		return -1;
+	}
+	return socketError;
+}
+
+/**
+	Authenticate with the SSH server using the tunnel's password or private key, on a session connectToSSHAndFingerprint has set up, waiting on 
+	this thread for the SSH server. New tunnels are authenticated by a TunnelSetupLoop instead, this is used when reconnecting the session
+	@param response The JSON error response if the authentication failed
+	@param error The reason the authentication failed, see continueAuthentication
+	@return bool True if the session authenticated
+*/
+bool SSHTunnelForwarder::authenticateSSHServer(string *response, ErrorStatus& error)
+{
+	//The key may have been evicted from the cache since the tunnel was created, this thread can wait for it to be decoded again
+	this->privateKeyLoaded = false;
+	this->startAuthentication();
+	SetupResult result;
+	while ((result = this->continueAuthentication(response, error)) == SetupResult::SETUP_WAITING)
+	{
+		this->waitForSetupStep();
+	}
+	return result == SetupResult::SETUP_DONE;
+}
+
+/**
+	Look up the tunnel's private key in the PrivateKeyCache, decoding and caching it if it isn't cached yet. Decoding an encrypted key runs 
+	the deliberately slow key derivation, so TunnelManager does this on the request thread before the setup is handed to a setup loop, 
+	where continueAuthentication only uses the result
+*/
+void SSHTunnelForwarder::loadPrivateKey()
+{
+	if (this->privateKeyLoaded)
+	{
+		return;
+	}
+	PrivateKeyCache privateKeyCache(this->logger);
+	this->privateKeyLookup = privateKeyCache.getKey(this->getSSHPrivateKey(), this->getSSHPrivateKeyCertPassphrase(), &this->privateKeyCacheKey, 
+		&this->publicKeyBlob);
+	this->privateKeyLoaded = true;
+}
+
+/**
+	Start authenticating on a session that has finished its handshake, continueAuthentication does the authentication
+*/
+void SSHTunnelForwarder::startAuthentication()
+{
+	this->beginSetupStep(SetupStep::SETUP_USERAUTH);
+	this->userauthStep = UserauthStep::USERAUTH_LIST;
+}
+
+/**
+	Carry on authenticating with the SSH server using the tunnel's password or private key, for as far as it can go without waiting for the 
+	SSH server. This is called straight after startAuthentication, then each time the SSH socket is ready or the step's deadline has passed
+	@param response The JSON error response if the authentication failed
+	@param error The reason the authentication failed, PASSWORD_AUTH_FAILED if the SSH server rejected the password or SETUP_TIMEOUT if the SSH server
+	didn't respond within sshAuthTimeoutSeconds
+	@return SetupResult SETUP_WAITING until the SSH server has answered, then SETUP_DONE if the session authenticated or SETUP_FAILED
+*/
+SSHTunnelForwarder::SetupResult SSHTunnelForwarder::continueAuthentication(string *response, ErrorStatus& error)
+{
+	error = ErrorStatus::AUTH_FAILED;
+	if (this->setupStepTimedOut)
+	{
+		return this->failSetupStepTimedOut(response, error);
+	}
+
+	int result = -1;
+	if (this->userauthStep == UserauthStep::USERAUTH_LIST)
+	{
+		char *userauthlist = libssh2_userauth_list(this->session, this->getUsername().c_str(), strlen(this->getUsername().c_str()));
+		if (userauthlist == NULL && libssh2_session_last_errno(this->session) == LIBSSH2_ERROR_EAGAIN)
+		{
+			return SetupResult::SETUP_WAITING;
+		}
+		if (userauthlist == NULL)
+		{
+			userauthlist = (char*)"";
+		}
+
+		if (strstr(userauthlist, "password"))
+		{
+			supportedAuthMethod |= AUTH_PASSWORD;
+		}
+		if (strstr(userauthlist, "publickey"))
+		{
+			supportedAuthMethod |= AUTH_PUBLICKEY;
+		}
+
+		//Are we authenticating via a password
+		if (this->getAuthMethod() == SupportedAuthMethods::AUTH_PASSWORD)
+		{
+			stringstream logstream;
+			logstream << "Using password authentication for SSH Host: " << this->getSSHHostnameOrIPAddress();
+			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "continueAuthentication");
+			if (!(chosenAuthMethod & SupportedAuthMethods::AUTH_PASSWORD))
+			{
+				logstream.clear();
+				logstream.str(string());
+				this->abandonSetup();
+				logstream << "SSH Host: " << this->getSSHHostnameOrIPAddress() << " does not support password authentication";
+				this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "continueAuthentication");
+				JSONResponseGenerator jsonResponse;
+				jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_AUTH_FAILURE, "PasswordAuthNotSupported");
+				*response = jsonResponse.getJSONString();
+				return SetupResult::SETUP_FAILED;
+			}
+			this->userauthStep = UserauthStep::USERAUTH_PASSWORD;
+		}
+		else if (this->getAuthMethod() == SupportedAuthMethods::AUTH_PUBLICKEY)
+		{
+			stringstream logstream;
+			logstream << "Using public key authentication for SSH Host: " << this->getSSHHostnameOrIPAddress();
+			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "continueAuthentication");
+			if (!(chosenAuthMethod & SupportedAuthMethods::AUTH_PUBLICKEY))
+			{
+				this->userauthStep = UserauthStep::USERAUTH_FINISHED;
+			}
+			else
+			{
+				this->loadPrivateKey();
+				if (this->privateKeyLookup == PrivateKeyCache::LookupResult::KEY_WRONG_PASSPHRASE)
+				{
+					libssh2_session_set_last_error(this->session, LIBSSH2_ERROR_FILE, "Unable to decrypt the private key with the passphrase");
+					return this->failPublicKeyAuthentication(response, LIBSSH2_ERROR_FILE);
+				}
+				this->userauthStep = this->privateKeyLookup == PrivateKeyCache::LookupResult::KEY_AVAILABLE ? UserauthStep::USERAUTH_CACHED_KEY : UserauthStep::USERAUTH_KEY;
+			}
+		}
+		else
+		{
+			this->userauthStep = UserauthStep::USERAUTH_FINISHED;
+		}
+	}
+
+	if (this->userauthStep == UserauthStep::USERAUTH_PASSWORD)
+	{
+		result = libssh2_userauth_password(this->session, this->getUsername().c_str(), this->getPassword().c_str());
+		if (result == LIBSSH2_ERROR_EAGAIN)
+		{
+			return SetupResult::SETUP_WAITING;
+		}
+		stringstream logstream;
+		if (result < 0)
+		{
+			this->abandonSetup();
+			logstream << "SSH Host " << this->getSSHHostnameOrIPAddress() << " password authentication failed";
+			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "continueAuthentication");
+			JSONResponseGenerator jsonResponse;
+			jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "PasswordAuthFailed");
+			*response =  jsonResponse.getJSONString();
+			error = ErrorStatus::PASSWORD_AUTH_FAILED;
+			return SetupResult::SETUP_FAILED;
+		}
+		logstream << "Successfully authenticated with SSH Host: " << this->getSSHHostnameOrIPAddress();
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "continueAuthentication");
+		this->userauthStep = UserauthStep::USERAUTH_FINISHED;
+	}
+
+	if (this->userauthStep == UserauthStep::USERAUTH_CACHED_KEY)
+	{
+		void *signAbstract = &this->privateKeyCacheKey;
+		result = libssh2_userauth_publickey(this->session, this->getUsername().c_str(), (const unsigned char*)this->publicKeyBlob.data(), 
+			this->publicKeyBlob.length(), PrivateKeyCache::signWithCachedKey, &signAbstract);
+		if (result == LIBSSH2_ERROR_EAGAIN)
+		{
+			return SetupResult::SETUP_WAITING;
+		}
+		//If the server rejected the key the cached key is fine, for anything else let libssh2 try the key itself
+		if (result == 0 || result == LIBSSH2_ERROR_PUBLICKEY_UNVERIFIED)
+		{
+			if (result != 0)
+			{
+				return this->failPublicKeyAuthentication(response, result);
+			}
+			this->userauthStep = UserauthStep::USERAUTH_FINISHED;
+		}
+		else
+		{
+			this->userauthStep = UserauthStep::USERAUTH_KEY;
+		}
+	}
+
+	if (this->userauthStep == UserauthStep::USERAUTH_KEY)
+	{
+		string key = this->getSSHPrivateKey();
+		string certpassPhrase = this->getSSHPrivateKeyCertPassphrase();
+		const char *keyPassphrase = certpassPhrase.empty() ? nullptr : certpassPhrase.c_str();
+		result = libssh2_userauth_publickey_frommemory(this->session, this->getUsername().c_str(), strlen(username.c_str()), nullptr, 0, key.c_str(), 
+			strlen(key.c_str()), keyPassphrase);
+		if (result == LIBSSH2_ERROR_EAGAIN)
+		{
+			return SetupResult::SETUP_WAITING;
+		}
+		if (result != 0)
+		{
+			return this->failPublicKeyAuthentication(response, result);
+		}
+		this->userauthStep = UserauthStep::USERAUTH_FINISHED;
+	}
+
+	//At this point we've authenticated
+	stringstream logstream;
+	logstream << "SSH Host " << this->getSSHHostnameOrIPAddress() << " authenticated successfully";
+	this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "continueAuthentication");
+	error = ErrorStatus::SUCCESS;
+	return SetupResult::SETUP_DONE;
+}
+
+/**
+	Fail the setup because the SSH server didn't accept the tunnel's private key, and give up on the session with abandonSetup
+	@param response Set to the JSON error response
+	@param result The libssh2 error from the public key authentication
+	@return SetupResult Always SETUP_FAILED so it can be returned straight from continueAuthentication
+*/
+SSHTunnelForwarder::SetupResult SSHTunnelForwarder::failPublicKeyAuthentication(string *response, int result)
+{
+	char * error = NULL;
+	int len = 0;
+	int errbuf = 0;
+	libssh2_session_last_error(this->session, &error, &len, errbuf);
+	this->logger->writeToLog(std::string(error), "SSHTunnelForwarder", "auth");
+	JSONResponseGenerator jsonResponse;
+	if (result == -16) //Invalid certificate passphrase
+	{
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "KeyPassphraseError");
+	}
+	else if (result == -18) //Username and private key combination doesn't match
+	{
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "UsernameNotMatchedToPrivateKey");
+	}
+	else
+	{
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "InvalidPublicKey");
+	}
+	*response = jsonResponse.getJSONString();
+	this->abandonSetup();
+	return SetupResult::SETUP_FAILED;
+}
+
+/**
+	Whether the tunnel's MySQL server is one the operator has allowed to be forwarded to directly, without SSH, see DirectForwarder
+	@return bool True if startDirectForwarding should be used instead of connecting to the SSH server
+*/
+bool SSHTunnelForwarder::isDirectDestination()
+{
+	return DirectForwarder::isDirectDestination(this->getSSHHostnameOrIPAddress(), this->getMySQLHost(), this->getMySQLPort());
+}
+
+/**
+	Set up the tunnel's local port for forwarding directly to the MySQL server. No SSH session is created, acceptAndForwardToMySQL
+	forwards the clients with the DirectForwarder
+	@param response Set to the JSON response generated by the JSONResponseGenerator class, the same as for a tunnel through SSH
+	@return bool True if the MySQL host has been resolved and the local port is listening for clients
+*/
+bool SSHTunnelForwarder::startDirectForwarding(string *response)
+{
+	this->directForwarding = true;
+	stringstream logstream;
+	logstream << "Tunnel to " << this->getMySQLHost() << ":" << this->getMySQLPort() << " for SSH host " << this->getSSHHostnameOrIPAddress();
+	logstream << " is in directForwardDestinations, forwarding directly without SSH";
+	this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "startDirectForwarding");
+	if (!DirectForwarder::resolveServer(this->logger, this->getMySQLHost(), this->getMySQLPort(), &this->directServerAddress))
+	{
+		JSONResponseGenerator jsonResponse;
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "DNSResolutionFailed");
+		*response = jsonResponse.getJSONString();
+		return false;
+	}
+	return this->setupPortForwarding(response);
+}
+
+/**
+	At this point the SSH server has successfully connected and authenticated, so now we need to set up the port forwarding so that 
+	MySQL traffic can be tunnelled through the SSH server.
+	@param response Set to the JSON response generated by the JSONResponseGenerator class, with the local port if it succeeded
+	@return bool True if the local port is listening for clients
+*/
+bool SSHTunnelForwarder::setupPortForwarding(string *response)
+{
+	this->listensock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+#ifdef WIN32
+	if (this->listensock == INVALID_SOCKET)
+	{
+		stringstream logstream;
+		logstream << "Failed to open listen socket";
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
+		JSONResponseGenerator jsonResponse;
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_GENERAL_ERROR, "SocketCreationFailed");
+		*response = jsonResponse.getJSONString();
+		return false;
+	}
+#else
+	if (listensock == -1) {
+		stringstream logstream;
+		logstream << "Failed to open listen socket";
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
+		JSONResponseGenerator jsonResponse;
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_GENERAL_ERROR, "SocketCreationFailed");
+		*response = jsonResponse.getJSONString();
+		return false;
+	}
+#endif
+	int sockopt = 1;
+	setsockopt(this->listensock, SOL_SOCKET, SO_REUSEADDR, (char*)&sockopt, sizeof(sockopt));
+	//setsockopt(this->listensock, SOL_SOCKET, SO_REUSEADDR, &this->sockopt, sizeof(this->sockopt));
+
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(this->localListenPort);
+	if (INADDR_NONE == (sin.sin_addr.s_addr = inet_addr("127.0.0.1"))) {
+		TunnelManager tunnelManager(this->logger);
+		stringstream logstream;
+		logstream << "Failed to set up local listen details";
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
+		this->closeSSHSessions();
+		JSONResponseGenerator jsonResponse;
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_GENERAL_ERROR, "LocalListenDetailsFailed");
+		*response = jsonResponse.getJSONString();
+		return false;
+	}
+	sinlen = sizeof(sin);
+	int result = ::bind(this->listensock, (struct sockaddr *)&sin, sinlen);
+	if (result == -1) 
+	{
+
+		//The socket bind failed, probably because the local listen socket has only just closed - can take
+		//a few seconds for the socket to clean up completely.
+		//Get a new socket instead, but if it fails more than 3 times, actually send a failure so we don't
+		//get stuck in a loop
+		if (this->socketBindRetryCount < 3)
+		{
+			this->socketBindRetryCount++;
+			stringstream logstream;
+			logstream << "Local listen port " << this->localListenPort << " bind failed. Retrying ";
+			logstream << this->socketBindRetryCount << " of 3";
+#ifdef _WIN32
+			logstream << "Bind Error: " << WSAGetLastError();
+#else
+			logstream << "Bind Error: " << strerror(result);
+#endif
+			this->closeSSHSessions();
+			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
+			TunnelManager tunnelManager(this->logger);
+			this->localListenPort = tunnelManager.findNextAvailableLocalSSHPort();
+			logstream.clear();
+			logstream.str(string());
+			logstream << "Now got local listen port of " << this->localListenPort;
+			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
+			return this->setupPortForwarding(response);
+		}
+		else
+		{
+			this->closeSSHSessions();
+			stringstream logstream;
+			logstream << "Failed to bind socket";
+			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
+			JSONResponseGenerator jsonResponse;
+			jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_GENERAL_ERROR, "SocketBindFailed");
+			*response = jsonResponse.getJSONString();
+			return false;
+		}
+	}
+	if (-1 == listen(listensock, SOMAXCONN)) {
+		stringstream logstream;
+		logstream << "Failed to start socket listening";
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
+		this->closeSSHSessions();
+		JSONResponseGenerator jsonResponse;
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_GENERAL_ERROR, "SocketListenFailed");
+		*response = jsonResponse.getJSONString();
+		return false;
+	}
+
+	stringstream logstream;
+	logstream << "Waiting for TCP connection on " << inet_ntoa(sin.sin_addr) << ":" << ntohs(sin.sin_port);
+	this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarder");
+
+	JSONResponseGenerator jsonResponse;
+	map<string, string> data;
+	data["LocalTunnelPort"] = std::to_string(this->localListenPort);
+	jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_SUCCESS, "", &data);
+	*response = jsonResponse.getJSONString();
+	return true;
+}
+
+/**
+	Forward another local port through this tunnel's SSH session, for a tunnel in the same batch with the same SSH server and credentials, 
+	so it doesn't need an SSH session of its own. Clients on the port get their own direct-tcpip channel to the port's MySQL server. This 
+	must be called before acceptAndForwardToMySQL is started. If the port can't be opened only that port fails, the session is left as it is
+	@param localPort The local port to listen on, set to the port that was used if it had to be changed because the bind failed
+	@param mysqlHost The MySQL server clients on the port are forwarded to
+	@param mysqlPort The port of the MySQL server
+	@param response Set to the JSON response generated by the JSONResponseGenerator class, with the local port if it succeeded
+	@return bool True if the local port is listening for clients
+*/
+bool SSHTunnelForwarder::addSharedPort(int *localPort, string mysqlHost, int mysqlPort, string *response)
+{
+	JSONResponseGenerator jsonResponse;
+	SharedPort sharedPort;
+	sharedPort.mysqlHost = mysqlHost;
+	sharedPort.mysqlPort = mysqlPort;
+	//The same as setupPortForwarding, a port that has only just closed can fail to bind so up to 3 other ports are tried
+	for (int attempt = 0; attempt <= 3; attempt++)
+	{
+		if (attempt > 0)
+		{
+			TunnelManager tunnelManager(this->logger);
+			*localPort = tunnelManager.findNextAvailableLocalSSHPort();
+		}
+		sharedPort.listensock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+#ifdef _WIN32
+		if (sharedPort.listensock == INVALID_SOCKET)
+#else
+		if (sharedPort.listensock == -1)
+#endif
+		{
+			this->logger->writeToLog("Failed to open listen socket", "SSHTunnelForwarder", "addSharedPort");
+			jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_GENERAL_ERROR, "SocketCreationFailed");
+			*response = jsonResponse.getJSONString();
+			return false;
+		}
+		int sockopt = 1;
+		setsockopt(sharedPort.listensock, SOL_SOCKET, SO_REUSEADDR, (char*)&sockopt, sizeof(sockopt));
+		struct sockaddr_in portAddr;
+		memset(&portAddr, 0, sizeof(portAddr));
+		portAddr.sin_family = AF_INET;
+		portAddr.sin_port = htons(*localPort);
+		portAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
+		if (::bind(sharedPort.listensock, (struct sockaddr *)&portAddr, sizeof(portAddr)) == 0 && listen(sharedPort.listensock, SOMAXCONN) == 0)
+		{
+			sharedPort.localPort = *localPort;
+			this->sharedPorts.push_back(sharedPort);
+			this->sessionShared = true;
+
+			stringstream logstream;
+			logstream << "Waiting for TCP connection on 127.0.0.1:" << *localPort << " for " << mysqlHost << ":" << mysqlPort;
+			logstream << ", sharing the SSH session of the tunnel on port " << this->localListenPort;
+			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "addSharedPort");
+			map<string, string> data;
+			data["LocalTunnelPort"] = std::to_string(*localPort);
+			jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_SUCCESS, "", &data);
+			*response = jsonResponse.getJSONString();
+			return true;
+		}
+		stringstream logstream;
+#ifdef _WIN32
+		logstream << "Local listen port " << *localPort << " bind failed. Bind Error: " << WSAGetLastError();
+		closesocket(sharedPort.listensock);
+#else
+		logstream << "Local listen port " << *localPort << " bind failed. Bind Error: " << strerror(errno);
+		close(sharedPort.listensock);
+#endif
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "addSharedPort");
+	}
+	jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_GENERAL_ERROR, "SocketBindFailed");
+	*response = jsonResponse.getJSONString();
+	return false;
+}
+
+/**
+	Take the spare channel that was opened while no clients were waiting so it can be used by a client that has just connected. 
+	The MySQL server closes connections that don't authenticate within its connect_timeout, so a spare channel that has been idle 
+	for longer than spareChannelMaxIdleSeconds, or that the MySQL server has already closed, is thrown away
+	@return LIBSSH2_CHANNEL The open channel or NULL if there is no usable spare channel
+*/
+LIBSSH2_CHANNEL *SSHTunnelForwarder::takeSpareChannel()
+{
+	LIBSSH2_CHANNEL *readyChannel = this->spareChannel;
+	this->spareChannel = NULL;
+	if (readyChannel == NULL)
+	{
+		return NULL;
+	}
+	if (libssh2_channel_eof(readyChannel) || std::time(nullptr) - this->spareChannelOpenedTime > StaticSettings::AppSettings::spareChannelMaxIdleSeconds)
+	{
+		stringstream logstream;
+		logstream << "Spare channel to " << this->getMySQLHost() << ":" << this->getMySQLPort() << " is stale, opening a new channel instead";
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "takeSpareChannel");
+		libssh2_channel_set_blocking(readyChannel, 1);
+		libssh2_channel_close(readyChannel);
+		libssh2_channel_free(readyChannel);
+		libssh2_session_set_blocking(this->session, 0);
+		return NULL;
+	}
+	return readyChannel;
+}
+
+/**
+	Open direct-tcpip channels to the MySQL server for the clients that are waiting for one, without blocking on the SSH server. 
+	libssh2 can only open one channel at a time on a session, so clients get their channel in the order they connected. While a client 
+	is waiting, anything it sends is read into its pending data so that it can be written to the channel the moment it is open.
+	When no clients are waiting and eagerChannelOpen is enabled, a spare channel is opened instead, so the next client that connects 
+	doesn't have to wait a full SSH round trip for its channel
+*/
+void SSHTunnelForwarder::progressChannelOpen()
+{
+	if (!this->channelOpenInProgress)
+	{
+		ForwardedConnection *waitingConnection = NULL;
+		for (vector<ForwardedConnection*>::iterator it = this->connections.begin(); it != this->connections.end(); ++it)
+		{
+			if ((*it)->state == ForwardedConnection::ConnectionState::OPENING_CHANNEL)
+			{
+				waitingConnection = *it;
+				break;
+			}
+		}
+		if (waitingConnection != NULL)
+		{
+			//The spare channel goes to the tunnel's own MySQL server, not the MySQL server of a port sharing the session
+			LIBSSH2_CHANNEL *readyChannel = waitingConnection->localPort == this->localListenPort ? this->takeSpareChannel() : NULL;
+			if (readyChannel != NULL)
+			{
+				this->channelOpened(waitingConnection, readyChannel, this->spareChannelWindowSize);
+				return;
+			}
+			this->channelOpenConnection = waitingConnection;
+		}
+		else if (!StaticSettings::AppSettings::eagerChannelOpen || this->spareChannel != NULL || this->spareChannelFailed)
+		{
+			return;
+		}
+		this->channelOpenInProgress = true;
+		this->openingChannelWindowSize = this->getChannelWindowSize();
+		this->channelOpenStarted = std::chrono::steady_clock::now();
+	}
+
+	//The originating host and port are only sent when the open starts, after that libssh2 carries on with the open that is already in progress
+	string destinationHost = this->getMySQLHost();
+	int destinationPort = this->getMySQLPort();
+	string originHost = "127.0.0.1";
+	int originPort = this->localListenPort;
+	if (this->channelOpenConnection != NULL)
+	{
+		destinationHost = this->channelOpenConnection->destinationHost;
+		destinationPort = this->channelOpenConnection->destinationPort;
+		originHost = this->channelOpenConnection->clientHost;
+		originPort = this->channelOpenConnection->clientPort;
+	}
+	LIBSSH2_CHANNEL *openedChannel = this->openDirectTcpipChannel(destinationHost, destinationPort, originHost, originPort);
+	if (openedChannel == NULL && libssh2_session_last_errno(this->session) == LIBSSH2_ERROR_EAGAIN)
+	{
+		return;
+	}
+
+	ForwardedConnection *openedFor = this->channelOpenConnection;
+	this->channelOpenConnection = NULL;
+	this->channelOpenInProgress = false;
+	if (openedChannel == NULL)
+	{
+		char * error = NULL;
+		int len = 0;
+		libssh2_session_last_error(this->session, &error, &len, 0);
+		stringstream logstream;
+		logstream << "Could not open the direct tcpip channel for port forwarding.";
+		logstream << "Note that this could be a server problem so please check your SSH servers logs";
+		logstream << "LIBSSH2 SSH Error: " << error;
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "progressChannelOpen");
+		if (openedFor != NULL)
+		{
+			this->closeConnection(openedFor);
+		}
+		else
+		{
+			//Don't keep trying to open spare channels, the clients will get the error when they connect
+			this->spareChannelFailed = true;
+		}
+		return;
+	}
+
+	//Opening a channel is a single round trip to the SSH server, which gives the round trip time of the link
+	LinkStatistics linkStatistics(this->getSSHHostnameOrIPAddress(), this->getSSHPort());
+	linkStatistics.recordRoundTrip(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - this->channelOpenStarted).count());
+
+	if (openedFor != NULL)
+	{
+		this->channelOpened(openedFor, openedChannel, this->openingChannelWindowSize);
+	}
+	else if (this->spareChannel == NULL && destinationHost == this->getMySQLHost() && destinationPort == this->getMySQLPort())
+	{
+		//Either the eager spare channel, or the client it was opened for disconnected while it was opening
+		this->spareChannel = openedChannel;
+		this->spareChannelOpenedTime = std::time(nullptr);
+		this->spareChannelWindowSize = this->openingChannelWindowSize;
+	}
+	else
+	{
+		libssh2_channel_set_blocking(openedChannel, 1);
+		libssh2_channel_close(openedChannel);
+		libssh2_channel_free(openedChannel);
+		libssh2_session_set_blocking(this->session, 0);
+	}
+}
+
+/**
+	Start, or carry on, opening a direct-tcpip channel to the MySQL server. This does the same as libssh2_channel_direct_tcpip_ex except the 
+	channel's window and maximum packet size come from the configuration instead of the libssh2 defaults, which limit a channel to 
+	window size / round trip time no matter how fast the link is
+	@param destinationHost The MySQL server the channel is opened to
+	@param destinationPort The port of the MySQL server
+	@param originHost The host the connection to the MySQL server is being forwarded for
+	@param originPort The port the connection to the MySQL server is being forwarded for
+	@return LIBSSH2_CHANNEL* The opened channel, NULL if it failed or is still opening (libssh2_session_last_errno is LIBSSH2_ERROR_EAGAIN)
+*/
+LIBSSH2_CHANNEL *SSHTunnelForwarder::openDirectTcpipChannel(string destinationHost, int destinationPort, string originHost, int originPort)
+{
+	//The direct-tcpip request data is string host, uint32 port, string originator host, uint32 originator port (RFC 4254 7.2)
+	std::vector<unsigned char> message;
+	unsigned int values[4] = { (unsigned int)destinationHost.length(), (unsigned int)destinationPort, (unsigned int)originHost.length(), (unsigned int)originPort };
+	const string *strings[2] = { &destinationHost, &originHost };
+	for (int index = 0; index < 2; index++)
+	{
+		for (int shift = 24; shift >= 0; shift -= 8)
+		{
+			message.push_back((unsigned char)(values[index * 2] >> shift));
+		}
+		message.insert(message.end(), strings[index]->begin(), strings[index]->end());
+		for (int shift = 24; shift >= 0; shift -= 8)
+		{
+			message.push_back((unsigned char)(values[index * 2 + 1] >> shift));
+		}
+	}
+	return libssh2_channel_open_ex(this->session, "direct-tcpip", sizeof("direct-tcpip") - 1, this->openingChannelWindowSize,
+		this->getChannelMaxPacketSize(), (const char*)message.data(), (unsigned int)message.size());
+}
+
+/**
+	The window size new channels are opened with, from channelWindowSize in the SSH host's section or [app_settings]. When it is set to auto
+	the window is sized from the round trip time and throughput measured on previous channels to the same SSH server, up to channelMaxWindowSize
+	@return unsigned int The window size in bytes
+*/
+unsigned int SSHTunnelForwarder::getChannelWindowSize()
+{
+	string windowSize = HostSettings::getSetting(this->getSSHHostnameOrIPAddress(), "channelWindowSize", StaticSettings::AppSettings::channelWindowSize);
+	if (windowSize == "auto")
+	{
+		int maxWindowSize = HostSettings::getSetting(this->getSSHHostnameOrIPAddress(), "channelMaxWindowSize", StaticSettings::AppSettings::channelMaxWindowSize);
+		if (maxWindowSize < LIBSSH2_CHANNEL_WINDOW_DEFAULT)
+		{
+			maxWindowSize = LIBSSH2_CHANNEL_WINDOW_DEFAULT;
+		}
+		LinkStatistics linkStatistics(this->getSSHHostnameOrIPAddress(), this->getSSHPort());
+		return linkStatistics.suggestChannelWindowSize(LIBSSH2_CHANNEL_WINDOW_DEFAULT, maxWindowSize);
+	}
+	try
+	{
+		int configuredWindowSize = stoi(windowSize);
+		if (configuredWindowSize > 0)
+		{
+			return configuredWindowSize;
+		}
+	}
+	catch (std::exception&)
+	{
+	}
+	stringstream logstream;
+	logstream << "Invalid channelWindowSize " << windowSize << " for " << this->getSSHHostnameOrIPAddress() << ". Using " << LIBSSH2_CHANNEL_WINDOW_DEFAULT;
+	this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "getChannelWindowSize");
+	return LIBSSH2_CHANNEL_WINDOW_DEFAULT;
+}
+
+/**
+	The maximum packet size new channels are opened with, from channelMaxPacketSize in the SSH host's section or [app_settings]. 
+	libssh2 drops SSH packets bigger than about 35000 bytes, so it can't be set above the libssh2 default of 32768
+	@return unsigned int The maximum packet size in bytes
+*/
+unsigned int SSHTunnelForwarder::getChannelMaxPacketSize()
+{
+	int packetSize = HostSettings::getSetting(this->getSSHHostnameOrIPAddress(), "channelMaxPacketSize", StaticSettings::AppSettings::channelMaxPacketSize);
+	if (packetSize <= 0 || packetSize > LIBSSH2_CHANNEL_PACKET_DEFAULT)
+	{
+		return LIBSSH2_CHANNEL_PACKET_DEFAULT;
+	}
+	return packetSize;
+}
+
+/**
+	The channel for the connection is open, anything the client sent while it was opening is already in the connection's buffer and is sent
+	with the rest of the client's data
+	@param connection The client connection that was waiting for the channel
+	@param openedChannel The channel that has been opened to the MySQL server
+	@param windowSize The window size the channel was opened with
+*/
+void SSHTunnelForwarder::channelOpened(ForwardedConnection *connection, LIBSSH2_CHANNEL *openedChannel, unsigned int windowSize)
+{
+	connection->channel = openedChannel;
+	connection->channelWindowSize = windowSize;
+	connection->state = ForwardedConnection::ConnectionState::FORWARDING;
+}
+
+/**
+	Accept a new client on the local listen port, or a port sharing the session. The client is forwarded through its own channel on the 
+	tunnel's SSH session
+	@param sharedPort The shared port the client connected to, NULL for the tunnel's own local port
+*/
+void SSHTunnelForwarder::acceptClient(SharedPort *sharedPort)
+{
+	struct sockaddr_in clientAddr;
+	socklen_t clientAddrLen = sizeof(clientAddr);
+#ifdef _WIN32
+	SOCKET clientSocket = accept(sharedPort != NULL ? sharedPort->listensock : this->listensock, (struct sockaddr *)&clientAddr, &clientAddrLen);
+	if (clientSocket == INVALID_SOCKET)
+	{
+		return;
+	}
+#else
+	int clientSocket = accept(sharedPort != NULL ? sharedPort->listensock : this->listensock, (struct sockaddr *)&clientAddr, &clientAddrLen);
+	if (clientSocket == -1)
+	{
+		return;
+	}
+#endif
+	//The client is only read from and written to when poll() says it's ready, a slow client must never block the other clients on the tunnel
+	SSHTunnelForwarder::setSocketBlocking(clientSocket, false);
+	this->addClient(clientSocket, &clientAddr, sharedPort);
+}
+
+/**
+	Add a client that has been accepted on the local listen port to the tunnel. Its channel is opened by progressChannelOpen
+	@param clientSocket The client's socket
+	@param clientAddr The client's address
+	@param sharedPort The shared port the client connected to, NULL for the tunnel's own local port
+*/
+#ifdef _WIN32
+void SSHTunnelForwarder::addClient(SOCKET clientSocket, struct sockaddr_in *clientAddr, SharedPort *sharedPort)
+#else
+void SSHTunnelForwarder::addClient(int clientSocket, struct sockaddr_in *clientAddr, SharedPort *sharedPort)
+#endif
+{
+	SSHTunnelForwarder::setTCPKeepalive(clientSocket);
+	ForwardedConnection *connection = new ForwardedConnection(clientSocket, inet_ntoa(clientAddr->sin_addr), ntohs(clientAddr->sin_port));
+	connection->localPort = sharedPort != NULL ? sharedPort->localPort : this->localListenPort;
+	connection->destinationHost = sharedPort != NULL ? sharedPort->mysqlHost : this->getMySQLHost();
+	connection->destinationPort = sharedPort != NULL ? sharedPort->mysqlPort : this->getMySQLPort();
+	this->connections.push_back(connection);
+
+	stringstream logstream;
+	logstream << "Forwarding connection from " << connection->clientHost << ":" << connection->clientPort << " to ";
+	logstream << connection->destinationHost << ":" << connection->destinationPort << " (" << this->connections.size() << " client(s) on port " << connection->localPort << ")";
+	this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "acceptClient");
+}
+
+/**
+	Forward any data that is waiting between the client and its channel. Each direction has its own buffer, so data is only read from one side 
+	while the other side is keeping up, and nothing here waits for a socket or the channel to become ready
+	@param connection The client connection, its clientReadable is set if poll() reported the client socket as readable
+	@return bool False if the client or the MySQL server has disconnected, or forwarding failed, and the connection should be closed
+*/
+bool SSHTunnelForwarder::forwardConnectionData(ForwardedConnection *connection)
+{
+	if (connection->clientReadable && !connection->clientReadPaused && !connection->clientDisconnected)
+	{
+		if (!this->receiveFromClient(connection))
+		{
+			return false;
+		}
+	}
+	if (!this->forwardChannelData(connection) || !this->sendToClient(connection))
+	{
+		return false;
+	}
+	this->updateBackpressure(connection);
+	connection->releaseIdleBuffers();
+	return !this->hasConnectionFinished(connection);
+}
+
+/**
+	Pass the client's data on to its channel, and read whatever the MySQL server has sent from the channel, once the channel is open
+	@param connection The client connection
+	@return bool False if writing to or reading from the channel failed
+*/
+bool SSHTunnelForwarder::forwardChannelData(ForwardedConnection *connection)
+{
+	size_t quantum = (size_t)StaticSettings::AppSettings::schedulerQuantumBytes;
+	connection->scheduleQuantumLeft = StaticSettings::AppSettings::schedulerQuantumBytes > 0 ? quantum : (size_t)-1;
+	connection->scheduleLimited = false;
+	connection->bandwidthLimited = false;
+	if (connection->state == ForwardedConnection::ConnectionState::FORWARDING)
+	{
+		return this->writeToChannel(connection) && this->readFromChannel(connection);
+	}
+	return true;
+}
+
+/**
+	Check whether the client or the MySQL server has disconnected. Only once everything the side that disconnected sent has been passed on 
+	to the other side is the connection finished
+	@param connection The client connection
+	@return bool True if the connection should be closed
+*/
+bool SSHTunnelForwarder::hasConnectionFinished(ForwardedConnection *connection)
+{
+	if (connection->clientDisconnected && (connection->state != ForwardedConnection::ConnectionState::FORWARDING || connection->clientToServer.empty()))
+	{
+		stringstream logstream;
+		if (connection->state == ForwardedConnection::ConnectionState::FORWARDING)
+		{
+			logstream << "The client " << connection->clientHost << ":" << connection->clientPort << " has disconnected";
+		}
+		else
+		{
+			logstream << "The client " << connection->clientHost << ":" << connection->clientPort << " disconnected before the channel was opened";
+		}
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "hasConnectionFinished");
+		return true;
+	}
+	if (connection->serverDisconnected && connection->serverToClient.empty())
+	{
+		stringstream logstream;
+		logstream << "The server at " << connection->destinationHost << ":" << connection->destinationPort << " closed the connection for client ";
+		logstream << connection->clientHost << ":" << connection->clientPort;
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "hasConnectionFinished");
+		return true;
+	}
+	return false;
+}
+
+/**
+	Read whatever the client has sent into the client to server buffer
+	@param connection The client connection
+	@return bool False if reading from the client failed
+*/
+bool SSHTunnelForwarder::receiveFromClient(ForwardedConnection *connection)
+{
+	size_t length = 0;
+	char *writePointer = this->getClientReceiveSpace(connection, &length);
+	if (length == 0)
+	{
+		return true;
+	}
+	int received = recv(connection->clientSocket, writePointer, (int)length, 0);
+	if (received == 0)
+	{
+		connection->clientDisconnected = true;
+	}
+	else if (received < 0)
+	{
+		if (SSHTunnelForwarder::socketWouldBlock())
+		{
+			return true;
+		}
+		stringstream logstream;
+#ifdef _WIN32
+		logstream << "Failed to receive data on socket. Error: " << WSAGetLastError();
+#else
+		logstream << "Failed to receive data on socket. Error: " << strerror(errno);
+#endif
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "receiveFromClient");
+		return false;
+	}
+	else
+	{
+		connection->clientToServer.commitWrite(received);
+	}
+	return true;
+}
+
+/**
+	Get where the next data from the client should be received into
+	@param connection The client connection
+	@param length Set to how much can be received, 0 if the buffer is full, or the buffer pool is at forwardBufferPoolMaxBytes in which 
+	case the data waits in the socket until a buffer is free
+	@return char* Where to receive into
+*/
+char *SSHTunnelForwarder::getClientReceiveSpace(ForwardedConnection *connection, size_t *length)
+{
+	*length = 0;
+	if (!connection->attachBuffer(&connection->clientToServer))
+	{
+		return NULL;
+	}
+	char *writePointer = connection->clientToServer.getWritePointer(length);
+	if (connection->state == ForwardedConnection::ConnectionState::OPENING_CHANNEL)
+	{
+		//Don't hold more than channelOpenBufferSize for a client that is still waiting for its channel
+		size_t openingSpace = (size_t)StaticSettings::AppSettings::channelOpenBufferSize > connection->clientToServer.size() ?
+			StaticSettings::AppSettings::channelOpenBufferSize - connection->clientToServer.size() : 0;
+		*length = *length < openingSpace ? *length : openingSpace;
+	}
+	return writePointer;
+}
+
+/**
+	Write as much of the client to server buffer to the channel as the channel's window allows. Whatever doesn't fit stays in the buffer
+	until the SSH server adjusts the window
+	@param connection The client connection
+	@return bool False if writing to the channel failed
+*/
+bool SSHTunnelForwarder::writeToChannel(ForwardedConnection *connection)
+{
+	connection->channelWriteHeld = this->shouldHoldChannelWrite(connection);
+	if (connection->channelWriteHeld)
+	{
+		return true;
+	}
+	bool wrote = false;
+	while (!connection->clientToServer.empty())
+	{
+		size_t length = 0;
+		const char *readPointer = connection->clientToServer.getReadPointer(&length);
+		size_t allowed = this->allowTransfer(connection, length);
+		if (allowed == 0)
+		{
+			break;
+		}
+		ssize_t written = libssh2_channel_write(connection->channel, readPointer, allowed);
+		this->finishTransfer(connection, allowed, written > 0 ? written : 0);
+		if (LIBSSH2_ERROR_EAGAIN == written)
+		{
+			break;
+		}
+		if (written < 0)
+		{
+			stringstream logstream;
+			logstream << "libssh2_channel_write failed. Error: " << (int)written;
+			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "writeToChannel");
+			return false;
+		}
+		connection->clientToServer.consume(written);
+		this->totalBytesToServer += written;
+		this->totalChannelWrites++;
+		wrote = true;
+	}
+	if (wrote)
+	{
+		connection->lastChannelWrite = std::chrono::steady_clock::now();
+	}
+	return true;
+}
+
+/**
+	Most MySQL packets are small, and every channel write is an SSH packet with its own padding and MAC. So while a client is sending a burst 
+	of small packets, whatever arrives within channelWriteCoalesceMicroseconds of the last channel write is held back and written together, 
+	unless there's at least channelWriteCoalesceBytes of it. The first write after a quiet spell always goes straight away, so a client 
+	waiting on a single query doesn't see any extra latency
+	@param connection The client connection
+	@return bool True if the client's data should be left in the buffer for now
+*/
+bool SSHTunnelForwarder::shouldHoldChannelWrite(ForwardedConnection *connection)
+{
+	if (StaticSettings::AppSettings::channelWriteCoalesceMicroseconds <= 0 || connection->clientToServer.empty() || connection->clientDisconnected ||
+		connection->clientToServer.size() >= (size_t)StaticSettings::AppSettings::channelWriteCoalesceBytes || connection->clientReadPaused)
+	{
+		return false;
+	}
+	return std::chrono::steady_clock::now() - connection->lastChannelWrite < 
+		std::chrono::microseconds(StaticSettings::AppSettings::channelWriteCoalesceMicroseconds);
+}
+
+/**
+	How long the forwarding loop can wait for the sockets before it has to come back and write data that is being held back for coalescing, 
+	carry on with a connection that used up its quantum, or retry a connection that was held back by a bandwidth limit
+	@return long The timeout in microseconds, at most 100ms
+*/
+long SSHTunnelForwarder::getLoopTimeoutMicroseconds()
+{
+	long timeout = 100000;
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	for (vector<ForwardedConnection*>::iterator it = this->connections.begin(); it != this->connections.end(); ++it)
+	{
+		//A connection that used its whole quantum still has data to forward, so it carries on straight away on the next pass
+		if ((*it)->scheduleLimited)
+		{
+			return 0;
+		}
+		if ((*it)->bandwidthLimited)
+		{
+			for (vector<BandwidthLimiter*>::iterator limiter = this->bandwidthLimiters.begin(); limiter != this->bandwidthLimiters.end(); ++limiter)
+			{
+				long wait = (*limiter)->getWaitMicroseconds();
+				timeout = wait < timeout ? wait : timeout;
+			}
+		}
+		if ((*it)->channelWriteHeld)
+		{
+			long remaining = (long)std::chrono::duration_cast<std::chrono::microseconds>((*it)->lastChannelWrite + 
+				std::chrono::microseconds(StaticSettings::AppSettings::channelWriteCoalesceMicroseconds) - now).count();
+			remaining = remaining > 0 ? remaining : 0;
+			timeout = remaining < timeout ? remaining : timeout;
+		}
+	}
+	return timeout;
+}
+
+/**
+	Read from the channel into the server to client buffer until there is nothing left to read or the client has fallen too far behind. 
+	While the channel isn't being read the SSH window isn't adjusted, so the SSH server stops sending for this channel
+	@param connection The client connection
+	@return bool False if reading from the channel failed
+*/
+bool SSHTunnelForwarder::readFromChannel(ForwardedConnection *connection)
+{
+	while (!connection->channelReadPaused && !connection->serverDisconnected)
+	{
+		if (!connection->serverToClient.hasMemory())
+		{
+			//Only take a buffer from the pool when libssh2 has data queued for the channel, or the channel needs to be read to see the EOF
+			unsigned long readAvailable = 0;
+			libssh2_channel_window_read_ex(connection->channel, &readAvailable, NULL);
+			if (readAvailable == 0 && !libssh2_channel_eof(connection->channel))
+			{
+				break;
+			}
+		}
+		if (!connection->attachBuffer(&connection->serverToClient))
+		{
+			//The data stays queued in libssh2 until a buffer is free, the SSH window isn't adjusted in the meantime
+			break;
+		}
+		size_t length = 0;
+		char *writePointer = connection->serverToClient.getWritePointer(&length);
+		size_t allowed = this->allowTransfer(connection, length);
+		if (allowed == 0)
+		{
+			break;
+		}
+		ssize_t received = libssh2_channel_read(connection->channel, writePointer, allowed);
+		this->finishTransfer(connection, allowed, received > 0 ? received : 0);
+		if (LIBSSH2_ERROR_EAGAIN == received)
+		{
+			break;
+		}
+		if (received < 0)
+		{
+			stringstream logstream;
+			logstream << "libssh2_channel_read failed. Error: " << (int)received;
+			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "readFromChannel");
+			return false;
+		}
+		connection->serverToClient.commitWrite(received);
+		if (received > 0)
+		{
+			this->totalBytesFromServer += received;
+			this->trackServerData(connection, received);
+		}
+		if (libssh2_channel_eof(connection->channel))
+		{
+			connection->serverDisconnected = true;
+		}
+		if (received == 0)
+		{
+			break;
+		}
+		if (connection->serverToClient.size() >= (size_t)StaticSettings::AppSettings::forwardBufferHighWatermark)
+		{
+			connection->channelReadPaused = true;
+		}
+	}
+	return true;
+}
+
+/**
+	Keep track of bursts of data from the MySQL server (e.g. a large result set) so the throughput of the link can be measured. A burst ends
+	once no data has arrived for a while, as the time in between queries says nothing about the link
+	@param connection The client connection
+	@param bytes The number of bytes just read from the channel
+*/
+void SSHTunnelForwarder::trackServerData(ForwardedConnection *connection, size_t bytes)
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (connection->burstBytes > 0 && now - connection->lastServerData > std::chrono::milliseconds(250))
+	{
+		this->endServerBurst(connection);
+	}
+	if (connection->burstBytes == 0)
+	{
+		connection->burstStarted = now;
+	}
+	connection->burstBytes += bytes;
+	connection->lastServerData = now;
+}
+
+/**
+	Record the throughput of the connection's current burst. Small bursts are mostly round trip time, so only bursts large enough to have 
+	filled a good part of the window are recorded
+	@param connection The client connection
+*/
+void SSHTunnelForwarder::endServerBurst(ForwardedConnection *connection)
+{
+	if (connection->burstBytes >= 262144)
+	{
+		LinkStatistics linkStatistics(this->getSSHHostnameOrIPAddress(), this->getSSHPort());
+		linkStatistics.recordTransfer(connection->burstBytes, 
+			std::chrono::duration_cast<std::chrono::milliseconds>(connection->lastServerData - connection->burstStarted).count(), connection->channelWindowSize);
+	}
+	connection->burstBytes = 0;
+}
+
+/**
+	Get the tunnel's connections in the order they should be forwarded on this pass. Each pass starts with the next connection along, and 
+	each connection can only forward schedulerQuantumBytes on a pass (deficit round robin), so a client pulling a large result set can't 
+	starve an interactive client on the same tunnel, and the connections take turns at the bandwidth that is left
+	@return vector The connections, a copy as connections are removed from the list as they close
+*/
+vector<ForwardedConnection*> SSHTunnelForwarder::getScheduledConnections()
+{
+	vector<ForwardedConnection*> scheduledConnections = this->connections;
+	if (scheduledConnections.size() > 1)
+	{
+		size_t first = this->schedulePass++ % scheduledConnections.size();
+		std::rotate(scheduledConnections.begin(), scheduledConnections.begin() + first, scheduledConnections.end());
+	}
+	return scheduledConnections;
+}
+
+/**
+	Work out how much of a channel read or write can go ahead, from what is left of the connection's quantum for this pass and the 
+	bandwidth limits. finishTransfer has to be called afterwards with what was actually transferred
+	@param connection The client connection
+	@param wanted The number of bytes to read or write
+	@return size_t The number of bytes that can be read or written, 0 if the connection has to wait for the next pass or for bandwidth
+*/
+size_t SSHTunnelForwarder::allowTransfer(ForwardedConnection *connection, size_t wanted)
+{
+	if (wanted == 0)
+	{
+		return 0;
+	}
+	if (connection->scheduleQuantumLeft == 0)
+	{
+		connection->scheduleLimited = true;
+		return 0;
+	}
+	size_t allowed = wanted < connection->scheduleQuantumLeft ? wanted : connection->scheduleQuantumLeft;
+	for (size_t i = 0; i < this->bandwidthLimiters.size() && allowed > 0; i++)
+	{
+		size_t granted = this->bandwidthLimiters[i]->take(allowed);
+		//Whatever this limiter didn't allow goes back to the limiters that had already allowed it
+		for (size_t j = 0; j < i; j++)
+		{
+			this->bandwidthLimiters[j]->giveBack(allowed - granted);
+		}
+		allowed = granted;
+	}
+	if (allowed == 0)
+	{
+		connection->bandwidthLimited = true;
+	}
+	return allowed;
+}
+
+/**
+	Take what was transferred from the connection's quantum, and give the bandwidth that wasn't used back to the limiters
+	@param connection The client connection
+	@param allowed What allowTransfer returned
+	@param transferred The number of bytes that were actually read or written
+*/
+void SSHTunnelForwarder::finishTransfer(ForwardedConnection *connection, size_t allowed, size_t transferred)
+{
+	connection->scheduleQuantumLeft -= transferred < connection->scheduleQuantumLeft ? transferred : connection->scheduleQuantumLeft;
+	if (transferred < allowed)
+	{
+		for (vector<BandwidthLimiter*>::iterator it = this->bandwidthLimiters.begin(); it != this->bandwidthLimiters.end(); ++it)
+		{
+			(*it)->giveBack(allowed - transferred);
+		}
+	}
+}
+
+/**
+	Send as much of the server to client buffer as the client socket will take without blocking
+	@param connection The client connection
+	@return bool False if sending to the client failed
+*/
+bool SSHTunnelForwarder::sendToClient(ForwardedConnection *connection)
+{
+	while (!connection->serverToClient.empty())
+	{
+		//Everything read from the channel on this pass goes in one send, including the part that has wrapped around the buffer
+		size_t length = 0;
+		size_t wrappedLength = 0;
+		const char *readPointer = connection->serverToClient.getReadPointer(&length);
+		const char *wrappedPointer = connection->serverToClient.getWrappedReadPointer(&wrappedLength);
+#ifdef _WIN32
+		WSABUF buffers[2];
+		buffers[0].buf = const_cast<char*>(readPointer);
+		buffers[0].len = (ULONG)length;
+		buffers[1].buf = const_cast<char*>(wrappedPointer);
+		buffers[1].len = (ULONG)wrappedLength;
+		DWORD bytesSent = 0;
+		int sent = WSASend(connection->clientSocket, buffers, wrappedLength > 0 ? 2 : 1, &bytesSent, 0, NULL, NULL) == 0 ? (int)bytesSent : -1;
+#else
+		struct iovec buffers[2];
+		buffers[0].iov_base = const_cast<char*>(readPointer);
+		buffers[0].iov_len = length;
+		buffers[1].iov_base = const_cast<char*>(wrappedPointer);
+		buffers[1].iov_len = wrappedLength;
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = buffers;
+		message.msg_iovlen = wrappedLength > 0 ? 2 : 1;
+		int sent = (int)sendmsg(connection->clientSocket, &message, MSG_NOSIGNAL);
+#endif
+		if (sent < 0 && SSHTunnelForwarder::socketWouldBlock())
+		{
+			break;
+		}
+		if (sent <= 0)
+		{
+			stringstream logstream;
+#ifdef _WIN32
+			logstream << "Failed to send to forward socket. Error: " << WSAGetLastError();
+#else
+			logstream << "Failed to send to forward socket. Error: " << strerror(errno);
+#endif
+			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "sendToClient");
+			return false;
+		}
+		connection->serverToClient.consume(sent);
+	}
+	return true;
+}
+
+/**
+	Stop reading from a side of the connection once its buffer reaches the high watermark, and only start again once the other side has 
+	drained it down to the low watermark, so reading doesn't flip on and off for every packet
+	@param connection The client connection
+*/
+void SSHTunnelForwarder::updateBackpressure(ForwardedConnection *connection)
+{
+	size_t highWatermark = (size_t)StaticSettings::AppSettings::forwardBufferHighWatermark;
+	size_t lowWatermark = (size_t)StaticSettings::AppSettings::forwardBufferLowWatermark;
+
+	size_t clientHighWatermark = highWatermark;
+	if (connection->state == ForwardedConnection::ConnectionState::OPENING_CHANNEL && 
+		(size_t)StaticSettings::AppSettings::channelOpenBufferSize < clientHighWatermark)
+	{
+		clientHighWatermark = StaticSettings::AppSettings::channelOpenBufferSize;
+	}
+	if (connection->clientToServer.size() >= clientHighWatermark)
+	{
+		connection->clientReadPaused = true;
+	}
+	else if (connection->clientReadPaused && connection->clientToServer.size() <= lowWatermark)
+	{
+		connection->clientReadPaused = false;
+	}
+
+	if (connection->serverToClient.size() >= highWatermark)
+	{
+		connection->channelReadPaused = true;
+	}
+	else if (connection->channelReadPaused && connection->serverToClient.size() <= lowWatermark)
+	{
+		connection->channelReadPaused = false;
+	}
+}
+
+/**
+	Close a single client connection and its channel and remove it from the tunnel. The tunnel carries on listening for other clients
+	@param connection The client connection to close
+*/
+void SSHTunnelForwarder::closeConnection(ForwardedConnection *connection)
+{
+	if (this->channelOpenConnection == connection)
+	{
+		//libssh2 carries on with the open, it'll be kept as the spare channel when it completes
+		this->channelOpenConnection = NULL;
+	}
+	for (vector<ForwardedConnection*>::iterator it = this->connections.begin(); it != this->connections.end(); ++it)
+	{
+		if (*it == connection)
+		{
+			this->connections.erase(it);
+			break;
+		}
+	}
+	this->endServerBurst(connection);
+#ifdef HAVE_LIBURING
+	if (this->ioUring != NULL && this->ioUring->cancelClientIO(connection))
+	{
+		//The ring deletes the connection once it has finished with the connection's buffers
+		connection->closeConnection();
+		if (this->session != NULL)
+		{
+			libssh2_session_set_blocking(this->session, 0);
+		}
+		return;
+	}
+#endif
+	connection->closeConnection();
+	delete connection;
+	if (this->session != NULL)
+	{
+		libssh2_session_set_blocking(this->session, 0);
+	}
+}
+
+/**
+	Switch a socket between blocking and non-blocking mode
+	@param sock The socket to change
+	@param blocking True for blocking mode, false for non-blocking mode
+*/
+#ifdef _WIN32
+void SSHTunnelForwarder::setSocketBlocking(SOCKET sock, bool blocking)
+{
+	u_long mode = blocking ? 0 : 1;
+	ioctlsocket(sock, FIONBIO, &mode);
+}
+#else
+void SSHTunnelForwarder::setSocketBlocking(int sock, bool blocking)
+{
+	int flags = fcntl(sock, F_GETFL, 0);
+	fcntl(sock, F_SETFL, blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+}
+#endif
+
+/**
+	Add a socket to the sockets the forwarding loop waits on with poll()
+	@param pollSockets The sockets the loop is going to poll
+	@param sock The socket to wait on
+	@param events The poll events to wait for
+	@return int The socket's index in pollSockets
+*/
+#ifdef _WIN32
+int SSHTunnelForwarder::addPollSocket(vector<struct pollfd> *pollSockets, SOCKET sock, short events)
+#else
+int SSHTunnelForwarder::addPollSocket(vector<struct pollfd> *pollSockets, int sock, short events)
+#endif
+{
+	struct pollfd pollSocket;
+	pollSocket.fd = sock;
+	pollSocket.events = events;
+	pollSocket.revents = 0;
+	pollSockets->push_back(pollSocket);
+	return (int)pollSockets->size() - 1;
+}
+
+/**
+	Turn on TCP keepalive for a socket, using tcpKeepaliveIdleSeconds, tcpKeepaliveIntervalSeconds and tcpKeepaliveCount, so a peer that has 
+	gone away without closing the connection (a dropped VPN or NAT entry, a host that lost power) is noticed by the OS and the socket fails, 
+	instead of the socket staying open until the tunnel expires. Nothing is changed if tcpKeepaliveIdleSeconds is 0
+	@param sock The socket to change
+*/
+#ifdef _WIN32
+void SSHTunnelForwarder::setTCPKeepalive(SOCKET sock)
+{
+	if (StaticSettings::AppSettings::tcpKeepaliveIdleSeconds <= 0)
+	{
+		return;
+	}
+	//Windows always sends 10 probes, only the idle time and the interval can be set
+	struct tcp_keepalive keepalive;
+	keepalive.onoff = 1;
+	keepalive.keepalivetime = (u_long)StaticSettings::AppSettings::tcpKeepaliveIdleSeconds * 1000;
+	keepalive.keepaliveinterval = (u_long)StaticSettings::AppSettings::tcpKeepaliveIntervalSeconds * 1000;
+	DWORD bytesReturned = 0;
+	WSAIoctl(sock, SIO_KEEPALIVE_VALS, &keepalive, sizeof(keepalive), NULL, 0, &bytesReturned, NULL, NULL);
+}
+#else
+void SSHTunnelForwarder::setTCPKeepalive(int sock)
+{
+	if (StaticSettings::AppSettings::tcpKeepaliveIdleSeconds <= 0)
+	{
+		return;
+	}
+	int enabled = 1;
+	setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &enabled, sizeof(enabled));
+	int idle = StaticSettings::AppSettings::tcpKeepaliveIdleSeconds;
+	int interval = StaticSettings::AppSettings::tcpKeepaliveIntervalSeconds;
+	int count = StaticSettings::AppSettings::tcpKeepaliveCount;
+#ifdef TCP_KEEPIDLE
+	setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+#elif defined(TCP_KEEPALIVE)
+	setsockopt(sock, IPPROTO_TCP, TCP_KEEPALIVE, &idle, sizeof(idle));
+#endif
+#ifdef TCP_KEEPINTVL
+	setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+#endif
+#ifdef TCP_KEEPCNT
+	setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+#endif
+#ifdef TCP_USER_TIMEOUT
+	//Keepalive probes aren't sent while there is unacknowledged data, so data that is never acknowledged fails the socket in the same time
+	unsigned int userTimeout = (unsigned int)(idle + interval * count) * 1000;
+	setsockopt(sock, IPPROTO_TCP, TCP_USER_TIMEOUT, &userTimeout, sizeof(userTimeout));
+#endif
+}
+#endif
+
+/**
+	Check whether the last failed send() or recv() on a non-blocking socket failed only because the socket wasn't ready
+	@return bool True if the call should be tried again once poll() says the socket is ready
+*/
+bool SSHTunnelForwarder::socketWouldBlock()
+{
+#ifdef _WIN32
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+/**
+	The SSH tunnelling has been set up so now accept connections through the SSH tunnel. Any number of clients (up to maxClientsPerTunnel at the same time)
+	can connect to the local listen port, one after another or at the same time, and each is forwarded through its own channel on the same SSH session.
+	This carries on until the tunnel expires or is closed by the PHP API
+*/
+void SSHTunnelForwarder::acceptAndForwardToMySQL()
+{
+	if (this->directForwarding)
+	{
+		SSHTunnelForwarder::setSocketBlocking(this->listensock, false);
+		this->forwardingStartedTime = std::time(nullptr);
+		DirectForwarder directForwarder(this->logger, this->getMySQLHost(), this->getMySQLPort(), this->directServerAddress, this->localListenPort);
+		directForwarder.acceptAndForward((int)this->listensock, &this->closeRequested, &this->hasSessionBeenClosed);
+		this->totalBytesToServer = directForwarder.getBytesToServer();
+		this->totalBytesFromServer = directForwarder.getBytesFromServer();
+		this->closeSSHSessions();
+		return;
+	}
+
+	/* Must use non-blocking IO hereafter due to the current libssh2 API */
+	libssh2_session_set_blocking(this->session, 0);
+	this->forwardingStartedTime = std::time(nullptr);
+	this->startSSHKeepalive();
+
+	//The tunnel's own limit is checked first, so a tunnel that is over its own limit doesn't take bandwidth from the shared limits
+	BandwidthLimiter *hostBandwidthLimiter = BandwidthLimiter::getHostLimiter(this->getSSHHostnameOrIPAddress());
+	if (this->tunnelBandwidthLimiter.isLimited())
+	{
+		this->bandwidthLimiters.push_back(&this->tunnelBandwidthLimiter);
+	}
+	if (hostBandwidthLimiter != NULL)
+	{
+		this->bandwidthLimiters.push_back(hostBandwidthLimiter);
+	}
+	if (BandwidthLimiter::getGlobalLimiter() != NULL)
+	{
+		this->bandwidthLimiters.push_back(BandwidthLimiter::getGlobalLimiter());
+	}
+#ifdef HAVE_LIBURING
+	//The ring only accepts on one listen socket, so a session shared by several ports uses the poll() loop
+	if (this->sharedPorts.empty() && ClientIOUring::isSupported() && this->forwardWithIOUring())
+	{
+		return;
+	}
+#endif
+	SSHTunnelForwarder::setSocketBlocking(this->listensock, false);
+	for (vector<SharedPort>::iterator it = this->sharedPorts.begin(); it != this->sharedPorts.end(); ++it)
+	{
+		SSHTunnelForwarder::setSocketBlocking(it->listensock, false);
+	}
+
+	//poll() rather than select(), a busy server can hand out socket numbers past FD_SETSIZE
+	vector<struct pollfd> pollSockets;
+	vector<int> clientPollIndexes;
+	while (!this->closeRequested && !this->hasSessionBeenClosed && (this->isSSHServerAlive() || this->reconnectSSHSession()))
+	{
+		if (this->sessionShared)
+		{
+			this->closeRequestedPorts();
+			if (this->closeRequested)
+			{
+				break;
+			}
+		}
+		pollSockets.clear();
+		clientPollIndexes.clear();
+
+		//Watch the SSH socket whenever there is a channel, so channel data for any of the clients is picked up straight away
+		bool hasChannels = !this->connections.empty() || this->spareChannel != NULL || this->channelOpenInProgress;
+		bool sshBlockedOutbound = (libssh2_session_block_directions(this->session) & LIBSSH2_SESSION_BLOCK_OUTBOUND) != 0;
+		int sshPollIndex = -1;
+		if (hasChannels || sshBlockedOutbound)
+		{
+			sshPollIndex = SSHTunnelForwarder::addPollSocket(&pollSockets, this->sshSocket, (hasChannels ? POLLIN : 0) | (sshBlockedOutbound ? POLLOUT : 0));
+		}
+		//A client that is waiting for a buffer isn't watched, otherwise poll() would keep returning for data that can't be read yet
+		bool buffersAvailable = BufferPool::canAcquire();
+		//Ports sharing the session each count as a tunnel towards maxClientsPerTunnel
+		bool accepting = this->connections.size() < (size_t)StaticSettings::AppSettings::maxClientsPerTunnel * (this->sharedPorts.size() + 1);
+		int listenPollIndex = -1;
+#ifdef _WIN32
+		if (accepting && this->listensock != INVALID_SOCKET)
+#else
+		if (accepting && this->listensock != -1)
+#endif
+		{
+			listenPollIndex = SSHTunnelForwarder::addPollSocket(&pollSockets, this->listensock, POLLIN);
+		}
+		int sharedPortsPollIndex = (int)pollSockets.size();
+		for (vector<SharedPort>::iterator it = this->sharedPorts.begin(); accepting && it != this->sharedPorts.end(); ++it)
+		{
+			SSHTunnelForwarder::addPollSocket(&pollSockets, it->listensock, POLLIN);
+		}
+		for (vector<ForwardedConnection*>::iterator it = this->connections.begin(); it != this->connections.end(); ++it)
+		{
+			//A client is only read from while its data is being passed on, and only written to when there is data waiting for it
+			short events = 0;
+			if (!(*it)->clientReadPaused && !(*it)->clientDisconnected && (buffersAvailable || (*it)->clientToServer.hasMemory()))
+			{
+				events |= POLLIN;
+			}
+			if (!(*it)->serverToClient.empty())
+			{
+				events |= POLLOUT;
+			}
+			clientPollIndexes.push_back(events != 0 ? SSHTunnelForwarder::addPollSocket(&pollSockets, (*it)->clientSocket, events) : -1);
+		}
+
+		//The loop timeout is in microseconds, poll() waits in whole milliseconds
+		int timeoutMs = (int)((this->getLoopTimeoutMicroseconds() + 999) / 1000);
+#ifdef _WIN32
+		//WSAPoll fails on an empty set of sockets
+		if (pollSockets.empty())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+			rc = 0;
+		}
+		else
+		{
+			rc = WSAPoll(pollSockets.data(), (ULONG)pollSockets.size(), (INT)timeoutMs);
+		}
+#else
+		rc = poll(pollSockets.data(), pollSockets.size(), timeoutMs);
+#endif
+		if (-1 == rc) 
+		{
+			stringstream logstream;
+#ifdef _WIN32
+			logstream << "Socket poll failed: Error: " << WSAGetLastError();
+#else
+			logstream << "Socket poll failed. Error: " << strerror(errno);
+#endif
+			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "acceptAndForwardToMySQL");
+			break;
+		}
+		//A socket that has hung up or failed is passed on as readable, the same as select() did, so the read finds out what happened
+		short readableEvents = POLLIN | POLLHUP | POLLERR;
+		for (size_t index = 0; index < clientPollIndexes.size(); index++)
+		{
+			this->connections[index]->clientReadable = rc > 0 && clientPollIndexes[index] != -1 && (pollSockets[clientPollIndexes[index]].revents & readableEvents);
+		}
+		if (rc > 0 && listenPollIndex != -1 && (pollSockets[listenPollIndex].revents & POLLIN))
+		{
+			this->acceptClient(NULL);
+		}
+		for (size_t index = 0; rc > 0 && accepting && index < this->sharedPorts.size(); index++)
+		{
+			if (pollSockets[sharedPortsPollIndex + index].revents & POLLIN)
+			{
+				this->acceptClient(&this->sharedPorts[index]);
+			}
+		}
 
+		this->progressChannelOpen();
 
-	//The session is not null as we are re-using the session but accepting a new client so we need to 
-	//be back in blocking mode for the setup.
-	if (this->session != NULL)
-	{
-		libssh2_session_set_blocking(this->session, 1);
+		//Channels that are paused, or the spare channel, aren't read from, so a zero length read lets libssh2 process whatever the 
+		//SSH server has sent, otherwise the SSH socket stays readable and poll() returns straight away
+		if (rc > 0 && sshPollIndex != -1 && (pollSockets[sshPollIndex].revents & readableEvents))
+		{
+			this->processSSHTransport();
+		}
+
+		vector<ForwardedConnection*> currentConnections = this->getScheduledConnections();
+		for (vector<ForwardedConnection*>::iterator it = currentConnections.begin(); it != currentConnections.end(); ++it)
+		{
+			if (!this->forwardConnectionData(*it))
+			{
+				this->closeConnection(*it);
+			}
+		}
 	}
+	this->closeSSHSessions();
+}
 
-#ifdef WIN32
-	if (forwardsock == INVALID_SOCKET) {
-		stringstream logstream;
-		logstream << "Failed to accept forward socket. Error: " << WSAGetLastError();
-		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
-		this->closeSSHSessions();
-		return;
+#ifdef HAVE_LIBURING
+/**
+	The same as the poll() loop in acceptAndForwardToMySQL, but the client sockets are accepted, received from and sent to through 
+	io_uring (see ClientIOUring). Each pass queues what every client needs, then submits it all and waits in a single call. The client 
+	sockets are left blocking as the ring never blocks on them, and a non-blocking socket would complete with EAGAIN instead of waiting
+	@return bool False if the ring couldn't be created, nothing has been forwarded and the poll() loop should be used instead
+*/
+bool SSHTunnelForwarder::forwardWithIOUring()
+{
+	ClientIOUring ioUring(this->logger);
+	if (!ioUring.initialise(this->listensock, StaticSettings::AppSettings::maxClientsPerTunnel))
+	{
+		return false;
 	}
-#else
-	if (forwardsock == -1) {
-		stringstream logstream;
-		logstream << "Failed to accept forward socket. Error: " << strerror(this->forwardsock);
-		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
-		this->closeSSHSessions();
-		return;
+	this->ioUring = &ioUring;
+
+	while (!this->closeRequested && !this->hasSessionBeenClosed && (this->isSSHServerAlive() || this->reconnectSSHSession()))
+	{
+		bool hasChannels = !this->connections.empty() || this->spareChannel != NULL || this->channelOpenInProgress;
+		short sshEvents = hasChannels ? POLLIN : 0;
+		if (libssh2_session_block_directions(this->session) & LIBSSH2_SESSION_BLOCK_OUTBOUND)
+		{
+			sshEvents |= POLLOUT;
+		}
+		ioUring.pollSocket(this->sshSocket, sshEvents);
+		ioUring.setAccepting(this->connections.size() < (size_t)StaticSettings::AppSettings::maxClientsPerTunnel);
+
+		if (!ioUring.waitForCompletions(this->getLoopTimeoutMicroseconds()))
+		{
+			break;
+		}
+
+		//A client accepted just before the accept was cancelled for maxClientsPerTunnel is still forwarded
+		int clientSocket;
+		while (ioUring.takeAcceptedSocket(&clientSocket))
+		{
+			struct sockaddr_in clientAddr;
+			socklen_t clientAddrLen = sizeof(clientAddr);
+			memset(&clientAddr, 0, sizeof(clientAddr));
+			getpeername(clientSocket, (struct sockaddr *)&clientAddr, &clientAddrLen);
+			this->addClient(clientSocket, &clientAddr, NULL);
+		}
+
+		this->progressChannelOpen();
+		if (ioUring.takeSocketReady())
+		{
+			this->processSSHTransport();
+		}
+
+		vector<ForwardedConnection*> currentConnections = this->getScheduledConnections();
+		for (vector<ForwardedConnection*>::iterator it = currentConnections.begin(); it != currentConnections.end(); ++it)
+		{
+			ForwardedConnection *connection = *it;
+			if (ioUring.hasClientFailed(connection) || !this->forwardChannelData(connection))
+			{
+				this->closeConnection(connection);
+				continue;
+			}
+			this->updateBackpressure(connection);
+			if (!connection->clientReadPaused && !connection->clientDisconnected)
+			{
+				size_t length = 0;
+				char *writePointer = this->getClientReceiveSpace(connection, &length);
+				ioUring.queueReceive(connection, writePointer, length);
+			}
+			ioUring.queueSend(connection);
+			connection->releaseIdleBuffers();
+			if (this->hasConnectionFinished(connection))
+			{
+				this->closeConnection(connection);
+			}
+		}
 	}
+	this->closeSSHSessions();
+	this->ioUring = NULL;
+	return true;
+}
 #endif
 
-	shost = inet_ntoa(sin.sin_addr);
-	sport = ntohs(sin.sin_port);
-
-	stringstream logstream;
-	logstream << "Forwarding connection from " << shost << ":" << sport << " to ";
-	logstream << this->getMySQLHost() << ":" << this->getMySQLPort();
-	this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
-	
-	channel = libssh2_channel_direct_tcpip_ex(this->session, this->getMySQLHost().c_str(), this->getMySQLPort(), shost, sport);
-	if (!channel) {
-		char * error = NULL;
-		int len = 0;
-		int errbuf = 0;
-		libssh2_session_last_error(this->session, &error, &len, errbuf);
+/**
+	Let libssh2 read everything the SSH server has sent into its channel queues. Data for a channel stays queued in libssh2 (limited by the 
+	channel's window) until that channel is read
+*/
+void SSHTunnelForwarder::processSSHTransport()
+{
+	LIBSSH2_CHANNEL *anyChannel = this->spareChannel;
+	for (vector<ForwardedConnection*>::iterator it = this->connections.begin(); anyChannel == NULL && it != this->connections.end(); ++it)
+	{
+		anyChannel = (*it)->channel;
+	}
+	if (anyChannel != NULL)
+	{
+		char unused;
+		libssh2_channel_read(anyChannel, &unused, 0);
+	}
+}
 
-		stringstream logstream;
-		logstream << "Could not open the direct tcpip channel for port forwarding.";
-		logstream << "Note that this could be a server problem so please check your SSH servers logs";
-		logstream << "LIBSSH2 SSH Error: " << error;
-		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
-		this->closeSSHSessions();
+/**
+	Start sending SSH keepalives every sshKeepaliveIntervalSeconds (which can be set for each SSH host), the SSH server replies to each one, 
+	so isSSHServerAlive hears from the SSH server even when the tunnel is idle
+*/
+void SSHTunnelForwarder::startSSHKeepalive()
+{
+	this->sshKeepaliveInterval = HostSettings::getSetting(this->getSSHHostnameOrIPAddress(), "sshKeepaliveIntervalSeconds", 
+		StaticSettings::AppSettings::sshKeepaliveIntervalSeconds);
+	if (this->sshKeepaliveInterval <= 0)
+	{
 		return;
 	}
+	libssh2_keepalive_config(this->session, 1, (unsigned int)this->sshKeepaliveInterval);
+	this->sshBytesSeen = this->sshSocketBytesReceived;
+	this->lastSSHActivity = std::chrono::steady_clock::now();
+	this->lastKeepaliveCheck = this->lastSSHActivity;
+}
 
-	/* Must use non-blocking IO hereafter due to the current libssh2 API */
-	libssh2_session_set_blocking(this->session, 0);
+/**
+	Send the SSH keepalive when it is due, and check the SSH server has sent something within sshKeepaliveMaxMissed keepalive intervals and 
+	hasn't closed the connection. Anything the SSH server sends counts, data that is still waiting on the SSH socket as well as what libssh2 
+	has read, as the SSH socket isn't read while the tunnel has no channels. If the SSH server has stopped answering the SSH socket is shut 
+	down, so closing the channels and the session fails straight away instead of waiting on a server that isn't there
+	@return bool False if the SSH session has been lost, and the tunnel should be reconnected or closed
+*/
+bool SSHTunnelForwarder::isSSHServerAlive()
+{
+	if (this->sshKeepaliveInterval <= 0)
+	{
+		return true;
+	}
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (now - this->lastKeepaliveCheck < std::chrono::seconds(1))
+	{
+		return true;
+	}
+	this->lastKeepaliveCheck = now;
 
-	while (1) {
-		FD_ZERO(&fds);
-		FD_SET(forwardsock, &fds);
-		tv.tv_sec = 0;
-		tv.tv_usec = 100000;
-		rc = select(forwardsock + 1, &fds, NULL, NULL, &tv);
-		if (-1 == rc) {
-			stringstream logstream;
+	//While a channel write is only partly sent libssh2 refuses to send anything else (LIBSSH2_ERROR_BAD_USE), the data going out shows the 
+	//connection is still there, so the keepalive waits for the next check. Only an error on the socket itself means the server is gone
+	int result = 0;
+	if (!(libssh2_session_block_directions(this->session) & LIBSSH2_SESSION_BLOCK_OUTBOUND))
+	{
+		int secondsToNextKeepalive = 0;
+		result = libssh2_keepalive_send(this->session, &secondsToNextKeepalive);
+	}
+	bool serverAnswering = result != LIBSSH2_ERROR_SOCKET_SEND && result != LIBSSH2_ERROR_SOCKET_RECV && result != LIBSSH2_ERROR_SOCKET_DISCONNECT &&
+		result != LIBSSH2_ERROR_SOCKET_TIMEOUT;
+	char peekByte;
+	int peeked = (int)recv(this->sshSocket, &peekByte, 1, MSG_PEEK);
+	bool connectionClosed = peeked == 0 || (peeked < 0 && !SSHTunnelForwarder::socketWouldBlock());
 #ifdef _WIN32
-			logstream << "Socket select failed: Error: " << WSAGetLastError();
+	u_long pendingBytes = 0;
+	ioctlsocket(this->sshSocket, FIONREAD, &pendingBytes);
 #else
-			logstream << "Socket select failed. Error: " << strerror(rc);
+	int pendingBytes = 0;
+	ioctl(this->sshSocket, FIONREAD, &pendingBytes);
 #endif
-			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
-			this->closeSSHSessions();
-		}
-		if (rc && FD_ISSET(forwardsock, &fds)) {
-			len = recv(forwardsock, buf, sizeof(buf), 0);
-			if (len < 0) {
-				stringstream logstream;
+	unsigned long long bytesSeen = this->sshSocketBytesReceived + (unsigned long long)pendingBytes;
+	if (bytesSeen != this->sshBytesSeen)
+	{
+		this->sshBytesSeen = bytesSeen;
+		this->lastSSHActivity = now;
+	}
+	int maxMissed = StaticSettings::AppSettings::sshKeepaliveMaxMissed > 0 ? StaticSettings::AppSettings::sshKeepaliveMaxMissed : 1;
+	if (serverAnswering && !connectionClosed && now - this->lastSSHActivity <= std::chrono::seconds(this->sshKeepaliveInterval * maxMissed))
+	{
+		return true;
+	}
+
+	stringstream logstream;
+	logstream << "Lost the SSH session for the tunnel on port " << this->localListenPort << ", the SSH server " << this->getSSHHostnameOrIPAddress();
+	if (connectionClosed)
+	{
+		logstream << " closed the connection";
+	}
+	else if (!serverAnswering)
+	{
+		logstream << " couldn't be sent a keepalive. Error: " << result;
+	}
+	else
+	{
+		logstream << " hasn't answered for " << std::chrono::duration_cast<std::chrono::seconds>(now - this->lastSSHActivity).count() << " seconds";
+	}
+	this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "isSSHServerAlive");
 #ifdef _WIN32
-				logstream << "Failed to receive data on socket. Error: " << WSAGetLastError();
+	shutdown(this->sshSocket, SD_BOTH);
 #else
-				logstream << "Failed to receive data on socket. Error: " << strerror(len);
+	shutdown(this->sshSocket, SHUT_RDWR);
 #endif
-				this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
-				this->closeSSHSessions();
-				return;
+	libssh2_session_set_timeout(this->session, 1000);
+	return false;
+}
+
+/**
+	Reconnect the SSH session after it has been lost (see isSSHServerAlive), so the tunnel keeps its local port and the next client that 
+	connects gets a working tunnel, instead of the app having to create the tunnel again. This is only done while the tunnel has no clients, 
+	a client's MySQL connection can't survive the channel going away, so the tunnel is closed as before. The tunnel's own credentials are 
+	used, and the SSH server has to have the host key that was confirmed when the tunnel was created. Clients that connect in the meantime 
+	wait in the listen socket's backlog. There are up to sshReconnectAttempts (which can be set for each SSH host) attempts, the delay 
+	between them starts at sshReconnectDelaySeconds and doubles each time, up to a minute. Each attempt goes through the SSH host's 
+	circuit breaker, and a rejected password or key, or a changed host key, closes the tunnel without trying again
+	@return bool True if the session has been reconnected and forwarding can carry on
+*/
+bool SSHTunnelForwarder::reconnectSSHSession()
+{
+	int attempts = HostSettings::getSetting(this->getSSHHostnameOrIPAddress(), "sshReconnectAttempts", StaticSettings::AppSettings::sshReconnectAttempts);
+	if (attempts <= 0 || !this->connections.empty() || this->hostKeyFingerprint.empty())
+	{
+		return false;
+	}
+	this->dropSSHSession();
+	this->reconnecting = true;
+	bool reconnected = false;
+	bool retry = true;
+
+	int delaySeconds = StaticSettings::AppSettings::sshReconnectDelaySeconds > 0 ? StaticSettings::AppSettings::sshReconnectDelaySeconds : 1;
+	for (int attempt = 1; attempt <= attempts && retry && !this->closeRequested; attempt++)
+	{
+		if (attempt > 1)
+		{
+			std::chrono::steady_clock::time_point retryAt = std::chrono::steady_clock::now() + std::chrono::seconds(delaySeconds);
+			while (!this->closeRequested && std::chrono::steady_clock::now() < retryAt)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
 			}
-			else if (0 == len) 
+			delaySeconds = delaySeconds * 2 < 60 ? delaySeconds * 2 : 60;
+			if (this->closeRequested)
 			{
-				stringstream logstream;
-				logstream << "The client " << shost << ":" << sport << " has disconnected";
-				this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
-				libssh2_channel_send_eof(channel);
-			libssh2_channel_close(channel);
-			libssh2_channel_free(channel);
-			channel = NULL;
-#ifdef _WIN32
-				closesocket(this->forwardsock);
-				closesocket(this->listensock);
-#else
-				close(this->forwardsock);
-				close(this->listensock);
-#endif
-				libssh2_channel_free(channel);
-				channel = NULL;
-				//this->acceptAndForwardToMySQL();
-				this->closeSSHSessions();
 				break;
 			}
-			wr = 0;
-			while (wr < len) {
-				i = libssh2_channel_write(channel, buf + wr, len - wr);
+		}
+		stringstream logstream;
+		logstream << "Reconnecting the SSH session for the tunnel on port " << this->localListenPort << " to " << this->getSSHHostnameOrIPAddress();
+		logstream << ":" << this->getSSHPort() << ", attempt " << attempt << " of " << attempts;
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "reconnectSSHSession");
+		logstream.clear();
+		logstream.str(string());
 
-				if (LIBSSH2_ERROR_EAGAIN == i) {
-					continue;
-				}
-				if (i < 0) {
-					stringstream logstream;
-					logstream << "libssh2_channel_write failed. Error: " << i;
-					this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
-					this->closeSSHSessions();
-				}
-				wr += i;
+		//The same circuit breaker as CreateTunnel, so revoked credentials or an SSH server that is down aren't tried by every idle tunnel
+		SSHHostCircuitBreaker circuitBreaker(this->logger, this->getSSHHostnameOrIPAddress(), this->getSSHPort(), this->credentialHash);
+		SSHHostCircuitBreaker::FailureType cachedFailure;
+		int retryAfterSeconds = 0;
+		if (!circuitBreaker.allowRequest(&cachedFailure, &retryAfterSeconds))
+		{
+			logstream << "SSH Host " << this->getSSHHostnameOrIPAddress() << " failed recently, retry after " << retryAfterSeconds << " seconds";
+			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "reconnectSSHSession");
+			retry = cachedFailure != SSHHostCircuitBreaker::FailureType::PASSWORD_AUTH_FAILED;
+			continue;
+		}
+		SSHHandshakeLimiter handshakeLimiter(this->logger, this->getSSHHostnameOrIPAddress(), this->getSSHPort());
+		if (!handshakeLimiter.acquireSlot())
+		{
+			continue;
+		}
+
+		ErrorStatus error;
+		string fingerprint = this->connectToSSHAndFingerprint(error);
+		if (fingerprint.empty() || error != ErrorStatus::SUCCESS)
+		{
+			if (error == ErrorStatus::DNS_RESOLUTION_FAILED)
+			{
+				circuitBreaker.recordConnectFailure(SSHHostCircuitBreaker::FailureType::DNS_RESOLUTION_FAILED);
+			}
+			else if (error == ErrorStatus::SSH_CONNECT_FAILED)
+			{
+				circuitBreaker.recordConnectFailure(SSHHostCircuitBreaker::FailureType::SSH_CONNECT_FAILED);
 			}
+			this->dropSSHSession();
+			continue;
+		}
+		circuitBreaker.recordConnectSuccess();
+		if (fingerprint.compare(this->hostKeyFingerprint) != 0)
+		{
+			logstream << "SSH Host " << this->getSSHHostnameOrIPAddress() << " now has Fingerprint " << fingerprint << " instead of ";
+			logstream << this->hostKeyFingerprint << ", not reconnecting the tunnel on port " << this->localListenPort;
+			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "reconnectSSHSession");
+			this->dropSSHSession();
+			retry = false;
+			continue;
 		}
-		while (1) 
+
+		string response;
+		bool authenticated = this->authenticateSSHServer(&response, error);
+		handshakeLimiter.releaseSlot();
+		if (!authenticated)
 		{
-			if (this->hasSessionBeenClosed)
+			//A rejected password or key won't be accepted on the next attempt either, only a timeout is tried again
+			if (error == ErrorStatus::PASSWORD_AUTH_FAILED)
 			{
-				this->closeSSHSessions();
-				return;
+				circuitBreaker.recordAuthFailure();
+			}
+			else if (error == ErrorStatus::SETUP_TIMEOUT)
+			{
+				circuitBreaker.recordConnectFailure(SSHHostCircuitBreaker::FailureType::SSH_CONNECT_FAILED);
 			}
-			len = libssh2_channel_read(channel, buf, sizeof(buf));
+			retry = error == ErrorStatus::SETUP_TIMEOUT;
+			this->dropSSHSession();
+			continue;
+		}
+		circuitBreaker.recordAuthSuccess();
 
-			if (LIBSSH2_ERROR_EAGAIN == len)
-				break;
-			else if (len < 0) {
-				stringstream logstream;
-				logstream << "libssh2_channel_read failed. Error: " << (int)len;
-				this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
-				this->closeSSHSessions();
-			}
-			wr = 0;
-			while (wr < len) {
-				i = send(forwardsock, buf + wr, len - wr, 0);
-				if (i <= 0) {
-					stringstream logstream;
+		libssh2_session_set_blocking(this->session, 0);
+		this->startSSHKeepalive();
+		this->sshReconnects++;
+		logstream << "Reconnected the SSH session for the tunnel on port " << this->localListenPort << " after " << attempt << " attempt(s)";
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "reconnectSSHSession");
+		reconnected = true;
+		break;
+	}
+	this->reconnecting = false;
+	return reconnected;
+}
+
+/**
+	Give up on setting up a session that failed to authenticate. A new tunnel is closed, but while the session is being reconnected only 
+	the session is freed, reconnectSSHSession decides whether to try again or close the tunnel
+*/
+void SSHTunnelForwarder::abandonSetup()
+{
+	if (this->reconnecting)
+	{
+		this->dropSSHSession();
+		return;
+	}
+	this->closeSSHSessions();
+}
+
+/**
+	Free a session that has been lost, or a reconnect attempt that failed, and close its socket. The tunnel's listen socket is left open. 
+	The session isn't disconnected, as the SSH server isn't there to be told
+*/
+void SSHTunnelForwarder::dropSSHSession()
+{
+	this->spareChannel = NULL;
+	this->spareChannelFailed = false;
+	this->channelOpenInProgress = false;
+	this->channelOpenConnection = NULL;
+	if (this->session != NULL)
+	{
+		//Frees the spare channel, and a channel that was being opened, as well
+		libssh2_session_set_blocking(this->session, 1);
+		libssh2_session_set_timeout(this->session, 1000);
+		libssh2_session_free(this->session);
+		this->session = NULL;
+	}
 #ifdef _WIN32
-					logstream << "Failed to send to forward socket. Error: " << WSAGetLastError();
+	if (this->sshSocket != INVALID_SOCKET)
+	{
+		closesocket(this->sshSocket);
+		this->sshSocket = INVALID_SOCKET;
+	}
 #else
-					logstream << "Failed to send to forward socket. Error: " << strerror(i);
+	if (this->sshSocket != -1)
+	{
+		close(this->sshSocket);
+		this->sshSocket = -1;
+	}
 #endif
-					this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortforwarding");
-					this->closeSSHSessions();
-					return;
-				}
-				wr += i;
+}
+
+/**
+	Ask the tunnel to close. This is used from other threads (tunnel expiry and the CloseTunnel request) so the thread that is 
+	forwarding the tunnel's data closes the SSH session itself, instead of the session being freed while it is still being used
+*/
+void SSHTunnelForwarder::requestClose()
+{
+	this->closeRequested = true;
+}
+
+/**
+	Ask for one of the tunnel's local ports to close, for the CloseTunnel request. If other tunnels from the same batch share the SSH 
+	session only the port and its clients are closed, by the thread forwarding the tunnel, otherwise the whole tunnel is closed
+	@param localPort The local port to close
+*/
+void SSHTunnelForwarder::requestPortClose(int localPort)
+{
+	if (!this->sessionShared)
+	{
+		this->requestClose();
+		return;
+	}
+	lock_guard<mutex> lock(this->portsToCloseMutex);
+	this->portsToClose.push_back(localPort);
+}
+
+/**
+	Close the local ports that requestPortClose has been asked to close, along with their clients, and free them from the active tunnel 
+	list. Once none of the ports are left the tunnel is closed
+*/
+void SSHTunnelForwarder::closeRequestedPorts()
+{
+	vector<int> closingPorts;
+	{
+		lock_guard<mutex> lock(this->portsToCloseMutex);
+		closingPorts.swap(this->portsToClose);
+	}
+	for (vector<int>::iterator port = closingPorts.begin(); port != closingPorts.end(); ++port)
+	{
+		vector<ForwardedConnection*> portConnections;
+		for (vector<ForwardedConnection*>::iterator it = this->connections.begin(); it != this->connections.end(); ++it)
+		{
+			if ((*it)->localPort == *port)
+			{
+				portConnections.push_back(*it);
+			}
+		}
+		for (vector<ForwardedConnection*>::iterator it = portConnections.begin(); it != portConnections.end(); ++it)
+		{
+			this->closeConnection(*it);
+		}
+
+		if (*port == this->localListenPort && !this->localPortClosed)
+		{
+#ifdef _WIN32
+			closesocket(this->listensock);
+			this->listensock = INVALID_SOCKET;
+#else
+			close(this->listensock);
+			this->listensock = -1;
+#endif
+			this->localPortClosed = true;
+		}
+		else
+		{
+			vector<SharedPort>::iterator it = this->sharedPorts.begin();
+			while (it != this->sharedPorts.end() && it->localPort != *port)
+			{
+				++it;
 			}
-			if (libssh2_channel_eof(channel))
+			if (it == this->sharedPorts.end())
 			{
-				stringstream logstream;
-				logstream << "The server at " << this->getMySQLHost() << ":" << this->getMySQLPort();
-				this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "setupPortForwarding");
-				this->closeSSHSessions();
-				return;
+				continue;
 			}
+#ifdef _WIN32
+			closesocket(it->listensock);
+#else
+			close(it->listensock);
+#endif
+			this->sharedPorts.erase(it);
 		}
+		stringstream logstream;
+		logstream << "Closed port " << *port << " of the SSH session for host: " << this->getSSHHostnameOrIPAddress() << ", ";
+		logstream << (this->sharedPorts.size() + (this->localPortClosed ? 0 : 1)) << " port(s) still use the session";
+		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "closeRequestedPorts");
+		TunnelManager tunnelManager(this->logger);
+		tunnelManager.removeTunnelFromActiveList(*port);
+	}
+	if (this->localPortClosed && this->sharedPorts.empty())
+	{
+		this->closeRequested = true;
 	}
 }
 
@@ -658,70 +2625,115 @@ void SSHTunnelForwarder::acceptAndForwardToMySQL()
 */
 void SSHTunnelForwarder::closeSSHSessions()
 {
-	//SSHTunnelForwarder::sshForwarderMutex.lock();
 	if (!hasSessionBeenClosed)
 	{
 		hasSessionBeenClosed = true;
 		stringstream logstream;
 		logstream << "Closing SSH session for host: " << this->getSSHHostnameOrIPAddress();
 		this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "closeSSHSessions");
+		if (this->forwardingStartedTime != 0)
+		{
+			logstream.clear();
+			logstream.str(string());
+			logstream << "Tunnel on port " << this->localListenPort << " forwarded " << this->totalBytesToServer << " bytes to and " << this->totalBytesFromServer;
+			logstream << " bytes from " << this->getMySQLHost() << ":" << this->getMySQLPort() << " in " << std::time(nullptr) - this->forwardingStartedTime << " seconds";
+			if (this->totalChannelWrites > 0)
+			{
+				logstream << " (" << this->totalChannelWrites << " channel writes)";
+			}
+			if (this->sshReconnects > 0)
+			{
+				logstream << ", reconnecting the SSH session " << this->sshReconnects << " time(s)";
+			}
+			logstream << " using " << this->negotiatedMethods;
+			if (this->compressionEnabled && this->sshSocketBytesReceived > 0)
+			{
+				logstream << " (" << this->sshSocketBytesReceived << " bytes received on the SSH socket)";
+			}
+			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "closeSSHSessions");
 
-#ifdef _WIN32
-		if (this->forwardsock != INVALID_SOCKET)
+			//Only sessions with enough data to outweigh the SSH handshake give a meaningful compression ratio
+			if (this->compressionEnabled && this->totalBytesFromServer >= 262144)
+			{
+				LinkStatistics linkStatistics(this->getSSHHostnameOrIPAddress(), this->getSSHPort());
+				linkStatistics.recordCompression(this->totalBytesFromServer, this->sshSocketBytesReceived);
+			}
+		}
+
+		while (!this->connections.empty())
+		{
+			this->closeConnection(this->connections.front());
+		}
+		if (this->session != NULL)
 		{
-			closesocket(this->forwardsock);
+			libssh2_session_set_blocking(this->session, 1);
+		}
+		if (this->spareChannel != NULL)
+		{
+			libssh2_channel_close(this->spareChannel);
+			libssh2_channel_free(this->spareChannel);
+			this->spareChannel = NULL;
+		}
+		if (this->session != NULL)
+		{
+			libssh2_session_disconnect(this->session, "Client disconnecting normally");
+			libssh2_session_free(this->session);
+			this->session = NULL;
+
+			stringstream logstream;
+			logstream << "SSH session for " << this->getSSHHostnameOrIPAddress() << " on port " << this->localListenPort << " peaked at ";
+			logstream << this->sessionMemory.getPeakBytes() << " bytes";
+			if (this->sessionMemory.getLimitFailures() > 0)
+			{
+				logstream << ", " << this->sessionMemory.getLimitFailures() << " allocation(s) were refused by sshSessionMemoryLimitBytes";
+			}
+			if (this->sessionMemory.getBytesInUse() > 0)
+			{
+				logstream << ". " << this->sessionMemory.getBytesInUse() << " bytes were not freed by libssh2";
+			}
+			this->logger->writeToLog(logstream.str(), "SSHTunnelForwarder", "closeSSHSessions");
 		}
 
+#ifdef _WIN32
 		if (this->listensock != INVALID_SOCKET)
 		{
 			closesocket(this->listensock);
+			this->listensock = INVALID_SOCKET;
 		}
 
 		if (this->sshSocket != INVALID_SOCKET)
 		{
 			closesocket(this->sshSocket);
+			this->sshSocket = INVALID_SOCKET;
 		}
-		
 #else
-		if (this->forwardsock != -1)
-		{
-                    //shutdown(this->forwardsock,SHUT_RDWR);
-			close(this->forwardsock);
-		}
-
 		if (this->listensock != -1)
 		{
-                    //shutdown(this->listensock,SHUT_RDWR);
-                        close(this->listensock);
+			close(this->listensock);
+			this->listensock = -1;
 		}
 		if (this->sshSocket != -1)
 		{
 			close(this->sshSocket);
+			this->sshSocket = -1;
 		}
 #endif
 
-		if (channel != NULL)
+		//Free the local port, and any ports sharing the session, from the active tunnel list
+		TunnelManager tunnelManager(this->logger);
+		if (!this->localPortClosed)
 		{
-			libssh2_channel_send_eof(channel);
-			libssh2_channel_close(channel);
-			libssh2_channel_free(channel);
-			channel = NULL;
+			tunnelManager.removeTunnelFromActiveList(this->localListenPort);
 		}
-		if (this->session != NULL)
+		for (vector<SharedPort>::iterator it = this->sharedPorts.begin(); it != this->sharedPorts.end(); ++it)
 		{
-			libssh2_session_disconnect(this->session, "Client disconnecting normally");
-			libssh2_session_free(this->session);
-			this->session = NULL;
+#ifdef _WIN32
+			closesocket(it->listensock);
+#else
+			close(it->listensock);
+#endif
+			tunnelManager.removeTunnelFromActiveList(it->localPort);
 		}
-		libssh2_exit();
-
-		//Free the local port from the active tunnel list
-		TunnelManager tunnelManager(this->logger);
-		tunnelManager.removeTunnelFromActiveList(this->localListenPort);
+		this->sharedPorts.clear();
 	}
-	else
-	{
-		cout << "Session already closed" << endl;
-	}
-	//SSHTunnelForwarder::sshForwarderMutex.unlock();
-}
\ No newline at end of file
+}
@@ -7,6 +7,10 @@
 #include "JSONResponseGenerator.h"
 #include <string>
 #include <mutex>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <chrono>
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/replace.hpp>
 
@@ -15,12 +19,17 @@
 #include <windows.h>
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#include <mstcpip.h>
 #else
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
 #include <netdb.h>
+#include <poll.h>
 struct hostent *gethostbyname(const char *name);
 #endif
 
@@ -38,6 +47,17 @@ struct hostent *gethostbyname(const char *name);
 #include <sys/select.h>
 #endif
 #include "Logger.h"
+#include "ForwardedConnection.h"
+#include "LinkStatistics.h"
+#include "HostSettings.h"
+#include "SSHMethodProfile.h"
+#include "PrivateKeyCache.h"
+#include "SSHSessionMemory.h"
+#include "SSHHandshakeLimiter.h"
+#include "SSHHostCircuitBreaker.h"
+#include "DirectForwarder.h"
+#include "ClientIOUring.h"
+#include "BandwidthLimiter.h"
 
 #ifndef INADDR_NONE
 #define INADDR_NONE (in_addr_t)-1
@@ -52,7 +72,9 @@ class SSHTunnelForwarder
 {
 public:
 	enum SupportedAuthMethods { AUTH_NONE = 0, AUTH_PASSWORD, AUTH_PUBLICKEY };
-	enum ErrorStatus { SUCCESS, SYSTEM_FAULT, DNS_RESOLUTION_FAILED, SSH_CONNECT_FAILED };
+	enum ErrorStatus { SUCCESS, SYSTEM_FAULT, DNS_RESOLUTION_FAILED, SSH_CONNECT_FAILED, PASSWORD_AUTH_FAILED, AUTH_FAILED, SETUP_TIMEOUT };
+	enum SetupStep { SETUP_CONNECT, SETUP_HANDSHAKE, SETUP_USERAUTH };
+	enum SetupResult { SETUP_WAITING, SETUP_DONE, SETUP_FAILED };
 	SSHTunnelForwarder() {};
 	//SSHTunnelForwarder(const SSHTunnelForwarder&) = default;
 	SSHTunnelForwarder(Logger *logger, int localListenPort);
@@ -65,22 +87,48 @@ public:
 	void setAuthMethod(SupportedAuthMethods chosenAuthMethod);
 	void setSSHPrivateKey(std::string sshPrivateKey);
 	void setSSHPrivateKeyCertPassphrase(std::string sshPrivateKeyCertPassphrase);
+	void setBandwidthLimit(unsigned long long bytesPerSecond);
+	void setCredentialHash(std::string credentialHash);
 	string connectToSSHAndFingerprint(ErrorStatus& error);
+	SetupResult startConnectToSSH(ErrorStatus& error);
+	SetupResult continueConnectToSSH(std::string *fingerprint, ErrorStatus& error);
 	void setFingerprintConfirmed(bool fingerprintConfirmed);
 	
-	bool authenticateSSHServerAndStartPortForwarding(std::string *response);
+	void loadPrivateKey();
+	void startAuthentication();
+	SetupResult continueAuthentication(std::string *response, ErrorStatus& error);
+	void getSetupStepDirections(bool *waitToRead, bool *waitToWrite);
+	std::chrono::steady_clock::time_point getSetupStepDeadline();
+	bool hasSetupStepExpired();
+	bool setupPortForwarding(std::string *response);
+	bool addSharedPort(int *localPort, std::string mysqlHost, int mysqlPort, std::string *response);
+	bool isDirectDestination();
+	bool startDirectForwarding(std::string *response);
 	void acceptAndForwardToMySQL();
 	std::string getSSHHostnameOrIPAddress();
 	
 	void closeSSHSessions();
+	void requestClose();
+	void requestPortClose(int localPort);
 	int getLocalListenPort();
-	
+	SSHSessionMemory *getSessionMemory();
+	static LIBSSH2_ALLOC_FUNC(allocateForSession);
+	static LIBSSH2_REALLOC_FUNC(reallocateForSession);
+	static LIBSSH2_FREE_FUNC(freeForSession);
+#ifdef _WIN32
+	static void setTCPKeepalive(SOCKET sock);
+	SOCKET getSSHSocket();
+#else
+	static void setTCPKeepalive(int sock);
+	int getSSHSocket();
+#endif
 	
 private:
 	int socketBindRetryCount = 0;
 	string getUsername();
 	std::string getPassword();
 	bool hasSessionBeenClosed = false;
+	std::atomic<bool> closeRequested{ false };
 	int getSSHPort();
 	std::string getMySQLHost();
 	int getMySQLPort();
@@ -89,7 +137,48 @@ private:
 	std::string getSSHPrivateKeyCertPassphrase();
 	
 	SupportedAuthMethods getAuthMethod();
-	std::string setupPortForwarding();
+	bool authenticateSSHServer(std::string *response, ErrorStatus& error);
+	SetupResult failPublicKeyAuthentication(std::string *response, int result);
+	bool reconnectSSHSession();
+	void abandonSetup();
+	void dropSSHSession();
+	LIBSSH2_CHANNEL *takeSpareChannel();
+	void progressChannelOpen();
+	void channelOpened(ForwardedConnection *connection, LIBSSH2_CHANNEL *openedChannel, unsigned int windowSize);
+	LIBSSH2_CHANNEL *openDirectTcpipChannel(std::string destinationHost, int destinationPort, std::string originHost, int originPort);
+	unsigned int getChannelWindowSize();
+	unsigned int getChannelMaxPacketSize();
+	void trackServerData(ForwardedConnection *connection, size_t bytes);
+	void endServerBurst(ForwardedConnection *connection);
+	struct SharedPort;
+	void acceptClient(SharedPort *sharedPort);
+	void closeRequestedPorts();
+	bool forwardConnectionData(ForwardedConnection *connection);
+	bool forwardChannelData(ForwardedConnection *connection);
+	bool hasConnectionFinished(ForwardedConnection *connection);
+	bool receiveFromClient(ForwardedConnection *connection);
+	char *getClientReceiveSpace(ForwardedConnection *connection, size_t *length);
+	bool writeToChannel(ForwardedConnection *connection);
+	bool shouldHoldChannelWrite(ForwardedConnection *connection);
+	long getLoopTimeoutMicroseconds();
+	std::vector<ForwardedConnection*> getScheduledConnections();
+	size_t allowTransfer(ForwardedConnection *connection, size_t wanted);
+	void finishTransfer(ForwardedConnection *connection, size_t allowed, size_t transferred);
+	bool readFromChannel(ForwardedConnection *connection);
+	bool sendToClient(ForwardedConnection *connection);
+	void updateBackpressure(ForwardedConnection *connection);
+	void processSSHTransport();
+	void startSSHKeepalive();
+	bool isSSHServerAlive();
+	static bool socketWouldBlock();
+	void beginSetupStep(SetupStep step);
+	int getSetupStepTimeout();
+	void waitForSetupStep();
+	SetupResult failSetupStepTimedOut(std::string *response, ErrorStatus& error);
+	static bool connectInProgress();
+	bool isCompressionEnabled();
+	static ssize_t receiveFromSSHSocket(libssh2_socket_t socket, void *buffer, size_t length, int flags, void **abstract);
+	void closeConnection(ForwardedConnection *connection);
 	std::string username;
 	std::string password;
 	std::string sshHostnameOrIpAddress;
@@ -105,22 +194,84 @@ private:
 	std::string sshServerIP;
 	int localListenPort;
 	LIBSSH2_SESSION *session = NULL;
-	LIBSSH2_CHANNEL *channel = NULL;
+	LIBSSH2_CHANNEL *spareChannel = NULL;
+	time_t spareChannelOpenedTime = 0;
+	unsigned int spareChannelWindowSize = 0;
+	unsigned int openingChannelWindowSize = 0;
+	std::chrono::steady_clock::time_point channelOpenStarted;
+	bool spareChannelFailed = false;
+	bool channelOpenInProgress = false;
+	ForwardedConnection *channelOpenConnection = NULL;
+	std::vector<ForwardedConnection*> connections;
+	std::string negotiatedMethods;
+	time_t forwardingStartedTime = 0;
+	unsigned long long totalBytesToServer = 0;
+	unsigned long long totalBytesFromServer = 0;
+	unsigned long long totalChannelWrites = 0;
+	BandwidthLimiter tunnelBandwidthLimiter;
+	std::vector<BandwidthLimiter*> bandwidthLimiters;
+	size_t schedulePass = 0;
+	bool compressionEnabled = false;
+	SetupStep setupStep = SetupStep::SETUP_CONNECT;
+	std::chrono::steady_clock::time_point setupStepDeadline;
+	bool setupStepTimedOut = false;
+	enum UserauthStep { USERAUTH_LIST, USERAUTH_PASSWORD, USERAUTH_CACHED_KEY, USERAUTH_KEY, USERAUTH_FINISHED };
+	UserauthStep userauthStep = UserauthStep::USERAUTH_LIST;
+	std::chrono::steady_clock::time_point handshakeStarted;
+	std::string methodProfileName;
+	bool privateKeyLoaded = false;
+	PrivateKeyCache::LookupResult privateKeyLookup = PrivateKeyCache::LookupResult::KEY_NOT_CACHEABLE;
+	std::string privateKeyCacheKey;
+	std::string publicKeyBlob;
+	unsigned long long sshSocketBytesReceived = 0;
+	std::string hostKeyFingerprint;
+	std::string credentialHash;
+	bool reconnecting = false;
+	int sshReconnects = 0;
+	int sshKeepaliveInterval = 0;
+	unsigned long long sshBytesSeen = 0;
+	std::chrono::steady_clock::time_point lastSSHActivity;
+	std::chrono::steady_clock::time_point lastKeepaliveCheck;
+	SSHSessionMemory sessionMemory;
+	bool directForwarding = false;
+	struct sockaddr_in directServerAddress;
+	//Other tunnels from the same batch that use this tunnel's SSH session, each with its own local port and MySQL server
+	struct SharedPort
+	{
+		int localPort;
+		std::string mysqlHost;
+		int mysqlPort;
+#ifdef _WIN32
+		SOCKET listensock;
+#else
+		int listensock;
+#endif
+	};
+	std::vector<SharedPort> sharedPorts;
+	std::atomic<bool> sessionShared{ false };
+	bool localPortClosed = false;
+	std::mutex portsToCloseMutex;
+	std::vector<int> portsToClose;
+#ifdef HAVE_LIBURING
+	ClientIOUring *ioUring = NULL;
+	bool forwardWithIOUring();
+#endif
 	char sockopt;
 #ifdef _WIN32
 	SOCKET listensock = INVALID_SOCKET;
-	SOCKET forwardsock = INVALID_SOCKET;
+	static void setSocketBlocking(SOCKET sock, bool blocking);
+	static int addPollSocket(std::vector<struct pollfd> *pollSockets, SOCKET sock, short events);
+	void addClient(SOCKET clientSocket, struct sockaddr_in *clientAddr, SharedPort *sharedPort);
+	static int getSocketError(SOCKET sock);
 #else
 	int listensock = -1;
-	int forwardsock = -1;
+	static void setSocketBlocking(int sock, bool blocking);
+	static int addPollSocket(std::vector<struct pollfd> *pollSockets, int sock, short events);
+	void addClient(int clientSocket, struct sockaddr_in *clientAddr, SharedPort *sharedPort);
+	static int getSocketError(int sock);
 #endif
-	char * shost;
-	int sport;
-	fd_set fds;
 	struct timeval tv;
 	int rc, i;
-	ssize_t len, wr;
-	char buf[16384];
 	struct sockaddr_in sin;
 	socklen_t sinlen;
 	std::thread acceptAndForwardThread;
@@ -28,90 +28,40 @@ SocketProcessor::SocketProcessor(Logger *logger, void *socketManager)
 */
 void SocketProcessor::processSocketData(void *clientpointer)
 {
+	//SocketListener's SocketProcessor only lives for one pass of its accept loop, but a batch of tunnels keeps this thread until the tunnels 
+	//close, so nothing is read from the object once this thread has started
 #ifdef _WIN32
-	client = static_cast<SOCKET *>(clientpointer);
+	SOCKET *client = static_cast<SOCKET *>(clientpointer);
+	WindowsSocket *socketManager = this->socketManager;
 #else
-	client = static_cast<int *>(clientpointer);
+	int *client = static_cast<int *>(clientpointer);
+	LinuxSocket *socketManager = this->socketManager;
 #endif
+	Logger *logger = this->logger;
+	ReceiveBuffer *receiveBuffer = ReceiveBuffer::acquire();
 	try
 	{
-		string command = this->socketManager->receiveDataOnSocket(client);
+		socketManager->receiveDataOnSocket(client, receiveBuffer);
 
+		//The SSH login credentials are replaced with asterix in the copy of the request that is logged, don't want SSH login credentials in the log file.
+		TunnelRequest tunnelRequest;
+		tunnelRequest.parse(receiveBuffer->getData(), StaticSettings::AppSettings::debugJSONMessages);
+		ReceiveBuffer::release(receiveBuffer);
+		receiveBuffer = NULL;
 		if (StaticSettings::AppSettings::debugJSONMessages)
 		{
-			//Replace the password with asterix so its not in the log
-			rapidjson::Document jsonObject;
-			jsonObject.Parse(command.c_str());
-
-			string method = jsonObject["method"].GetString();
-
-			//If it has the sshDetails object, then it may contain the password, if so, hide it, don't want SSH login credentials in the log file.
-			if (jsonObject.HasMember("sshDetails"))
-			{
-				Value& sshDetails = jsonObject["sshDetails"];
-				if (sshDetails.HasMember("sshPassword"))
-				{
-					string sshPassword = sshDetails["sshPassword"].GetString();
-
-					for (unsigned int i = 0; i < sshPassword.length(); i++)
-					{
-						sshPassword[i] = '*';
-					}
-
-					rapidjson::Value::MemberIterator sshPasswordMember = sshDetails.FindMember("sshPassword");
-					sshPasswordMember->value.SetString(sshPassword.c_str(), jsonObject.GetAllocator());
-				}
-				else if (sshDetails.HasMember("privateSSHKey"))
-				{
-					string privateKeyContent = sshDetails["privateSSHKey"].GetString();
-					for (unsigned int i = 0; i < privateKeyContent.length(); i++)
-					{
-						privateKeyContent[i] = '*';
-					}
-
-					rapidjson::Value::MemberIterator privateKeyMember = sshDetails.FindMember("privateSSHKey");
-					privateKeyMember->value.SetString(privateKeyContent.c_str(), jsonObject.GetAllocator());
-
-					if (!sshDetails["certPassphrase"].IsNull())
-					{
-						string certPassphrase = sshDetails["certPassphrase"].GetString();
-						for (unsigned int i = 0; i < certPassphrase.length(); i++)
-						{
-							certPassphrase[i] = '*';
-						}
-
-						rapidjson::Value::MemberIterator certPassphraseMember = sshDetails.FindMember("certPassphrase");
-						certPassphraseMember->value.SetString(certPassphrase.c_str(), jsonObject.GetAllocator());
-					}
-					
-				}
-				else
-				{
-					//We should never get here, but if we do, log the command anyway. However, as this is potentially showing SSH login credentials, if you it come into here
-					//and it is indeed show potential login details please raise the Issue on Github issue tracker or on our issue tracker at https://support.boardiesitsolutions.com
-					//with details on how to re-product. Obviously though, when raising the issue, don't send us your login credentials :)
-					logger->writeToLog(command);
-				}
-				//Convert it back to a string so that it can be logged
-				rapidjson::StringBuffer buffer;
-				buffer.Clear();
-				rapidjson::Writer<rapidjson::StringBuffer>writer(buffer);
-				jsonObject.Accept(writer);
-				string jsonString = buffer.GetString();
-				logger->writeToLog(jsonString);
-			}
-			else
-			{ 
-				logger->writeToLog(command);
-			}
-			
-			
+			logger->writeToLog(tunnelRequest.getRedactedJSON());
 		}
 		
-		TunnelManager tunnelManager(this->logger, command);
-		tunnelManager.startStopTunnel(socketManager, client);
-
-		this->socketManager->closeSocket(client);
+		//A tunnel that is waiting for the SSH server is handed to a setup loop, which sends the response and closes the client socket
+		//when the setup finishes, so this thread doesn't wait on it
+		TunnelManager *tunnelManager = new TunnelManager(logger, &tunnelRequest);
+		tunnelManager->startStopTunnel(socketManager, client);
+		if (!tunnelManager->handOverSetup())
+		{
+			delete tunnelManager;
+			socketManager->closeSocket(client);
+		}
 	}
 	catch (SocketException ex)
 	{
@@ -127,7 +77,12 @@ void SocketProcessor::processSocketData(void *clientpointer)
 			//We don't need to worry about the following error as it just means the socket was closed while waiting to receive data
 		}
 	}
+	if (receiveBuffer != NULL)
+	{
+		ReceiveBuffer::release(receiveBuffer);
+	}
 }
+
 SocketProcessor::~SocketProcessor()
 {
 	if ((this->threadStarted) && this->socketProcessorThread.joinable())
@@ -3,6 +3,7 @@
 
 #include <thread>
 #include "TunnelManager.h"
+#include "TunnelRequest.h"
 #include "StaticSettings.h"
 #include "Logger.h"
 #include <rapidjson/document.h>
@@ -26,10 +27,8 @@ private:
 	bool threadStarted = false;
 	Logger *logger = NULL;
 #ifdef _WIN32
-	SOCKET *client;
 	WindowsSocket *socketManager = NULL;
 #else
-	int *client;
 	LinuxSocket *socketManager = NULL;
 #endif
 };
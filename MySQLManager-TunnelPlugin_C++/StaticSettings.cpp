@@ -3,6 +3,7 @@
 */
 
 #include "StaticSettings.h"
+#include "SSHMethodProfile.h"
 
 using namespace std;
 
@@ -11,6 +12,48 @@ int StaticSettings::AppSettings::maxPortRange = 20000;
 int StaticSettings::AppSettings::listenSocket = 500;
 bool StaticSettings::AppSettings::debugJSONMessages = false;
 int StaticSettings::AppSettings::tunnelExpirationTimeInSeconds = 5;
+int StaticSettings::AppSettings::maxConcurrentHandshakesPerHost = 8;
+int StaticSettings::AppSettings::handshakeQueueTimeoutInSeconds = 30;
+int StaticSettings::AppSettings::circuitBreakerBaseBackoffInSeconds = 5;
+int StaticSettings::AppSettings::circuitBreakerMaxBackoffInSeconds = 300;
+bool StaticSettings::AppSettings::eagerChannelOpen = false;
+int StaticSettings::AppSettings::spareChannelMaxIdleSeconds = 8;
+int StaticSettings::AppSettings::channelOpenBufferSize = 16384;
+int StaticSettings::AppSettings::maxClientsPerTunnel = 10;
+int StaticSettings::AppSettings::forwardBufferSize = 65536;
+int StaticSettings::AppSettings::forwardBufferHighWatermark = 49152;
+int StaticSettings::AppSettings::forwardBufferLowWatermark = 16384;
+string StaticSettings::AppSettings::channelWindowSize = "2097152";
+int StaticSettings::AppSettings::channelMaxWindowSize = 16777216;
+int StaticSettings::AppSettings::channelMaxPacketSize = 32768;
+string StaticSettings::AppSettings::sshMethodProfile = "compat";
+string StaticSettings::AppSettings::sshCompression = "off";
+int StaticSettings::AppSettings::compressionMaxBytesPerSecond = 4194304;
+int StaticSettings::AppSettings::compressionMinRatioPercent = 130;
+int StaticSettings::AppSettings::privateKeyCacheMaxEntries = 32;
+int StaticSettings::AppSettings::privateKeyCacheTtlSeconds = 3600;
+int StaticSettings::AppSettings::sshConnectTimeoutSeconds = 10;
+int StaticSettings::AppSettings::sshHandshakeTimeoutSeconds = 20;
+int StaticSettings::AppSettings::sshAuthTimeoutSeconds = 20;
+int StaticSettings::AppSettings::maxTunnelsPerBatch = 16;
+int StaticSettings::AppSettings::tunnelTicketMaxWaitSeconds = 30;
+int StaticSettings::AppSettings::tunnelTicketResultTtlSeconds = 300;
+int StaticSettings::AppSettings::maxControlRequestBytes = 1048576;
+int StaticSettings::AppSettings::forwardBufferPoolMaxBytes = 268435456;
+int StaticSettings::AppSettings::sshSessionMemoryLimitBytes = 0;
+bool StaticSettings::AppSettings::useIOUring = true;
+int StaticSettings::AppSettings::channelWriteCoalesceMicroseconds = 500;
+int StaticSettings::AppSettings::channelWriteCoalesceBytes = 16384;
+int StaticSettings::AppSettings::bandwidthLimitBytesPerSecond = 0;
+int StaticSettings::AppSettings::schedulerQuantumBytes = 16384;
+int StaticSettings::AppSettings::sshKeepaliveIntervalSeconds = 15;
+int StaticSettings::AppSettings::sshKeepaliveMaxMissed = 3;
+int StaticSettings::AppSettings::tcpKeepaliveIdleSeconds = 30;
+int StaticSettings::AppSettings::tcpKeepaliveIntervalSeconds = 10;
+int StaticSettings::AppSettings::tcpKeepaliveCount = 3;
+int StaticSettings::AppSettings::sshReconnectAttempts = 5;
+int StaticSettings::AppSettings::sshReconnectDelaySeconds = 2;
+int StaticSettings::AppSettings::setupLoopThreads = 2;
 string StaticSettings::AppSettings::logFile = "";
 
 
@@ -52,4 +95,223 @@ void StaticSettings::readStaticSetting()
 		cout << "Failed to read tunnelExpirationTimeInSeconds in [app_settings]. Defaulting to 30 seconds" << endl;
 		StaticSettings::AppSettings::tunnelExpirationTimeInSeconds = 30;
 	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "maxConcurrentHandshakesPerHost", &StaticSettings::AppSettings::maxConcurrentHandshakesPerHost))
+	{
+		cout << "Failed to read maxConcurrentHandshakesPerHost in [app_settings]. Defaulting to 8" << endl;
+		StaticSettings::AppSettings::maxConcurrentHandshakesPerHost = 8;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "handshakeQueueTimeoutInSeconds", &StaticSettings::AppSettings::handshakeQueueTimeoutInSeconds))
+	{
+		cout << "Failed to read handshakeQueueTimeoutInSeconds in [app_settings]. Defaulting to 30 seconds" << endl;
+		StaticSettings::AppSettings::handshakeQueueTimeoutInSeconds = 30;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "circuitBreakerBaseBackoffInSeconds", &StaticSettings::AppSettings::circuitBreakerBaseBackoffInSeconds))
+	{
+		cout << "Failed to read circuitBreakerBaseBackoffInSeconds in [app_settings]. Defaulting to 5 seconds" << endl;
+		StaticSettings::AppSettings::circuitBreakerBaseBackoffInSeconds = 5;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "circuitBreakerMaxBackoffInSeconds", &StaticSettings::AppSettings::circuitBreakerMaxBackoffInSeconds))
+	{
+		cout << "Failed to read circuitBreakerMaxBackoffInSeconds in [app_settings]. Defaulting to 300 seconds" << endl;
+		StaticSettings::AppSettings::circuitBreakerMaxBackoffInSeconds = 300;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "eagerChannelOpen", &StaticSettings::AppSettings::eagerChannelOpen))
+	{
+		cout << "Failed to read eagerChannelOpen in [app_settings]. Defaulting to false" << endl;
+		StaticSettings::AppSettings::eagerChannelOpen = false;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "spareChannelMaxIdleSeconds", &StaticSettings::AppSettings::spareChannelMaxIdleSeconds))
+	{
+		cout << "Failed to read spareChannelMaxIdleSeconds in [app_settings]. Defaulting to 8 seconds" << endl;
+		StaticSettings::AppSettings::spareChannelMaxIdleSeconds = 8;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "channelOpenBufferSize", &StaticSettings::AppSettings::channelOpenBufferSize))
+	{
+		cout << "Failed to read channelOpenBufferSize in [app_settings]. Defaulting to 16384 bytes" << endl;
+		StaticSettings::AppSettings::channelOpenBufferSize = 16384;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "maxClientsPerTunnel", &StaticSettings::AppSettings::maxClientsPerTunnel))
+	{
+		cout << "Failed to read maxClientsPerTunnel in [app_settings]. Defaulting to 10" << endl;
+		StaticSettings::AppSettings::maxClientsPerTunnel = 10;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "forwardBufferSize", &StaticSettings::AppSettings::forwardBufferSize))
+	{
+		cout << "Failed to read forwardBufferSize in [app_settings]. Defaulting to 65536 bytes" << endl;
+		StaticSettings::AppSettings::forwardBufferSize = 65536;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "forwardBufferHighWatermark", &StaticSettings::AppSettings::forwardBufferHighWatermark))
+	{
+		cout << "Failed to read forwardBufferHighWatermark in [app_settings]. Defaulting to 49152 bytes" << endl;
+		StaticSettings::AppSettings::forwardBufferHighWatermark = 49152;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "forwardBufferLowWatermark", &StaticSettings::AppSettings::forwardBufferLowWatermark))
+	{
+		cout << "Failed to read forwardBufferLowWatermark in [app_settings]. Defaulting to 16384 bytes" << endl;
+		StaticSettings::AppSettings::forwardBufferLowWatermark = 16384;
+	}
+	if (StaticSettings::AppSettings::forwardBufferHighWatermark > StaticSettings::AppSettings::forwardBufferSize || 
+		StaticSettings::AppSettings::forwardBufferLowWatermark >= StaticSettings::AppSettings::forwardBufferHighWatermark)
+	{
+		cout << "forwardBufferHighWatermark must be no larger than forwardBufferSize and above forwardBufferLowWatermark. Using 3/4 and 1/4 of forwardBufferSize" << endl;
+		StaticSettings::AppSettings::forwardBufferHighWatermark = StaticSettings::AppSettings::forwardBufferSize / 4 * 3;
+		StaticSettings::AppSettings::forwardBufferLowWatermark = StaticSettings::AppSettings::forwardBufferSize / 4;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "channelWindowSize", &StaticSettings::AppSettings::channelWindowSize))
+	{
+		cout << "Failed to read channelWindowSize in [app_settings]. Defaulting to 2097152 bytes" << endl;
+		StaticSettings::AppSettings::channelWindowSize = "2097152";
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "channelMaxWindowSize", &StaticSettings::AppSettings::channelMaxWindowSize))
+	{
+		cout << "Failed to read channelMaxWindowSize in [app_settings]. Defaulting to 16777216 bytes" << endl;
+		StaticSettings::AppSettings::channelMaxWindowSize = 16777216;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "channelMaxPacketSize", &StaticSettings::AppSettings::channelMaxPacketSize))
+	{
+		cout << "Failed to read channelMaxPacketSize in [app_settings]. Defaulting to 32768 bytes" << endl;
+		StaticSettings::AppSettings::channelMaxPacketSize = 32768;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "sshMethodProfile", &StaticSettings::AppSettings::sshMethodProfile))
+	{
+		cout << "Failed to read sshMethodProfile in [app_settings]. Defaulting to compat" << endl;
+		StaticSettings::AppSettings::sshMethodProfile = "compat";
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "sshCompression", &StaticSettings::AppSettings::sshCompression))
+	{
+		cout << "Failed to read sshCompression in [app_settings]. Defaulting to off" << endl;
+		StaticSettings::AppSettings::sshCompression = "off";
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "compressionMaxBytesPerSecond", &StaticSettings::AppSettings::compressionMaxBytesPerSecond))
+	{
+		cout << "Failed to read compressionMaxBytesPerSecond in [app_settings]. Defaulting to 4194304" << endl;
+		StaticSettings::AppSettings::compressionMaxBytesPerSecond = 4194304;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "compressionMinRatioPercent", &StaticSettings::AppSettings::compressionMinRatioPercent))
+	{
+		cout << "Failed to read compressionMinRatioPercent in [app_settings]. Defaulting to 130" << endl;
+		StaticSettings::AppSettings::compressionMinRatioPercent = 130;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "privateKeyCacheMaxEntries", &StaticSettings::AppSettings::privateKeyCacheMaxEntries))
+	{
+		cout << "Failed to read privateKeyCacheMaxEntries in [app_settings]. Defaulting to 32" << endl;
+		StaticSettings::AppSettings::privateKeyCacheMaxEntries = 32;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "privateKeyCacheTtlSeconds", &StaticSettings::AppSettings::privateKeyCacheTtlSeconds))
+	{
+		cout << "Failed to read privateKeyCacheTtlSeconds in [app_settings]. Defaulting to 3600" << endl;
+		StaticSettings::AppSettings::privateKeyCacheTtlSeconds = 3600;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "sshConnectTimeoutSeconds", &StaticSettings::AppSettings::sshConnectTimeoutSeconds))
+	{
+		cout << "Failed to read sshConnectTimeoutSeconds in [app_settings]. Defaulting to 10" << endl;
+		StaticSettings::AppSettings::sshConnectTimeoutSeconds = 10;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "sshHandshakeTimeoutSeconds", &StaticSettings::AppSettings::sshHandshakeTimeoutSeconds))
+	{
+		cout << "Failed to read sshHandshakeTimeoutSeconds in [app_settings]. Defaulting to 20" << endl;
+		StaticSettings::AppSettings::sshHandshakeTimeoutSeconds = 20;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "sshAuthTimeoutSeconds", &StaticSettings::AppSettings::sshAuthTimeoutSeconds))
+	{
+		cout << "Failed to read sshAuthTimeoutSeconds in [app_settings]. Defaulting to 20" << endl;
+		StaticSettings::AppSettings::sshAuthTimeoutSeconds = 20;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "maxTunnelsPerBatch", &StaticSettings::AppSettings::maxTunnelsPerBatch))
+	{
+		cout << "Failed to read maxTunnelsPerBatch in [app_settings]. Defaulting to 16" << endl;
+		StaticSettings::AppSettings::maxTunnelsPerBatch = 16;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "tunnelTicketMaxWaitSeconds", &StaticSettings::AppSettings::tunnelTicketMaxWaitSeconds))
+	{
+		cout << "Failed to read tunnelTicketMaxWaitSeconds in [app_settings]. Defaulting to 30" << endl;
+		StaticSettings::AppSettings::tunnelTicketMaxWaitSeconds = 30;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "tunnelTicketResultTtlSeconds", &StaticSettings::AppSettings::tunnelTicketResultTtlSeconds))
+	{
+		cout << "Failed to read tunnelTicketResultTtlSeconds in [app_settings]. Defaulting to 300" << endl;
+		StaticSettings::AppSettings::tunnelTicketResultTtlSeconds = 300;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "maxControlRequestBytes", &StaticSettings::AppSettings::maxControlRequestBytes))
+	{
+		cout << "Failed to read maxControlRequestBytes in [app_settings]. Defaulting to 1048576" << endl;
+		StaticSettings::AppSettings::maxControlRequestBytes = 1048576;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "forwardBufferPoolMaxBytes", &StaticSettings::AppSettings::forwardBufferPoolMaxBytes))
+	{
+		cout << "Failed to read forwardBufferPoolMaxBytes in [app_settings]. Defaulting to 268435456" << endl;
+		StaticSettings::AppSettings::forwardBufferPoolMaxBytes = 268435456;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "sshSessionMemoryLimitBytes", &StaticSettings::AppSettings::sshSessionMemoryLimitBytes))
+	{
+		cout << "Failed to read sshSessionMemoryLimitBytes in [app_settings]. Defaulting to 0" << endl;
+		StaticSettings::AppSettings::sshSessionMemoryLimitBytes = 0;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "useIOUring", &StaticSettings::AppSettings::useIOUring))
+	{
+		cout << "Failed to read useIOUring in [app_settings]. Defaulting to true" << endl;
+		StaticSettings::AppSettings::useIOUring = true;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "channelWriteCoalesceMicroseconds", &StaticSettings::AppSettings::channelWriteCoalesceMicroseconds))
+	{
+		cout << "Failed to read channelWriteCoalesceMicroseconds in [app_settings]. Defaulting to 500" << endl;
+		StaticSettings::AppSettings::channelWriteCoalesceMicroseconds = 500;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "channelWriteCoalesceBytes", &StaticSettings::AppSettings::channelWriteCoalesceBytes))
+	{
+		cout << "Failed to read channelWriteCoalesceBytes in [app_settings]. Defaulting to 16384" << endl;
+		StaticSettings::AppSettings::channelWriteCoalesceBytes = 16384;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "bandwidthLimitBytesPerSecond", &StaticSettings::AppSettings::bandwidthLimitBytesPerSecond))
+	{
+		cout << "Failed to read bandwidthLimitBytesPerSecond in [app_settings]. Defaulting to 0" << endl;
+		StaticSettings::AppSettings::bandwidthLimitBytesPerSecond = 0;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "schedulerQuantumBytes", &StaticSettings::AppSettings::schedulerQuantumBytes))
+	{
+		cout << "Failed to read schedulerQuantumBytes in [app_settings]. Defaulting to 16384" << endl;
+		StaticSettings::AppSettings::schedulerQuantumBytes = 16384;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "sshKeepaliveIntervalSeconds", &StaticSettings::AppSettings::sshKeepaliveIntervalSeconds))
+	{
+		cout << "Failed to read sshKeepaliveIntervalSeconds in [app_settings]. Defaulting to 15" << endl;
+		StaticSettings::AppSettings::sshKeepaliveIntervalSeconds = 15;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "sshKeepaliveMaxMissed", &StaticSettings::AppSettings::sshKeepaliveMaxMissed))
+	{
+		cout << "Failed to read sshKeepaliveMaxMissed in [app_settings]. Defaulting to 3" << endl;
+		StaticSettings::AppSettings::sshKeepaliveMaxMissed = 3;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "tcpKeepaliveIdleSeconds", &StaticSettings::AppSettings::tcpKeepaliveIdleSeconds))
+	{
+		cout << "Failed to read tcpKeepaliveIdleSeconds in [app_settings]. Defaulting to 30" << endl;
+		StaticSettings::AppSettings::tcpKeepaliveIdleSeconds = 30;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "tcpKeepaliveIntervalSeconds", &StaticSettings::AppSettings::tcpKeepaliveIntervalSeconds))
+	{
+		cout << "Failed to read tcpKeepaliveIntervalSeconds in [app_settings]. Defaulting to 10" << endl;
+		StaticSettings::AppSettings::tcpKeepaliveIntervalSeconds = 10;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "tcpKeepaliveCount", &StaticSettings::AppSettings::tcpKeepaliveCount))
+	{
+		cout << "Failed to read tcpKeepaliveCount in [app_settings]. Defaulting to 3" << endl;
+		StaticSettings::AppSettings::tcpKeepaliveCount = 3;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "sshReconnectAttempts", &StaticSettings::AppSettings::sshReconnectAttempts))
+	{
+		cout << "Failed to read sshReconnectAttempts in [app_settings]. Defaulting to 5" << endl;
+		StaticSettings::AppSettings::sshReconnectAttempts = 5;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "sshReconnectDelaySeconds", &StaticSettings::AppSettings::sshReconnectDelaySeconds))
+	{
+		cout << "Failed to read sshReconnectDelaySeconds in [app_settings]. Defaulting to 2" << endl;
+		StaticSettings::AppSettings::sshReconnectDelaySeconds = 2;
+	}
+	if (!iniParser.getKeyValueFromSection("app_settings", "setupLoopThreads", &StaticSettings::AppSettings::setupLoopThreads))
+	{
+		cout << "Failed to read setupLoopThreads in [app_settings]. Defaulting to 2" << endl;
+		StaticSettings::AppSettings::setupLoopThreads = 2;
+	}
+	HostSettings::loadHostSettings(&iniParser);
+	SSHMethodProfile::loadProfiles(&iniParser);
 }
\ No newline at end of file
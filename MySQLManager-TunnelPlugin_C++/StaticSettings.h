@@ -3,6 +3,7 @@
 #define STATICSETTINGS_H
 #include <iostream>
 #include "INIParser.h"
+#include "HostSettings.h"
 
 class StaticSettings
 {
@@ -17,6 +18,48 @@ public:
 		static int listenSocket;
 		static bool debugJSONMessages;
 		static int tunnelExpirationTimeInSeconds;
+		static int maxConcurrentHandshakesPerHost;
+		static int handshakeQueueTimeoutInSeconds;
+		static int circuitBreakerBaseBackoffInSeconds;
+		static int circuitBreakerMaxBackoffInSeconds;
+		static bool eagerChannelOpen;
+		static int spareChannelMaxIdleSeconds;
+		static int channelOpenBufferSize;
+		static int maxClientsPerTunnel;
+		static int forwardBufferSize;
+		static int forwardBufferHighWatermark;
+		static int forwardBufferLowWatermark;
+		static std::string channelWindowSize;
+		static int channelMaxWindowSize;
+		static int channelMaxPacketSize;
+		static std::string sshMethodProfile;
+		static std::string sshCompression;
+		static int compressionMaxBytesPerSecond;
+		static int compressionMinRatioPercent;
+		static int privateKeyCacheMaxEntries;
+		static int privateKeyCacheTtlSeconds;
+		static int sshConnectTimeoutSeconds;
+		static int sshHandshakeTimeoutSeconds;
+		static int sshAuthTimeoutSeconds;
+		static int maxTunnelsPerBatch;
+		static int tunnelTicketMaxWaitSeconds;
+		static int tunnelTicketResultTtlSeconds;
+		static int maxControlRequestBytes;
+		static int forwardBufferPoolMaxBytes;
+		static int sshSessionMemoryLimitBytes;
+		static bool useIOUring;
+		static int channelWriteCoalesceMicroseconds;
+		static int channelWriteCoalesceBytes;
+		static int bandwidthLimitBytesPerSecond;
+		static int schedulerQuantumBytes;
+		static int sshKeepaliveIntervalSeconds;
+		static int sshKeepaliveMaxMissed;
+		static int tcpKeepaliveIdleSeconds;
+		static int tcpKeepaliveIntervalSeconds;
+		static int tcpKeepaliveCount;
+		static int sshReconnectAttempts;
+		static int sshReconnectDelaySeconds;
+		static int setupLoopThreads;
 	};
 private:
 	std::string configFile;
@@ -22,13 +22,13 @@ TunnelManager::TunnelManager(Logger *logger)
 }
 
 /**
-	Initialies a tunnel manager object within logging and JSON string so the JSON can be processed for starting/stopping tunnels
+	Initialies a tunnel manager object within logging and the parsed request so the request can be processed for starting/stopping tunnels
 	@param logger Allow any debug or events to be logged
-	@param json The json message from the PHP API that was retrieved in the SocketProcess class
+	@param request The request from the PHP API that was parsed in the SocketProcess class
 */
-TunnelManager::TunnelManager(Logger *logger, string json)
+TunnelManager::TunnelManager(Logger *logger, TunnelRequest *request)
 {
-	this->json = json;
+	this->request = request;
 	this->logger = logger;
 }
 
@@ -51,39 +51,26 @@ void TunnelManager::tunnelMonitorThread()
 	StatusManager statusManager;
 	while (statusManager.getApplicationStatus() != StatusManager::ApplicationStatus::Stopping)
 	{
-		SSHTunnelForwarder *sshTunnelForwarder = NULL;
+		//The tunnels are only asked to close here, the thread forwarding the tunnel closes the SSH session, removes it from the active list and deletes it
+		TunnelManager::tunnelMutex.lock();
 		for (vector<ActiveTunnels>::iterator it = activeTunnelsList.begin(); it != activeTunnelsList.end(); ++it)
 		{
 			//Get the current time
 			time_t currentTime = std::time(nullptr);
 			
 			//Get the time difference
-             time_t timeDifference = currentTime - (*it).tunnelCreatedTime;
+			time_t timeDifference = currentTime - (*it).tunnelCreatedTime;
 			
 			//Time has expired so close the SSH Session
 			if (timeDifference >= StaticSettings::AppSettings::tunnelExpirationTimeInSeconds)
 			{
-				sshTunnelForwarder = it->sshTunnelForwarder;
-				it = activeTunnelsList.erase(it);
-				break;
+				stringstream logstream;
+				logstream << "Host: " << it->sshTunnelForwarder->getSSHHostnameOrIPAddress() << " on client port " << it->localPort << " has expired. Disconnecting";
+				this->logger->writeToLog(logstream.str(), "TunnelManager", "tunnelMonitorThread");
+				it->sshTunnelForwarder->requestClose();
 			}
 		}
-
-		if (sshTunnelForwarder != NULL)
-		{
-			stringstream logstream;
-			logstream << "Host: " << sshTunnelForwarder->getSSHHostnameOrIPAddress() << " on client port " << sshTunnelForwarder->getLocalListenPort() << " has expired. Disconnecting";
-			this->logger->writeToLog(logstream.str(), "TunnelManager", "tunnelMonitorThread");
-
-			logstream.clear();
-			logstream.str(string());
-			logstream << "Now " << this->getFreePortCount() << " of " << this->getTotalPortCount() << " available";
-			this->logger->writeToLog(logstream.str(), "TunnelManager", "tunnelMonitorThread");
-
-			sshTunnelForwarder->closeSSHSessions();
-			delete sshTunnelForwarder;
-			sshTunnelForwarder = NULL;
-		}
+		TunnelManager::tunnelMutex.unlock();
 		this_thread::sleep_for(chrono::seconds(StaticSettings::AppSettings::tunnelExpirationTimeInSeconds));
 	}
 }
@@ -96,7 +83,15 @@ void TunnelManager::tunnelMonitorThread()
 */
 bool TunnelManager::startStopTunnel(void *socketManager, void *clientsockptr)
 {
-	processJson();
+	if (!this->processRequest())
+	{
+		map<string, string> data;
+		data["error"] = this->request->getError();
+		JSONResponseGenerator jsonResponse;
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_GENERAL_ERROR, "InvalidRequest", &data);
+		this->sendResponseToSocket(clientsockptr, socketManager, &jsonResponse);
+		return false;
+	}
 	if (this->tunnelCommand == TunnelCommand::CreateConnection)
 	{
 		return this->startTunnel(socketManager, clientsockptr);
@@ -105,6 +100,22 @@ bool TunnelManager::startStopTunnel(void *socketManager, void *clientsockptr)
 	{
 		return this->stopTunnel(socketManager, clientsockptr);
 	}
+	else if (this->tunnelCommand == TunnelCommand::GetStatistics)
+	{
+		return this->sendStatistics(socketManager, clientsockptr);
+	}
+	else if (this->tunnelCommand == TunnelCommand::CreateConnections)
+	{
+		return this->startTunnels(socketManager, clientsockptr);
+	}
+	else if (this->tunnelCommand == TunnelCommand::CloseConnections)
+	{
+		return this->stopTunnels(socketManager, clientsockptr);
+	}
+	else if (this->tunnelCommand == TunnelCommand::GetTunnelResult)
+	{
+		return this->sendTunnelResult(socketManager, clientsockptr);
+	}
 	return false;
 }
 
@@ -116,49 +127,445 @@ bool TunnelManager::startStopTunnel(void *socketManager, void *clientsockptr)
 */
 bool TunnelManager::stopTunnel(void *socketManagerptr, void *clientsockptr)
 {
-#ifdef _WIN32
-	WindowsSocket * socketManager = static_cast<WindowsSocket*>(socketManagerptr);
-	SOCKET *clientsock = static_cast<SOCKET*>(clientsockptr);
-#else
-	LinuxSocket * socketManager = static_cast<LinuxSocket*>(socketManagerptr);
-	int *clientsock = static_cast<int*>(clientsockptr);
-#endif
+	if (this->requestTunnelClose(this->getLocalPort()))
+	{
+		JSONResponseGenerator jsonResponse;
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_SUCCESS, "");
+		this->sendResponseToSocket(clientsockptr, socketManagerptr, &jsonResponse);
+		return true;
+	}
+	return false;
+}
+
+/**
+	Stop several tunnels from one request, the localPorts array within the JSON determines what SSH tunnels need to be closed.
+	The response has a tunnels array with a result for each local port, in the same order as the request
+	@param socketManagerPtr A pointer to the socket class (WindowsSocket or LinuxSocket)
+	@param clientsockptr The socket descriptor where the response needs to be sent
+	@return bool False on error otherwise true is returned
+*/
+bool TunnelManager::stopTunnels(void *socketManagerptr, void *clientsockptr)
+{
+	vector<string> responses;
+	for (vector<int>::iterator it = this->batchLocalPorts.begin(); it != this->batchLocalPorts.end(); ++it)
+	{
+		map<string, string> data;
+		data["localPort"] = std::to_string(*it);
+		JSONResponseGenerator jsonResponse;
+		if (this->requestTunnelClose(*it))
+		{
+			jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_SUCCESS, "", &data);
+		}
+		else
+		{
+			jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "TunnelNotFound", &data);
+		}
+		responses.push_back(jsonResponse.getJSONString());
+	}
+	JSONResponseGenerator jsonResponse;
+	jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_SUCCESS, "");
+	jsonResponse.addJSONArray("tunnels", &responses);
+	this->sendResponseToSocket(clientsockptr, socketManagerptr, &jsonResponse);
+	return true;
+}
+
+/**
+	Ask the tunnel on the local port to close. The thread forwarding the tunnel closes it
+	@param localPort The local port of the tunnel
+	@return bool True if there is a tunnel on the local port, otherwise false
+*/
+bool TunnelManager::requestTunnelClose(int localPort)
+{
 	//Find we need to find the SSHTunnelForwarder so that we can call close session
 	stringstream logstream;
-	logstream << "Requested tunnel closure on port: " << this->getLocalPort();
+	logstream << "Requested tunnel closure on port: " << localPort;
 	this->logger->writeToLog(logstream.str(), "TunnelManager", "stopTunnel");
+	bool tunnelFound = false;
+	TunnelManager::tunnelMutex.lock();
 	for (std::vector<ActiveTunnels>::iterator it = activeTunnelsList.begin(); it != activeTunnelsList.end(); ++it)
 	{
-		ActiveTunnels activeTunnel = *it;
-		if (activeTunnel.localPort == this->getLocalPort())
+		if (it->localPort == localPort)
 		{
 			logstream.clear();
 			logstream.str(string());
-			logstream << "Closing SSH tunnel for host: " << it->sshTunnelForwarder->getSSHHostnameOrIPAddress() << " for port " << this->getLocalPort();
+			logstream << "Closing SSH tunnel for host: " << it->sshTunnelForwarder->getSSHHostnameOrIPAddress() << " for port " << localPort;
 			this->logger->writeToLog(logstream.str(), "TunnelManager", "stopTunnel");
-			SSHTunnelForwarder *sshTunnelForwarder = activeTunnel.sshTunnelForwarder;
-			sshTunnelForwarder->closeSSHSessions();
-			JSONResponseGenerator jsonResponse;
-			jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_SUCCESS, "");
-			socketManager->sendToSocket(clientsock, jsonResponse.getJSONString());
-#ifndef _WIN32
-                        //shutdown(*clientsock, SHUT_RDWR);
-			socketManager->closeSocket(clientsock);
-#endif
-			socketManager->closeSocket(clientsock);
-			return true;
+			it->sshTunnelForwarder->requestPortClose(localPort);
+			tunnelFound = true;
+			break;
 		}
 	}
-	return false;
+	TunnelManager::tunnelMutex.unlock();
+	return tunnelFound;
 }
 
 /**
-	Start an SSH tunnel
+	Send the current tunnel statistics back to the PHP API, e.g. how many tunnels are active and how long tunnel requests are waiting to start
+	their SSH handshake
+	@param socketManagerPtr A pointer to the socket class (WindowsSocket or LinuxSocket)
+	@param clientsockptr The socket descriptor where the response needs to be sent
+	@return bool False on error otherwise true is returned
+*/
+bool TunnelManager::sendStatistics(void *socketManagerptr, void *clientsockptr)
+{
+	map<string, string> stats;
+	SSHHandshakeLimiter::appendStatistics(&stats);
+	SSHHostCircuitBreaker::appendStatistics(&stats);
+	TunnelSetupLoop::appendStatistics(&stats);
+	LinkStatistics::appendStatistics(&stats);
+	PrivateKeyCache::appendStatistics(&stats);
+	TunnelSetupTickets::appendStatistics(&stats);
+	ReceiveBuffer::appendStatistics(&stats);
+	BufferPool::appendStatistics(&stats);
+	SSHSessionMemory::appendStatistics(&stats);
+	BandwidthLimiter::appendStatistics(&stats);
+
+	//The memory each tunnel's SSH session is using. The tunnel counts are read under the same lock, as the setup loops and forwarding 
+	//threads add and remove tunnels while the statistics are collected
+	vector<string> tunnelMemory;
+	TunnelManager::tunnelMutex.lock();
+	stats["activeTunnels"] = std::to_string(activeTunnelsList.size());
+	stats["freePorts"] = std::to_string(this->getFreePortCount());
+	for (vector<ActiveTunnels>::iterator it = activeTunnelsList.begin(); it != activeTunnelsList.end(); ++it)
+	{
+		SSHSessionMemory *sessionMemory = it->sshTunnelForwarder->getSessionMemory();
+		StringBuffer buffer;
+		Writer<StringBuffer> writer(buffer);
+		writer.StartObject();
+		writer.Key("localPort");
+		writer.Int(it->localPort);
+		writer.Key("sshHost");
+		writer.String(it->sshTunnelForwarder->getSSHHostnameOrIPAddress().c_str());
+		writer.Key("sessionMemoryBytes");
+		writer.Uint64(sessionMemory->getBytesInUse());
+		writer.Key("sessionMemoryPeakBytes");
+		writer.Uint64(sessionMemory->getPeakBytes());
+		writer.Key("sessionMemoryLimitFailures");
+		writer.Uint64(sessionMemory->getLimitFailures());
+		writer.EndObject();
+		tunnelMemory.push_back(string(buffer.GetString(), buffer.GetSize()));
+	}
+	TunnelManager::tunnelMutex.unlock();
+
+	JSONResponseGenerator jsonResponse;
+	jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_SUCCESS, "", &stats);
+	jsonResponse.addJSONArray("tunnels", &tunnelMemory);
+	this->sendResponseToSocket(clientsockptr, socketManagerptr, &jsonResponse);
+	return true;
+}
+
+/**
+	Start an SSH tunnel. If the setup has to wait for the SSH server it is left for handOverSetup to give to a setup loop, which sends the 
+	response once the tunnel is set up
 	@param socketManagerPtr A pointer to the socket class (WindowsSocket or LinuxSocket)
 	@param clientsockptr The socket descriptor where the response needs to be sent
 	@return bool False on error otherwise true is returned
 */
 bool TunnelManager::startTunnel(void *socketManagerptr, void *clientsockptr)
+{
+	if (this->asyncRequest)
+	{
+		return this->startTunnelAsync(socketManagerptr, clientsockptr);
+	}
+	this->setupSocketManager = socketManagerptr;
+	this->setupClient = clientsockptr;
+	string response;
+	SSHTunnelForwarder::SetupResult result = this->startSetup(&response);
+	if (result == SSHTunnelForwarder::SetupResult::SETUP_WAITING)
+	{
+		//The response is sent by the setup loop that handOverSetup gives the tunnel to
+		return true;
+	}
+	this->sendResponseToSocket(clientsockptr, socketManagerptr, response);
+	this->forwardTunnel();
+	return result == SSHTunnelForwarder::SetupResult::SETUP_DONE;
+}
+
+/**
+	Start an SSH tunnel without making the PHP API wait for it to be set up. A ticket is sent back straight away and the CreateTunnel 
+	response is stored against the ticket when the setup finishes, for the PHP API to fetch with GetTunnelResult
+	@param socketManagerPtr A pointer to the socket class (WindowsSocket or LinuxSocket)
+	@param clientsockptr The socket descriptor where the response needs to be sent
+	@return bool False on error otherwise true is returned
+*/
+bool TunnelManager::startTunnelAsync(void *socketManagerptr, void *clientsockptr)
+{
+	TunnelSetupTickets tunnelSetupTickets(this->logger);
+	string ticket = tunnelSetupTickets.createTicket();
+	JSONResponseGenerator jsonResponse;
+	if (ticket.empty())
+	{
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_GENERAL_ERROR, "TicketCreationFailed");
+		this->sendResponseToSocket(clientsockptr, socketManagerptr, &jsonResponse);
+		return false;
+	}
+	map<string, string> data;
+	data["ticket"] = ticket;
+	jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_SUCCESS, "TunnelSetupStarted", &data);
+	this->sendResponseToSocket(clientsockptr, socketManagerptr, &jsonResponse);
+
+	this->setupSocketManager = socketManagerptr;
+	this->setupClient = clientsockptr;
+	this->ticket = ticket;
+	string response;
+	SSHTunnelForwarder::SetupResult result = this->startSetup(&response);
+	if (result == SSHTunnelForwarder::SetupResult::SETUP_WAITING)
+	{
+		//The ticket is completed by the setup loop that handOverSetup gives the tunnel to
+		return true;
+	}
+	tunnelSetupTickets.completeTicket(ticket, response);
+	this->forwardTunnel();
+	return result == SSHTunnelForwarder::SetupResult::SETUP_DONE;
+}
+
+/**
+	Send the CreateTunnel response for an async tunnel setup. If the setup hasn't finished the request waits for up to waitSeconds 
+	for it, after that TunnelSetupInProgress is sent back and the PHP API can ask again
+	@param socketManagerPtr A pointer to the socket class (WindowsSocket or LinuxSocket)
+	@param clientsockptr The socket descriptor where the response needs to be sent
+	@return bool False on error otherwise true is returned
+*/
+bool TunnelManager::sendTunnelResult(void *socketManagerptr, void *clientsockptr)
+{
+	TunnelSetupTickets tunnelSetupTickets(this->logger);
+	string response;
+	TunnelSetupTickets::TicketStatus ticketStatus = tunnelSetupTickets.getResult(this->ticket, this->ticketWaitSeconds, &response);
+	if (ticketStatus == TunnelSetupTickets::TicketStatus::TICKET_COMPLETE)
+	{
+		this->sendResponseToSocket(clientsockptr, socketManagerptr, response);
+		return true;
+	}
+	map<string, string> data;
+	data["ticket"] = this->ticket;
+	JSONResponseGenerator jsonResponse;
+	if (ticketStatus == TunnelSetupTickets::TicketStatus::TICKET_PENDING)
+	{
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_SUCCESS, "TunnelSetupInProgress", &data);
+	}
+	else
+	{
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_GENERAL_ERROR, "TicketNotFound", &data);
+	}
+	this->sendResponseToSocket(clientsockptr, socketManagerptr, &jsonResponse);
+	return ticketStatus == TunnelSetupTickets::TicketStatus::TICKET_PENDING;
+}
+
+/**
+	Forward the tunnel that startSetup and continueSetup set up until the tunnel expires or is closed, then delete it. Does nothing if the setup 
+	didn't leave a tunnel to forward
+*/
+void TunnelManager::forwardTunnel()
+{
+	if (this->sshTunnelForwarder == NULL)
+	{
+		return;
+	}
+	this->sshTunnelForwarder->acceptAndForwardToMySQL();
+	delete this->sshTunnelForwarder;
+	this->sshTunnelForwarder = NULL;
+}
+
+/**
+	Set up a tunnel that forwards directly to the MySQL server because it is in directForwardDestinations for the SSH host. There is no
+	SSH host key, so the request that would get the fingerprint to confirm gets DIRECT back instead, and the confirmed request opens the 
+	tunnel. The responses are otherwise the same as for a tunnel through SSH
+	@param setupResponse Set to the response to send back to the PHP API
+	@return bool False if the tunnel couldn't be set up
+*/
+bool TunnelManager::setupDirectTunnel(string *setupResponse)
+{
+	if (!this->getFingerprintConfirmed())
+	{
+		map<string, string> jsonData;
+		jsonData["fingerprint"] = "DIRECT";
+		JSONResponseGenerator jsonResponse;
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_SUCCESS, "", &jsonData);
+		*setupResponse = jsonResponse.getJSONString();
+		delete sshTunnelForwarder;
+		sshTunnelForwarder = NULL;
+		return true;
+	}
+	if (!sshTunnelForwarder->startDirectForwarding(setupResponse))
+	{
+		delete sshTunnelForwarder;
+		sshTunnelForwarder = NULL;
+		return false;
+	}
+	ActiveTunnels activeTunnels(sshTunnelForwarder, this->localPort);
+	TunnelManager::tunnelMutex.lock();
+	activeTunnelsList.push_back(activeTunnels);
+	TunnelManager::tunnelMutex.unlock();
+
+	stringstream logstream;
+	logstream << "Current ports available: " << this->getFreePortCount();
+	this->logger->writeToLog(logstream.str(), "TunnelManager", "setupDirectTunnel");
+	return true;
+}
+
+/**
+	Start several SSH tunnels from one request, e.g. to a primary and a replica. Each tunnel's setup is started here and carried on by the 
+	setup loops, so the tunnels are set up at the same time and the response comes back once the slowest tunnel is set up rather than after 
+	all of them one after another. Tunnels in the request with exactly the same details are only set up once and share the tunnel, as a 
+	tunnel accepts more than one client. Tunnels to different MySQL servers through the same SSH server with the same credentials share 
+	one SSH session, only the first of them connects and authenticates and the others get their own local port on its session (see 
+	SSHTunnelForwarder::addSharedPort). The response has a tunnels array with the CreateTunnel response for each tunnel, in the same 
+	order as the request
+	@param socketManagerPtr A pointer to the socket class (WindowsSocket or LinuxSocket)
+	@param clientsockptr The socket descriptor where the response needs to be sent
+	@return bool False on error otherwise true is returned
+*/
+bool TunnelManager::startTunnels(void *socketManagerptr, void *clientsockptr)
+{
+	JSONResponseGenerator jsonResponse;
+	if (this->batchTunnels.empty() || this->batchTunnels.size() > (size_t)StaticSettings::AppSettings::maxTunnelsPerBatch)
+	{
+		stringstream logstream;
+		logstream << "Tunnel batch of " << this->batchTunnels.size() << " tunnels rejected, batches can have 1 to " << StaticSettings::AppSettings::maxTunnelsPerBatch << " tunnels";
+		this->logger->writeToLog(logstream.str(), "TunnelManager", "startTunnels");
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_GENERAL_ERROR, "InvalidTunnelBatch");
+		this->sendResponseToSocket(clientsockptr, socketManagerptr, &jsonResponse);
+		this->deleteBatchTunnels();
+		return false;
+	}
+
+	BatchSetup batchSetup;
+	batchSetup.responses.resize(this->batchTunnels.size());
+	vector<size_t> sharedWith(this->batchTunnels.size());
+	map<string, size_t> uniqueTunnels;
+	map<string, TunnelManager*> sessionTunnels;
+	for (size_t i = 0; i < this->batchTunnels.size(); i++)
+	{
+		string requestHash = this->batchTunnels[i]->getTunnelRequestHash();
+		map<string, size_t>::iterator existing = uniqueTunnels.find(requestHash);
+		if (existing != uniqueTunnels.end())
+		{
+			sharedWith[i] = existing->second;
+			continue;
+		}
+		uniqueTunnels[requestHash] = i;
+		sharedWith[i] = i;
+
+		TunnelManager *batchTunnel = this->batchTunnels[i];
+		batchTunnel->batchSetup = &batchSetup;
+		batchTunnel->batchIndex = i;
+		if (!DirectForwarder::isDirectDestination(batchTunnel->sshHost, batchTunnel->mysqlServerHost, (int)batchTunnel->remoteMySQLPort))
+		{
+			string sessionHash = batchTunnel->getSessionHash();
+			map<string, TunnelManager*>::iterator session = sessionTunnels.find(sessionHash);
+			if (session != sessionTunnels.end())
+			{
+				//Its response is recorded when the tunnel whose session it shares finishes setting up
+				session->second->sessionTunnels.push_back(batchTunnel);
+				batchTunnel->batchSetup = NULL;
+				continue;
+			}
+			sessionTunnels[sessionHash] = batchTunnel;
+		}
+		batchSetup.setupsRemaining++;
+	}
+	//Reserved up front so adding a thread that has started can't throw
+	batchSetup.forwardingThreads.reserve(batchSetup.setupsRemaining);
+	for (map<string, TunnelManager*>::iterator it = sessionTunnels.begin(); it != sessionTunnels.end(); ++it)
+	{
+		if (!it->second->sessionTunnels.empty())
+		{
+			stringstream logstream;
+			logstream << "Tunnel " << it->second->batchIndex << " of the batch shares its SSH session with " << it->second->sessionTunnels.size() << " other tunnel(s)";
+			this->logger->writeToLog(logstream.str(), "TunnelManager", "startTunnels");
+		}
+	}
+	for (size_t i = 0; i < this->batchTunnels.size(); i++)
+	{
+		TunnelManager *batchTunnel = this->batchTunnels[i];
+		if (sharedWith[i] != i || batchTunnel->batchSetup == NULL)
+		{
+			continue;
+		}
+		string response;
+		if (batchTunnel->startSetup(&response) == SSHTunnelForwarder::SetupResult::SETUP_WAITING)
+		{
+			if (!TunnelSetupLoop::addSetup(batchTunnel))
+			{
+				batchTunnel->abandonSetup();
+			}
+		}
+		else
+		{
+			batchTunnel->finishSetup(response);
+		}
+	}
+
+	{
+		unique_lock<mutex> lock(batchSetup.setupMutex);
+		batchSetup.setupFinished.wait(lock, [&batchSetup] { return batchSetup.setupsRemaining == 0; });
+	}
+	for (size_t i = 0; i < this->batchTunnels.size(); i++)
+	{
+		batchSetup.responses[i] = batchSetup.responses[sharedWith[i]];
+	}
+	jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_SUCCESS, "");
+	jsonResponse.addJSONArray("tunnels", &batchSetup.responses);
+	this->sendResponseToSocket(clientsockptr, socketManagerptr, &jsonResponse);
+
+	//Like a single tunnel used to, this thread stays until all of the tunnels have been closed, as the batch's tunnel managers are deleted here
+	for (vector<std::thread>::iterator it = batchSetup.forwardingThreads.begin(); it != batchSetup.forwardingThreads.end(); ++it)
+	{
+		it->join();
+	}
+	this->deleteBatchTunnels();
+	return true;
+}
+
+/**
+	Get a hash of the details of the tunnel request, so tunnels in a batch with the same details can share a tunnel
+	@return string The SHA-256 hash of the tunnel request details
+*/
+string TunnelManager::getTunnelRequestHash()
+{
+	HelperMethods helperMethods;
+	stringstream requestStream;
+	requestStream << this->sshHost << '\0' << this->sshPort << '\0' << this->sshUsername << '\0' << this->authMethod << '\0' << this->sshPassword << '\0';
+	requestStream << this->privateKey << '\0' << this->certPassphrase << '\0' << this->mysqlServerHost << '\0' << this->remoteMySQLPort << '\0';
+	requestStream << this->fingerprintConfirmed << '\0' << this->postedFingerprint;
+	return helperMethods.sha256Hash(requestStream.str());
+}
+
+/**
+	Get a hash of the SSH server and credentials of the tunnel request, so tunnels in a batch to different MySQL servers through the same 
+	SSH server can share an SSH session. The bandwidth limit is included as the tunnels sharing the session share the limit
+	@return string The SHA-256 hash of the SSH details
+*/
+string TunnelManager::getSessionHash()
+{
+	HelperMethods helperMethods;
+	stringstream sessionStream;
+	sessionStream << this->sshHost << '\0' << this->sshPort << '\0' << this->sshUsername << '\0' << this->authMethod << '\0' << this->sshPassword << '\0';
+	sessionStream << this->privateKey << '\0' << this->certPassphrase << '\0' << this->fingerprintConfirmed << '\0' << this->postedFingerprint << '\0';
+	sessionStream << this->bandwidthLimitBytesPerSecond;
+	return helperMethods.sha256Hash(sessionStream.str());
+}
+
+/**
+	Delete the tunnel managers that were created for each tunnel in a batch
+*/
+void TunnelManager::deleteBatchTunnels()
+{
+	for (vector<TunnelManager*>::iterator it = this->batchTunnels.begin(); it != this->batchTunnels.end(); ++it)
+	{
+		delete *it;
+	}
+	this->batchTunnels.clear();
+}
+
+/**
+	Start setting up the tunnel. Everything that doesn't wait for the SSH server is done here: the tunnel's local port is picked, a direct 
+	tunnel is set up straight away, the circuit breaker and the handshake limiter are checked and the connect to the SSH server is started. 
+	The rest of the setup is carried on by continueSetup once the SSH server answers
+	@param setupResponse Set to the JSON response for the PHP API if the setup has already finished
+	@return SetupResult SETUP_WAITING if continueSetup needs to carry on the setup, otherwise SETUP_DONE or SETUP_FAILED with setupResponse set
+*/
+SSHTunnelForwarder::SetupResult TunnelManager::startSetup(string *setupResponse)
 {
 	this->localPort = findNextAvailableLocalSSHPort();
 
@@ -170,6 +577,7 @@ bool TunnelManager::startTunnel(void *socketManagerptr, void *clientsockptr)
 	sshTunnelForwarder->setSSHPort(this->sshPort);
 	sshTunnelForwarder->setMySQLHost(this->mysqlServerHost);
 	sshTunnelForwarder->setMySQLPort(this->remoteMySQLPort);
+	sshTunnelForwarder->setBandwidthLimit(this->bandwidthLimitBytesPerSecond);
 	if (this->getAuthMethod() == AuthMethod::Password)
 	{
 		sshTunnelForwarder->setAuthMethod(SSHTunnelForwarder::SupportedAuthMethods::AUTH_PASSWORD);
@@ -186,110 +594,439 @@ bool TunnelManager::startTunnel(void *socketManagerptr, void *clientsockptr)
 		stringstream logstream;
 		logstream << "No valid authentication method was selected. Only password and public and private ";
 		logstream << "key is acceppted";
-		this->logger->writeToLog(logstream.str(), "TunnelManager", "startTunnel");
+		this->logger->writeToLog(logstream.str(), "TunnelManager", "startSetup");
 		JSONResponseGenerator jsonResponse;
 		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_AUTH_FAILURE, "NoValidAuthMethod");
 		string response = jsonResponse.getJSONString();
 		logstream.clear();
 		logstream.str(string());
 		logstream << "Sending Response: " << response;
-		this->logger->writeToLog(logstream.str(), "TunnelManager", "startTunnel");
-		this->sendResponseToSocket(clientsockptr, socketManagerptr, response);
+		this->logger->writeToLog(logstream.str(), "TunnelManager", "startSetup");
+		*setupResponse = response;
 		delete sshTunnelForwarder;
-		return false;
+		sshTunnelForwarder = NULL;
+		return SSHTunnelForwarder::SetupResult::SETUP_FAILED;
 	}
-	SSHTunnelForwarder::ErrorStatus errorStatus;
-	string fingerprint = sshTunnelForwarder->connectToSSHAndFingerprint(errorStatus);
-	if (!fingerprint.empty() && errorStatus == SSHTunnelForwarder::ErrorStatus::SUCCESS)
+
+	if (sshTunnelForwarder->isDirectDestination())
 	{
-		stringstream logstream;
-		logstream << "SSH Host " << this->getSSHHost() << " has Fingerprint of: " << fingerprint;
-		this->logger->writeToLog(logstream.str(), "TunnelManager", "startTunnel");
-		//Send the fingerprint back to Android and check with the user whether they want to accept this token
-		if (!this->getFingerprintConfirmed())
+		return this->setupDirectTunnel(setupResponse) ? SSHTunnelForwarder::SetupResult::SETUP_DONE : SSHTunnelForwarder::SetupResult::SETUP_FAILED;
+	}
+
+	//If the SSH server or these credentials failed recently, don't wait for the same timeout or authentication failure again
+	HelperMethods helperMethods;
+	stringstream credentialStream;
+	credentialStream << this->sshUsername << '\0' << this->sshPassword << '\0' << this->privateKey << '\0' << this->certPassphrase;
+	this->credentialHash = helperMethods.sha256Hash(credentialStream.str());
+	sshTunnelForwarder->setCredentialHash(this->credentialHash);
+	SSHHostCircuitBreaker circuitBreaker(this->logger, this->sshHost, this->sshPort, this->credentialHash);
+	SSHHostCircuitBreaker::FailureType cachedFailure;
+	int retryAfterSeconds = 0;
+	if (!circuitBreaker.allowRequest(&cachedFailure, &retryAfterSeconds))
+	{
+		map<string, string> jsonData;
+		jsonData["retryAfterSeconds"] = std::to_string(retryAfterSeconds);
+		JSONResponseGenerator jsonResponse;
+		if (cachedFailure == SSHHostCircuitBreaker::FailureType::DNS_RESOLUTION_FAILED)
 		{
-			map<string, string> jsonData;
-			jsonData["fingerprint"] = fingerprint;
-			JSONResponseGenerator jsonResponse;
-			jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_SUCCESS, "", &jsonData);
-			string response = jsonResponse.getJSONString();
-			this->sendResponseToSocket(clientsockptr, socketManagerptr, response);
-			sshTunnelForwarder->closeSSHSessions();
-			delete sshTunnelForwarder;
-			return true;
+			jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "DNSResolutionFailed", &jsonData);
 		}
-		else if (fingerprint.compare(this->getPostedFingerprint()) != 0)
+		else if (cachedFailure == SSHHostCircuitBreaker::FailureType::PASSWORD_AUTH_FAILED)
 		{
-			//The fingerprint doesn't match what was posted, so send back an error to the user
-			//to ask to confirm that the fingerprint is for the server what they expected
-			sshTunnelForwarder->closeSSHSessions();
-			map<string, string> jsonData;
-			jsonData["fingerprint"] = fingerprint;
-			JSONResponseGenerator jsonResponse;
-			jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "FingerprintNotMatched", &jsonData);
-			string response = jsonResponse.getJSONString();
-			this->sendResponseToSocket(clientsockptr, socketManagerptr, response);
-			delete sshTunnelForwarder;
-			return false;
+			jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "PasswordAuthFailed", &jsonData);
 		}
-		//Fingerprint confirmed so auth and set up the port forwarding
-		string response;
-		bool result = sshTunnelForwarder->authenticateSSHServerAndStartPortForwarding(&response);
-		this->sendResponseToSocket(clientsockptr, socketManagerptr, response);
-		if (!result)
+		else
 		{
-			delete sshTunnelForwarder;
-			return false; //Error in the authentication so stop processing
+			jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "SSHConnectFailed", &jsonData);
 		}
+		stringstream logstream;
+		logstream << "SSH Host " << this->getSSHHost() << " failed recently. Failing fast, retry after " << retryAfterSeconds << " seconds";
+		this->logger->writeToLog(logstream.str(), "TunnelManager", "startSetup");
+		*setupResponse = jsonResponse.getJSONString();
+		delete sshTunnelForwarder;
+		sshTunnelForwarder = NULL;
+		return SSHTunnelForwarder::SetupResult::SETUP_FAILED;
+	}
 
-		Document jsonObject;
-		jsonObject.Parse(response.c_str());
+	//The private key is decoded here rather than on the setup loop, which carries on the setups of other tunnels while it waits
+	if (this->getAuthMethod() == AuthMethod::PrivateKey)
+	{
+		sshTunnelForwarder->loadPrivateKey();
+	}
 
-		if (jsonObject["result"].GetInt() == JSONResponseGenerator::APIResponse::API_SUCCESS)
-		{
-			ActiveTunnels activeTunnels(sshTunnelForwarder, this->localPort);
-			activeTunnelsList.push_back(activeTunnels);
+	//Wait for our turn if there are already too many handshakes in progress against this SSH server, otherwise
+	//the SSH server may start dropping the connections (OpenSSH MaxStartups). The slot is held until the authentication has finished
+	this->handshakeLimiter = new SSHHandshakeLimiter(this->logger, this->sshHost, this->sshPort);
+	if (!this->handshakeLimiter->acquireSlot())
+	{
+		JSONResponseGenerator jsonResponse;
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "SSHHandshakeQueueTimeout");
+		*setupResponse = jsonResponse.getJSONString();
+		delete this->handshakeLimiter;
+		this->handshakeLimiter = NULL;
+		delete sshTunnelForwarder;
+		sshTunnelForwarder = NULL;
+		return SSHTunnelForwarder::SetupResult::SETUP_FAILED;
+	}
 
-			logstream.clear();
-			logstream.str(std::string());
-			logstream << "Current ports available: " << this->getFreePortCount();
-			this->logger->writeToLog(logstream.str(), "TunnelManager", "startTunnel");
+	SSHTunnelForwarder::ErrorStatus errorStatus;
+	if (sshTunnelForwarder->startConnectToSSH(errorStatus) == SSHTunnelForwarder::SetupResult::SETUP_FAILED)
+	{
+		this->failSSHConnect(errorStatus, setupResponse);
+		return SSHTunnelForwarder::SetupResult::SETUP_FAILED;
+	}
+	this->setupState = SetupState::SETUP_CONNECTING;
+	return SSHTunnelForwarder::SetupResult::SETUP_WAITING;
+}
 
-			sshTunnelForwarder->acceptAndForwardToMySQL();
+/**
+	Carry on the tunnel's setup for as far as it can go without waiting for the SSH server. This is called by the setup loop when the 
+	tunnel's SSH socket is ready or the current setup step has passed its deadline. When the setup finishes the response is sent and the 
+	tunnel is handed to its own thread to be forwarded
+	@return bool True if the setup has finished, after which the setup loop mustn't use the tunnel manager again
+*/
+bool TunnelManager::continueSetup()
+{
+	string response;
+	SSHTunnelForwarder::SetupResult result = SSHTunnelForwarder::SetupResult::SETUP_WAITING;
+	if (this->setupState == SetupState::SETUP_CONNECTING)
+	{
+		result = this->continueSSHConnect(&response);
+		if (result == SSHTunnelForwarder::SetupResult::SETUP_DONE && this->setupState == SetupState::SETUP_AUTHENTICATING)
+		{
+			result = SSHTunnelForwarder::SetupResult::SETUP_WAITING;
 		}
+	}
+	if (this->setupState == SetupState::SETUP_AUTHENTICATING)
+	{
+		result = this->continueSSHAuthentication(&response);
+	}
+	if (result == SSHTunnelForwarder::SetupResult::SETUP_WAITING)
+	{
+		return false;
+	}
+	this->finishSetup(response);
+	return true;
+}
+
+/**
+	Carry on connecting to the SSH server. Once the handshake has finished the fingerprint is checked, and if it has been confirmed the 
+	authentication is started
+	@param setupResponse Set to the JSON response for the PHP API if the setup has finished
+	@return SetupResult SETUP_WAITING while connecting, SETUP_DONE once the fingerprint is sent back or the authentication has started, or SETUP_FAILED
+*/
+SSHTunnelForwarder::SetupResult TunnelManager::continueSSHConnect(string *setupResponse)
+{
+	string fingerprint;
+	SSHTunnelForwarder::ErrorStatus errorStatus;
+	SSHTunnelForwarder::SetupResult result = sshTunnelForwarder->continueConnectToSSH(&fingerprint, errorStatus);
+	if (result == SSHTunnelForwarder::SetupResult::SETUP_WAITING)
+	{
+		return result;
+	}
+	if (result == SSHTunnelForwarder::SetupResult::SETUP_FAILED)
+	{
+		this->failSSHConnect(errorStatus, setupResponse);
+		return result;
+	}
+
+	SSHHostCircuitBreaker circuitBreaker(this->logger, this->sshHost, this->sshPort, this->credentialHash);
+	circuitBreaker.recordConnectSuccess();
+	stringstream logstream;
+	logstream << "SSH Host " << this->getSSHHost() << " has Fingerprint of: " << fingerprint;
+	this->logger->writeToLog(logstream.str(), "TunnelManager", "continueSSHConnect");
+	//Send the fingerprint back to Android and check with the user whether they want to accept this token
+	if (!this->getFingerprintConfirmed())
+	{
+		map<string, string> jsonData;
+		jsonData["fingerprint"] = fingerprint;
+		JSONResponseGenerator jsonResponse;
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_SUCCESS, "", &jsonData);
+		*setupResponse = jsonResponse.getJSONString();
+		sshTunnelForwarder->closeSSHSessions();
 		delete sshTunnelForwarder;
-		return true;
+		sshTunnelForwarder = NULL;
+		return SSHTunnelForwarder::SetupResult::SETUP_DONE;
 	}
-	else
+	else if (fingerprint.compare(this->getPostedFingerprint()) != 0)
 	{
-		//If we got here then something went wrong, check the error ErrorStatus for the type
-		string response;
+		//The fingerprint doesn't match what was posted, so send back an error to the user
+		//to ask to confirm that the fingerprint is for the server what they expected
+		sshTunnelForwarder->closeSSHSessions();
+		map<string, string> jsonData;
+		jsonData["fingerprint"] = fingerprint;
 		JSONResponseGenerator jsonResponse;
-		if (errorStatus == SSHTunnelForwarder::ErrorStatus::SYSTEM_FAULT)
-		{
-			this->logger->writeToLog("Failed to start tunnel. System Fault error occurred", "TunnelManager", "startTunnel");
-			jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "SSH_SystemFaultOccurred");
-		}
-		else if (errorStatus == SSHTunnelForwarder::ErrorStatus::DNS_RESOLUTION_FAILED)
-		{
-			jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "DNSResolutionFailed");
-		}
-		else if (errorStatus == SSHTunnelForwarder::ErrorStatus::SSH_CONNECT_FAILED)
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "FingerprintNotMatched", &jsonData);
+		*setupResponse = jsonResponse.getJSONString();
+		delete sshTunnelForwarder;
+		sshTunnelForwarder = NULL;
+		return SSHTunnelForwarder::SetupResult::SETUP_FAILED;
+	}
+	//Fingerprint confirmed so auth and set up the port forwarding
+	this->setupState = SetupState::SETUP_AUTHENTICATING;
+	sshTunnelForwarder->startAuthentication();
+	return SSHTunnelForwarder::SetupResult::SETUP_DONE;
+}
+
+/**
+	Carry on authenticating with the SSH server. Once authenticated the tunnel's local port is opened and the tunnel is added to the 
+	active tunnels
+	@param setupResponse Set to the JSON response for the PHP API if the setup has finished
+	@return SetupResult SETUP_WAITING while authenticating, otherwise SETUP_DONE or SETUP_FAILED
+*/
+SSHTunnelForwarder::SetupResult TunnelManager::continueSSHAuthentication(string *setupResponse)
+{
+	SSHTunnelForwarder::ErrorStatus authErrorStatus;
+	SSHTunnelForwarder::SetupResult result = sshTunnelForwarder->continueAuthentication(setupResponse, authErrorStatus);
+	if (result == SSHTunnelForwarder::SetupResult::SETUP_WAITING)
+	{
+		return result;
+	}
+	this->handshakeLimiter->releaseSlot();
+	SSHHostCircuitBreaker circuitBreaker(this->logger, this->sshHost, this->sshPort, this->credentialHash);
+	if (authErrorStatus == SSHTunnelForwarder::ErrorStatus::SUCCESS)
+	{
+		circuitBreaker.recordAuthSuccess();
+	}
+	else if (authErrorStatus == SSHTunnelForwarder::ErrorStatus::PASSWORD_AUTH_FAILED)
+	{
+		circuitBreaker.recordAuthFailure();
+	}
+	else if (authErrorStatus == SSHTunnelForwarder::ErrorStatus::SETUP_TIMEOUT)
+	{
+		circuitBreaker.recordConnectFailure(SSHHostCircuitBreaker::FailureType::SSH_CONNECT_FAILED);
+	}
+	if (result == SSHTunnelForwarder::SetupResult::SETUP_FAILED || !sshTunnelForwarder->setupPortForwarding(setupResponse))
+	{
+		delete sshTunnelForwarder;
+		sshTunnelForwarder = NULL;
+		return SSHTunnelForwarder::SetupResult::SETUP_FAILED; //Error in the authentication so stop processing
+	}
+
+	ActiveTunnels activeTunnels(sshTunnelForwarder, this->localPort);
+	TunnelManager::tunnelMutex.lock();
+	activeTunnelsList.push_back(activeTunnels);
+	TunnelManager::tunnelMutex.unlock();
+
+	stringstream logstream;
+	logstream << "Current ports available: " << this->getFreePortCount();
+	this->logger->writeToLog(logstream.str(), "TunnelManager", "continueSSHAuthentication");
+	return SSHTunnelForwarder::SetupResult::SETUP_DONE;
+}
+
+/**
+	Fail the setup because the connect or handshake with the SSH server failed, the failure is recorded against the SSH server
+	@param errorStatus The reason the connect failed
+	@param setupResponse Set to the JSON error response for the PHP API
+*/
+void TunnelManager::failSSHConnect(SSHTunnelForwarder::ErrorStatus errorStatus, string *setupResponse)
+{
+	//If we got here then something went wrong, check the error ErrorStatus for the type
+	SSHHostCircuitBreaker circuitBreaker(this->logger, this->sshHost, this->sshPort, this->credentialHash);
+	JSONResponseGenerator jsonResponse;
+	if (errorStatus == SSHTunnelForwarder::ErrorStatus::SYSTEM_FAULT)
+	{
+		this->logger->writeToLog("Failed to start tunnel. System Fault error occurred", "TunnelManager", "failSSHConnect");
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "SSH_SystemFaultOccurred");
+	}
+	else if (errorStatus == SSHTunnelForwarder::ErrorStatus::DNS_RESOLUTION_FAILED)
+	{
+		circuitBreaker.recordConnectFailure(SSHHostCircuitBreaker::FailureType::DNS_RESOLUTION_FAILED);
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "DNSResolutionFailed");
+	}
+	else if (errorStatus == SSHTunnelForwarder::ErrorStatus::SSH_CONNECT_FAILED)
+	{
+		this->logger->writeToLog("Failed to start tunnel. SSH Connect Failed", "TunnelManager", "failSSHConnect");
+		circuitBreaker.recordConnectFailure(SSHHostCircuitBreaker::FailureType::SSH_CONNECT_FAILED);
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "SSHConnectFailed");
+	}
+	else
+	{
+		this->logger->writeToLog("Failed to start tunnel", "TunnelManager", "failSSHConnect");
+		jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "StartTunnelFailed");
+	}
+	*setupResponse = jsonResponse.getJSONString();
+	delete this->handshakeLimiter;
+	this->handshakeLimiter = NULL;
+	delete sshTunnelForwarder;
+	sshTunnelForwarder = NULL;
+}
+
+/**
+	Finish a setup that was carried on by a setup loop, or that finished before it needed one. The response is sent to the PHP API, stored 
+	against the ticket for an async request, or recorded in the batch, then the tunnel is forwarded on its own thread. A tunnel manager that 
+	isn't part of a batch deletes itself once its tunnel has closed, or straight away if the setup didn't leave a tunnel to forward
+	@param setupResponse The CreateTunnel response for the setup
+*/
+void TunnelManager::finishSetup(string setupResponse)
+{
+	this->setupState = SetupState::SETUP_NONE;
+	delete this->handshakeLimiter;
+	this->handshakeLimiter = NULL;
+
+	if (this->batchSetup != NULL)
+	{
+		BatchSetup *batch = this->batchSetup;
+		lock_guard<mutex> lock(batch->setupMutex);
+		//The tunnels sharing the session get their ports before the forwarding thread starts using the session. If the setup failed, or 
+		//only got the fingerprint, they get the same response as this tunnel
+		for (vector<TunnelManager*>::iterator it = this->sessionTunnels.begin(); it != this->sessionTunnels.end(); ++it)
 		{
-			this->logger->writeToLog("Failed to start tunnel. SSH Connect Failed", "TunnelManager", "startTunnel");
-			jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "SSHConnectFailed");
+			string sharedResponse = setupResponse;
+			if (this->sshTunnelForwarder != NULL)
+			{
+				(*it)->localPort = this->findNextAvailableLocalSSHPort();
+				if (this->sshTunnelForwarder->addSharedPort(&(*it)->localPort, (*it)->mysqlServerHost, (int)(*it)->remoteMySQLPort, &sharedResponse))
+				{
+					ActiveTunnels activeTunnels(this->sshTunnelForwarder, (*it)->localPort);
+					TunnelManager::tunnelMutex.lock();
+					activeTunnelsList.push_back(activeTunnels);
+					TunnelManager::tunnelMutex.unlock();
+				}
+			}
+			batch->responses[(*it)->batchIndex] = sharedResponse;
 		}
-		else
+		if (this->sshTunnelForwarder != NULL)
 		{
-			this->logger->writeToLog("Failed to start tunnel", "TunnelManager", "startTunnel");
-			jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "StartTunnelFailed");
+			try
+			{
+				batch->forwardingThreads.push_back(std::thread(&TunnelManager::forwardTunnel, this));
+			}
+			catch (std::system_error& ex)
+			{
+				stringstream logstream;
+				logstream << "Failed to start the thread for tunnel " << this->batchIndex << " of the batch. Error: " << ex.what();
+				this->logger->writeToLog(logstream.str(), "TunnelManager", "finishSetup");
+				this->sshTunnelForwarder->closeSSHSessions();
+				delete this->sshTunnelForwarder;
+				this->sshTunnelForwarder = NULL;
+				JSONResponseGenerator threadErrorResponse;
+				threadErrorResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_GENERAL_ERROR, "TunnelThreadFailed");
+				setupResponse = threadErrorResponse.getJSONString();
+				for (vector<TunnelManager*>::iterator it = this->sessionTunnels.begin(); it != this->sessionTunnels.end(); ++it)
+				{
+					batch->responses[(*it)->batchIndex] = setupResponse;
+				}
+			}
 		}
-		response = jsonResponse.getJSONString();
-		this->sendResponseToSocket(clientsockptr, socketManagerptr, response);
-		delete sshTunnelForwarder;
+		batch->responses[this->batchIndex] = setupResponse;
+		batch->setupsRemaining--;
+		//Notified while the lock is held, as startTunnels' batch can go as soon as it sees the last setup finish
+		batch->setupFinished.notify_one();
+		return;
+	}
+
+	if (this->asyncRequest)
+	{
+		TunnelSetupTickets tunnelSetupTickets(this->logger);
+		tunnelSetupTickets.completeTicket(this->ticket, setupResponse);
+	}
+	else
+	{
+		this->sendResponseToSocket(this->setupClient, this->setupSocketManager, setupResponse);
+		this->closeClientSocket(this->setupSocketManager, this->setupClient);
+		this->setupClient = NULL;
+	}
+
+	if (this->sshTunnelForwarder == NULL)
+	{
+		delete this;
+		return;
+	}
+	try
+	{
+		std::thread(&TunnelManager::forwardTunnelThread, this).detach();
+	}
+	catch (std::system_error& ex)
+	{
+		stringstream logstream;
+		logstream << "Failed to start the thread to forward the tunnel on local port " << this->localPort << ". Error: " << ex.what();
+		this->logger->writeToLog(logstream.str(), "TunnelManager", "finishSetup");
+		this->sshTunnelForwarder->closeSSHSessions();
+		delete this->sshTunnelForwarder;
+		this->sshTunnelForwarder = NULL;
+		delete this;
+	}
+}
+
+/**
+	Hand the tunnel's setup to a setup loop if startTunnel left it waiting for the SSH server. For an async request the PHP API already has 
+	its ticket, so the client socket is closed now rather than when the setup finishes
+	@return bool True if a setup loop now owns the tunnel manager, or the setup has been abandoned, in which case the caller mustn't delete 
+	it or close the client socket
+*/
+bool TunnelManager::handOverSetup()
+{
+	if (this->setupState == SetupState::SETUP_NONE)
+	{
 		return false;
 	}
+	this->request = NULL;
+	if (this->asyncRequest)
+	{
+		this->closeClientSocket(this->setupSocketManager, this->setupClient);
+		this->setupClient = NULL;
+	}
+	if (!TunnelSetupLoop::addSetup(this))
+	{
+		this->abandonSetup();
+	}
+	return true;
+}
 
+/**
+	Give up on a setup that was left waiting for the SSH server but can't be handed to a setup loop, as the application is stopping. The 
+	SSH session is closed and the setup is finished with an error response, the same as a setup that failed
+*/
+void TunnelManager::abandonSetup()
+{
+	this->logger->writeToLog("The tunnel setup loops have been stopped, abandoning the setup", "TunnelManager", "abandonSetup");
+	this->sshTunnelForwarder->closeSSHSessions();
+	delete this->sshTunnelForwarder;
+	this->sshTunnelForwarder = NULL;
+	JSONResponseGenerator jsonResponse;
+	jsonResponse.generateJSONResponse(JSONResponseGenerator::APIResponse::API_TUNNEL_ERROR, "StartTunnelFailed");
+	this->finishSetup(jsonResponse.getJSONString());
+}
+
+/**
+	Forward a tunnel that was set up by a setup loop, then delete the tunnel manager
+*/
+void TunnelManager::forwardTunnelThread()
+{
+	this->forwardTunnel();
+	delete this;
+}
+
+/**
+	Close the PHP API's socket once its response has been sent
+	@param socketManagerPtr A pointer to the socket class (WindowsSocket or LinuxSocket)
+	@param clientsockptr The socket descriptor to close
+*/
+void TunnelManager::closeClientSocket(void *socketManagerptr, void *clientsockptr)
+{
+	try
+	{
+#ifdef _WIN32
+		static_cast<WindowsSocket*>(socketManagerptr)->closeSocket(static_cast<SOCKET *>(clientsockptr));
+#else
+		static_cast<LinuxSocket *>(socketManagerptr)->closeSocket(static_cast<int *>(clientsockptr));
+#endif
+	}
+	catch (SocketException ex)
+	{
+		stringstream logstream;
+		logstream << "Failed to close client socket. Error: " << ex.what();
+		this->logger->writeToLog(logstream.str(), "TunnelManager", "closeClientSocket");
+	}
+}
+
+/**
+	@return SSHTunnelForwarder The forwarder for the tunnel being set up, for the setup loop to wait on its SSH socket
+*/
+SSHTunnelForwarder *TunnelManager::getSSHTunnelForwarder()
+{
+	return this->sshTunnelForwarder;
 }
 
 /**
@@ -334,101 +1071,84 @@ bool TunnelManager::doesPortExistInTunnel(int port)
 }
 
 /**
-	Process the JSON data, this data determines how the SSH tunnel is created, or whether an SSH tunnel should be stopped
+	Process the request, this determines how the SSH tunnel is created, or whether an SSH tunnel should be stopped
 	@return true on success otherwise false
 */
-bool TunnelManager::processJson()
+bool TunnelManager::processRequest()
 {
-	Document jsonObject;
-	jsonObject.Parse(this->json.c_str());
-
-	string method = jsonObject["method"].GetString();
+	if (!this->request->isValid())
+	{
+		stringstream logstream;
+		logstream << "Invalid request was received. Error: " << this->request->getError();
+		this->logger->writeToLog(logstream.str(), "TunnelManager", "processRequest");
+		return false;
+	}
 
-	//if (jsonObject["method"].GetString() == "CreateTunnel")
-	if (std::string(jsonObject["method"].GetString()).compare("CreateTunnel") == 0)
+	if (this->request->method == TunnelRequest::Method::CREATE_TUNNEL)
 	{
 		this->tunnelCommand = TunnelCommand::CreateConnection;
-		return this->processTunnelCreation(jsonObject);
+		this->asyncRequest = this->request->async;
+		this->processTunnelCreation(this->request->tunnel);
 	}
-	else if (std::string(jsonObject["method"].GetString()).compare("CloseTunnel") == 0)
+	else if (this->request->method == TunnelRequest::Method::CLOSE_TUNNEL)
 	{
 		this->tunnelCommand = TunnelCommand::CloseConnection;
-		return this->processTunnelClosure(jsonObject);
+		this->setLocalPort(this->request->localPort);
+	}
+	else if (this->request->method == TunnelRequest::Method::CREATE_TUNNELS)
+	{
+		this->tunnelCommand = TunnelCommand::CreateConnections;
+		for (vector<TunnelRequest::TunnelDetails>::iterator it = this->request->tunnels.begin(); it != this->request->tunnels.end(); ++it)
+		{
+			TunnelManager *tunnelManager = new TunnelManager(this->logger);
+			tunnelManager->processTunnelCreation(*it);
+			this->batchTunnels.push_back(tunnelManager);
+		}
+	}
+	else if (this->request->method == TunnelRequest::Method::CLOSE_TUNNELS)
+	{
+		this->tunnelCommand = TunnelCommand::CloseConnections;
+		this->batchLocalPorts = std::move(this->request->localPorts);
+	}
+	else if (this->request->method == TunnelRequest::Method::GET_TUNNEL_RESULT)
+	{
+		this->tunnelCommand = TunnelCommand::GetTunnelResult;
+		this->ticket = std::move(this->request->ticket);
+		this->ticketWaitSeconds = this->request->waitSeconds;
 	}
 	else
 	{
-		stringstream logstream;
-		logstream << "Invalid JSON message was received. JSON was: " << this->json;
-		this->logger->writeToLog(logstream.str(), "TunnelManager", "processJson");
-		return false;
+		this->tunnelCommand = TunnelCommand::GetStatistics;
 	}
 	return true;
 }
 
 /**
-	Set required class members in order to close the SSH tunnel
-	@param jsonObject a reference to the json Document created in the processJson method
-	@return bool True on success otherwise false
+	Set required class memembers in order to open the SSH tunnel. The strings are moved out of the request as it isn't needed afterwards
+	@param details The tunnel details from the parsed request, these have already been validated
 */
-bool TunnelManager::processTunnelClosure(Document& jsonObject)
+void TunnelManager::processTunnelCreation(TunnelRequest::TunnelDetails& details)
 {
-	this->setLocalPort(jsonObject["localPort"].GetInt());
-	return true;
-}
-
-/**
-	Set required class memembers in order to open the SSH tunnel
-	@param jsonObject a reference to the json Document created in the processJson method
-	@return bool True on success otherwise false
-*/
-bool TunnelManager::processTunnelCreation(Document& jsonObject)
-{
-	try
+	//Determine the auth method
+	if (details.authMethod.compare("Password") == 0)
 	{
-		//Determine the auth method
-		const Value& sshDetails = jsonObject["sshDetails"];
-		if (std::string(sshDetails["authMethod"].GetString()).compare("Password") == 0)
-		{
-			authMethod = AuthMethod::Password;
-		}
-		else
-		{
-			authMethod = AuthMethod::PrivateKey;
-		}
-		sshUsername = sshDetails["sshUsername"].GetString();
-		if (authMethod == AuthMethod::Password)
-		{
-			sshPassword = sshDetails["sshPassword"].GetString();
-		}
-		else
-		{
-			privateKey = sshDetails["privateSSHKey"].GetString();
-			if (sshDetails.HasMember("certPassphrase"))
-			{
-				if (!sshDetails["certPassphrase"].IsNull())
-				{
-					certPassphrase = sshDetails["certPassphrase"].GetString();
-				}
-			}
-		}
-		sshPort = (unsigned long long)sshDetails["sshPort"].GetDouble();
-		sshHost = sshDetails["sshHost"].GetString();
-		remoteMySQLPort = (unsigned long long)jsonObject["remoteMySQLPort"].GetDouble();
-		mysqlServerHost = jsonObject["mysqlHost"].GetString();
-		fingerprintConfirmed = jsonObject["fingerprintConfirmed"].GetBool();
-		if (jsonObject.HasMember("fingerprint"))
-		{
-			postedFingerprint = jsonObject["fingerprint"].GetString();
-		}
-		return true;
+		authMethod = AuthMethod::Password;
+		sshPassword = std::move(details.sshPassword);
 	}
-	catch (exception& ex)
+	else
 	{
-		stringstream logstream;
-		logstream << "Failed to project JSON tunnel creation. Error: " << ex.what();
-		this->logger->writeToLog(logstream.str(), "TunnelManager", "processTunnelCreation");
-		return false;
+		authMethod = AuthMethod::PrivateKey;
+		privateKey = std::move(details.privateSSHKey);
+		certPassphrase = std::move(details.certPassphrase);
 	}
+	sshUsername = std::move(details.sshUsername);
+	sshPort = details.sshPort;
+	sshHost = std::move(details.sshHost);
+	remoteMySQLPort = details.remoteMySQLPort;
+	bandwidthLimitBytesPerSecond = details.bandwidthLimitBytesPerSecond;
+	mysqlServerHost = std::move(details.mysqlHost);
+	fingerprintConfirmed = details.fingerprintConfirmed;
+	postedFingerprint = std::move(details.fingerprint);
 }
 
 /**
@@ -478,17 +1198,42 @@ int TunnelManager::getFreePortCount()
 	@param jsonResponse The actual JSON response that is sent on the socket
 */
 void TunnelManager::sendResponseToSocket(void * socketptr, void * socketManagerPtr, std::string jsonResponse)
+{
+	this->sendResponseToSocket(socketptr, socketManagerPtr, jsonResponse.c_str(), jsonResponse.length());
+}
+
+/**
+	Send a generated response to the client socket straight from the generator's buffer
+	@param socketptr A socket descriptor for where the response should be sent
+	@param socketManagerPtr A pointer to the WindowsSocket or LinuxSocket class depending on the platform being used
+	@param jsonResponse The generator holding the response
+*/
+void TunnelManager::sendResponseToSocket(void * socketptr, void * socketManagerPtr, JSONResponseGenerator *jsonResponse)
+{
+	size_t length = 0;
+	const char *data = jsonResponse->getJSONData(&length);
+	this->sendResponseToSocket(socketptr, socketManagerPtr, data, length);
+}
+
+/**
+	Send the JSON response to a socket
+	@param socketptr A socket descriptor for where the response should be sent
+	@param socketManagerPtr A pointer to the WindowsSocket or LinuxSocket class depending on the platform being used
+	@param data The JSON response that is sent on the socket
+	@param length The length of the JSON response
+*/
+void TunnelManager::sendResponseToSocket(void * socketptr, void * socketManagerPtr, const char *data, size_t length)
 {
 	try
 	{
 #ifdef _WIN32
 		SOCKET * clientsock = static_cast<SOCKET *>(socketptr);
 		WindowsSocket *socketManager = static_cast<WindowsSocket*>(socketManagerPtr);
-		int i = socketManager->sendToSocket(clientsock, jsonResponse);
+		socketManager->sendToSocket(clientsock, data, length);
 #else
 		int *clientsock = static_cast<int *>(socketptr);
 		LinuxSocket *socketManager = static_cast<LinuxSocket *>(socketManagerPtr);
-		socketManager->sendToSocket(clientsock, jsonResponse);
+		socketManager->sendToSocket(clientsock, data, length);
 #endif
 	}
 	catch (SocketException ex)
@@ -6,6 +6,9 @@
 #include <vector>
 #include <rapidjson/document.h>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <system_error>
 #include <stdlib.h>
 #include "StaticSettings.h"
 #include "Logger.h"
@@ -16,6 +19,16 @@
 #include <ctime>
 #include "ActiveTunnels.h"
 #include "SSHTunnelForwarder.h"
+#include "SSHHandshakeLimiter.h"
+#include "SSHHostCircuitBreaker.h"
+#include "LinkStatistics.h"
+#include "PrivateKeyCache.h"
+#include "TunnelSetupTickets.h"
+#include "ReceiveBuffer.h"
+#include "BufferPool.h"
+#include "TunnelRequest.h"
+#include "TunnelSetupLoop.h"
+#include "HelperMethods.h"
 #ifdef _WIN32
 #include "WindowsSocket.h"
 #else
@@ -27,21 +40,46 @@ class TunnelManager
 
 public:
 	TunnelManager(Logger *logger);
-	TunnelManager(Logger *logger, std::string json);
+	TunnelManager(Logger *logger, TunnelRequest *request);
 	bool startStopTunnel(void *socketManager, void *clientsockprt);
 	void removeTunnelFromActiveList(int localPort);
 	void tunnelMonitorThread();
 	int findNextAvailableLocalSSHPort();
+	bool handOverSetup();
+	bool continueSetup();
+	SSHTunnelForwarder *getSSHTunnelForwarder();
 private:
 	std::string postedFingerprint;
 	SSHTunnelForwarder *sshTunnelForwarder = NULL;
 	std::thread acceptAndForwardThread;
-	enum TunnelCommand {CreateConnection, CloseConnection};
+	enum TunnelCommand {CreateConnection, CloseConnection, GetStatistics, CreateConnections, CloseConnections, GetTunnelResult};
+	struct BatchSetup
+	{
+		std::mutex setupMutex;
+		std::condition_variable setupFinished;
+		std::vector<std::string> responses;
+		size_t setupsRemaining = 0;
+		std::vector<std::thread> forwardingThreads;
+	};
+	enum SetupState {SETUP_NONE, SETUP_CONNECTING, SETUP_AUTHENTICATING};
+	SetupState setupState = SetupState::SETUP_NONE;
+	SSHHandshakeLimiter *handshakeLimiter = NULL;
+	std::string credentialHash;
+	void *setupSocketManager = NULL;
+	void *setupClient = NULL;
+	BatchSetup *batchSetup = NULL;
+	size_t batchIndex = 0;
+	std::vector<TunnelManager*> sessionTunnels;
+	std::vector<TunnelManager*> batchTunnels;
+	std::vector<int> batchLocalPorts;
+	bool asyncRequest = false;
+	std::string ticket;
+	int ticketWaitSeconds = 0;
 	enum AuthMethod {Password, PrivateKey};
 	AuthMethod authMethod;
 	static int currentListenPort;
 	TunnelCommand tunnelCommand;
-	std::string json;
+	TunnelRequest *request = NULL;
 	std::string sshUsername;
 	std::string sshPassword;
 	std::string privateKey;
@@ -49,14 +87,33 @@ private:
 	unsigned long long sshPort;
 	std::string sshHost;
 	unsigned long long remoteMySQLPort;
+	unsigned long long bandwidthLimitBytesPerSecond = 0;
 	std::string mysqlServerHost;
 	int localPort;
 	static std::vector<ActiveTunnels> activeTunnelsList;
-	bool processJson();
-	bool processTunnelCreation(rapidjson::Document& jsonObject);
-	bool processTunnelClosure(rapidjson::Document& jsobObject);
+	bool processRequest();
+	void processTunnelCreation(TunnelRequest::TunnelDetails& details);
 	bool startTunnel(void *socketManager, void *clientsockptr);
+	bool startTunnelAsync(void *socketManager, void *clientsockptr);
+	bool sendTunnelResult(void *socketManager, void *clientsockptr);
+	bool setupDirectTunnel(std::string *setupResponse);
+	SSHTunnelForwarder::SetupResult startSetup(std::string *setupResponse);
+	SSHTunnelForwarder::SetupResult continueSSHConnect(std::string *setupResponse);
+	SSHTunnelForwarder::SetupResult continueSSHAuthentication(std::string *setupResponse);
+	void failSSHConnect(SSHTunnelForwarder::ErrorStatus errorStatus, std::string *setupResponse);
+	void finishSetup(std::string setupResponse);
+	void abandonSetup();
+	void forwardTunnel();
+	void forwardTunnelThread();
+	void closeClientSocket(void *socketManager, void *clientsockptr);
+	bool startTunnels(void *socketManager, void *clientsockptr);
+	std::string getTunnelRequestHash();
+	std::string getSessionHash();
+	void deleteBatchTunnels();
 	bool stopTunnel(void *socketManager, void *clientsockptr);
+	bool stopTunnels(void *socketManager, void *clientsockptr);
+	bool requestTunnelClose(int localPort);
+	bool sendStatistics(void *socketManager, void *clientsockptr);
 	static std::mutex tunnelMutex;
 	bool doesPortExistInTunnel(int port);
 	bool fingerprintConfirmed;
@@ -65,6 +122,8 @@ private:
 	void setPostedFingerprint(std::string postedFingerprint);
 	std::string getPostedFingerprint();
     void sendResponseToSocket(void * socketptr, void * socketManagerPtr, std::string jsonResponse);
+    void sendResponseToSocket(void * socketptr, void * socketManagerPtr, JSONResponseGenerator *jsonResponse);
+    void sendResponseToSocket(void * socketptr, void * socketManagerPtr, const char *data, size_t length);
 	Logger *logger = NULL;
 
 	//Setters
@@ -76,10 +135,6 @@ private:
 	{
 		this->tunnelCommand = tunnelCommand;
 	}
-	void setJson(std::string json)
-	{
-		this->json = json;
-	}
 	void setSSHUsername(std::string sshUsername)
 	{
 		this->sshUsername = sshUsername;
@@ -130,10 +185,6 @@ private:
 	{
 		return this->tunnelCommand;
 	}
-	std::string getJson()
-	{
-		return this->json;
-	}
 	std::string getSSHUsername()
 	{
 		return this->sshUsername;
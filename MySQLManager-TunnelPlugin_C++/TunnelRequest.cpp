@@ -0,0 +1,591 @@
+/**
+	Parses the JSON request from the PHP API in a single pass straight into the request's fields, using the rapidjson SAX reader rather
+	than building a DOM. Unknown fields are skipped, fields with the wrong type or missing required fields fail the parse with an error
+	that can be sent back to the PHP API, instead of rapidjson asserting on malformed input.
+	When the request is going to be logged, a copy of the JSON is written while parsing with the SSH password, private key and key
+	passphrase replaced with asterix, so the SSH login credentials aren't written to the log
+*/
+
+#include "TunnelRequest.h"
+#include <climits>
+
+using namespace std;
+using namespace rapidjson;
+
+class TunnelRequest::Handler : public BaseReaderHandler<UTF8<>, TunnelRequest::Handler>
+{
+public:
+	Handler(TunnelRequest *request, Writer<StringBuffer> *redactedWriter);
+	bool StartObject();
+	bool EndObject(SizeType memberCount);
+	bool StartArray();
+	bool EndArray(SizeType elementCount);
+	bool Key(const char *str, SizeType length, bool copy);
+	bool String(const char *str, SizeType length, bool copy);
+	bool Null();
+	bool Bool(bool value);
+	bool Int(int value);
+	bool Uint(unsigned value);
+	bool Int64(int64_t value);
+	bool Uint64(uint64_t value);
+	bool Double(double value);
+private:
+	enum Context { CONTEXT_ROOT, CONTEXT_SSH_DETAILS, CONTEXT_TUNNELS, CONTEXT_TUNNEL, CONTEXT_LOCAL_PORTS, CONTEXT_IGNORED };
+	bool number(double value);
+	bool isKey(const char *name);
+	bool isSecretKey();
+	bool fail(const string& message);
+	TunnelDetails *getTunnelDetails();
+	TunnelRequest *request = NULL;
+	Writer<StringBuffer> *redactedWriter = NULL;
+	vector<Context> contexts;
+	string key;
+};
+
+TunnelRequest::Handler::Handler(TunnelRequest *request, Writer<StringBuffer> *redactedWriter)
+{
+	this->request = request;
+	this->redactedWriter = redactedWriter;
+}
+
+/**
+	Get the tunnel details that the fields in the current object belong to, the request's own tunnel for CreateTunnel, or the tunnel
+	in the tunnels array for CreateTunnels
+*/
+TunnelRequest::TunnelDetails *TunnelRequest::Handler::getTunnelDetails()
+{
+	Context context = this->contexts.back();
+	if (context == Context::CONTEXT_SSH_DETAILS)
+	{
+		context = this->contexts[this->contexts.size() - 2];
+	}
+	return context == Context::CONTEXT_TUNNEL ? &this->request->tunnels.back() : &this->request->tunnel;
+}
+
+bool TunnelRequest::Handler::isKey(const char *name)
+{
+	return this->key.compare(name) == 0;
+}
+
+bool TunnelRequest::Handler::isSecretKey()
+{
+	return this->isKey("sshPassword") || this->isKey("privateSSHKey") || this->isKey("certPassphrase");
+}
+
+bool TunnelRequest::Handler::fail(const string& message)
+{
+	this->request->error = message;
+	return false;
+}
+
+bool TunnelRequest::Handler::StartObject()
+{
+	if (this->redactedWriter != NULL)
+	{
+		this->redactedWriter->StartObject();
+	}
+	if (this->contexts.empty())
+	{
+		this->contexts.push_back(Context::CONTEXT_ROOT);
+	}
+	else if (this->contexts.back() == Context::CONTEXT_TUNNELS)
+	{
+		this->request->tunnels.push_back(TunnelDetails());
+		this->contexts.push_back(Context::CONTEXT_TUNNEL);
+	}
+	else if ((this->contexts.back() == Context::CONTEXT_ROOT || this->contexts.back() == Context::CONTEXT_TUNNEL) && this->isKey("sshDetails"))
+	{
+		this->contexts.push_back(Context::CONTEXT_SSH_DETAILS);
+	}
+	else if (this->contexts.back() == Context::CONTEXT_LOCAL_PORTS)
+	{
+		return this->fail("localPorts must only contain numbers");
+	}
+	else
+	{
+		this->contexts.push_back(Context::CONTEXT_IGNORED);
+	}
+	return true;
+}
+
+bool TunnelRequest::Handler::EndObject(SizeType memberCount)
+{
+	if (this->redactedWriter != NULL)
+	{
+		this->redactedWriter->EndObject(memberCount);
+	}
+	this->contexts.pop_back();
+	return true;
+}
+
+bool TunnelRequest::Handler::StartArray()
+{
+	if (this->redactedWriter != NULL)
+	{
+		this->redactedWriter->StartArray();
+	}
+	if (this->contexts.empty())
+	{
+		return this->fail("The request must be a JSON object");
+	}
+	if (this->contexts.back() == Context::CONTEXT_ROOT && this->isKey("tunnels"))
+	{
+		this->contexts.push_back(Context::CONTEXT_TUNNELS);
+	}
+	else if (this->contexts.back() == Context::CONTEXT_ROOT && this->isKey("localPorts"))
+	{
+		this->contexts.push_back(Context::CONTEXT_LOCAL_PORTS);
+	}
+	else if (this->contexts.back() == Context::CONTEXT_TUNNELS || this->contexts.back() == Context::CONTEXT_LOCAL_PORTS)
+	{
+		return this->fail(this->contexts.back() == Context::CONTEXT_TUNNELS ? "tunnels must only contain objects" : "localPorts must only contain numbers");
+	}
+	else
+	{
+		this->contexts.push_back(Context::CONTEXT_IGNORED);
+	}
+	return true;
+}
+
+bool TunnelRequest::Handler::EndArray(SizeType elementCount)
+{
+	if (this->redactedWriter != NULL)
+	{
+		this->redactedWriter->EndArray(elementCount);
+	}
+	this->contexts.pop_back();
+	return true;
+}
+
+bool TunnelRequest::Handler::Key(const char *str, SizeType length, bool copy)
+{
+	if (this->redactedWriter != NULL)
+	{
+		this->redactedWriter->Key(str, length, copy);
+	}
+	this->key.assign(str, length);
+	return true;
+}
+
+bool TunnelRequest::Handler::String(const char *str, SizeType length, bool copy)
+{
+	if (this->contexts.empty())
+	{
+		return this->fail("The request must be a JSON object");
+	}
+	if (this->redactedWriter != NULL)
+	{
+		if (this->isSecretKey())
+		{
+			string redacted(length, '*');
+			this->redactedWriter->String(redacted.c_str(), length, true);
+		}
+		else
+		{
+			this->redactedWriter->String(str, length, copy);
+		}
+	}
+
+	Context context = this->contexts.back();
+	if (context == Context::CONTEXT_TUNNELS)
+	{
+		return this->fail("tunnels must only contain objects");
+	}
+	if (context == Context::CONTEXT_LOCAL_PORTS)
+	{
+		return this->fail("localPorts must only contain numbers");
+	}
+	if (context == Context::CONTEXT_IGNORED)
+	{
+		return true;
+	}
+	TunnelDetails *details = this->getTunnelDetails();
+	if (context == Context::CONTEXT_SSH_DETAILS)
+	{
+		if (this->isKey("authMethod"))
+		{
+			details->authMethod.assign(str, length);
+			details->fieldsSet |= Field::FIELD_AUTH_METHOD;
+		}
+		else if (this->isKey("sshUsername"))
+		{
+			details->sshUsername.assign(str, length);
+			details->fieldsSet |= Field::FIELD_SSH_USERNAME;
+		}
+		else if (this->isKey("sshPassword"))
+		{
+			details->sshPassword.assign(str, length);
+			details->fieldsSet |= Field::FIELD_SSH_PASSWORD;
+		}
+		else if (this->isKey("privateSSHKey"))
+		{
+			details->privateSSHKey.assign(str, length);
+			details->fieldsSet |= Field::FIELD_PRIVATE_SSH_KEY;
+		}
+		else if (this->isKey("certPassphrase"))
+		{
+			details->certPassphrase.assign(str, length);
+		}
+		else if (this->isKey("sshHost"))
+		{
+			details->sshHost.assign(str, length);
+			details->fieldsSet |= Field::FIELD_SSH_HOST;
+		}
+		else if (this->isKey("sshPort"))
+		{
+			return this->fail("sshPort must be a number");
+		}
+		return true;
+	}
+
+	if (this->isKey("mysqlHost"))
+	{
+		details->mysqlHost.assign(str, length);
+		details->fieldsSet |= Field::FIELD_MYSQL_HOST;
+	}
+	else if (this->isKey("fingerprint"))
+	{
+		details->fingerprint.assign(str, length);
+	}
+	else if (this->isKey("remoteMySQLPort") || this->isKey("fingerprintConfirmed") || this->isKey("bandwidthLimitBytesPerSecond"))
+	{
+		return this->fail(this->key + " has the wrong type");
+	}
+	else if (context == Context::CONTEXT_ROOT && this->isKey("method"))
+	{
+		string method(str, length);
+		if (method == "CreateTunnel")
+		{
+			this->request->method = Method::CREATE_TUNNEL;
+		}
+		else if (method == "CloseTunnel")
+		{
+			this->request->method = Method::CLOSE_TUNNEL;
+		}
+		else if (method == "GetStats")
+		{
+			this->request->method = Method::GET_STATS;
+		}
+		else if (method == "CreateTunnels")
+		{
+			this->request->method = Method::CREATE_TUNNELS;
+		}
+		else if (method == "CloseTunnels")
+		{
+			this->request->method = Method::CLOSE_TUNNELS;
+		}
+		else if (method == "GetTunnelResult")
+		{
+			this->request->method = Method::GET_TUNNEL_RESULT;
+		}
+		else
+		{
+			return this->fail("Unknown method " + method);
+		}
+	}
+	else if (context == Context::CONTEXT_ROOT && this->isKey("ticket"))
+	{
+		this->request->ticket.assign(str, length);
+	}
+	else if (context == Context::CONTEXT_ROOT && (this->isKey("localPort") || this->isKey("waitSeconds") || this->isKey("async")))
+	{
+		return this->fail(this->key + " has the wrong type");
+	}
+	return true;
+}
+
+bool TunnelRequest::Handler::Null()
+{
+	if (this->redactedWriter != NULL)
+	{
+		this->redactedWriter->Null();
+	}
+	if (!this->contexts.empty() && (this->contexts.back() == Context::CONTEXT_TUNNELS || this->contexts.back() == Context::CONTEXT_LOCAL_PORTS))
+	{
+		return this->fail(this->contexts.back() == Context::CONTEXT_TUNNELS ? "tunnels must only contain objects" : "localPorts must only contain numbers");
+	}
+	//A null field is treated the same as the field not being sent, e.g. a null certPassphrase for a key without a passphrase
+	return true;
+}
+
+bool TunnelRequest::Handler::Bool(bool value)
+{
+	if (this->redactedWriter != NULL)
+	{
+		this->redactedWriter->Bool(value);
+	}
+	if (this->contexts.empty())
+	{
+		return this->fail("The request must be a JSON object");
+	}
+	Context context = this->contexts.back();
+	if (context == Context::CONTEXT_TUNNELS || context == Context::CONTEXT_LOCAL_PORTS)
+	{
+		return this->fail(context == Context::CONTEXT_TUNNELS ? "tunnels must only contain objects" : "localPorts must only contain numbers");
+	}
+	if ((context == Context::CONTEXT_ROOT || context == Context::CONTEXT_TUNNEL) && this->isKey("fingerprintConfirmed"))
+	{
+		TunnelDetails *details = this->getTunnelDetails();
+		details->fingerprintConfirmed = value;
+		details->fieldsSet |= Field::FIELD_FINGERPRINT_CONFIRMED;
+	}
+	else if (context == Context::CONTEXT_ROOT && this->isKey("async"))
+	{
+		this->request->async = value;
+	}
+	else if (context != Context::CONTEXT_IGNORED && (this->isKey("sshPort") || this->isKey("remoteMySQLPort") || this->isKey("localPort") || this->isKey("waitSeconds") ||
+		this->isKey("bandwidthLimitBytesPerSecond")))
+	{
+		return this->fail(this->key + " must be a number");
+	}
+	return true;
+}
+
+bool TunnelRequest::Handler::Int(int value)
+{
+	if (this->redactedWriter != NULL)
+	{
+		this->redactedWriter->Int(value);
+	}
+	return this->number(value);
+}
+
+bool TunnelRequest::Handler::Uint(unsigned value)
+{
+	if (this->redactedWriter != NULL)
+	{
+		this->redactedWriter->Uint(value);
+	}
+	return this->number(value);
+}
+
+bool TunnelRequest::Handler::Int64(int64_t value)
+{
+	if (this->redactedWriter != NULL)
+	{
+		this->redactedWriter->Int64(value);
+	}
+	return this->number((double)value);
+}
+
+bool TunnelRequest::Handler::Uint64(uint64_t value)
+{
+	if (this->redactedWriter != NULL)
+	{
+		this->redactedWriter->Uint64(value);
+	}
+	return this->number((double)value);
+}
+
+bool TunnelRequest::Handler::Double(double value)
+{
+	if (this->redactedWriter != NULL)
+	{
+		this->redactedWriter->Double(value);
+	}
+	return this->number(value);
+}
+
+/**
+	Store a number from the request. The PHP API can send the ports as integers or doubles, either is accepted as long as it is a
+	whole number that fits in an int
+*/
+bool TunnelRequest::Handler::number(double value)
+{
+	if (this->contexts.empty())
+	{
+		return this->fail("The request must be a JSON object");
+	}
+	Context context = this->contexts.back();
+	if (context == Context::CONTEXT_IGNORED)
+	{
+		return true;
+	}
+	if (context == Context::CONTEXT_TUNNELS)
+	{
+		return this->fail("tunnels must only contain objects");
+	}
+	bool isPortField = context == Context::CONTEXT_LOCAL_PORTS || this->isKey("sshPort") || this->isKey("remoteMySQLPort") || this->isKey("localPort") || this->isKey("waitSeconds");
+	if (isPortField && (value < INT_MIN || value > INT_MAX || value != (double)(int)value))
+	{
+		return this->fail((context == Context::CONTEXT_LOCAL_PORTS ? string("localPorts") : this->key) + " must be a whole number");
+	}
+	int intValue = (int)value;
+	if (context == Context::CONTEXT_LOCAL_PORTS)
+	{
+		this->request->localPorts.push_back(intValue);
+		return true;
+	}
+	TunnelDetails *details = this->getTunnelDetails();
+	if (context == Context::CONTEXT_SSH_DETAILS)
+	{
+		if (this->isKey("sshPort"))
+		{
+			details->sshPort = intValue;
+			details->fieldsSet |= Field::FIELD_SSH_PORT;
+		}
+		else if (this->isKey("authMethod") || this->isKey("sshUsername") || this->isKey("sshPassword") || this->isKey("privateSSHKey") || this->isKey("sshHost"))
+		{
+			return this->fail(this->key + " must be a string");
+		}
+		return true;
+	}
+	if (this->isKey("bandwidthLimitBytesPerSecond"))
+	{
+		//Optional, 0 or not sent means the tunnel is only limited by the global and SSH host limits
+		if (value < 0 || value > 9.0e15 || value != (double)(long long)value)
+		{
+			return this->fail("bandwidthLimitBytesPerSecond must be a whole number of 0 or more");
+		}
+		details->bandwidthLimitBytesPerSecond = (unsigned long long)value;
+		return true;
+	}
+	if (this->isKey("remoteMySQLPort"))
+	{
+		details->remoteMySQLPort = intValue;
+		details->fieldsSet |= Field::FIELD_REMOTE_MYSQL_PORT;
+	}
+	else if (context == Context::CONTEXT_ROOT && this->isKey("localPort"))
+	{
+		this->request->localPort = intValue;
+	}
+	else if (context == Context::CONTEXT_ROOT && this->isKey("waitSeconds"))
+	{
+		this->request->waitSeconds = intValue;
+	}
+	else if (this->isKey("mysqlHost") || this->isKey("fingerprint") || this->isKey("fingerprintConfirmed") || (context == Context::CONTEXT_ROOT && (this->isKey("method") || this->isKey("ticket"))))
+	{
+		return this->fail(this->key + " has the wrong type");
+	}
+	return true;
+}
+
+/**
+	Parse the JSON request
+	@param json The JSON request received from the PHP API
+	@param redactForLogging Whether to write the copy of the request with the SSH credentials redacted, for getRedactedJSON
+	@return bool False if the request isn't valid JSON, or is missing or has the wrong type for any fields, getError has the reason
+*/
+bool TunnelRequest::parse(const string& json, bool redactForLogging)
+{
+	return this->parse(json.c_str(), redactForLogging);
+}
+
+/**
+	Parse the request in place from a null terminated buffer, e.g. the connection's ReceiveBuffer
+	@param json The null terminated request
+	@param redactForLogging Build a copy of the request with the credentials masked, returned by getRedactedJSON
+	@return bool False if the request isn't valid JSON or isn't a valid request, getError says why
+*/
+bool TunnelRequest::parse(const char *json, bool redactForLogging)
+{
+	this->redactedJSON.Clear();
+	Writer<StringBuffer> redactedWriter(this->redactedJSON);
+	Handler handler(this, redactForLogging ? &redactedWriter : NULL);
+	Reader reader;
+	StringStream stream(json);
+	ParseResult result = reader.Parse(stream, handler);
+	if (!result)
+	{
+		if (this->error.empty())
+		{
+			this->error = string("Invalid JSON: ") + GetParseError_En(result.Code()) + " at offset " + std::to_string(result.Offset());
+		}
+		this->valid = false;
+		return false;
+	}
+	this->valid = this->validate();
+	return this->valid;
+}
+
+/**
+	Check that the fields that the request's method needs were all sent
+	@return bool False if any required field is missing
+*/
+bool TunnelRequest::validate()
+{
+	if (this->method == Method::UNKNOWN_METHOD)
+	{
+		this->error = "method is required";
+		return false;
+	}
+	else if (this->method == Method::CREATE_TUNNEL)
+	{
+		return this->validateTunnelDetails(this->tunnel);
+	}
+	else if (this->method == Method::CREATE_TUNNELS)
+	{
+		for (vector<TunnelDetails>::iterator it = this->tunnels.begin(); it != this->tunnels.end(); ++it)
+		{
+			if (!this->validateTunnelDetails(*it))
+			{
+				this->error = "tunnels[" + std::to_string(it - this->tunnels.begin()) + "]: " + this->error;
+				return false;
+			}
+		}
+	}
+	else if (this->method == Method::CLOSE_TUNNEL && this->localPort <= 0)
+	{
+		this->error = "localPort is required";
+		return false;
+	}
+	else if (this->method == Method::GET_TUNNEL_RESULT && this->ticket.empty())
+	{
+		this->error = "ticket is required";
+		return false;
+	}
+	return true;
+}
+
+/**
+	Check that the tunnel details have everything needed to create the tunnel
+	@param details The tunnel details
+	@return bool False if any required field is missing
+*/
+bool TunnelRequest::validateTunnelDetails(const TunnelDetails& details)
+{
+	static const struct { unsigned int field; const char *name; } requiredFields[] = {
+		{ Field::FIELD_AUTH_METHOD, "sshDetails.authMethod" }, { Field::FIELD_SSH_USERNAME, "sshDetails.sshUsername" },
+		{ Field::FIELD_SSH_PORT, "sshDetails.sshPort" }, { Field::FIELD_SSH_HOST, "sshDetails.sshHost" },
+		{ Field::FIELD_MYSQL_HOST, "mysqlHost" }, { Field::FIELD_REMOTE_MYSQL_PORT, "remoteMySQLPort" },
+		{ Field::FIELD_FINGERPRINT_CONFIRMED, "fingerprintConfirmed" }
+	};
+	for (size_t i = 0; i < sizeof(requiredFields) / sizeof(requiredFields[0]); i++)
+	{
+		if ((details.fieldsSet & requiredFields[i].field) == 0)
+		{
+			this->error = string(requiredFields[i].name) + " is required";
+			return false;
+		}
+	}
+	if (details.authMethod == "Password" && (details.fieldsSet & Field::FIELD_SSH_PASSWORD) == 0)
+	{
+		this->error = "sshDetails.sshPassword is required";
+		return false;
+	}
+	if (details.authMethod != "Password" && (details.fieldsSet & Field::FIELD_PRIVATE_SSH_KEY) == 0)
+	{
+		this->error = "sshDetails.privateSSHKey is required";
+		return false;
+	}
+	return true;
+}
+
+bool TunnelRequest::isValid()
+{
+	return this->valid;
+}
+
+std::string TunnelRequest::getError()
+{
+	return this->error;
+}
+
+/**
+	Get the request with the SSH credentials replaced with asterix, only available when parse was asked to redact it
+	@return string The redacted JSON request
+*/
+std::string TunnelRequest::getRedactedJSON()
+{
+	return string(this->redactedJSON.GetString(), this->redactedJSON.GetSize());
+}
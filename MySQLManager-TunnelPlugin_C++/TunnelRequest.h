@@ -0,0 +1,60 @@
+#pragma once
+#ifndef TUNNELREQUEST_H
+#define TUNNELREQUEST_H
+#include <string>
+#include <vector>
+#include <rapidjson/reader.h>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/error/en.h>
+
+class TunnelRequest
+{
+public:
+	enum Method { UNKNOWN_METHOD, CREATE_TUNNEL, CLOSE_TUNNEL, GET_STATS, CREATE_TUNNELS, CLOSE_TUNNELS, GET_TUNNEL_RESULT };
+	enum Field
+	{
+		FIELD_AUTH_METHOD = 1 << 0, FIELD_SSH_USERNAME = 1 << 1, FIELD_SSH_PASSWORD = 1 << 2, FIELD_PRIVATE_SSH_KEY = 1 << 3,
+		FIELD_SSH_PORT = 1 << 4, FIELD_SSH_HOST = 1 << 5, FIELD_MYSQL_HOST = 1 << 6, FIELD_REMOTE_MYSQL_PORT = 1 << 7,
+		FIELD_FINGERPRINT_CONFIRMED = 1 << 8
+	};
+	struct TunnelDetails
+	{
+		std::string authMethod;
+		std::string sshUsername;
+		std::string sshPassword;
+		std::string privateSSHKey;
+		std::string certPassphrase;
+		int sshPort = 0;
+		std::string sshHost;
+		std::string mysqlHost;
+		int remoteMySQLPort = 0;
+		unsigned long long bandwidthLimitBytesPerSecond = 0;
+		bool fingerprintConfirmed = false;
+		std::string fingerprint;
+		unsigned int fieldsSet = 0;
+	};
+	Method method = Method::UNKNOWN_METHOD;
+	TunnelDetails tunnel;
+	std::vector<TunnelDetails> tunnels;
+	int localPort = 0;
+	std::vector<int> localPorts;
+	bool async = false;
+	std::string ticket;
+	int waitSeconds = 0;
+
+	bool parse(const std::string& json, bool redactForLogging);
+	bool parse(const char *json, bool redactForLogging);
+	bool isValid();
+	std::string getError();
+	std::string getRedactedJSON();
+private:
+	class Handler;
+	bool validate();
+	bool validateTunnelDetails(const TunnelDetails& details);
+	bool valid = false;
+	std::string error;
+	rapidjson::StringBuffer redactedJSON;
+};
+
+#endif //!TUNNELREQUEST_H
@@ -0,0 +1,256 @@
+/**
+	Sets up SSH tunnels without a thread for each one. A tunnel's connect, SSH handshake and authentication never block (see
+	SSHTunnelForwarder::continueConnectToSSH and continueAuthentication), so once the connect has been started the tunnel is handed to one
+	of setupLoopThreads loops. Each loop waits on the SSH sockets of all of its tunnels with a single poll() and carries on whichever tunnels
+	the SSH server has answered, or whose setup step has passed its deadline. When a tunnel's setup finishes TunnelManager::continueSetup
+	sends the response and starts forwarding the tunnel, and the loop forgets about it
+*/
+
+#include "TunnelSetupLoop.h"
+#include "TunnelManager.h"
+
+using namespace std;
+
+std::vector<TunnelSetupLoop*> TunnelSetupLoop::setupLoops;
+std::mutex TunnelSetupLoop::setupLoopsMutex;
+size_t TunnelSetupLoop::nextSetupLoop = 0;
+unsigned long long TunnelSetupLoop::setupsInProgress = 0;
+unsigned long long TunnelSetupLoop::setupsFinished = 0;
+unsigned long long TunnelSetupLoop::maxSetupsInProgress = 0;
+
+TunnelSetupLoop::TunnelSetupLoop(Logger *logger)
+{
+	this->logger = logger;
+#ifndef _WIN32
+	if (pipe(this->wakePipe) == 0)
+	{
+		fcntl(this->wakePipe[0], F_SETFL, fcntl(this->wakePipe[0], F_GETFL, 0) | O_NONBLOCK);
+		fcntl(this->wakePipe[1], F_SETFL, fcntl(this->wakePipe[1], F_GETFL, 0) | O_NONBLOCK);
+	}
+	else
+	{
+		this->wakePipe[0] = -1;
+		this->wakePipe[1] = -1;
+		this->logger->writeToLog("Failed to create the setup loop's wake up pipe, new setups will be picked up on the next poll timeout", "TunnelSetupLoop", "TunnelSetupLoop");
+	}
+#endif
+}
+
+TunnelSetupLoop::~TunnelSetupLoop()
+{
+	if (this->loopThread.joinable())
+	{
+		this->loopThread.join();
+	}
+#ifndef _WIN32
+	if (this->wakePipe[0] != -1)
+	{
+		close(this->wakePipe[0]);
+		close(this->wakePipe[1]);
+	}
+#endif
+}
+
+/**
+	Start the setup loop threads, setupLoopThreads in [app_settings]. There is always at least one
+	@param logger Allow any debug or events to be logged
+*/
+void TunnelSetupLoop::startSetupLoops(Logger *logger)
+{
+	lock_guard<mutex> lock(TunnelSetupLoop::setupLoopsMutex);
+	int loopCount = StaticSettings::AppSettings::setupLoopThreads > 0 ? StaticSettings::AppSettings::setupLoopThreads : 1;
+	for (int i = 0; i < loopCount; i++)
+	{
+		TunnelSetupLoop *setupLoop = new TunnelSetupLoop(logger);
+		setupLoop->loopThread = std::thread(&TunnelSetupLoop::setupLoopThread, setupLoop);
+		TunnelSetupLoop::setupLoops.push_back(setupLoop);
+	}
+	stringstream logstream;
+	logstream << "Started " << loopCount << " tunnel setup loop(s)";
+	logger->writeToLog(logstream.str(), "TunnelSetupLoop", "startSetupLoops");
+}
+
+/**
+	Wait for the setup loops to finish once the application is stopping. Any tunnels still being set up are abandoned with the process, and 
+	addSetup refuses any more
+*/
+void TunnelSetupLoop::stopSetupLoops()
+{
+	vector<TunnelSetupLoop*> stoppingLoops;
+	{
+		lock_guard<mutex> lock(TunnelSetupLoop::setupLoopsMutex);
+		stoppingLoops.swap(TunnelSetupLoop::setupLoops);
+	}
+	//A loop takes setupLoopsMutex to count the setups it has finished, so it is joined without holding it
+	for (vector<TunnelSetupLoop*>::iterator it = stoppingLoops.begin(); it != stoppingLoops.end(); ++it)
+	{
+		(*it)->wake();
+		delete *it;
+	}
+}
+
+/**
+	Hand a tunnel whose setup has been started to a setup loop, the loops take the tunnels in turn. From here the setup loop owns the tunnel
+	manager, so the caller mustn't use it again
+	@param tunnelManager The tunnel manager whose SSH connect has been started
+	@return bool False if the setup loops have been stopped, the caller still owns the tunnel manager and has to abandon the setup
+*/
+bool TunnelSetupLoop::addSetup(TunnelManager *tunnelManager)
+{
+	lock_guard<mutex> lock(TunnelSetupLoop::setupLoopsMutex);
+	if (TunnelSetupLoop::setupLoops.empty())
+	{
+		return false;
+	}
+	TunnelSetupLoop::setupsInProgress++;
+	if (TunnelSetupLoop::setupsInProgress > TunnelSetupLoop::maxSetupsInProgress)
+	{
+		TunnelSetupLoop::maxSetupsInProgress = TunnelSetupLoop::setupsInProgress;
+	}
+	TunnelSetupLoop *setupLoop = TunnelSetupLoop::setupLoops[TunnelSetupLoop::nextSetupLoop++ % TunnelSetupLoop::setupLoops.size()];
+	{
+		lock_guard<mutex> addedLock(setupLoop->addedMutex);
+		setupLoop->addedSetups.push_back(tunnelManager);
+	}
+	setupLoop->wake();
+	return true;
+}
+
+/**
+	Wake the loop from poll() so it picks up a setup that has just been added
+*/
+void TunnelSetupLoop::wake()
+{
+#ifndef _WIN32
+	if (this->wakePipe[1] != -1)
+	{
+		char wakeByte = 0;
+		//If the pipe is full the loop is already going to wake up
+		if (write(this->wakePipe[1], &wakeByte, 1) < 0)
+		{
+			return;
+		}
+	}
+#endif
+}
+
+/**
+	The setup loop. Each pass waits for any of the loop's SSH sockets to be ready for its setup step, for up to the earliest deadline of the
+	steps, then carries on each setup whose socket is ready or whose step has timed out
+*/
+void TunnelSetupLoop::setupLoopThread()
+{
+	StatusManager statusManager;
+	vector<struct pollfd> pollSockets;
+	while (statusManager.getApplicationStatus() != StatusManager::ApplicationStatus::Stopping)
+	{
+		{
+			lock_guard<mutex> lock(this->addedMutex);
+			this->setups.insert(this->setups.end(), this->addedSetups.begin(), this->addedSetups.end());
+			this->addedSetups.clear();
+		}
+
+		//The loop wakes up at least once a second to see whether the application is stopping
+		long long timeoutMs = 1000;
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		pollSockets.clear();
+		for (vector<TunnelManager*>::iterator it = this->setups.begin(); it != this->setups.end(); ++it)
+		{
+			SSHTunnelForwarder *sshTunnelForwarder = (*it)->getSSHTunnelForwarder();
+			bool waitToRead = false;
+			bool waitToWrite = false;
+			sshTunnelForwarder->getSetupStepDirections(&waitToRead, &waitToWrite);
+			struct pollfd pollSocket;
+			pollSocket.fd = sshTunnelForwarder->getSSHSocket();
+			pollSocket.events = (waitToRead ? POLLIN : 0) | (waitToWrite ? POLLOUT : 0);
+			pollSocket.revents = 0;
+			pollSockets.push_back(pollSocket);
+
+			long long remainingMs = std::chrono::duration_cast<std::chrono::milliseconds>(sshTunnelForwarder->getSetupStepDeadline() - now).count() + 1;
+			timeoutMs = remainingMs < timeoutMs ? (remainingMs > 0 ? remainingMs : 0) : timeoutMs;
+		}
+
+#ifdef _WIN32
+		//WSAPoll only waits on sockets, there is no pipe to wake it, so a setup that has just been added waits for up to 10ms to be picked up
+		timeoutMs = timeoutMs < 10 ? timeoutMs : 10;
+		int ready = 0;
+		if (pollSockets.empty())
+		{
+			this_thread::sleep_for(chrono::milliseconds(timeoutMs));
+		}
+		else
+		{
+			ready = WSAPoll(pollSockets.data(), (ULONG)pollSockets.size(), (INT)timeoutMs);
+		}
+		if (ready < 0)
+		{
+			stringstream logstream;
+			logstream << "Setup loop poll failed. Error: " << WSAGetLastError();
+			this->logger->writeToLog(logstream.str(), "TunnelSetupLoop", "setupLoopThread");
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+#else
+		if (this->wakePipe[0] != -1)
+		{
+			struct pollfd wakeSocket;
+			wakeSocket.fd = this->wakePipe[0];
+			wakeSocket.events = POLLIN;
+			wakeSocket.revents = 0;
+			pollSockets.push_back(wakeSocket);
+		}
+		else
+		{
+			timeoutMs = timeoutMs < 10 ? timeoutMs : 10;
+		}
+		int ready = poll(pollSockets.data(), pollSockets.size(), (int)timeoutMs);
+		if (ready < 0 && errno != EINTR)
+		{
+			stringstream logstream;
+			logstream << "Setup loop poll failed. Error: " << strerror(errno);
+			this->logger->writeToLog(logstream.str(), "TunnelSetupLoop", "setupLoopThread");
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+		if (this->wakePipe[0] != -1 && (pollSockets.back().revents & POLLIN))
+		{
+			char wakeBytes[64];
+			while (read(this->wakePipe[0], wakeBytes, sizeof(wakeBytes)) > 0);
+		}
+#endif
+
+		//A setup that has finished has sent its response and been handed on, so it isn't the loop's any more
+		size_t index = 0;
+		size_t finished = 0;
+		for (vector<TunnelManager*>::iterator it = this->setups.begin(); it != this->setups.end(); index++)
+		{
+			bool socketReady = ready > 0 && pollSockets[index].revents != 0;
+			if ((socketReady || (*it)->getSSHTunnelForwarder()->hasSetupStepExpired()) && (*it)->continueSetup())
+			{
+				it = this->setups.erase(it);
+				finished++;
+			}
+			else
+			{
+				++it;
+			}
+		}
+		if (finished > 0)
+		{
+			lock_guard<mutex> lock(TunnelSetupLoop::setupLoopsMutex);
+			TunnelSetupLoop::setupsInProgress -= finished;
+			TunnelSetupLoop::setupsFinished += finished;
+		}
+	}
+}
+
+/**
+	Add the setup loop counters to the statistics that are returned to the PHP API
+	@param stats The map that the statistics are added to
+*/
+void TunnelSetupLoop::appendStatistics(map<string, string> *stats)
+{
+	lock_guard<mutex> lock(TunnelSetupLoop::setupLoopsMutex);
+	(*stats)["setupLoops"] = std::to_string(TunnelSetupLoop::setupLoops.size());
+	(*stats)["setupsInProgress"] = std::to_string(TunnelSetupLoop::setupsInProgress);
+	(*stats)["maxSetupsInProgress"] = std::to_string(TunnelSetupLoop::maxSetupsInProgress);
+	(*stats)["setupsFinished"] = std::to_string(TunnelSetupLoop::setupsFinished);
+}
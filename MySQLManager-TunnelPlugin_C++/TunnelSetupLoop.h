@@ -0,0 +1,51 @@
+#pragma once
+#ifndef TUNNELSETUPLOOP_H
+#define TUNNELSETUPLOOP_H
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include "StaticSettings.h"
+#include "StatusManager.h"
+#include "Logger.h"
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+class TunnelManager;
+
+class TunnelSetupLoop
+{
+public:
+	static void startSetupLoops(Logger *logger);
+	static void stopSetupLoops();
+	static bool addSetup(TunnelManager *tunnelManager);
+	static void appendStatistics(std::map<std::string, std::string> *stats);
+private:
+	TunnelSetupLoop(Logger *logger);
+	~TunnelSetupLoop();
+	void setupLoopThread();
+	void wake();
+	Logger *logger = NULL;
+	std::thread loopThread;
+	std::mutex addedMutex;
+	std::vector<TunnelManager*> addedSetups;
+	std::vector<TunnelManager*> setups;
+#ifndef _WIN32
+	int wakePipe[2] = { -1, -1 };
+#endif
+	static std::vector<TunnelSetupLoop*> setupLoops;
+	static std::mutex setupLoopsMutex;
+	static size_t nextSetupLoop;
+	static unsigned long long setupsInProgress;
+	static unsigned long long setupsFinished;
+	static unsigned long long maxSetupsInProgress;
+};
+
+#endif //!TUNNELSETUPLOOP_H
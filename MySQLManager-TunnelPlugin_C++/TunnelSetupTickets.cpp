@@ -0,0 +1,156 @@
+/**
+	Keeps track of tunnels that are being set up asynchronously. An async CreateTunnel request gets a ticket straight away, so the PHP API 
+	isn't held up for the DNS lookup, connect, handshake and authentication. The CreateTunnel response is stored against the ticket when the 
+	setup finishes, and the PHP API fetches it with GetTunnelResult, optionally waiting for up to tunnelTicketMaxWaitSeconds for it to finish.
+	Results that aren't fetched within tunnelTicketResultTtlSeconds are thrown away
+*/
+
+#include "TunnelSetupTickets.h"
+#include <openssl/rand.h>
+
+using namespace std;
+
+std::mutex TunnelSetupTickets::ticketMutex;
+std::condition_variable TunnelSetupTickets::ticketCompleted;
+std::map<std::string, TunnelSetupTickets::TicketState> TunnelSetupTickets::tickets;
+unsigned long long TunnelSetupTickets::ticketsCreated = 0;
+unsigned long long TunnelSetupTickets::ticketsCollected = 0;
+unsigned long long TunnelSetupTickets::ticketsExpired = 0;
+
+TunnelSetupTickets::TunnelSetupTickets(Logger *logger)
+{
+	this->logger = logger;
+}
+
+/**
+	Create a ticket for a tunnel that is about to be set up
+	@return string The ticket id, a random 128 bit hex string so other clients can't guess it
+*/
+string TunnelSetupTickets::createTicket()
+{
+	unsigned char random[16];
+	if (RAND_bytes(random, sizeof(random)) != 1)
+	{
+		this->logger->writeToLog("Failed to generate a random tunnel ticket", "TunnelSetupTickets", "createTicket");
+		return string();
+	}
+	static const char hexChars[] = "0123456789abcdef";
+	string ticket;
+	ticket.reserve(sizeof(random) * 2);
+	for (size_t i = 0; i < sizeof(random); i++)
+	{
+		ticket += hexChars[random[i] >> 4];
+		ticket += hexChars[random[i] & 0x0F];
+	}
+
+	lock_guard<mutex> lock(TunnelSetupTickets::ticketMutex);
+	this->removeExpiredTickets();
+	TunnelSetupTickets::tickets[ticket] = TicketState();
+	TunnelSetupTickets::ticketsCreated++;
+	return ticket;
+}
+
+/**
+	Store the CreateTunnel response for the ticket once the tunnel setup has finished, and wake anything waiting for it
+	@param ticket The ticket id from createTicket
+	@param response The CreateTunnel JSON response
+*/
+void TunnelSetupTickets::completeTicket(string ticket, string response)
+{
+	{
+		lock_guard<mutex> lock(TunnelSetupTickets::ticketMutex);
+		map<string, TicketState>::iterator it = TunnelSetupTickets::tickets.find(ticket);
+		if (it == TunnelSetupTickets::tickets.end())
+		{
+			return;
+		}
+		it->second.complete = true;
+		it->second.response = response;
+		it->second.completedTime = std::time(nullptr);
+	}
+	TunnelSetupTickets::ticketCompleted.notify_all();
+}
+
+/**
+	Get the CreateTunnel response for the ticket. A completed ticket can only be fetched once
+	@param ticket The ticket id
+	@param waitSeconds How long to wait for the setup to finish if it hasn't already, capped at tunnelTicketMaxWaitSeconds
+	@param response Set to the CreateTunnel JSON response if the ticket is complete
+	@return TicketStatus TICKET_COMPLETE, TICKET_PENDING if the setup is still running, or TICKET_NOT_FOUND
+*/
+TunnelSetupTickets::TicketStatus TunnelSetupTickets::getResult(string ticket, int waitSeconds, string *response)
+{
+	if (waitSeconds > StaticSettings::AppSettings::tunnelTicketMaxWaitSeconds)
+	{
+		waitSeconds = StaticSettings::AppSettings::tunnelTicketMaxWaitSeconds;
+	}
+	std::chrono::steady_clock::time_point waitUntil = std::chrono::steady_clock::now() + std::chrono::seconds(waitSeconds > 0 ? waitSeconds : 0);
+
+	unique_lock<mutex> lock(TunnelSetupTickets::ticketMutex);
+	while (true)
+	{
+		map<string, TicketState>::iterator it = TunnelSetupTickets::tickets.find(ticket);
+		if (it == TunnelSetupTickets::tickets.end())
+		{
+			return TicketStatus::TICKET_NOT_FOUND;
+		}
+		if (it->second.complete)
+		{
+			*response = it->second.response;
+			TunnelSetupTickets::tickets.erase(it);
+			TunnelSetupTickets::ticketsCollected++;
+			return TicketStatus::TICKET_COMPLETE;
+		}
+		if (TunnelSetupTickets::ticketCompleted.wait_until(lock, waitUntil) == std::cv_status::timeout)
+		{
+			it = TunnelSetupTickets::tickets.find(ticket);
+			if (it != TunnelSetupTickets::tickets.end() && it->second.complete)
+			{
+				continue;
+			}
+			return it == TunnelSetupTickets::tickets.end() ? TicketStatus::TICKET_NOT_FOUND : TicketStatus::TICKET_PENDING;
+		}
+	}
+}
+
+/**
+	Remove the completed tickets whose result wasn't fetched within tunnelTicketResultTtlSeconds. The ticket mutex must be locked
+*/
+void TunnelSetupTickets::removeExpiredTickets()
+{
+	time_t currentTime = std::time(nullptr);
+	for (map<string, TicketState>::iterator it = TunnelSetupTickets::tickets.begin(); it != TunnelSetupTickets::tickets.end();)
+	{
+		if (it->second.complete && currentTime - it->second.completedTime >= StaticSettings::AppSettings::tunnelTicketResultTtlSeconds)
+		{
+			it = TunnelSetupTickets::tickets.erase(it);
+			TunnelSetupTickets::ticketsExpired++;
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+/**
+	Add the async tunnel setup statistics to the statistics returned by the GetStats request
+	@param stats The statistics to add to
+*/
+void TunnelSetupTickets::appendStatistics(map<string, string> *stats)
+{
+	lock_guard<mutex> lock(TunnelSetupTickets::ticketMutex);
+	int pending = 0;
+	for (map<string, TicketState>::iterator it = TunnelSetupTickets::tickets.begin(); it != TunnelSetupTickets::tickets.end(); ++it)
+	{
+		if (!it->second.complete)
+		{
+			pending++;
+		}
+	}
+	(*stats)["tunnelTicketsPending"] = std::to_string(pending);
+	(*stats)["tunnelTicketsAwaitingCollection"] = std::to_string(TunnelSetupTickets::tickets.size() - pending);
+	(*stats)["tunnelTicketsCreated"] = std::to_string(TunnelSetupTickets::ticketsCreated);
+	(*stats)["tunnelTicketsCollected"] = std::to_string(TunnelSetupTickets::ticketsCollected);
+	(*stats)["tunnelTicketsExpired"] = std::to_string(TunnelSetupTickets::ticketsExpired);
+}
@@ -0,0 +1,39 @@
+#pragma once
+#ifndef TUNNELSETUPTICKETS_H
+#define TUNNELSETUPTICKETS_H
+#include <string>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <ctime>
+#include "StaticSettings.h"
+#include "Logger.h"
+
+class TunnelSetupTickets
+{
+public:
+	enum TicketStatus { TICKET_COMPLETE, TICKET_PENDING, TICKET_NOT_FOUND };
+	TunnelSetupTickets(Logger *logger);
+	std::string createTicket();
+	void completeTicket(std::string ticket, std::string response);
+	TicketStatus getResult(std::string ticket, int waitSeconds, std::string *response);
+	static void appendStatistics(std::map<std::string, std::string> *stats);
+private:
+	struct TicketState
+	{
+		bool complete = false;
+		std::string response;
+		time_t completedTime = 0;
+	};
+	Logger *logger = NULL;
+	void removeExpiredTickets();
+	static std::mutex ticketMutex;
+	static std::condition_variable ticketCompleted;
+	static std::map<std::string, TicketState> tickets;
+	static unsigned long long ticketsCreated;
+	static unsigned long long ticketsCollected;
+	static unsigned long long ticketsExpired;
+};
+
+#endif //!TUNNELSETUPTICKETS_H
@@ -40,7 +40,7 @@ bool WindowsSocket::createSocket(int family, int socketType, int protocol, int p
 bool WindowsSocket::createSocket(int family, int socketType, int protocol, int port, int bufferLength, string ipAddress)
 {
 	stringstream logstream;
-	//Call the base method to do the prep work e.g. create the buffer
+	//Call the base method to do the prep work e.g. set the buffer length
 	BaseSocket::createsocket(port, bufferLength);
 
 	iResult = WSAStartup(MAKEWORD(2, 2), &wsaData);
@@ -134,12 +134,30 @@ SOCKET *WindowsSocket::acceptClientAndReturnSocket(sockaddr_in *clientAddr)
 int WindowsSocket::sendToSocket(SOCKET *socket, string dataToSend)
 {
 	//dataToSend.append("\r\n");
-	int sentBytes = send(*socket, dataToSend.c_str(), dataToSend.length(), 0);
-	if (sentBytes == SOCKET_ERROR)
+	return this->sendToSocket(socket, dataToSend.c_str(), dataToSend.length());
+}
+
+/**
+	Send data on the specified socket without copying it first
+	@param socket The socket descriptor where the data should be sent
+	@param data The data that is to be sent on the socket
+	@param length The length of the data
+	@return int The number of bytes that have been sent on the socket
+	@throws SocketException If the sending of the socket fails
+*/
+int WindowsSocket::sendToSocket(SOCKET *socket, const char *data, size_t length)
+{
+	size_t sentBytes = 0;
+	while (sentBytes < length)
 	{
-		throw SocketException(this->getErrorStringFromErrorCode(WSAGetLastError()).c_str());
+		int sent = send(*socket, data + sentBytes, static_cast<int>(length - sentBytes), 0);
+		if (sent == SOCKET_ERROR)
+		{
+			throw SocketException(this->getErrorStringFromErrorCode(WSAGetLastError()).c_str());
+		}
+		sentBytes += sent;
 	}
-	return sentBytes;
+	return static_cast<int>(sentBytes);
 }
 
 /**
@@ -151,21 +169,29 @@ SOCKET *WindowsSocket::returnSocket()
 }
 
 /**
-	Wait and receive data on the specified socket
+	Wait and receive a request on the specified socket. The data is received straight into the buffer, the request is complete
+	when a recv returns less than was asked for
 	@param socket The socket that should be receiving data
-	@return string The string content of the data that was received on the socket
-	@throws SocketException If an error occurred while receiving the socket an exception is thrown
+	@param receiveBuffer The buffer the request is received into, any previous contents are cleared
+	@throws SocketException If an error occurred while receiving the socket, or the request is larger than maxControlRequestBytes, an exception is thrown
 */
-std::string WindowsSocket::receiveDataOnSocket(SOCKET *socket)
+void WindowsSocket::receiveDataOnSocket(SOCKET *socket, ReceiveBuffer *receiveBuffer)
 {
 	if (*socket != -1)
 	{
-		string receivedData = "";
-		char *temp = NULL;
+		receiveBuffer->clear();
+		size_t available = 0;
 		int bytesReceived = 0;
 		do
 		{
-			bytesReceived = recv(*socket, this->buffer, this->bufferLength, 0);
+			if (receiveBuffer->getLength() >= static_cast<size_t>(StaticSettings::AppSettings::maxControlRequestBytes))
+			{
+				this->logger->writeToLog("Request is larger than maxControlRequestBytes", "WindowsSocket", "receiveDataOnSocket");
+				closesocket(*socket);
+				throw SocketException("Request too large");
+			}
+			char *space = receiveBuffer->prepare(this->bufferLength, &available);
+			bytesReceived = recv(*socket, space, static_cast<int>(available), 0);
 			if (bytesReceived == SOCKET_ERROR)
 			{
 				string socketError = this->getErrorStringFromErrorCode(WSAGetLastError()).c_str();
@@ -177,23 +203,9 @@ std::string WindowsSocket::receiveDataOnSocket(SOCKET *socket)
 				closesocket(*socket);
 				WSACleanup();
 				throw SocketException(socketError.c_str());
-				return "";
 			}
-
-			//If we got here, then we should be able to get some data
-			temp = new char[bytesReceived + 1];
-			//memset(&temp, 0, bytesReceived + 1);
-			strncpy(temp, this->buffer, bytesReceived);
-			temp[bytesReceived] = '\0'; //Add a null terminator to the end of the string
-			receivedData.append(temp);
-			temp = NULL;
-
-			//Now clear the buffer ready for more data
-			memset(this->buffer, 0, this->bufferLength);
-
-		} while (bytesReceived == this->bufferLength && bytesReceived >= 0); //Keep going until the received bytes is less than the buffer length
-
-		return receivedData;
+			receiveBuffer->commit(bytesReceived);
+		} while (static_cast<size_t>(bytesReceived) == available); //Keep going until the received bytes is less than the space that was available
 	}
 	else
 	{
@@ -275,10 +287,6 @@ void WindowsSocket::closeSocket()
 	if (this->serverSocket != -1)
 	{
 		this->closeSocket(&this->serverSocket);
-		if (this->buffer != NULL)
-		{
-			delete[] this->buffer;
-		}
 		this->serverSocket = -1;
 	}
 }
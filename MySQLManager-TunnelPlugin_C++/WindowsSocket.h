@@ -2,6 +2,8 @@
 #define WINDOWSSOCKET_H
 
 #include "BaseSocket.h"
+#include "ReceiveBuffer.h"
+#include "StaticSettings.h"
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #define _WINSOCKAPI_
@@ -26,7 +28,8 @@ public:
 	SOCKET *returnSocket();
 	SOCKET *acceptClientAndReturnSocket(sockaddr_in *clientAddr);
 	int sendToSocket(SOCKET *clientSocket, std::string dataToSend);
-	std::string receiveDataOnSocket(SOCKET *socket);
+	int sendToSocket(SOCKET *clientSocket, const char *data, size_t length);
+	void receiveDataOnSocket(SOCKET *socket, ReceiveBuffer *receiveBuffer);
 	std::string getErrorStringFromErrorCode(int errorCode);
 	void updateClassSocket(SOCKET *socket);
 	void closeSocket();
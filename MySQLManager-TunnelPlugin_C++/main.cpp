@@ -10,14 +10,18 @@
 #include "Logger.h"
 #include "LogRotation.h"
 #include "INIParser.h"
+#include "ClientIOUring.h"
 #include <signal.h>
 #include <stdio.h>
 #include <cstdlib>
+#include <libssh2.h>
+#include <openssl/crypto.h>
 
 
 using namespace std;
 
 void signalHandler(int signal);
+bool initialiseLibssh2(Logger *logger);
 int ctrlCSignalCount = 0;
 
 int main()
@@ -35,12 +39,27 @@ int main()
 
 		logger = new Logger();
 
+		if (!initialiseLibssh2(logger))
+		{
+			delete logger;
+			return EXIT_FAILURE;
+		}
+
+		if (ClientIOUring::isSupported())
+		{
+			logger->writeToLog("Tunnel client sockets will be forwarded using io_uring");
+		}
+
 		INIParser iniParser("tunnel.conf");
 		logRotation = new LogRotation();
 		logRotation->loadLogRotateConfiguration(&iniParser);
 		logRotation->startLogRotation();
 
 		signal(SIGINT, signalHandler); //Ctrl +C
+#ifndef _WIN32
+		//A client that disconnects while data is being spliced to it would otherwise kill the process, splice() can't take MSG_NOSIGNAL
+		signal(SIGPIPE, SIG_IGN);
+#endif
 
 		StatusManager statusManager;
 		statusManager.setApplicationStatus(StatusManager::ApplicationStatus::Running);
@@ -49,6 +68,9 @@ int main()
 		TunnelManager tunnelManager(logger);
 		std::thread tunnelMonitorThread(&TunnelManager::tunnelMonitorThread, &tunnelManager);
 
+		//Start the loops that set up new tunnels while they wait for the SSH server
+		TunnelSetupLoop::startSetupLoops(logger);
+
 		SocketListener socketListener(logger);
 		socketListener.startSocketListener();
 
@@ -57,6 +79,7 @@ int main()
 		{
 			tunnelMonitorThread.join();
 		}
+		TunnelSetupLoop::stopSetupLoops();
 	}
 	catch (SocketException ex)
 	{
@@ -68,6 +91,8 @@ int main()
 		}
 	}
 
+	libssh2_exit();
+
 	if (logger != NULL)
 	{
 		delete logger;
@@ -79,6 +104,34 @@ int main()
 	return EXIT_SUCCESS;
 }
 
+/**
+	Initialise libssh2 and its crypto backend once for the whole process, before any tunnel threads are started. libssh2_exit() is only
+	called when the process exits as it frees global state that every SSH session uses, whichever thread the session is on
+	@param logger The logger
+	@return bool False if libssh2 couldn't be initialised
+*/
+bool initialiseLibssh2(Logger *logger)
+{
+	int result = libssh2_init(0);
+	if (result != 0)
+	{
+		stringstream logstream;
+		logstream << "libssh2 initialised failed (" << result << ")";
+		logger->writeToLog(logstream.str());
+		return false;
+	}
+	stringstream logstream;
+	logstream << "Initialised libssh2 " << libssh2_version(0) << " with " << OpenSSL_version(OPENSSL_VERSION);
+	logger->writeToLog(logstream.str());
+
+	//Sessions on different threads share OpenSSL, which only does its own locking from 1.1.0. Before that locking callbacks are required
+	if (OpenSSL_version_num() < 0x10100000L)
+	{
+		logger->writeToLog("OpenSSL is older than 1.1.0 and isn't thread safe without locking callbacks, concurrent SSH tunnels may crash");
+	}
+	return true;
+}
+
 void signalHandler(int signal)
 {
 	switch (signal)